@@ -63,6 +63,7 @@
 #include "mdf_mem.h"
 #include "mdf_event_loop.h"
 #include "mdf_info_store.h"
+#include "mdf_metrics.h"
 
 #define MCOMMON_ESPRESSIF_ID        (0x02E5) /**< Espressif Incorporated */
 
@@ -103,6 +104,22 @@ extern "C" {
  */
 #define mdf_get_version()    MDF_VER
 
+/**
+ * @brief  Hash of a MAC address for the tables indexed by device, the bucket
+ *         is taken from the high bits: (mdf_addr_hash(addr) >> 16) & bucket_mask
+ *
+ * @param  addr MAC address, 6 bytes
+ *
+ * @return Multiplicative hash of the address
+ */
+static inline uint32_t mdf_addr_hash(const uint8_t *addr)
+{
+    uint32_t key = ((uint32_t)addr[2] << 24 | (uint32_t)addr[3] << 16 | (uint32_t)addr[4] << 8 | addr[5])
+                   ^ ((uint32_t)addr[0] << 8 | addr[1]);
+
+    return key * 2654435761U;
+}
+
 #ifdef __cplusplus
 }
 #endif /**< _cplusplus */
@@ -40,6 +40,15 @@ extern "C" {
 #define MALLOC_CAP_INDICATE MALLOC_CAP_DEFAULT
 #endif
 
+/**
+ * @brief Memory recorded for a tag, see mdf_mem_get_tag_usage()
+ */
+typedef struct {
+    const char *tag; /**< Tag of the MDF_MALLOC calls, TAG of their file */
+    uint32_t size;   /**< Memory allocated and not released */
+    uint16_t count;  /**< Number of blocks */
+} mdf_mem_tag_usage_t;
+
 /**
  * @brief Add to memory record
  *
@@ -66,6 +75,22 @@ void mdf_mem_remove_record(void *ptr, const char *tag, int line);
  */
 void mdf_mem_print_record(void);
 
+/**
+ * @brief  Get the memory recorded per tag, the largest first
+ *
+ * @note   Only the memory allocated by MDF_MALLOC, MDF_CALLOC and MDF_REALLOC while the
+ *         record has room, CONFIG_MDF_MEM_DBG_INFO_MAX blocks, is counted
+ *
+ * @param  usage  Usage of each tag
+ * @param  num    Number of usage, set to the number of tags
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NOT_SUPPORTED: CONFIG_MDF_MEM_DEBUG is disabled
+ */
+mdf_err_t mdf_mem_get_tag_usage(mdf_mem_tag_usage_t *usage, size_t *num);
+
 /**
  * @brief Print memory and free space on the stack
  */
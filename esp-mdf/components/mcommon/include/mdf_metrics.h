@@ -0,0 +1,204 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MDF_METRICS_H__
+#define __MDF_METRICS_H__
+
+#include "mdf_err.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Counters, append new ones before MDF_METRICS_COUNTER_MAX and to tools/mdf_metrics.py
+ */
+typedef enum {
+    MDF_METRICS_MWIFI_FRAGMENT_SEND,     /**< Fragments sent by esp_mesh_send() */
+    MDF_METRICS_MWIFI_FRAGMENT_RECV,     /**< Fragments received by esp_mesh_recv() */
+    MDF_METRICS_MWIFI_REASSEMBLY_DROP,   /**< Packets dropped because a fragment is lost */
+    MDF_METRICS_MWIFI_DUPLICATE,         /**< Retransmitted fragments filtered */
+    MDF_METRICS_MWIFI_NO_MEMORY_RETRY,   /**< esp_mesh_send() retried after ESP_ERR_MESH_NO_MEMORY */
+    MDF_METRICS_MWIFI_SEND_FAIL,         /**< Fragments that could not be sent */
+    MDF_METRICS_MESPNOW_SEND,            /**< ESP-NOW frames sent */
+    MDF_METRICS_MESPNOW_SEND_RETRY,      /**< ESP-NOW frames sent again without a MAC acknowledgement */
+    MDF_METRICS_MESPNOW_SEND_FAIL,       /**< ESP-NOW frames that could not be sent */
+    MDF_METRICS_MESPNOW_RECV,            /**< ESP-NOW frames queued to a pipe */
+    MDF_METRICS_MESPNOW_DUPLICATE,       /**< ESP-NOW frames filtered by their magic */
+    MDF_METRICS_MESPNOW_CRC_FAIL,        /**< ESP-NOW frames with a wrong CRC */
+    MDF_METRICS_MESPNOW_QUEUE_FULL,      /**< ESP-NOW frames dropped, the queue of the pipe is full */
+    MDF_METRICS_MLINK_REQUEST,           /**< Requests handled by mlink_handle() */
+    MDF_METRICS_MLINK_REQUEST_FAIL,      /**< Requests whose handler failed or is not found */
+    MDF_METRICS_COUNTER_MAX,
+} mdf_metrics_counter_t;
+
+/**
+ * @brief Gauges, the highest value observed
+ */
+typedef enum {
+    MDF_METRICS_MESPNOW_QUEUE_HIGH,      /**< High-water mark of the ESP-NOW pipe queues */
+    MDF_METRICS_GAUGE_MAX,
+} mdf_metrics_gauge_t;
+
+/**
+ * @brief Latency histograms, in microseconds
+ */
+typedef enum {
+    MDF_METRICS_MWIFI_WRITE_US,          /**< mwifi_write() */
+    MDF_METRICS_MESPNOW_WRITE_US,        /**< mespnow_write() */
+    MDF_METRICS_MLINK_HANDLE_US,         /**< Handler of an mlink request */
+    MDF_METRICS_HISTOGRAM_MAX,
+} mdf_metrics_histogram_t;
+
+#define MDF_METRICS_VERSION      (1)  /**< Version of mdf_metrics_snapshot_t */
+#define MDF_METRICS_BUCKET_NUM   (16) /**< Buckets of a histogram */
+#define MDF_METRICS_BUCKET_SHIFT (6)  /**< Bucket 0 is below 64 us, bucket i below 64 << i us, the last one has the rest */
+
+/**
+ * @brief Metrics of a core, only updated by the tasks running on it
+ */
+typedef struct {
+    uint32_t counters[MDF_METRICS_COUNTER_MAX];
+    uint32_t gauges[MDF_METRICS_GAUGE_MAX];
+    uint32_t buckets[MDF_METRICS_HISTOGRAM_MAX][MDF_METRICS_BUCKET_NUM];
+    uint32_t max_us[MDF_METRICS_HISTOGRAM_MAX];
+} mdf_metrics_core_t;
+
+/**
+ * @brief Snapshot of the metrics, the cores merged, in little endian
+ */
+typedef struct {
+    uint8_t version;       /**< MDF_METRICS_VERSION */
+    uint8_t counter_num;   /**< MDF_METRICS_COUNTER_MAX */
+    uint8_t gauge_num;     /**< MDF_METRICS_GAUGE_MAX */
+    uint8_t histogram_num; /**< MDF_METRICS_HISTOGRAM_MAX */
+    uint8_t bucket_num;    /**< MDF_METRICS_BUCKET_NUM */
+    uint8_t bucket_shift;  /**< MDF_METRICS_BUCKET_SHIFT */
+    uint16_t reserved;     /**< Reserved */
+    uint32_t uptime_ms;    /**< Time of the snapshot since the boot */
+    uint32_t values[0];    /**< Counters, gauges, then the buckets and the maximum of each histogram */
+} __attribute__((packed)) mdf_metrics_snapshot_t;
+
+#define MDF_METRICS_SNAPSHOT_SIZE (sizeof(mdf_metrics_snapshot_t) + sizeof(uint32_t) * (MDF_METRICS_COUNTER_MAX \
+                                   + MDF_METRICS_GAUGE_MAX + MDF_METRICS_HISTOGRAM_MAX * (MDF_METRICS_BUCKET_NUM + 1)))
+
+#ifdef CONFIG_MDF_METRICS
+
+extern mdf_metrics_core_t g_mdf_metrics[portNUM_PROCESSORS];
+
+#if portNUM_PROCESSORS > 1
+#define MDF_METRICS_CORE() (&g_mdf_metrics[xPortGetCoreID()])
+#else
+#define MDF_METRICS_CORE() (&g_mdf_metrics[0])
+#endif
+
+/**
+ * @brief Add to a counter, a load, an add and a store on the counters of the current core
+ *
+ * @note  The interrupts of the current core are masked during the update, so the task
+ *        is neither preempted nor moved to the other core between the index and the store.
+ *        The mask is saved and restored, it may be called from an ISR.
+ */
+static inline void mdf_metrics_add(mdf_metrics_counter_t id, uint32_t n)
+{
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    MDF_METRICS_CORE()->counters[id] += n;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+/**
+ * @brief Raise a gauge to value if it is higher
+ */
+static inline void mdf_metrics_max(mdf_metrics_gauge_t id, uint32_t value)
+{
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    uint32_t *gauge   = &MDF_METRICS_CORE()->gauges[id];
+
+    if (value > *gauge) {
+        *gauge = value;
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+/**
+ * @brief Count a latency in the bucket of its power of two
+ */
+static inline void mdf_metrics_observe(mdf_metrics_histogram_t id, uint32_t us)
+{
+    int bucket               = (us >> MDF_METRICS_BUCKET_SHIFT) ? 32 - __builtin_clz(us) - MDF_METRICS_BUCKET_SHIFT : 0;
+    UBaseType_t state        = portSET_INTERRUPT_MASK_FROM_ISR();
+    mdf_metrics_core_t *core = MDF_METRICS_CORE();
+
+    core->buckets[id][bucket < MDF_METRICS_BUCKET_NUM ? bucket : MDF_METRICS_BUCKET_NUM - 1]++;
+
+    if (us > core->max_us[id]) {
+        core->max_us[id] = us;
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+#define MDF_METRICS_ADD(id, n)         mdf_metrics_add(id, n)
+#define MDF_METRICS_INC(id)            mdf_metrics_add(id, 1)
+#define MDF_METRICS_MAX(id, value)     mdf_metrics_max(id, value)
+#define MDF_METRICS_TIME()             esp_timer_get_time()
+#define MDF_METRICS_OBSERVE(id, start) mdf_metrics_observe(id, (uint32_t)(esp_timer_get_time() - (start)))
+
+#else
+
+#define MDF_METRICS_ADD(id, n)
+#define MDF_METRICS_INC(id)
+#define MDF_METRICS_MAX(id, value)
+#define MDF_METRICS_TIME()             (0)
+#define MDF_METRICS_OBSERVE(id, start) ((void)(start))
+
+#endif /**< CONFIG_MDF_METRICS */
+
+/**
+ * @brief  Take a snapshot of the metrics, the counters of the cores are summed,
+ *         their gauges and the maximum of their histograms are the highest
+ *
+ * @param  snapshot  Buffer of MDF_METRICS_SNAPSHOT_SIZE bytes
+ * @param  size      Size of the buffer, set to the size of the snapshot
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_BUF: The buffer is too small
+ *     - MDF_ERR_NOT_SUPPORTED: CONFIG_MDF_METRICS is disabled
+ */
+mdf_err_t mdf_metrics_snapshot(mdf_metrics_snapshot_t *snapshot, size_t *size);
+
+/**
+ * @brief  Clear all the metrics
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_SUPPORTED: CONFIG_MDF_METRICS is disabled
+ */
+mdf_err_t mdf_metrics_reset(void);
+
+/**
+ * @brief Print the metrics, the counters not zero and the histograms observed
+ */
+void mdf_metrics_print(void);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MDF_METRICS_H__ */
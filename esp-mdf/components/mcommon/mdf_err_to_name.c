@@ -157,6 +157,10 @@ static const mdf_err_msg_t mdf_err_msg_table[] = {
 #   endif
 #   ifdef      MDF_ERR_MUPGRADE_STOP
     ERR_TBL_IT(MDF_ERR_MUPGRADE_STOP),                /**< 5242890 0x50000a Upgrade configuration is not initialized */
+#   endif
+#   ifdef      MDF_ERR_MUPGRADE_DELTA_BASE
+    ERR_TBL_IT(MDF_ERR_MUPGRADE_DELTA_BASE),          /**< 5242891 0x50000b The running firmware is not the base of the
+                                                                            delta */
 #   endif
     // components/mcommon/include/mdf_err.h
 #   ifdef      MDF_ERR_MDEBUG_BASE
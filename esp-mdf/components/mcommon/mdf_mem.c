@@ -129,6 +129,74 @@ void mdf_mem_print_record(void)
     MDF_LOGI("Memory record, num: %d, size: %zu", g_mem_count, total_size);
 }
 
+mdf_err_t mdf_mem_get_tag_usage(mdf_mem_tag_usage_t *usage, size_t *num)
+{
+    MDF_PARAM_CHECK(usage);
+    MDF_PARAM_CHECK(num);
+    MDF_ERROR_CHECK(!MDF_MEM_DEBUG, MDF_ERR_NOT_SUPPORTED, "Please enable memory record");
+
+    size_t tag_num                = 0;
+    mdf_mem_tag_usage_t *tag_list = NULL;
+
+    if (!g_mem_count || !g_mem_info) {
+        *num = 0;
+        return MDF_OK;
+    }
+
+    /**< Every tag is summed before the largest are kept, not recorded by itself */
+    tag_list = calloc(MDF_MEM_DBG_INFO_MAX, sizeof(mdf_mem_tag_usage_t));
+    MDF_ERROR_CHECK(!tag_list, MDF_ERR_NO_MEM, "");
+
+    if (!g_mem_info_lock) {
+        g_mem_info_lock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(g_mem_info_lock, portMAX_DELAY);
+
+    for (int i = 0; i < MDF_MEM_DBG_INFO_MAX; i++) {
+        if (!g_mem_info[i].size) {
+            continue;
+        }
+
+        /**< The tags are the TAG of each file, a file is found by its pointer */
+        int j = 0;
+
+        for (; j < tag_num && tag_list[j].tag != g_mem_info[i].tag
+                && strcmp(tag_list[j].tag, g_mem_info[i].tag); ++j);
+
+        if (j == tag_num) {
+            tag_list[tag_num].tag = g_mem_info[i].tag;
+            tag_num++;
+        }
+
+        tag_list[j].size += g_mem_info[i].size;
+        tag_list[j].count++;
+    }
+
+    xSemaphoreGive(g_mem_info_lock);
+
+    /**< Few tags, sorted by insertion */
+    for (int i = 1; i < tag_num; i++) {
+        mdf_mem_tag_usage_t tmp = tag_list[i];
+        int j = i - 1;
+
+        for (; j >= 0 && tag_list[j].size < tmp.size; j--) {
+            tag_list[j + 1] = tag_list[j];
+        }
+
+        tag_list[j + 1] = tmp;
+    }
+
+    if (tag_num < *num) {
+        *num = tag_num;
+    }
+
+    memcpy(usage, tag_list, *num * sizeof(mdf_mem_tag_usage_t));
+    free(tag_list);
+
+    return MDF_OK;
+}
+
 #if ( ( configUSE_TRACE_FACILITY == 1 ) && ( configUSE_STATS_FORMATTING_FUNCTIONS > 0 ) )
 
 void mdf_mem_print_task()
@@ -0,0 +1,164 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mdf_common.h"
+#include "mdf_metrics.h"
+
+static const char *TAG = "mdf_metrics";
+
+#ifdef CONFIG_MDF_METRICS
+
+mdf_metrics_core_t g_mdf_metrics[portNUM_PROCESSORS] = {0};
+
+static const char *g_counter_names[MDF_METRICS_COUNTER_MAX] = {
+    "mwifi_fragment_send",
+    "mwifi_fragment_recv",
+    "mwifi_reassembly_drop",
+    "mwifi_duplicate",
+    "mwifi_no_memory_retry",
+    "mwifi_send_fail",
+    "mespnow_send",
+    "mespnow_send_retry",
+    "mespnow_send_fail",
+    "mespnow_recv",
+    "mespnow_duplicate",
+    "mespnow_crc_fail",
+    "mespnow_queue_full",
+    "mlink_request",
+    "mlink_request_fail",
+};
+
+static const char *g_gauge_names[MDF_METRICS_GAUGE_MAX] = {
+    "mespnow_queue_high",
+};
+
+static const char *g_histogram_names[MDF_METRICS_HISTOGRAM_MAX] = {
+    "mwifi_write_us",
+    "mespnow_write_us",
+    "mlink_handle_us",
+};
+
+mdf_err_t mdf_metrics_snapshot(mdf_metrics_snapshot_t *snapshot, size_t *size)
+{
+    MDF_PARAM_CHECK(snapshot);
+    MDF_PARAM_CHECK(size);
+    MDF_ERROR_CHECK(*size < MDF_METRICS_SNAPSHOT_SIZE, MDF_ERR_BUF,
+                    "Buffer is too small, size: %d, the expected size is: %d", *size, MDF_METRICS_SNAPSHOT_SIZE);
+
+    uint32_t *value = (uint32_t *)(snapshot + 1);
+
+    memset(snapshot, 0, MDF_METRICS_SNAPSHOT_SIZE);
+    snapshot->version       = MDF_METRICS_VERSION;
+    snapshot->counter_num   = MDF_METRICS_COUNTER_MAX;
+    snapshot->gauge_num     = MDF_METRICS_GAUGE_MAX;
+    snapshot->histogram_num = MDF_METRICS_HISTOGRAM_MAX;
+    snapshot->bucket_num    = MDF_METRICS_BUCKET_NUM;
+    snapshot->bucket_shift  = MDF_METRICS_BUCKET_SHIFT;
+    snapshot->uptime_ms     = esp_timer_get_time() / 1000;
+
+    /**< Read without a lock, a counter updated meanwhile is in this snapshot or in the next one */
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        const mdf_metrics_core_t *metrics = g_mdf_metrics + core;
+        value = (uint32_t *)(snapshot + 1);
+
+        for (int i = 0; i < MDF_METRICS_COUNTER_MAX; ++i, ++value) {
+            *value += metrics->counters[i];
+        }
+
+        for (int i = 0; i < MDF_METRICS_GAUGE_MAX; ++i, ++value) {
+            *value = MAX(*value, metrics->gauges[i]);
+        }
+
+        for (int i = 0; i < MDF_METRICS_HISTOGRAM_MAX; ++i) {
+            for (int j = 0; j < MDF_METRICS_BUCKET_NUM; ++j, ++value) {
+                *value += metrics->buckets[i][j];
+            }
+
+            *value = MAX(*value, metrics->max_us[i]);
+            ++value;
+        }
+    }
+
+    *size = (uint8_t *)value - (uint8_t *)snapshot;
+
+    return MDF_OK;
+}
+
+mdf_err_t mdf_metrics_reset(void)
+{
+    memset(g_mdf_metrics, 0, sizeof(g_mdf_metrics));
+
+    return MDF_OK;
+}
+
+void mdf_metrics_print(void)
+{
+    size_t size = MDF_METRICS_SNAPSHOT_SIZE;
+    mdf_metrics_snapshot_t *snapshot = MDF_MALLOC(size);
+
+    if (!snapshot) {
+        return;
+    }
+
+    mdf_metrics_snapshot(snapshot, &size);
+    const uint32_t *value = (const uint32_t *)(snapshot + 1);
+
+    MDF_LOGI("Metrics, uptime: %d ms", snapshot->uptime_ms);
+
+    for (int i = 0; i < MDF_METRICS_COUNTER_MAX; ++i, ++value) {
+        if (*value) {
+            MDF_LOGI("%-24s %u", g_counter_names[i], *value);
+        }
+    }
+
+    for (int i = 0; i < MDF_METRICS_GAUGE_MAX; ++i, ++value) {
+        MDF_LOGI("%-24s %u", g_gauge_names[i], *value);
+    }
+
+    for (int i = 0; i < MDF_METRICS_HISTOGRAM_MAX; ++i, value += MDF_METRICS_BUCKET_NUM + 1) {
+        char buckets[MDF_METRICS_BUCKET_NUM * 11 + 1] = {0};
+        uint32_t count = 0;
+
+        for (int j = 0, len = 0; j < MDF_METRICS_BUCKET_NUM; ++j) {
+            count += value[j];
+            len += sprintf(buckets + len, " %u", value[j]);
+        }
+
+        if (count) {
+            MDF_LOGI("%-24s count: %u, max: %u, buckets (<%d us, x2):%s", g_histogram_names[i],
+                     count, value[MDF_METRICS_BUCKET_NUM], 1 << MDF_METRICS_BUCKET_SHIFT, buckets);
+        }
+    }
+
+    MDF_FREE(snapshot);
+}
+
+#else
+
+mdf_err_t mdf_metrics_snapshot(mdf_metrics_snapshot_t *snapshot, size_t *size)
+{
+    return MDF_ERR_NOT_SUPPORTED;
+}
+
+mdf_err_t mdf_metrics_reset(void)
+{
+    return MDF_ERR_NOT_SUPPORTED;
+}
+
+void mdf_metrics_print(void)
+{
+    MDF_LOGW("Metrics are disabled, enable CONFIG_MDF_METRICS");
+}
+
+#endif /**< CONFIG_MDF_METRICS */
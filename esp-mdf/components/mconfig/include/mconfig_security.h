@@ -38,6 +38,10 @@ extern "C" {
 #define MCONFIG_DH_PUBKEY_LEN            (128)
 #define MCONFIG_AES_KEY_LEN              (16)
 
+#define MCONFIG_ECDH_KEY_LEN             (32) /**< X25519 key, raw in the byte order of RFC 7748 */
+#define MCONFIG_AEAD_NONCE_LEN           (12) /**< AES-GCM nonce */
+#define MCONFIG_AEAD_TAG_LEN             (16) /**< AES-GCM tag */
+
 /**
  * @brief  Generate an array of random numbers
  *
@@ -110,6 +114,90 @@ mdf_err_t mconfig_rsa_decrypt(const uint8_t *ciphertext, const char *privkey_pem
 mdf_err_t mconfig_rsa_encrypt(const void *plaintext, size_t plaintext_size,
                               const char *pubkey_pem, uint8_t *ciphertext);
 
+/**
+ * @brief  Generate an ephemeral X25519 key pair
+ *
+ * @param  privkey X25519 private key, MCONFIG_ECDH_KEY_LEN bytes
+ * @param  pubkey  X25519 public key, MCONFIG_ECDH_KEY_LEN bytes
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL
+ */
+mdf_err_t mconfig_ecdh_gen_key(uint8_t *privkey, uint8_t *pubkey);
+
+/**
+ * @brief  Get the X25519 key pair of the device, the private key written in the
+ *         mconfig partition with CONFIG_MCONFIG_WHITELIST_SECURITY_ENABLE so that
+ *         the whitelist can verify its public key, otherwise an ephemeral one
+ *
+ * @param  privkey X25519 private key, MCONFIG_ECDH_KEY_LEN bytes
+ * @param  pubkey  X25519 public key, MCONFIG_ECDH_KEY_LEN bytes
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_NOT_SUPPORTED: The partition is not found
+ *     - MDF_FAIL
+ */
+mdf_err_t mconfig_ecdh_get_key(uint8_t *privkey, uint8_t *pubkey);
+
+/**
+ * @brief  Derive the AES key of a master and a slave, SHA-256 of their X25519 shared
+ *         secret followed by the public key of the master and the one of the slave
+ *
+ * @param  privkey       Own X25519 private key
+ * @param  peer_pubkey   X25519 public key of the peer
+ * @param  master_pubkey X25519 public key of the master
+ * @param  slave_pubkey  X25519 public key of the slave
+ * @param  aes_key       AES key, MCONFIG_AES_KEY_LEN bytes
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL: The public key of the peer is invalid
+ */
+mdf_err_t mconfig_ecdh_derive_key(const uint8_t *privkey, const uint8_t *peer_pubkey,
+                                  const uint8_t *master_pubkey, const uint8_t *slave_pubkey,
+                                  uint8_t *aes_key);
+
+/**
+ * @brief  Encrypt and authenticate the data with AES-GCM
+ *
+ * @param  aes_key    AES key, MCONFIG_AES_KEY_LEN bytes
+ * @param  nonce      Nonce, MCONFIG_AEAD_NONCE_LEN bytes, never used twice with the same key
+ * @param  plaintext  Unencrypted data
+ * @param  size       The length of the data
+ * @param  ciphertext Encrypted data, the same length, can be plaintext
+ * @param  tag        Tag, MCONFIG_AEAD_TAG_LEN bytes
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL
+ */
+mdf_err_t mconfig_aead_encrypt(const uint8_t *aes_key, const uint8_t *nonce,
+                               const void *plaintext, size_t size, uint8_t *ciphertext, uint8_t *tag);
+
+/**
+ * @brief  Verify and decrypt the data with AES-GCM
+ *
+ * @param  aes_key    AES key, MCONFIG_AES_KEY_LEN bytes
+ * @param  nonce      Nonce, MCONFIG_AEAD_NONCE_LEN bytes
+ * @param  ciphertext Encrypted data
+ * @param  size       The length of the data
+ * @param  tag        Tag, MCONFIG_AEAD_TAG_LEN bytes
+ * @param  plaintext  Unencrypted data, the same length, can be ciphertext
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL: The data or the tag is modified
+ */
+mdf_err_t mconfig_aead_decrypt(const uint8_t *aes_key, const uint8_t *nonce,
+                               const uint8_t *ciphertext, size_t size, const uint8_t *tag, void *plaintext);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,7 +26,27 @@
 #define VENDOR_OUI_TYPE_CONFIG       (0x0F)
 #define MCONFIG_CHAIN_EXIT_DELAY     (100)
 #define MCONFIG_CHAIN_SEND_RETRY_NUM (3)
-#define ESPNOW_BUFFER_LEN            (MESPNOW_PAYLOAD_LEN + CONFIG_MCONFIG_CUSTOM_EXTERN_LEN)
+
+/**
+ * @brief Request of a slave, its public key and the rssi of the master, then the response of the master
+ *        - RSA:  the AES key and the start of the configuration encrypted by RSA, the rest by AES-CFB
+ *        - ECDH: the X25519 public key of the master, a nonce, the configuration encrypted by AES-GCM and its tag
+ */
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+#define MCONFIG_CHAIN_REQUEST_SIZE   (MCONFIG_ECDH_KEY_LEN + 1)
+#define MCONFIG_CHAIN_RESPONSE_SIZE  (MCONFIG_ECDH_KEY_LEN + MCONFIG_AEAD_NONCE_LEN + sizeof(mconfig_data_t) + MCONFIG_AEAD_TAG_LEN)
+#define MCONFIG_CHAIN_WHITELIST_HEAD (MCONFIG_AEAD_NONCE_LEN)
+#define MCONFIG_CHAIN_WHITELIST_TAIL (MCONFIG_AEAD_TAG_LEN)
+#define MCONFIG_CHAIN_PUBKEY_SIZE    (MCONFIG_ECDH_KEY_LEN)
+#else
+#define MCONFIG_CHAIN_REQUEST_SIZE   (MCONFIG_RSA_PUBKEY_PEM_DATA_SIZE + 1)
+#define MCONFIG_CHAIN_RESPONSE_SIZE  ((MCONFIG_RSA_CIPHERTEXT_SIZE - MCONFIG_RSA_PLAINTEXT_MAX_SIZE) + sizeof(mconfig_chain_data_t))
+#define MCONFIG_CHAIN_WHITELIST_HEAD (0)
+#define MCONFIG_CHAIN_WHITELIST_TAIL (0)
+#define MCONFIG_CHAIN_PUBKEY_SIZE    (MCONFIG_RSA_PUBKEY_PEM_SIZE)
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+
+#define ESPNOW_BUFFER_LEN            MAX(MESPNOW_PAYLOAD_LEN + CONFIG_MCONFIG_CUSTOM_EXTERN_LEN, MCONFIG_CHAIN_RESPONSE_SIZE + 1)
 
 /**
  * @brief Used to save wifi scanned information
@@ -44,6 +64,33 @@ typedef struct {
     mconfig_data_t mconfig_data;          /**< Mesh network configuration information */
 } mconfig_chain_data_t;
 
+/**
+ * @brief A slave served by the chain master, the master owns it while it is not used
+ *        and the worker that sends to the slave while it is
+ */
+typedef struct {
+    volatile bool used;                             /**< Handed to a worker */
+    uint8_t addr[MWIFI_ADDR_LEN];                   /**< MAC address of the slave */
+    uint8_t pubkey[MCONFIG_CHAIN_PUBKEY_SIZE + 1];  /**< Public key of the slave, a PEM string for RSA */
+} mconfig_chain_session_t;
+
+/**
+ * @brief State of the chain master shared with its workers
+ */
+typedef struct {
+    mconfig_chain_data_t *chain_data;   /**< Configuration and whitelist sent to all the slaves */
+    uint8_t *whitelist_compress_data;   /**< Whitelist compressed once for all the slaves */
+    mz_ulong whitelist_compress_size;   /**< Length of the compressed whitelist */
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    uint8_t privkey[MCONFIG_ECDH_KEY_LEN];
+    uint8_t pubkey[MCONFIG_ECDH_KEY_LEN];
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+    volatile bool running;              /**< Cleared to stop the workers */
+    QueueHandle_t session_queue;        /**< Sessions waiting for a worker */
+    SemaphoreHandle_t worker_exit_sem;  /**< Given by each worker when it exits */
+    mconfig_chain_session_t sessions[CONFIG_MCONFIG_CHAIN_SESSION_NUM];
+} mconfig_chain_master_t;
+
 static const char *TAG                    = "mconfig_chain";
 static bool g_chain_slave_flag            = false;
 static bool g_switch_channel_flag         = false;
@@ -91,7 +138,7 @@ static void wifi_sniffer_cb(void *recv_buf, wifi_promiscuous_pkt_type_t type)
 }
 
 static bool mconfig_device_verify(mconfig_whitelist_t *whitelist_data, size_t whitelist_size,
-                                  uint8_t *addr, char *pubkey_pem)
+                                  uint8_t *addr, const uint8_t *pubkey, size_t pubkey_size)
 {
 #ifndef CONFIG_MCONFIG_WHITELIST_ENABLE
     return true;
@@ -105,10 +152,12 @@ static bool mconfig_device_verify(mconfig_whitelist_t *whitelist_data, size_t wh
         if (!memcmp((whitelist_data + i)->addr, addr, MWIFI_ADDR_LEN)) {
 
 #ifdef CONFIG_MCONFIG_WHITELIST_SECURITY_ENABLE
+            uint8_t checksum[16] = {0};
 
-            if (mbedtls_md5_ret((uint8_t *)pubkey_pem, MCONFIG_RSA_PUBKEY_PEM_SIZE,
-                                (whitelist_data + i)->checksum) != ESP_OK) {
-                MDF_LOGW("RSA public key verification error");
+            if (mbedtls_md5_ret(pubkey, pubkey_size, checksum) != ESP_OK
+                    || memcmp(checksum, (whitelist_data + i)->checksum,
+                              MIN(sizeof(checksum), CONFIG_MCONFIG_WHITELIST_CHECKSUM_SIZE))) {
+                MDF_LOGW("Public key verification error");
                 return false;
             }
 
@@ -121,20 +170,176 @@ static bool mconfig_device_verify(mconfig_whitelist_t *whitelist_data, size_t wh
     return false;
 }
 
+/**
+ * @brief Send the configuration and the whitelist to the slave of a session
+ */
+static mdf_err_t mconfig_chain_session_send(mconfig_chain_master_t *master, mconfig_chain_session_t *session,
+        uint8_t *espnow_data)
+{
+    mdf_err_t ret                    = MDF_OK;
+    mconfig_chain_data_t *chain_data = master->chain_data;
+    mconfig_chain_data_t session_data;
+    uint8_t *whitelist_data          = NULL;
+
+    /**< Everything but the whitelist, with the key of the session */
+    memcpy(&session_data, chain_data, sizeof(mconfig_chain_data_t));
+
+#ifndef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    mbedtls_aes_context aes_ctx = {0};
+    uint8_t aes_iv[16]          = {0};
+    size_t aes_iv_offset        = 0;
+    mbedtls_aes_init(&aes_ctx);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+
+    /**
+     * @brief 4. Send network configuration information
+     */
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    ret = mconfig_ecdh_derive_key(master->privkey, session->pubkey, master->pubkey, session->pubkey, session_data.aes_key);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mconfig_ecdh_derive_key, ret: %d", ret);
+
+    memcpy(espnow_data, master->pubkey, MCONFIG_ECDH_KEY_LEN);
+    mconfig_random(NULL, espnow_data + MCONFIG_ECDH_KEY_LEN, MCONFIG_AEAD_NONCE_LEN);
+
+    ret = mconfig_aead_encrypt(session_data.aes_key, espnow_data + MCONFIG_ECDH_KEY_LEN,
+                               &session_data.mconfig_data, sizeof(mconfig_data_t),
+                               espnow_data + MCONFIG_ECDH_KEY_LEN + MCONFIG_AEAD_NONCE_LEN,
+                               espnow_data + MCONFIG_CHAIN_RESPONSE_SIZE - MCONFIG_AEAD_TAG_LEN);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mconfig_aead_encrypt, ret: %d", ret);
+#else
+    mconfig_random(NULL, session_data.aes_key, MCONFIG_AES_KEY_LEN);
+
+    ret = mconfig_rsa_encrypt(&session_data, MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
+                              (char *)session->pubkey, (uint8_t *)espnow_data);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "mconfig_rsa_encrypt, ret: %d", ret);
+
+    ret = mbedtls_aes_setkey_enc(&aes_ctx, session_data.aes_key, MCONFIG_AES_KEY_LEN * 8);
+    MDF_ERROR_GOTO(ret < 0, EXIT, "mbedtls_aes_setkey_enc, ret: %d", ret);
+
+    aes_iv_offset = 0;
+    memcpy(aes_iv, MCONFIG_AES_CFB_IV, MCONFIG_AES_KEY_LEN);
+    MDF_LOGV("whitelist_size: %d encrypted_size: %d, chain_data:" MACSTR,
+             session_data.mconfig_data.whitelist_size,
+             sizeof(mconfig_chain_data_t) - MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
+             MAC2STR((uint8_t *)&session_data + MCONFIG_RSA_PLAINTEXT_MAX_SIZE));
+
+    ret = mbedtls_aes_crypt_cfb128(&aes_ctx, MBEDTLS_AES_ENCRYPT,
+                                   sizeof(mconfig_chain_data_t) - MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
+                                   &aes_iv_offset, aes_iv, (uint8_t *)&session_data + MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
+                                   espnow_data + MCONFIG_RSA_CIPHERTEXT_SIZE);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "mbedtls_aes_crypt_cfb128, ret: %d", ret);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+
+    ESP_ERROR_CHECK(mespnow_add_peer(ESP_IF_WIFI_AP, session->addr, (uint8_t *)CONFIG_MCONFIG_CHAIN_LMK));
+    ret = mespnow_write(MESPNOW_TRANS_PIPE_MCONFIG, session->addr, espnow_data,
+                        MCONFIG_CHAIN_RESPONSE_SIZE, portMAX_DELAY);
+
+    if (ret != ESP_OK) {
+        MDF_LOGD("<%s> mespnow_write AES key & config", mdf_err_to_name(ret));
+        goto EXIT;
+    }
+
+    /**
+     * @brief 5. Send device whitelist information, compressed once by the master
+     */
+#ifdef CONFIG_MCONFIG_WHITELIST_ENABLE
+    int retry_count       = MCONFIG_CHAIN_SEND_RETRY_NUM;
+    size_t whitelist_size = master->whitelist_compress_size;
+    whitelist_data        = MDF_MALLOC(MCONFIG_CHAIN_WHITELIST_HEAD + whitelist_size + MCONFIG_CHAIN_WHITELIST_TAIL);
+    MDF_ERROR_GOTO(!whitelist_data, EXIT, "");
+
+    uint8_t *whitelist_body = whitelist_data + MCONFIG_CHAIN_WHITELIST_HEAD;
+
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    mconfig_random(NULL, whitelist_data, MCONFIG_AEAD_NONCE_LEN);
+    ret = mconfig_aead_encrypt(session_data.aes_key, whitelist_data, master->whitelist_compress_data,
+                               whitelist_size, whitelist_body, whitelist_body + whitelist_size);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mconfig_aead_encrypt, ret: %d", ret);
+#else
+    aes_iv_offset = 0;
+    memcpy(aes_iv, MCONFIG_AES_CFB_IV, MCONFIG_AES_KEY_LEN);
+    mbedtls_aes_crypt_cfb128(&aes_ctx, MBEDTLS_AES_ENCRYPT, whitelist_size,
+                             &aes_iv_offset, aes_iv, master->whitelist_compress_data, whitelist_body);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+
+    do {
+        ret = mespnow_write(MESPNOW_TRANS_PIPE_MCONFIG, session->addr, whitelist_data,
+                            MCONFIG_CHAIN_WHITELIST_HEAD + whitelist_size + MCONFIG_CHAIN_WHITELIST_TAIL,
+                            portMAX_DELAY);
+    } while (ret != ESP_OK && --retry_count);
+
+    if (ret != ESP_OK) {
+        MDF_LOGW("<%s> mespnow_write", mdf_err_to_name(ret));
+    }
+
+#endif /**< CONFIG_MCONFIG_WHITELIST_ENABLE */
+
+EXIT:
+    ESP_ERROR_CHECK(mespnow_del_peer(session->addr));
+    MDF_FREE(whitelist_data);
+    memset(session_data.aes_key, 0, MCONFIG_AES_KEY_LEN);
+#ifndef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    mbedtls_aes_free(&aes_ctx);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+
+    return ret;
+}
+
+/**
+ * @brief Serve the sessions queued by the master until it stops, the workers
+ *        encrypt and send for several slaves at the same time
+ */
+static void mconfig_chain_worker_task(void *arg)
+{
+    mconfig_chain_master_t *master = (mconfig_chain_master_t *)arg;
+    uint8_t *espnow_data           = MDF_MALLOC(ESPNOW_BUFFER_LEN);
+    mconfig_chain_session_t *session = NULL;
+
+    while (master->running) {
+        if (xQueueReceive(master->session_queue, &session, MCONFIG_CHAIN_EXIT_DELAY / portTICK_RATE_MS) != pdPASS) {
+            continue;
+        }
+
+        if (espnow_data && mconfig_chain_session_send(master, session, espnow_data) == MDF_OK) {
+            MDF_LOGI("Send network configured, addr: " MACSTR, MAC2STR(session->addr));
+        }
+
+        /**< The master can reuse the session from now on */
+        session->used = false;
+    }
+
+    MDF_FREE(espnow_data);
+    xSemaphoreGive(master->worker_exit_sem);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Find the session of a slave, or a free one if addr is NULL
+ */
+static mconfig_chain_session_t *mconfig_chain_session_find(mconfig_chain_master_t *master, const uint8_t *addr)
+{
+    for (int i = 0; i < CONFIG_MCONFIG_CHAIN_SESSION_NUM; ++i) {
+        mconfig_chain_session_t *session = master->sessions + i;
+
+        if (addr ? (session->used && !memcmp(session->addr, addr, MWIFI_ADDR_LEN)) : !session->used) {
+            return session;
+        }
+    }
+
+    return NULL;
+}
+
 static void mconfig_chain_master_task(void *arg)
 {
     mdf_err_t ret                  = MDF_ERR_NO_MEM;
     size_t espnow_size             = 0;
     uint8_t *espnow_data           = MDF_MALLOC(ESPNOW_BUFFER_LEN);
-    char *pubkey_pem               = MDF_MALLOC(MCONFIG_RSA_PUBKEY_PEM_SIZE + 1);
     uint8_t src_addr[MWIFI_ADDR_LEN] = {0};
     uint32_t start_ticks           = xTaskGetTickCount();
-    bool vendor_ie_flag            = true;
-
-    mbedtls_aes_context aes_ctx    = {0};
-    uint8_t aes_iv[16]             = {0};
-    size_t aes_iv_offset           = 0;
+    bool vendor_ie_flag            = false;
+    int worker_num                 = 0;
 
+    mconfig_chain_master_t *master   = MDF_CALLOC(1, sizeof(mconfig_chain_master_t));
     mconfig_chain_data_t *chain_data = (mconfig_chain_data_t *)arg;
     mconfig_data_t *mconfig_data     = &chain_data->mconfig_data;
 
@@ -146,23 +351,58 @@ static void mconfig_chain_master_task(void *arg)
     };
 
     MDF_ERROR_GOTO(!espnow_data, EXIT, "");
-    MDF_ERROR_GOTO(!pubkey_pem, EXIT, "");
+    MDF_ERROR_GOTO(!master, EXIT, "");
+
+    master->chain_data      = chain_data;
+    master->running         = true;
+    master->session_queue   = xQueueCreate(CONFIG_MCONFIG_CHAIN_SESSION_NUM, sizeof(mconfig_chain_session_t *));
+    master->worker_exit_sem = xSemaphoreCreateCounting(CONFIG_MCONFIG_CHAIN_SESSION_NUM, 0);
+    MDF_ERROR_GOTO(!master->session_queue || !master->worker_exit_sem, EXIT, "");
+
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    /**< One ephemeral key for all the slaves of this run, a slave costs one scalar multiplication */
+    ret = mconfig_ecdh_gen_key(master->privkey, master->pubkey);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mconfig_ecdh_gen_key, ret: %d", ret);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+
+#ifdef CONFIG_MCONFIG_WHITELIST_ENABLE
+    /**< Compression date to improve transmission efficiency, once for all the slaves */
+    master->whitelist_compress_size = compressBound(mconfig_data->whitelist_size);
+    master->whitelist_compress_data = MDF_MALLOC(master->whitelist_compress_size);
+    MDF_ERROR_GOTO(!master->whitelist_compress_data, EXIT, "");
+
+    ret = compress(master->whitelist_compress_data, &master->whitelist_compress_size,
+                   (uint8_t *)mconfig_data->whitelist_data, mconfig_data->whitelist_size);
+    MDF_ERROR_GOTO(ret != MZ_OK, EXIT, "<%s> Compressed whitelist failed", mz_error(ret));
+#endif /**< CONFIG_MCONFIG_WHITELIST_ENABLE */
+
+    for (; worker_num < CONFIG_MCONFIG_CHAIN_SESSION_NUM; ++worker_num) {
+        if (xTaskCreatePinnedToCore(mconfig_chain_worker_task, "mconfig_chain_worker", 4 * 1024,
+                                    master, CONFIG_MDF_TASK_DEFAULT_PRIOTY,
+                                    NULL, worker_num % portNUM_PROCESSORS) != pdPASS) {
+            break;
+        }
+    }
+
+    MDF_ERROR_GOTO(!worker_num, EXIT, "Create the workers of the chain master");
 
-    MDF_LOGI("Start send network configured");
+    MDF_LOGI("Start send network configured, workers: %d", worker_num);
 
     /**< Send MDF_EVENT_MCONFIG_CHAIN_MASTER_STARTED event to the event handler */
     mdf_event_loop_send(MDF_EVENT_MCONFIG_CHAIN_MASTER_STARTED, NULL);
-    mbedtls_aes_init(&aes_ctx);
 
     MDF_LOGD("g_chain_master_duration_ticks: %d", g_chain_master_duration_ticks);
 
     while ((xTaskGetTickCount() - start_ticks) < g_chain_master_duration_ticks) {
         /**
-         * @brief 1. Notify the device to request network configuration information from itself
+         * @brief 1. Notify the device to request network configuration information from itself,
+         *           as long as a session is free
          */
-        if (vendor_ie_flag) {
-            esp_wifi_set_vendor_ie(true, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_1, &ie_data);
-            vendor_ie_flag = false;
+        bool session_free = mconfig_chain_session_find(master, NULL) != NULL;
+
+        if (session_free != vendor_ie_flag) {
+            esp_wifi_set_vendor_ie(session_free, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_1, &ie_data);
+            vendor_ie_flag = session_free;
         }
 
         /**
@@ -172,118 +412,84 @@ static void mconfig_chain_master_task(void *arg)
         ret = mespnow_read(MESPNOW_TRANS_PIPE_MCONFIG, src_addr, espnow_data,
                            &espnow_size, MCONFIG_CHAIN_EXIT_DELAY / portTICK_RATE_MS);
 
-        if (ret != ESP_OK || espnow_size != MCONFIG_RSA_PUBKEY_PEM_DATA_SIZE + 1) {
-            MDF_LOGV("receive, size: %d, data:\n%s", espnow_size, espnow_data);
+        if (ret != ESP_OK || espnow_size != MCONFIG_CHAIN_REQUEST_SIZE) {
+            MDF_LOGV("receive, size: %d", espnow_size);
             continue;
         }
 
-        int8_t rssi = espnow_data[MCONFIG_RSA_PUBKEY_PEM_DATA_SIZE];
+        int8_t rssi = espnow_data[MCONFIG_CHAIN_REQUEST_SIZE - 1];
+
+        /**< A slave repeats its request while waiting for the response */
+        if (mconfig_chain_session_find(master, src_addr)) {
+            MDF_LOGD("Session in progress, addr: " MACSTR, MAC2STR(src_addr));
+            continue;
+        }
+
+        mconfig_chain_session_t *session = mconfig_chain_session_find(master, NULL);
+
+        if (!session) {
+            MDF_LOGD("No free session, addr: " MACSTR, MAC2STR(src_addr));
+            continue;
+        }
 
-        esp_wifi_set_vendor_ie(false, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_1, &ie_data);
-        vendor_ie_flag = true;
         MDF_LOGI("Add device, rssi: %d, addr: " MACSTR, rssi, MAC2STR(src_addr));
 
         /**
          * @brief 3. Verify that the device is a forged device
          */
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+        memcpy(session->pubkey, espnow_data, MCONFIG_ECDH_KEY_LEN);
+#else
         espnow_data[MCONFIG_RSA_PUBKEY_PEM_DATA_SIZE] = '\0';
         MDF_LOGV("size: %d, espnow_data: %s", espnow_size, espnow_data);
-        sprintf(pubkey_pem, PEM_BEGIN_PUBLIC_KEY "%s" PEM_END_PUBLIC_KEY, espnow_data);
-        MDF_LOGV("pubkey_pem: %s", pubkey_pem);
+        sprintf((char *)session->pubkey, PEM_BEGIN_PUBLIC_KEY "%s" PEM_END_PUBLIC_KEY, espnow_data);
+        MDF_LOGV("pubkey_pem: %s", session->pubkey);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
 
-        if (rssi < g_filter_rssi || !mconfig_device_verify(mconfig_data->whitelist_data, mconfig_data->whitelist_size, src_addr, pubkey_pem)) {
+        if (rssi < g_filter_rssi || !mconfig_device_verify(mconfig_data->whitelist_data, mconfig_data->whitelist_size,
+                src_addr, session->pubkey, MCONFIG_CHAIN_PUBKEY_SIZE)) {
             MDF_LOGD("this device("MACSTR") is not on the whitelist of the device configuration network device",
                      MAC2STR(src_addr));
             continue;
         }
 
         /**
-         * @brief 4. Send network configuration information
+         * @brief 4. Hand the session to a worker, which sends the configuration and the whitelist
          */
-        mconfig_random(NULL, chain_data->aes_key, MCONFIG_AES_KEY_LEN);
-
-        ret = mconfig_rsa_encrypt(chain_data, MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
-                                  pubkey_pem, (uint8_t *)espnow_data);
-        MDF_ERROR_CONTINUE(ret != ESP_OK, "mconfig_rsa_encrypt, ret: %d", ret);
-
-        ret = mbedtls_aes_setkey_enc(&aes_ctx, chain_data->aes_key, MCONFIG_AES_KEY_LEN * 8);
-        MDF_ERROR_CONTINUE(ret < 0, "mbedtls_aes_setkey_enc, ret: %d", ret);
-
-        aes_iv_offset = 0;
-        memcpy(aes_iv, MCONFIG_AES_CFB_IV, MCONFIG_AES_KEY_LEN);
-        MDF_LOGV("whitelist_size: %d encrypted_size: %d, chain_data:" MACSTR,
-                 chain_data->mconfig_data.whitelist_size,
-                 sizeof(mconfig_chain_data_t) - MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
-                 MAC2STR((uint8_t *)chain_data + MCONFIG_RSA_PLAINTEXT_MAX_SIZE));
-
-        ret = mbedtls_aes_crypt_cfb128(&aes_ctx, MBEDTLS_AES_ENCRYPT,
-                                       sizeof(mconfig_chain_data_t) - MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
-                                       &aes_iv_offset, aes_iv, (uint8_t *)chain_data + MCONFIG_RSA_PLAINTEXT_MAX_SIZE,
-                                       espnow_data + MCONFIG_RSA_CIPHERTEXT_SIZE);
-        MDF_ERROR_CONTINUE(ret != ESP_OK, "mbedtls_aes_crypt_cfb128, ret: %d", ret);
-
-        ESP_ERROR_CHECK(mespnow_add_peer(ESP_IF_WIFI_AP, src_addr, (uint8_t *)CONFIG_MCONFIG_CHAIN_LMK));
-        ret = mespnow_write(MESPNOW_TRANS_PIPE_MCONFIG, src_addr, espnow_data,
-                            (MCONFIG_RSA_CIPHERTEXT_SIZE - MCONFIG_RSA_PLAINTEXT_MAX_SIZE) + sizeof(mconfig_chain_data_t), portMAX_DELAY);
-        ESP_ERROR_CHECK(mespnow_del_peer(src_addr));
-
-        if (ret != ESP_OK) {
-            MDF_LOGD("<%s> mespnow_write AES key & config", mdf_err_to_name(ret));
-            continue;
-        }
+        memcpy(session->addr, src_addr, MWIFI_ADDR_LEN);
+        session->used = true;
+        xQueueSend(master->session_queue, &session, 0);
+    }
 
+EXIT:
 
+    MDF_LOGI("End send network configured");
 
-        /**
-         * @brief 5. Send device whitelist information
-         */
-#ifdef CONFIG_MCONFIG_WHITELIST_ENABLE
+    esp_wifi_set_vendor_ie(false, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_1, &ie_data);
 
-        int retry_count = MCONFIG_CHAIN_SEND_RETRY_NUM;
-        uint8_t *whitelist_compress_data = NULL;
-        ESP_ERROR_CHECK(mespnow_add_peer(ESP_IF_WIFI_AP, src_addr, (uint8_t *)CONFIG_MCONFIG_CHAIN_LMK));
+    if (master) {
+        /**< The workers finish their session before they exit */
+        master->running = false;
 
-        do {
-            /**< Compression date to improve transmission efficiency */
-            mz_ulong whitelist_compress_size = compressBound(mconfig_data->whitelist_size);
-            whitelist_compress_data          = MDF_CALLOC(1, (int)whitelist_compress_size);
-            MDF_ERROR_CONTINUE(!whitelist_compress_data, "");
-
-            ret = compress(whitelist_compress_data, &whitelist_compress_size,
-                           (uint8_t *)mconfig_data->whitelist_data, mconfig_data->whitelist_size);
-            MDF_ERROR_BREAK(ret != MZ_OK, "<%s> Compressed whitelist failed", mz_error(ret));
-
-            aes_iv_offset = 0;
-            memcpy(aes_iv, MCONFIG_AES_CFB_IV, MCONFIG_AES_KEY_LEN);
-            mbedtls_aes_crypt_cfb128(&aes_ctx, MBEDTLS_AES_ENCRYPT, whitelist_compress_size,
-                                     &aes_iv_offset, aes_iv, whitelist_compress_data,
-                                     whitelist_compress_data);
-
-            do {
-                ret = mespnow_write(MESPNOW_TRANS_PIPE_MCONFIG, src_addr, whitelist_compress_data,
-                                    whitelist_compress_size, portMAX_DELAY);
-            } while (ret != ESP_OK && --retry_count);
-        } while (0);
+        for (int i = 0; i < worker_num; ++i) {
+            xSemaphoreTake(master->worker_exit_sem, portMAX_DELAY);
+        }
 
-        MDF_FREE(whitelist_compress_data);
-        ESP_ERROR_CHECK(mespnow_del_peer(src_addr));
+        if (master->session_queue) {
+            vQueueDelete(master->session_queue);
+        }
 
-        if (ret != ESP_OK) {
-            MDF_LOGW("<%s> mespnow_write", mdf_err_to_name(ret));
+        if (master->worker_exit_sem) {
+            vSemaphoreDelete(master->worker_exit_sem);
         }
 
-#endif /**< CONFIG_MCONFIG_WHITELIST_ENABLE */
+        MDF_FREE(master->whitelist_compress_data);
+        memset(master, 0, sizeof(mconfig_chain_master_t));
+        MDF_FREE(master);
     }
 
-EXIT:
-
-    MDF_LOGI("End send network configured");
-
-    esp_wifi_set_vendor_ie(false, WIFI_VND_IE_TYPE_BEACON, WIFI_VND_IE_ID_1, &ie_data);
-    MDF_FREE(pubkey_pem);
     MDF_FREE(espnow_data);
     MDF_FREE(chain_data);
-    mbedtls_aes_free(&aes_ctx);
     g_chain_master_duration_ticks = 0;
 
     /**< Send MDF_EVENT_MCONFIG_CHAIN_MASTER_STOPED event to the event handler */
@@ -348,28 +554,40 @@ static void mconfig_chain_slave_task(void *arg)
     mdf_err_t ret                   = MDF_ERR_NO_MEM;
     size_t espnow_size              = 0;
     uint8_t *espnow_data            = MDF_MALLOC(ESPNOW_BUFFER_LEN);
-    char *privkey_pem               = MDF_CALLOC(1, MCONFIG_RSA_PRIVKEY_PEM_SIZE);
-    char *pubkey_pem                = MDF_CALLOC(1, MCONFIG_RSA_PUBKEY_PEM_SIZE);
     g_mconfig_scan_queue            = xQueueCreate(10, sizeof(mconfig_scan_info_t));
     uint8_t dest_addr[MWIFI_ADDR_LEN] = {0};
     int8_t rssi                     = 0;
 
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    uint8_t privkey[MCONFIG_ECDH_KEY_LEN] = {0};
+    uint8_t pubkey[MCONFIG_ECDH_KEY_LEN]  = {0};
+#else
+    char *privkey_pem               = MDF_CALLOC(1, MCONFIG_RSA_PRIVKEY_PEM_SIZE);
+    char *pubkey_pem                = MDF_CALLOC(1, MCONFIG_RSA_PUBKEY_PEM_SIZE);
     mbedtls_aes_context aes_ctx     = {0};
     uint8_t aes_iv[16]              = {0};
     size_t aes_iv_offset            = 0;
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
 
     mconfig_chain_data_t *chain_data = MDF_MALLOC(sizeof(mconfig_chain_data_t));
 
     MDF_ERROR_GOTO(!espnow_data, EXIT, "");
+    MDF_ERROR_GOTO(!chain_data, EXIT, "");
+
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    ret = mconfig_ecdh_get_key(privkey, pubkey);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mconfig_ecdh_get_key, ret: %d", ret);
+    MDF_LOGI("Get X25519 public and private keys");
+#else
     MDF_ERROR_GOTO(!privkey_pem, EXIT, "");
     MDF_ERROR_GOTO(!pubkey_pem, EXIT, "");
-    MDF_ERROR_GOTO(!chain_data, EXIT, "");
 
     ESP_ERROR_CHECK(mconfig_rsa_gen_key(privkey_pem, pubkey_pem));
     MDF_LOGI("Generate RSA public and private keys");
     MDF_LOGV("privkey_pem: %s, pubkey_pem: %s", privkey_pem, pubkey_pem);
 
     mbedtls_aes_init(&aes_ctx);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
 
     ESP_ERROR_CHECK(esp_wifi_set_promiscuous_rx_cb(wifi_sniffer_cb));
     ESP_ERROR_CHECK(esp_wifi_set_promiscuous(true));
@@ -398,12 +616,16 @@ static void mconfig_chain_slave_task(void *arg)
                                espnow_data, &espnow_size, 0);
         } while (ret == MDF_OK);
 
-        /**< Remove headers and footers to reduce data length */
         memset(espnow_data, 0, ESPNOW_BUFFER_LEN);
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+        memcpy(espnow_data, pubkey, MCONFIG_ECDH_KEY_LEN);
+#else
+        /**< Remove headers and footers to reduce data length */
         memcpy(espnow_data, pubkey_pem + strlen(PEM_BEGIN_PUBLIC_KEY),
                MCONFIG_RSA_PUBKEY_PEM_DATA_SIZE);
-        espnow_data[MCONFIG_RSA_PUBKEY_PEM_DATA_SIZE] = rssi;
-        espnow_size = MCONFIG_RSA_PUBKEY_PEM_DATA_SIZE + 1;
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
+        espnow_data[MCONFIG_CHAIN_REQUEST_SIZE - 1] = rssi;
+        espnow_size = MCONFIG_CHAIN_REQUEST_SIZE;
 
         ret = mespnow_write(MESPNOW_TRANS_PIPE_MCONFIG, dest_addr,
                             espnow_data, espnow_size, portMAX_DELAY);
@@ -424,12 +646,28 @@ static void mconfig_chain_slave_task(void *arg)
         ret = mespnow_read(MESPNOW_TRANS_PIPE_MCONFIG, dest_addr,
                            espnow_data, &espnow_size, 1000 / portTICK_RATE_MS);
 
-        if (ret != ESP_OK || espnow_size != (MCONFIG_RSA_CIPHERTEXT_SIZE - MCONFIG_RSA_PLAINTEXT_MAX_SIZE) + sizeof(mconfig_chain_data_t)) {
+        if (ret != ESP_OK || espnow_size != MCONFIG_CHAIN_RESPONSE_SIZE) {
             MDF_LOGD("<%s> mespnow_read", mdf_err_to_name(ret));
             ESP_ERROR_CHECK(mespnow_del_peer(dest_addr));
             continue;
         }
 
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+        ret = mconfig_ecdh_derive_key(privkey, espnow_data, espnow_data, pubkey, chain_data->aes_key);
+
+        if (ret == MDF_OK) {
+            ret = mconfig_aead_decrypt(chain_data->aes_key, espnow_data + MCONFIG_ECDH_KEY_LEN,
+                                       espnow_data + MCONFIG_ECDH_KEY_LEN + MCONFIG_AEAD_NONCE_LEN, sizeof(mconfig_data_t),
+                                       espnow_data + MCONFIG_CHAIN_RESPONSE_SIZE - MCONFIG_AEAD_TAG_LEN,
+                                       &chain_data->mconfig_data);
+        }
+
+        if (ret != MDF_OK) {
+            MDF_LOGW("Configuration information decryption failed, ret: 0x%x", -ret);
+            ESP_ERROR_CHECK(mespnow_del_peer(dest_addr));
+            continue;
+        }
+#else
         ret = mconfig_rsa_decrypt(espnow_data, privkey_pem, chain_data, MCONFIG_RSA_PLAINTEXT_MAX_SIZE);
 
         if (ret != ESP_OK) {
@@ -447,6 +685,7 @@ static void mconfig_chain_slave_task(void *arg)
                                        &aes_iv_offset, aes_iv, espnow_data + MCONFIG_RSA_CIPHERTEXT_SIZE,
                                        (uint8_t *)chain_data + MCONFIG_RSA_PLAINTEXT_MAX_SIZE);
         MDF_ERROR_CONTINUE(ret != ESP_OK, "mbedtls_aes_crypt_cfb128, ret: 0x%x", -ret);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
 
         /**
          * @brief 4. Receive device whitelist information
@@ -460,12 +699,14 @@ static void mconfig_chain_slave_task(void *arg)
         mconfig_data_t *mconfig_data     = &chain_data->mconfig_data;
         mz_ulong whitelist_size          = mconfig_data->whitelist_size;
         mz_ulong whitelist_compress_size = 0;
-        uint8_t *whitelist_compress_data = MDF_MALLOC(mconfig_data->whitelist_size + 64);
+        size_t whitelist_buffer_size     = mconfig_data->whitelist_size + 64
+                                           + MCONFIG_CHAIN_WHITELIST_HEAD + MCONFIG_CHAIN_WHITELIST_TAIL;
+        uint8_t *whitelist_compress_data = MDF_MALLOC(whitelist_buffer_size);
         uint8_t src_addr[ESP_NOW_ETH_ALEN] = {0};
         MDF_ERROR_CONTINUE(!whitelist_compress_data, "");
 
         do {
-            whitelist_compress_size = mconfig_data->whitelist_size + 64;
+            whitelist_compress_size = whitelist_buffer_size;
             ret = mespnow_read(MESPNOW_TRANS_PIPE_MCONFIG, src_addr, whitelist_compress_data,
                                (size_t *)&whitelist_compress_size, 10000 / portTICK_RATE_MS);
 
@@ -482,13 +723,33 @@ static void mconfig_chain_slave_task(void *arg)
             continue;
         }
 
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+        if (whitelist_compress_size < MCONFIG_CHAIN_WHITELIST_HEAD + MCONFIG_CHAIN_WHITELIST_TAIL) {
+            MDF_FREE(whitelist_compress_data);
+            MDF_LOGW("Whitelist is too short, size: %d", (int)whitelist_compress_size);
+            continue;
+        }
+
+        whitelist_compress_size -= MCONFIG_CHAIN_WHITELIST_HEAD + MCONFIG_CHAIN_WHITELIST_TAIL;
+        uint8_t *whitelist_body = whitelist_compress_data + MCONFIG_CHAIN_WHITELIST_HEAD;
+        ret = mconfig_aead_decrypt(chain_data->aes_key, whitelist_compress_data, whitelist_body,
+                                   whitelist_compress_size, whitelist_body + whitelist_compress_size, whitelist_body);
+
+        if (ret != MDF_OK) {
+            MDF_FREE(whitelist_compress_data);
+            MDF_LOGW("Whitelist decryption failed, ret: 0x%x", -ret);
+            continue;
+        }
+#else
+        uint8_t *whitelist_body = whitelist_compress_data;
         aes_iv_offset = 0;
         memcpy(aes_iv, MCONFIG_AES_CFB_IV, MCONFIG_AES_KEY_LEN);
         mbedtls_aes_crypt_cfb128(&aes_ctx, MBEDTLS_AES_DECRYPT, whitelist_compress_size,
                                  &aes_iv_offset, aes_iv, whitelist_compress_data, whitelist_compress_data);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
 
         ret = uncompress((uint8_t *)mconfig_data->whitelist_data, &whitelist_size,
-                         whitelist_compress_data, whitelist_compress_size);
+                         whitelist_body, whitelist_compress_size);
         mconfig_data->whitelist_size = whitelist_size;
 
         MDF_FREE(whitelist_compress_data);
@@ -515,13 +776,17 @@ static void mconfig_chain_slave_task(void *arg)
 
 EXIT:
 
+#ifdef CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH
+    memset(privkey, 0, sizeof(privkey));
+#else
     MDF_FREE(pubkey_pem);
     MDF_FREE(privkey_pem);
+    mbedtls_aes_free(&aes_ctx);
+#endif /**< CONFIG_MCONFIG_CHAIN_HANDSHAKE_ECDH */
     MDF_FREE(espnow_data);
     MDF_FREE(chain_data);
     vQueueDelete(g_mconfig_scan_queue);
     g_mconfig_scan_queue = NULL;
-    mbedtls_aes_free(&aes_ctx);
     xSemaphoreGive(g_chain_slave_exit_sem);
 
     vTaskDelete(NULL);
@@ -16,6 +16,9 @@
 #include "mbedtls/pk.h"
 #include "mbedtls/aes.h"
 #include "mbedtls/dhm.h"
+#include "mbedtls/ecdh.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/sha256.h"
 
 #include "mdf_common.h"
 #include "mconfig_security.h"
@@ -222,3 +225,225 @@ EXIT:
     mbedtls_pk_free(&pk);
     return ret;
 }
+
+/**
+ * @brief X25519 keys are little endian, the MPI of mbedtls big endian
+ */
+static void mconfig_ecdh_reverse(uint8_t *dest, const uint8_t *src)
+{
+    for (int i = 0; i < MCONFIG_ECDH_KEY_LEN; ++i) {
+        dest[i] = src[MCONFIG_ECDH_KEY_LEN - 1 - i];
+    }
+}
+
+static int mconfig_ecdh_read_mpi(mbedtls_mpi *mpi, const uint8_t *key)
+{
+    uint8_t buf[MCONFIG_ECDH_KEY_LEN] = {0};
+
+    mconfig_ecdh_reverse(buf, key);
+    return mbedtls_mpi_read_binary(mpi, buf, MCONFIG_ECDH_KEY_LEN);
+}
+
+static int mconfig_ecdh_write_mpi(const mbedtls_mpi *mpi, uint8_t *key)
+{
+    uint8_t buf[MCONFIG_ECDH_KEY_LEN] = {0};
+    int ret = mbedtls_mpi_write_binary(mpi, buf, MCONFIG_ECDH_KEY_LEN);
+
+    mconfig_ecdh_reverse(key, buf);
+    return ret;
+}
+
+/**
+ * @brief Public key of a private key, clamped as RFC 7748
+ */
+static mdf_err_t mconfig_ecdh_pubkey(uint8_t *privkey, uint8_t *pubkey)
+{
+    int ret                 = MDF_OK;
+    mbedtls_ecp_group grp   = {0};
+    mbedtls_ecp_point Q     = {0};
+    mbedtls_mpi d           = {0};
+
+    privkey[0]  &= 0xf8;
+    privkey[31] &= 0x7f;
+    privkey[31] |= 0x40;
+
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_ecp_point_init(&Q);
+    mbedtls_mpi_init(&d);
+
+    ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_CURVE25519);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_ecp_group_load, ret: -0x%x", -ret);
+
+    ret = mconfig_ecdh_read_mpi(&d, privkey);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_mpi_read_binary, ret: -0x%x", -ret);
+
+    ret = mbedtls_ecp_mul(&grp, &Q, &d, &grp.G, mconfig_random, NULL);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_ecp_mul, ret: -0x%x", -ret);
+
+    ret = mconfig_ecdh_write_mpi(&Q.X, pubkey);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_mpi_write_binary, ret: -0x%x", -ret);
+
+EXIT:
+    mbedtls_ecp_group_free(&grp);
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_mpi_free(&d);
+    return ret != 0 ? MDF_FAIL : MDF_OK;
+}
+
+mdf_err_t mconfig_ecdh_gen_key(uint8_t *privkey, uint8_t *pubkey)
+{
+    MDF_PARAM_CHECK(privkey);
+    MDF_PARAM_CHECK(pubkey);
+
+    mconfig_random(NULL, privkey, MCONFIG_ECDH_KEY_LEN);
+
+    return mconfig_ecdh_pubkey(privkey, pubkey);
+}
+
+mdf_err_t mconfig_ecdh_get_key(uint8_t *privkey, uint8_t *pubkey)
+{
+    MDF_PARAM_CHECK(privkey);
+    MDF_PARAM_CHECK(pubkey);
+
+#ifdef CONFIG_MCONFIG_WHITELIST_SECURITY_ENABLE
+    const uint8_t erased[MCONFIG_ECDH_KEY_LEN] = {
+        [0 ... MCONFIG_ECDH_KEY_LEN - 1] = 0xff
+    };
+
+    const esp_partition_t *ecdh_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                       CONFIG_MCONFIG_PARTITION_SUBTYPE, CONFIG_MCONFIG_PARTITION_LABLE);
+    MDF_ERROR_CHECK(!ecdh_part, MDF_ERR_NOT_SUPPORTED, "partition no find, subtype: 0x%x, label: %s",
+                    CONFIG_MCONFIG_PARTITION_SUBTYPE, CONFIG_MCONFIG_PARTITION_LABLE);
+
+    /**< Only the private key is written, its public key is derived from it */
+    if (esp_partition_read(ecdh_part, 0, privkey, MCONFIG_ECDH_KEY_LEN) != ESP_OK
+            || !memcmp(privkey, erased, MCONFIG_ECDH_KEY_LEN)) {
+        MDF_LOGE("The key of mconfig ECDH is not written correctly");
+        return MDF_FAIL;
+    }
+
+    return mconfig_ecdh_pubkey(privkey, pubkey);
+#else
+    return mconfig_ecdh_gen_key(privkey, pubkey);
+#endif /**< CONFIG_MCONFIG_WHITELIST_SECURITY_ENABLE */
+}
+
+mdf_err_t mconfig_ecdh_derive_key(const uint8_t *privkey, const uint8_t *peer_pubkey,
+                                  const uint8_t *master_pubkey, const uint8_t *slave_pubkey,
+                                  uint8_t *aes_key)
+{
+    MDF_PARAM_CHECK(privkey);
+    MDF_PARAM_CHECK(peer_pubkey);
+    MDF_PARAM_CHECK(master_pubkey);
+    MDF_PARAM_CHECK(slave_pubkey);
+    MDF_PARAM_CHECK(aes_key);
+
+    int ret                  = MDF_OK;
+    mbedtls_ecp_group grp    = {0};
+    mbedtls_ecp_point Q      = {0};
+    mbedtls_mpi d            = {0};
+    mbedtls_mpi z            = {0};
+    mbedtls_sha256_context sha256 = {0};
+    uint8_t peer[MCONFIG_ECDH_KEY_LEN]   = {0};
+    uint8_t secret[MCONFIG_ECDH_KEY_LEN] = {0};
+    uint8_t digest[32]       = {0};
+
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_ecp_point_init(&Q);
+    mbedtls_mpi_init(&d);
+    mbedtls_mpi_init(&z);
+    mbedtls_sha256_init(&sha256);
+
+    ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_CURVE25519);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_ecp_group_load, ret: -0x%x", -ret);
+
+    /**< The most significant bit of the u-coordinate is ignored, RFC 7748 */
+    memcpy(peer, peer_pubkey, MCONFIG_ECDH_KEY_LEN);
+    peer[31] &= 0x7f;
+
+    ret = mconfig_ecdh_read_mpi(&d, privkey);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_mpi_read_binary, ret: -0x%x", -ret);
+    ret = mconfig_ecdh_read_mpi(&Q.X, peer);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_mpi_read_binary, ret: -0x%x", -ret);
+    ret = mbedtls_mpi_lset(&Q.Z, 1);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_mpi_lset, ret: -0x%x", -ret);
+
+    ret = mbedtls_ecdh_compute_shared(&grp, &z, &Q, &d, mconfig_random, NULL);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_ecdh_compute_shared, ret: -0x%x", -ret);
+
+    /**< A point of small order gives a secret of zero */
+    ret = mbedtls_mpi_cmp_int(&z, 0) ? 0 : MBEDTLS_ERR_ECP_INVALID_KEY;
+    MDF_ERROR_GOTO(ret != 0, EXIT, "The public key of the peer is of small order");
+
+    ret = mconfig_ecdh_write_mpi(&z, secret);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_mpi_write_binary, ret: -0x%x", -ret);
+
+    mbedtls_sha256_starts_ret(&sha256, false);
+    mbedtls_sha256_update_ret(&sha256, secret, MCONFIG_ECDH_KEY_LEN);
+    mbedtls_sha256_update_ret(&sha256, master_pubkey, MCONFIG_ECDH_KEY_LEN);
+    mbedtls_sha256_update_ret(&sha256, slave_pubkey, MCONFIG_ECDH_KEY_LEN);
+    mbedtls_sha256_finish_ret(&sha256, digest);
+    memcpy(aes_key, digest, MCONFIG_AES_KEY_LEN);
+
+EXIT:
+    memset(secret, 0, sizeof(secret));
+    memset(digest, 0, sizeof(digest));
+    mbedtls_ecp_group_free(&grp);
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_mpi_free(&d);
+    mbedtls_mpi_free(&z);
+    mbedtls_sha256_free(&sha256);
+    return ret != 0 ? MDF_FAIL : MDF_OK;
+}
+
+mdf_err_t mconfig_aead_encrypt(const uint8_t *aes_key, const uint8_t *nonce,
+                               const void *plaintext, size_t size, uint8_t *ciphertext, uint8_t *tag)
+{
+    MDF_PARAM_CHECK(aes_key);
+    MDF_PARAM_CHECK(nonce);
+    MDF_PARAM_CHECK(plaintext);
+    MDF_PARAM_CHECK(ciphertext);
+    MDF_PARAM_CHECK(tag);
+
+    int ret                 = MDF_OK;
+    mbedtls_gcm_context gcm = {0};
+
+    mbedtls_gcm_init(&gcm);
+
+    ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, aes_key, MCONFIG_AES_KEY_LEN * 8);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_gcm_setkey, ret: -0x%x", -ret);
+
+    ret = mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, size, nonce, MCONFIG_AEAD_NONCE_LEN,
+                                    NULL, 0, plaintext, ciphertext, MCONFIG_AEAD_TAG_LEN, tag);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_gcm_crypt_and_tag, ret: -0x%x", -ret);
+
+EXIT:
+    mbedtls_gcm_free(&gcm);
+    return ret != 0 ? MDF_FAIL : MDF_OK;
+}
+
+mdf_err_t mconfig_aead_decrypt(const uint8_t *aes_key, const uint8_t *nonce,
+                               const uint8_t *ciphertext, size_t size, const uint8_t *tag, void *plaintext)
+{
+    MDF_PARAM_CHECK(aes_key);
+    MDF_PARAM_CHECK(nonce);
+    MDF_PARAM_CHECK(ciphertext);
+    MDF_PARAM_CHECK(tag);
+    MDF_PARAM_CHECK(plaintext);
+
+    int ret                 = MDF_OK;
+    mbedtls_gcm_context gcm = {0};
+
+    mbedtls_gcm_init(&gcm);
+
+    ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, aes_key, MCONFIG_AES_KEY_LEN * 8);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_gcm_setkey, ret: -0x%x", -ret);
+
+    ret = mbedtls_gcm_auth_decrypt(&gcm, size, nonce, MCONFIG_AEAD_NONCE_LEN, NULL, 0,
+                                   tag, MCONFIG_AEAD_TAG_LEN, ciphertext, plaintext);
+    MDF_ERROR_GOTO(ret != 0, EXIT, "mbedtls_gcm_auth_decrypt, ret: -0x%x", -ret);
+
+EXIT:
+    mbedtls_gcm_free(&gcm);
+    return ret != 0 ? MDF_FAIL : MDF_OK;
+}
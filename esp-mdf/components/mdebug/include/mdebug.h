@@ -20,9 +20,11 @@ extern "C" {
 
 #include "mdf_common.h"
 #include "mdebug_console.h"
+#include "mdebug_coredump.h"
 #include "mdebug_espnow.h"
 #include "mdebug_flash.h"
 #include "mdebug_log.h"
+#include "mdebug_profile.h"
 
 /**
  *@brief Configuration mdebug print enable, whether the output information according to the client needs to know.
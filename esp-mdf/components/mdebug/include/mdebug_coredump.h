@@ -0,0 +1,84 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MDF_DEBUG_COREDUMP_H__
+#define __MDF_DEBUG_COREDUMP_H__
+
+#include "mdf_common.h"
+#include "mdebug_espnow.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Packet of a streamed core dump, MDEBUG_COREDUMP_STREAM_*
+ *
+ * @note  The data is the core dump compressed by miniz in the zlib format, offset
+ *        is the position of the data in the compressed stream. For BEGIN, offset is
+ *        the size of the core dump, for END the size of the compressed stream, for
+ *        ACK and NACK the size of the compressed stream received in order.
+ */
+typedef struct {
+    uint8_t type;     /**< Type of packet */
+    uint8_t window;   /**< Frames sent before waiting for an acknowledgement */
+    uint16_t size;    /**< Size of data */
+    uint32_t id;      /**< CRC-32 of the core dump, a transfer is resumed if it is the same */
+    uint32_t offset;  /**< Offset of data in the compressed stream */
+    uint8_t data[0];  /**< Compressed core dump */
+} __attribute__((packed)) mdebug_coredump_stream_t;
+
+#define MDEBUG_COREDUMP_STREAM_DATA_LEN (MDEBUG_ESPNOW_PAYLOAD_LEN - sizeof(mdebug_coredump_stream_t)) /**< Data of a frame */
+
+/**
+ * @brief  Send the core dump of the device in the background, compressed, with
+ *         CONFIG_MDEBUG_COREDUMP_WINDOW frames sent before an acknowledgement
+ *
+ * @note   If the receiver already has a part of this core dump, the transfer is
+ *         resumed from the last offset it acknowledged
+ *
+ * @param  dest_addr  Address of the receiver
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_FOUND: No core dump on the device
+ *     - MDF_ERR_INVALID_STATE: A core dump is being sent
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mdebug_coredump_send(const uint8_t *dest_addr);
+
+/**
+ * @brief  Handle a packet of a streamed core dump, called for MDEBUG_ESPNOW_COREDUMP.
+ *         The receiver acknowledges the data and prints it as lines that
+ *         tools/mdebug_coredump.py reassembles:
+ *             mdebug_coredump: <addr> begin <id> <size> <offset>
+ *             mdebug_coredump: <addr> data <id> <offset> <base64>
+ *             mdebug_coredump: <addr> end <id> <compressed size>
+ *
+ * @param  src_addr  Address of the sender
+ * @param  data      Packet received, the packets of mdebug_coredump_packet_t are ignored
+ * @param  size      Size of the packet
+ * @param  finished  Set to true when a core dump has been received entirely, can be NULL
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mdebug_coredump_recv(const uint8_t *src_addr, const void *data, size_t size, bool *finished);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MDF_DEBUG_COREDUMP_H__ */
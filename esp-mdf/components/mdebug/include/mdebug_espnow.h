@@ -16,11 +16,14 @@
 #define __MDF_ESPNOW_DEBUG_H__
 
 #include "mdf_common.h"
+#include "mespnow.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif /**< _cplusplus */
 
+#define MDEBUG_ESPNOW_PAYLOAD_LEN (MESPNOW_PAYLOAD_LEN - 2) /**< Data of mdebug_espnow_write() sent in a single frame */
+
 /**
  * @brief Type of data sent during wireless debugging
  */
@@ -28,6 +31,8 @@ typedef enum {
     MDEBUG_ESPNOW_COREDUMP = 1, /**< Core dump information */
     MDEBUG_ESPNOW_CONSOLE,      /**< Remotely call local terminal commands */
     MDEBUG_ESPNOW_LOG,          /**< Log information */
+    MDEBUG_ESPNOW_LOG_BATCH,    /**< Several logs, mdebug_log_batch_t */
+    MDEBUG_ESPNOW_METRICS,      /**< Metrics, mdf_metrics_snapshot_t */
 } mdebug_espnow_t;
 
 /**
@@ -37,10 +42,15 @@ enum {
     MDEBUG_COREDUMP_BEGIN = 1, /**< Start transferring core dump data */
     MDEBUG_COREDUMP_DATA,      /**< Send core dump data */
     MDEBUG_COREDUMP_END,       /**< End core dump data transfer */
+    MDEBUG_COREDUMP_STREAM_BEGIN, /**< Start a compressed transfer, mdebug_coredump_stream_t */
+    MDEBUG_COREDUMP_STREAM_DATA,  /**< Compressed core dump data */
+    MDEBUG_COREDUMP_STREAM_END,   /**< End of the compressed core dump */
+    MDEBUG_COREDUMP_STREAM_ACK,   /**< Compressed data received in order by the receiver */
+    MDEBUG_COREDUMP_STREAM_NACK,  /**< The frame at the offset is missing, the data before it is received */
 };
 
 /**
- * @brief Core dump data structure
+ * @brief Core dump data structure, sent by the previous firmware
  */
 typedef struct {
     uint8_t type;  /**< Type of packet */
@@ -55,6 +55,8 @@ mdf_err_t mdebug_flash_write(const char *data, size_t size);
 /**
  * @brief Read memory data in flash
  *
+ * @note  The logs are read from the oldest one not read, or from mdebug_flash_seek().
+ *        A log is read over several calls if it is larger than size.
  * @param data  Data from the flash's spiffs files in the log
  * @param size  Size from the flash's spiffs files in the log
  *
@@ -64,6 +66,33 @@ mdf_err_t mdebug_flash_write(const char *data, size_t size);
  */
 mdf_err_t mdebug_flash_read(char *data, size_t *size);
 
+/**
+ * @brief Move the reading to the logs of a time range, the range is rounded out to
+ *        the sectors holding it since only the time of the first log of a sector is kept
+ *
+ * @note  The time is time() when the logs were written, the time since boot if it was not set
+ *
+ * @param begin  Time of the first log to read, the oldest logs are read if it is before them
+ * @param end    Time after which the logs are not read, 0 to read up to the newest logs
+ *
+ * @return
+ *      - MDF_OK
+ *      - MDF_FAIL
+ */
+mdf_err_t mdebug_flash_seek(time_t begin, time_t end);
+
+/**
+ * @brief Time covered by the logs in flash, to seek to the last minutes before a crash
+ *
+ * @param first  Time of the oldest log
+ * @param last   Time of the first log of the sector being written
+ *
+ * @return
+ *      - MDF_OK
+ *      - MDF_FAIL: There are no logs
+ */
+mdf_err_t mdebug_flash_get_time(time_t *first, time_t *last);
+
 /**
  * @brief Erase when the data and pointers is full
  *
@@ -42,16 +42,63 @@ typedef struct {
 typedef enum {
     MDEBUG_LOG_TYPE_ESPNOW = 1 << 1,
     MDEBUG_LOG_TYPE_FLASH  = 1 << 2,
+    MDEBUG_LOG_TYPE_BINARY = 1 << 3, /**< The data is a mdebug_log_binary_t */
 } mdebug_log_type_t;
 
 /**
- * @brief Type of log storage queue
+ * @brief Record of the log ring
  */
 typedef struct {
-    uint16_t size;          /**< The length of the log data */
-    mdebug_log_type_t type; /**< Ways to send logs */
-    char data[0];           /**< Log data */
-} mdebug_log_queue_t;
+    uint16_t total;              /**< Space taken in the ring, header and alignment included */
+    uint16_t size;               /**< The length of the log data */
+    uint16_t type;               /**< Ways to send logs, 0 for a padding record */
+    volatile uint16_t committed; /**< Set once the data is written */
+    char data[0];                /**< Log data */
+} mdebug_log_record_t;
+
+#define MDEBUG_LOG_BATCH_MAX_SIZE (4096) /**< Maximum size of the logs of a batch, CONFIG_MDEBUG_LOG_BATCH_SIZE */
+
+/**
+ * @brief Logs sent over ESP-NOW with MDEBUG_ESPNOW_LOG_BATCH, see mdebug_log_batch_unpack()
+ */
+typedef struct {
+    uint8_t compressed : 1; /**< The logs are compressed with zlib */
+    uint8_t reserved   : 7; /**< Reserved */
+    uint8_t seq;            /**< Incremented at every batch, a gap is a lost batch */
+    uint16_t size;          /**< Size of the logs once uncompressed */
+    uint8_t data[0];        /**< Logs, one after the other */
+} __attribute__((packed)) mdebug_log_batch_t;
+
+/**
+ * @brief Usage of the log ring
+ */
+typedef struct {
+    uint32_t ring_size;         /**< Size of the ring */
+    uint32_t used_size;         /**< Bytes of the logs waiting to be sent */
+    uint32_t drop_count;        /**< Logs dropped as the ring was full */
+    uint32_t drop_size;         /**< Bytes of the dropped logs */
+    uint32_t espnow_fail_count; /**< Logs not delivered over ESP-NOW */
+} mdebug_log_stats_t;
+
+#define MDEBUG_LOG_BINARY_MARKER   (0x00) /**< A text log never starts with '\0' */
+#define MDEBUG_LOG_BINARY_MAX_SIZE (255)  /**< Maximum size of a binary log, longer strings are truncated */
+#define MDEBUG_LOG_BINARY_STR_DROM (0xff) /**< The string is in the firmware, its offset follows */
+
+/**
+ * @brief Binary log of CONFIG_MDEBUG_LOG_BINARY, decoded by tools/mdebug_log_decode.py
+ *
+ * @note The data is the offset of the format from SOC_DROM_LOW followed by the arguments
+ *       of its conversions. Offsets and integers are varints of 7 bits per byte, the signed
+ *       ones are zigzag encoded. "ll" integers and doubles are 8 bytes, little endian.
+ *       A string is a length byte followed by the characters, or MDEBUG_LOG_BINARY_STR_DROM
+ *       followed by the offset of a string stored in the firmware.
+ *       The timestamp, tag and level are part of the arguments and format of ESP_LOGx() and MDF_LOGx().
+ */
+typedef struct {
+    uint8_t marker;  /**< MDEBUG_LOG_BINARY_MARKER */
+    uint8_t size;    /**< Size of the record, header included */
+    uint8_t data[0]; /**< Offset of the format then its arguments */
+} __attribute__((packed)) mdebug_log_binary_t;
 
 /**
  * @brief  Get the configuration of the log during wireless debugging
@@ -75,6 +122,42 @@ mdf_err_t mdebug_log_get_config(mdebug_log_config_t *config);
  */
 mdf_err_t mdebug_log_set_config(const mdebug_log_config_t *config);
 
+/**
+ * @brief  Get the usage and drop counters of the log ring
+ *
+ * @param  stats The usage of the log ring
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mdebug_log_get_stats(mdebug_log_stats_t *stats);
+
+/**
+ * @brief  Get the logs of a batch received with MDEBUG_ESPNOW_LOG_BATCH
+ *
+ * @param  batch     The batch received
+ * @param  size      Size of the batch
+ * @param  logs      Buffer of the logs, MDEBUG_LOG_BATCH_MAX_SIZE is always enough
+ * @param  logs_size Size of the buffer, set to the size of the logs
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_FAIL: The logs could not be uncompressed
+ */
+mdf_err_t mdebug_log_batch_unpack(const mdebug_log_batch_t *batch, size_t size, uint8_t *logs, size_t *logs_size);
+
+/**
+ * @brief  Size of the first log of the logs of a batch, a line of text or a mdebug_log_binary_t
+ *
+ * @param  logs Logs of a batch
+ * @param  size Size of the logs
+ *
+ * @return Size of the first log, 0 if there is none
+ */
+size_t mdebug_log_next_size(const uint8_t *logs, size_t size);
+
 /**
  * @brief Init log mdebug
  *        - Set log mdebug configuration
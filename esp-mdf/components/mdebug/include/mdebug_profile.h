@@ -0,0 +1,69 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MDF_DEBUG_PROFILE_H__
+#define __MDF_DEBUG_PROFILE_H__
+
+#include "mdf_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+#define MDEBUG_PROFILE_TAG_MAX (16) /**< Tags of MDF_MALLOC reported, the largest ones */
+
+/**
+ * @brief Configuration of the profiler
+ */
+typedef struct {
+    uint32_t window_ms;   /**< Time between two snapshots, a report is made for each window */
+    uint16_t count;       /**< Number of windows, 0 until mdebug_profile_stop() */
+    uint8_t dest_addr[6]; /**< Receiver of the reports over ESP-NOW, all zeros to only print them */
+} mdebug_profile_config_t;
+
+/**
+ * @brief  Start the profiler in the background. At the end of each window it reports,
+ *         as "mdebug_profile:" lines, the CPU usage of each core, the run time of each
+ *         task in the window and its stack high water mark, the free heap and the
+ *         memory of the largest MDF_MALLOC tags with their change in the window.
+ *         The reports are also sent to dest_addr as a batch of logs.
+ *
+ * @note   Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS,
+ *         and CONFIG_MDF_MEM_DEBUG for the memory of the tags
+ *
+ * @param  config  Configuration of the profiler
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_INVALID_ARG
+ *     - MDF_ERR_INVALID_STATE: The profiler is running
+ *     - MDF_ERR_NOT_SUPPORTED: The run time stats of FreeRTOS are disabled
+ *     - MDF_ERR_NO_MEM
+ */
+mdf_err_t mdebug_profile_start(const mdebug_profile_config_t *config);
+
+/**
+ * @brief  Stop the profiler, the window in progress is not reported
+ *
+ * @return
+ *     - MDF_OK
+ *     - MDF_ERR_NOT_INIT: The profiler is not running
+ */
+mdf_err_t mdebug_profile_stop(void);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+
+#endif /**< __MDF_DEBUG_PROFILE_H__ */
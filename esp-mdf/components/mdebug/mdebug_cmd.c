@@ -88,6 +88,8 @@ static struct {
     struct arg_str *disable_type;
     struct arg_lit *output_type;
     struct arg_lit *read;
+    struct arg_int *minutes;
+    struct arg_lit *info;
     struct arg_end *end;
 } log_args;
 
@@ -145,17 +147,48 @@ static int log_func(int argc, char **argv)
                  log_config.log_flash_enable ? "/flash" : "", log_config.log_espnow_enable ? "/espuart" : "");
     }
 
+    if (log_args.info->count) { /**< Usage of the log ring */
+        mdebug_log_stats_t stats = {0};
+        mdebug_log_get_stats(&stats);
+        MDF_LOGI("Log ring, size: %d, used: %d, dropped: %d logs (%d Bytes), espnow failed: %d",
+                 stats.ring_size, stats.used_size, stats.drop_count, stats.drop_size, stats.espnow_fail_count);
+    }
+
     if (log_args.read->count) {  /**< read to the flash of log data */
         int log_size   = mdebug_flash_size();
         char *log_data = MDF_MALLOC(MDEBUG_LOG_MAX_SIZE - 17);
 
+        /**< Read from the last minutes before the newest sector, such as before a crash */
+        if (log_args.minutes->count) {
+            time_t first = 0;
+            time_t last  = 0;
+
+            if (mdebug_flash_get_time(&first, &last) == MDF_OK) {
+                mdebug_flash_seek(last - log_args.minutes->ival[0] * 60, 0);
+                log_size = mdebug_flash_size();
+            }
+        }
+
         MDF_LOGI("The flash partition that stores the log size: %d", log_size);
 
         if (log_config.log_flash_enable) {
             for (size_t size = MIN(MDEBUG_LOG_MAX_SIZE - 17, log_size);
                     size > 0 && mdebug_flash_read(log_data, &size) == MDF_OK;
                     log_size -= size, size = MIN(MDEBUG_LOG_MAX_SIZE - 17, log_size)) {
+#ifdef CONFIG_MDEBUG_LOG_BINARY
+                /**< Decoded by tools/mdebug_log_decode.py, one base64 line per read */
+                size_t olen = 0;
+                size_t dlen = (size + 2) / 3 * 4 + 1;
+                uint8_t *b64_buf = MDF_MALLOC(dlen);
+
+                if (b64_buf) {
+                    mbedtls_base64_encode(b64_buf, dlen, &olen, (uint8_t *)log_data, size);
+                    MDF_LOGI("mdebug_log_data: %s", b64_buf);
+                    MDF_FREE(b64_buf);
+                }
+#else
                 MDF_LOGI("mdebug_log_data: %.*s", size, log_data);
+#endif /**< CONFIG_MDEBUG_LOG_BINARY */
             }
         }
 
@@ -178,8 +211,10 @@ static void register_log()
     log_args.disable_type = arg_str0("d", "disable_type", "<disable_type('uart' or 'flash' or 'espnow')>", "Selects mdebug log to disable (uart,flash,espnow)");
     log_args.output_type  = arg_lit0("o", "output_type", "Output enable type");
     log_args.read        = arg_lit0("r", "read", "Read to the flash of mdebug log information");
+    log_args.minutes     = arg_int0("m", "minutes", "<minutes>", "With -r, read the logs of the last minutes in flash");
     log_args.send        = arg_str0("s", "send", "<addr (xx:xx:xx:xx:xx:xx)>", "Configure the address of the ESP-NOW log receiver");
-    log_args.end         = arg_end(8);
+    log_args.info        = arg_lit0("i", "info", "Print the usage and drop counters of the log ring");
+    log_args.end         = arg_end(10);
 
     const esp_console_cmd_t cmd = {
         .command = "log",
@@ -311,7 +346,6 @@ static struct {
     struct arg_str *send_length;
     struct arg_lit *output;
     struct arg_lit *erase;
-    struct arg_int *seq;
     struct arg_str *send;
     struct arg_end *end;
 } coredump_args;
@@ -379,60 +413,14 @@ static int coredump_func(int argc, char **argv)
 
     if (coredump_args.send->count) {
         uint8_t dest_addr[6] = {0x0};
-        mdebug_coredump_packet_t *packet = NULL;
 
         ret = mac_str2hex(coredump_args.send->sval[0], dest_addr);
         MDF_ERROR_CHECK(ret == false, ESP_ERR_INVALID_ARG,
                         "The format of the address is incorrect. Please enter the format as xx:xx:xx:xx:xx:xx");
 
-        packet = MDF_REALLOC_RETRY(NULL, sizeof(mdebug_coredump_packet_t));
-
-        if (coredump_args.seq->count) {
-            packet->seq = coredump_args.seq->ival[0];
-        }
-
-        if (packet->seq == 0) {
-            packet->type = MDEBUG_COREDUMP_BEGIN;
-            packet->size = coredump_size;
-            ret = mdebug_espnow_write(dest_addr, packet, 4, MDEBUG_ESPNOW_COREDUMP, portMAX_DELAY);
-            MDF_ERROR_CHECK(ret != MDF_OK, ret, "mdebug_espnow_write, seq: %d", packet->seq);
-        }
-
-        packet->type = MDEBUG_COREDUMP_DATA;
-
-        for (; packet->seq * sizeof(packet->data) < coredump_size; packet->seq++) {
-            packet->size = MIN(coredump_size - packet->seq * sizeof(packet->data), sizeof(packet->data));
-
-            esp_partition_read(coredump_part, 4 + packet->seq * sizeof(packet->data),
-                               packet->data, sizeof(packet->data));
-
-            for (int i = 0; i < 5; ++i) {
-                ret = mdebug_espnow_write(dest_addr, packet, sizeof(mdebug_coredump_packet_t),
-                                          MDEBUG_ESPNOW_COREDUMP, portMAX_DELAY);
-
-                if (ret == MDF_OK) {
-                    break;
-                }
-
-                vTaskDelay(100 / portTICK_RATE_MS);
-            }
-
-            MDF_ERROR_BREAK(ret != MDF_OK, "mdebug_espnow_write, seq: %d", packet->seq);
-
-            /**
-             * @brief TODO Since espnow is now an unreliable transmission,
-             *             sending too fast will result in packet loss.
-             */
-            vTaskDelay(20 / portTICK_RATE_MS);
-        }
-
-        packet->type = MDEBUG_COREDUMP_END;
-        packet->seq  = coredump_size / sizeof(packet->data) + (coredump_size % sizeof(packet->data) ? 1 : 0);
-        packet->size = coredump_size;
-        ret = mdebug_espnow_write(dest_addr, packet, 4, MDEBUG_ESPNOW_COREDUMP, portMAX_DELAY);
-        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mdebug_espnow_write, seq: %d", packet->seq);
-
-        MDF_FREE(packet);
+        /**< Sent in the background, resumed from what the receiver has if it is sent again */
+        ret = mdebug_coredump_send(dest_addr);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mdebug_coredump_send");
     }
 
     if (coredump_args.erase->count) {
@@ -453,8 +441,7 @@ static void register_coredump()
     coredump_args.send_length = arg_str0(NULL, "sendlength", "Send coredump data length", "Configure the address of the coredump data length receiver");
     coredump_args.output = arg_lit0("o", "output", "Read the coredump data of the device");
     coredump_args.erase  = arg_lit0("e", "erase", "Erase the coredump data of the device");
-    coredump_args.seq    = arg_int0("q", "sequence", "<seq>", "Sequence");
-    coredump_args.send   = arg_str0("s", "send", "<addr (xx:xx:xx:xx:xx:xx)>", "Configure the address of the ESP-NOW log receiver");
+    coredump_args.send   = arg_str0("s", "send", "<addr (xx:xx:xx:xx:xx:xx)>", "Send the coredump data compressed to this ESP-NOW receiver, resumed if it was interrupted");
     coredump_args.end    = arg_end(5);
 
     const esp_console_cmd_t cmd = {
@@ -468,6 +455,162 @@ static void register_coredump()
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
 
+static struct {
+    struct arg_lit *binary;
+    struct arg_str *send;
+    struct arg_lit *reset;
+    struct arg_end *end;
+} metrics_args;
+
+/**
+ * @brief  A function which implements metrics command.
+ */
+static int metrics_func(int argc, char **argv)
+{
+    mdf_err_t ret = MDF_OK;
+    size_t size   = MDF_METRICS_SNAPSHOT_SIZE;
+    mdf_metrics_snapshot_t *snapshot = NULL;
+
+    if (arg_parse(argc, argv, (void **)&metrics_args) != ESP_OK) {
+        arg_print_errors(stderr, metrics_args.end, argv[0]);
+        return MDF_FAIL;
+    }
+
+    if (!metrics_args.binary->count && !metrics_args.send->count && !metrics_args.reset->count) {
+        mdf_metrics_print();
+        return MDF_OK;
+    }
+
+    snapshot = MDF_MALLOC(size);
+    MDF_ERROR_CHECK(!snapshot, MDF_ERR_NO_MEM, "");
+
+    ret = mdf_metrics_snapshot(snapshot, &size);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mdf_metrics_snapshot");
+
+    /**< Decoded by tools/mdf_metrics.py */
+    if (metrics_args.binary->count) {
+        size_t b64_size  = (size + 2) / 3 * 4 + 1;
+        uint8_t *b64_buf = MDF_MALLOC(b64_size);
+
+        if (b64_buf) {
+            mbedtls_base64_encode(b64_buf, b64_size, &b64_size, (uint8_t *)snapshot, size);
+            printf("mdf_metrics: %s\n", b64_buf);
+            MDF_FREE(b64_buf);
+        }
+    }
+
+    if (metrics_args.send->count) {
+        uint8_t dest_addr[6] = {0x0};
+
+        ret = MDF_ERR_INVALID_ARG;
+        MDF_ERROR_GOTO(!mac_str2hex(metrics_args.send->sval[0], dest_addr), EXIT,
+                       "The format of the address is incorrect. Please enter the format as xx:xx:xx:xx:xx:xx");
+
+        ret = mdebug_espnow_write(dest_addr, snapshot, size, MDEBUG_ESPNOW_METRICS, portMAX_DELAY);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> mdebug_espnow_write", mdf_err_to_name(ret));
+    }
+
+    /**< After the snapshot, the metrics sent are those cleared */
+    if (metrics_args.reset->count) {
+        mdf_metrics_reset();
+    }
+
+EXIT:
+    MDF_FREE(snapshot);
+    return ret;
+}
+
+/**
+ * @brief  Register metrics command.
+ */
+static void register_metrics()
+{
+    metrics_args.binary = arg_lit0("b", "binary", "Print the snapshot in base64 for tools/mdf_metrics.py");
+    metrics_args.send   = arg_str0("s", "send", "<addr (xx:xx:xx:xx:xx:xx)>", "Send the snapshot to this ESP-NOW receiver");
+    metrics_args.reset  = arg_lit0("r", "reset", "Clear the metrics");
+    metrics_args.end    = arg_end(3);
+
+    const esp_console_cmd_t cmd = {
+        .command = "metrics",
+        .help = "Counters and latency histograms of mwifi, mespnow and mlink, CONFIG_MDF_METRICS",
+        .hint = NULL,
+        .func = &metrics_func,
+        .argtable = &metrics_args,
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+static struct {
+    struct arg_int *window;
+    struct arg_int *count;
+    struct arg_str *send;
+    struct arg_lit *stop;
+    struct arg_end *end;
+} profile_args;
+
+/**
+ * @brief  A function which implements profile command.
+ */
+static int profile_func(int argc, char **argv)
+{
+    mdf_err_t ret = MDF_OK;
+    mdebug_profile_config_t profile_config = {
+        .window_ms = 1000,
+        .count     = 1,
+    };
+
+    if (arg_parse(argc, argv, (void **)&profile_args) != ESP_OK) {
+        arg_print_errors(stderr, profile_args.end, argv[0]);
+        return MDF_FAIL;
+    }
+
+    if (profile_args.stop->count) {
+        return mdebug_profile_stop();
+    }
+
+    if (profile_args.window->count) {
+        profile_config.window_ms = profile_args.window->ival[0];
+    }
+
+    if (profile_args.count->count) {
+        profile_config.count = profile_args.count->ival[0];
+    }
+
+    if (profile_args.send->count) {
+        ret = mac_str2hex(profile_args.send->sval[0], profile_config.dest_addr);
+        MDF_ERROR_CHECK(ret == false, MDF_ERR_INVALID_ARG,
+                        "The format of the address is incorrect. Please enter the format as xx:xx:xx:xx:xx:xx");
+    }
+
+    ret = mdebug_profile_start(&profile_config);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> mdebug_profile_start", mdf_err_to_name(ret));
+
+    return MDF_OK;
+}
+
+/**
+ * @brief  Register profile command.
+ */
+static void register_profile()
+{
+    profile_args.window = arg_int0("w", "window", "<ms>", "Time between two reports, 1000 ms by default");
+    profile_args.count  = arg_int0("n", "count", "<num>", "Number of reports, 1 by default, 0 until stopped");
+    profile_args.send   = arg_str0("s", "send", "<addr (xx:xx:xx:xx:xx:xx)>", "Send the reports to this ESP-NOW receiver");
+    profile_args.stop   = arg_lit0("p", "stop", "Stop the profiler");
+    profile_args.end    = arg_end(4);
+
+    const esp_console_cmd_t cmd = {
+        .command = "profile",
+        .help = "Run time of the tasks and memory of the MDF_MALLOC tags over a window",
+        .hint = NULL,
+        .func = &profile_func,
+        .argtable = &profile_args,
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
 void mdebug_cmd_register_common()
 {
     register_version();
@@ -477,4 +620,6 @@ void mdebug_cmd_register_common()
     register_fallback();
     register_log();
     register_coredump();
+    register_metrics();
+    register_profile();
 }
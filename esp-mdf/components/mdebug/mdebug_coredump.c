@@ -0,0 +1,465 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "esp_partition.h"
+#include "mbedtls/base64.h"
+
+#include "mdf_common.h"
+#include "miniz.h"
+#include "mdebug.h"
+
+/**
+ * @brief The core dump is compressed while it is sent, go-back-N over ESP-NOW:
+ *
+ *        - The window holds the compressed data from the offset acknowledged by
+ *          the receiver, up to CONFIG_MDEBUG_COREDUMP_WINDOW frames of it are sent
+ *          without waiting
+ *        - The receiver acknowledges the data received in order every half window,
+ *          it sends a NACK when it misses a frame, the sender then goes back to it
+ *        - The frames not acknowledged in CONFIG_MDEBUG_COREDUMP_TIMEOUT_MS are sent again
+ *        - The receiver answers BEGIN with the offset it has of the same core dump,
+ *          the data before it is compressed again but not sent
+ */
+#define MDEBUG_COREDUMP_FRAME_SIZE  MDEBUG_COREDUMP_STREAM_DATA_LEN
+#define MDEBUG_COREDUMP_WINDOW_SIZE (CONFIG_MDEBUG_COREDUMP_WINDOW * MDEBUG_COREDUMP_FRAME_SIZE)
+#define MDEBUG_COREDUMP_READ_SIZE   (1024)
+#define MDEBUG_COREDUMP_RETRY_NUM   (10) /**< Timeouts in a row before the transfer is given up */
+#define MDEBUG_COREDUMP_B64_SIZE    ((MDEBUG_COREDUMP_FRAME_SIZE + 2) / 3 * 4 + 1)
+
+typedef struct {
+    uint8_t dest_addr[6];              /**< Address of the receiver */
+    const esp_partition_t *partition;  /**< Core dump partition */
+    uint32_t size;                     /**< Size of the core dump */
+    uint32_t id;                       /**< CRC-32 of the core dump */
+    uint32_t read_offset;              /**< Core dump read and given to the compressor */
+    mz_stream stream;                  /**< Compressor */
+    bool finished;                     /**< The compressed stream is entirely in the window */
+    uint8_t *input;                    /**< Core dump being compressed */
+    uint8_t *window;                   /**< Compressed data from base */
+    uint32_t base;                     /**< Offset acknowledged by the receiver */
+    uint32_t filled;                   /**< Compressed data in the window */
+    uint32_t sent;                     /**< Offset of the next frame to send */
+} mdebug_coredump_sender_t;
+
+typedef struct {
+    uint8_t src_addr[6];   /**< Address of the sender */
+    uint32_t id;           /**< CRC-32 of the core dump */
+    uint32_t offset;       /**< Compressed data received in order */
+    uint8_t unacked;       /**< Frames received since the last acknowledgement */
+    bool gap_acked;        /**< A frame out of order was answered, the next are not */
+    bool finished;         /**< The core dump was received entirely */
+} mdebug_coredump_receiver_t;
+
+static const char *TAG = "mdebug_coredump";
+static QueueHandle_t g_coredump_ack_queue        = NULL;
+static bool g_coredump_sending                   = false;
+static uint8_t g_coredump_dest_addr[6]           = {0};
+static uint32_t g_coredump_id                    = 0;
+static mdebug_coredump_receiver_t *g_coredump_receiver = NULL;
+
+/**
+ * @brief Compress the core dump until the window is full
+ */
+static mdf_err_t coredump_fill(mdebug_coredump_sender_t *sender)
+{
+    mdf_err_t ret = MDF_OK;
+
+    while (!sender->finished && sender->filled < MDEBUG_COREDUMP_WINDOW_SIZE) {
+        if (!sender->stream.avail_in && sender->read_offset < sender->size) {
+            size_t size = MIN(MDEBUG_COREDUMP_READ_SIZE, sender->size - sender->read_offset);
+
+            /**< The core dump follows its size in the partition */
+            ret = esp_partition_read(sender->partition, 4 + sender->read_offset, sender->input, size);
+            MDF_ERROR_CHECK(ret != ESP_OK, ret, "esp_partition_read, offset: %d", sender->read_offset);
+
+            sender->stream.next_in   = sender->input;
+            sender->stream.avail_in  = size;
+            sender->read_offset     += size;
+        }
+
+        sender->stream.next_out  = sender->window + sender->filled;
+        sender->stream.avail_out = MDEBUG_COREDUMP_WINDOW_SIZE - sender->filled;
+
+        int status = mz_deflate(&sender->stream, sender->read_offset < sender->size ? MZ_NO_FLUSH : MZ_FINISH);
+        MDF_ERROR_CHECK(status != MZ_OK && status != MZ_STREAM_END, MDF_FAIL, "mz_deflate, status: %d", status);
+
+        sender->filled   = MDEBUG_COREDUMP_WINDOW_SIZE - sender->stream.avail_out;
+        sender->finished = (status == MZ_STREAM_END);
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Drop the data acknowledged from the window and compress the following one,
+ *        the data before a resumed offset is compressed and dropped the same way
+ */
+static mdf_err_t coredump_slide(mdebug_coredump_sender_t *sender, uint32_t offset)
+{
+    mdf_err_t ret = MDF_OK;
+
+    do {
+        uint32_t drop = MIN(offset - sender->base, sender->filled);
+
+        memmove(sender->window, sender->window + drop, sender->filled - drop);
+        sender->filled -= drop;
+        sender->base   += drop;
+
+        ret = coredump_fill(sender);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "coredump_fill");
+    } while (sender->base < offset && sender->filled);
+
+    sender->sent = MAX(sender->sent, sender->base);
+
+    return MDF_OK;
+}
+
+static mdf_err_t coredump_write(mdebug_coredump_sender_t *sender, mdebug_coredump_stream_t *packet,
+                                uint8_t type, uint32_t offset, uint16_t size)
+{
+    packet->type   = type;
+    packet->window = CONFIG_MDEBUG_COREDUMP_WINDOW;
+    packet->size   = size;
+    packet->id     = sender->id;
+    packet->offset = offset;
+
+    if (size) {
+        memcpy(packet->data, sender->window + (offset - sender->base), size);
+    }
+
+    return mdebug_espnow_write(sender->dest_addr, packet, sizeof(mdebug_coredump_stream_t) + size,
+                               MDEBUG_ESPNOW_COREDUMP, portMAX_DELAY);
+}
+
+/**
+ * @brief Handle an ACK or a NACK, the frames are sent again from a NACK
+ */
+static mdf_err_t coredump_ack(mdebug_coredump_sender_t *sender, const mdebug_coredump_stream_t *ack)
+{
+    mdf_err_t ret = MDF_OK;
+
+    /**< An acknowledgement late after a timeout may be past the frames sent again */
+    if (ack->offset > sender->base + sender->filled) {
+        MDF_LOGD("Acknowledgement of data not sent, offset: %d, sent: %d", ack->offset, sender->sent);
+        return MDF_OK;
+    }
+
+    if (ack->offset > sender->base) {
+        ret = coredump_slide(sender, ack->offset);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "coredump_slide");
+    }
+
+    if (ack->type == MDEBUG_COREDUMP_STREAM_NACK) {
+        sender->sent = sender->base;
+    }
+
+    return MDF_OK;
+}
+
+static void mdebug_coredump_send_task(void *arg)
+{
+    mdf_err_t ret                    = MDF_OK;
+    mdebug_coredump_sender_t *sender = (mdebug_coredump_sender_t *)arg;
+    mdebug_coredump_stream_t *packet = MDF_MALLOC(MDEBUG_ESPNOW_PAYLOAD_LEN);
+    TickType_t timeout_ticks         = pdMS_TO_TICKS(CONFIG_MDEBUG_COREDUMP_TIMEOUT_MS);
+    TickType_t start_ticks           = xTaskGetTickCount();
+    mdebug_coredump_stream_t ack     = {0};
+    int retry                        = 0;
+
+    MDF_ERROR_GOTO(!packet, EXIT, "");
+
+    /**< The receiver answers with the offset it has of this core dump */
+    for (retry = 0; retry < MDEBUG_COREDUMP_RETRY_NUM; ++retry) {
+        ret = coredump_write(sender, packet, MDEBUG_COREDUMP_STREAM_BEGIN, sender->size, 0);
+
+        if (ret == MDF_OK && xQueueReceive(g_coredump_ack_queue, &ack, timeout_ticks) == pdTRUE) {
+            break;
+        }
+    }
+
+    MDF_ERROR_GOTO(retry == MDEBUG_COREDUMP_RETRY_NUM, EXIT, "The receiver does not answer");
+
+    ret = coredump_slide(sender, ack.offset);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "coredump_slide");
+
+    if (ack.offset) {
+        MDF_LOGI("Core dump resumed, offset: %d", sender->base);
+    }
+
+    for (retry = 0; retry < MDEBUG_COREDUMP_RETRY_NUM && (!sender->finished || sender->filled);) {
+        /**< Send the frames of the window not sent yet, the acknowledgements slide it meanwhile */
+        while (sender->sent < sender->base + sender->filled) {
+            uint16_t size = MIN(MDEBUG_COREDUMP_FRAME_SIZE, sender->base + sender->filled - sender->sent);
+
+            if (coredump_write(sender, packet, MDEBUG_COREDUMP_STREAM_DATA, sender->sent, size) != MDF_OK) {
+                break;
+            }
+
+            sender->sent += size;
+
+            if (xQueueReceive(g_coredump_ack_queue, &ack, 0) == pdTRUE) {
+                ret = coredump_ack(sender, &ack);
+                MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "coredump_ack");
+                retry = 0;
+            }
+        }
+
+        if (sender->finished && !sender->filled) {
+            break;
+        }
+
+        if (xQueueReceive(g_coredump_ack_queue, &ack, timeout_ticks) != pdTRUE) {
+            MDF_LOGD("Acknowledgement timeout, offset: %d, sent: %d", sender->base, sender->sent);
+            sender->sent = sender->base;
+            retry++;
+            continue;
+        }
+
+        ret = coredump_ack(sender, &ack);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "coredump_ack");
+        retry = 0;
+    }
+
+    MDF_ERROR_GOTO(retry == MDEBUG_COREDUMP_RETRY_NUM, EXIT,
+                   "The receiver does not acknowledge, offset: %d", sender->base);
+
+    for (retry = 0; retry < MDEBUG_COREDUMP_RETRY_NUM; ++retry) {
+        ret = coredump_write(sender, packet, MDEBUG_COREDUMP_STREAM_END, sender->base, 0);
+
+        if (ret == MDF_OK && xQueueReceive(g_coredump_ack_queue, &ack, timeout_ticks) == pdTRUE
+                && ack.offset == sender->base) {
+            break;
+        }
+    }
+
+    MDF_ERROR_GOTO(retry == MDEBUG_COREDUMP_RETRY_NUM, EXIT, "The receiver does not acknowledge the end");
+
+    MDF_LOGI("Core dump sent, size: %d, compressed: %d, spend time: %dms", sender->size, sender->base,
+             (xTaskGetTickCount() - start_ticks) * portTICK_RATE_MS);
+
+EXIT:
+    g_coredump_sending = false;
+
+    mz_deflateEnd(&sender->stream);
+    MDF_FREE(packet);
+    MDF_FREE(sender->input);
+    MDF_FREE(sender->window);
+    MDF_FREE(sender);
+    vTaskDelete(NULL);
+}
+
+mdf_err_t mdebug_coredump_send(const uint8_t *dest_addr)
+{
+    MDF_PARAM_CHECK(dest_addr);
+    MDF_ERROR_CHECK(g_coredump_sending, MDF_ERR_INVALID_STATE, "A core dump is being sent");
+
+    mdf_err_t ret                    = MDF_OK;
+    mdebug_coredump_sender_t *sender = MDF_CALLOC(1, sizeof(mdebug_coredump_sender_t));
+    MDF_ERROR_CHECK(!sender, MDF_ERR_NO_MEM, "");
+
+    memcpy(sender->dest_addr, dest_addr, 6);
+    sender->input  = MDF_MALLOC(MDEBUG_COREDUMP_READ_SIZE);
+    sender->window = MDF_MALLOC(MDEBUG_COREDUMP_WINDOW_SIZE);
+    MDF_ERROR_GOTO(!sender->input || !sender->window, ERR_NO_MEM, "");
+
+    sender->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                        ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+    MDF_ERROR_GOTO(!sender->partition, ERR_NOT_FOUND, "No core dump partition found!");
+
+    ret = esp_partition_read(sender->partition, 4, &sender->size, sizeof(uint32_t));
+    MDF_ERROR_GOTO(ret != ESP_OK || !sender->size || sender->size > sender->partition->size - 4,
+                   ERR_NOT_FOUND, "No core dump on the device, size: %d", sender->size);
+
+    /**< The CRC tells the receiver if it has a part of the same core dump */
+    for (uint32_t offset = 0, size = 0; offset < sender->size; offset += size) {
+        size = MIN(MDEBUG_COREDUMP_READ_SIZE, sender->size - offset);
+        ret  = esp_partition_read(sender->partition, 4 + offset, sender->input, size);
+        MDF_ERROR_GOTO(ret != ESP_OK, ERR_NOT_FOUND, "esp_partition_read, offset: %d", offset);
+        sender->id = crc32_le(sender->id, sender->input, size);
+    }
+
+    ret = mz_deflateInit(&sender->stream, MZ_BEST_SPEED);
+    MDF_ERROR_GOTO(ret != MZ_OK, ERR_NO_MEM, "mz_deflateInit, ret: %d", ret);
+
+    if (!g_coredump_ack_queue) {
+        g_coredump_ack_queue = xQueueCreate(CONFIG_MDEBUG_COREDUMP_WINDOW, sizeof(mdebug_coredump_stream_t));
+        MDF_ERROR_GOTO(!g_coredump_ack_queue, ERR_DEFLATE, "xQueueCreate");
+    }
+
+    xQueueReset(g_coredump_ack_queue);
+    memcpy(g_coredump_dest_addr, dest_addr, 6);
+    g_coredump_id      = sender->id;
+    g_coredump_sending = true;
+
+    /**< Acknowledgements come from mdebug_espnow_send_task, which may be running this command */
+    if (xTaskCreatePinnedToCore(mdebug_coredump_send_task, "mdebug_coredump", 4 * 1024,
+                                sender, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 1,
+                                NULL, CONFIG_MDF_TASK_PINNED_TO_CORE) != pdPASS) {
+        g_coredump_sending = false;
+        goto ERR_DEFLATE;
+    }
+
+    MDF_LOGI("Core dump sending, size: %d, id: %08x, dest_addr: " MACSTR,
+             sender->size, sender->id, MAC2STR(dest_addr));
+
+    return MDF_OK;
+
+ERR_DEFLATE:
+    mz_deflateEnd(&sender->stream);
+ERR_NO_MEM:
+    ret = MDF_ERR_NO_MEM;
+    goto EXIT;
+
+ERR_NOT_FOUND:
+    ret = MDF_ERR_NOT_FOUND;
+
+EXIT:
+    MDF_FREE(sender->input);
+    MDF_FREE(sender->window);
+    MDF_FREE(sender);
+    return ret;
+}
+
+static void coredump_recv_ack(mdebug_coredump_receiver_t *receiver, uint8_t type)
+{
+    mdebug_coredump_stream_t ack = {
+        .type   = type,
+        .id     = receiver->id,
+        .offset = receiver->offset,
+    };
+
+    receiver->unacked = 0;
+
+    if (mdebug_espnow_write(receiver->src_addr, &ack, sizeof(ack), MDEBUG_ESPNOW_COREDUMP, portMAX_DELAY) != MDF_OK) {
+        MDF_LOGD("Acknowledgement lost, offset: %d", receiver->offset);
+    }
+}
+
+mdf_err_t mdebug_coredump_recv(const uint8_t *src_addr, const void *data, size_t size, bool *finished)
+{
+    MDF_PARAM_CHECK(src_addr);
+    MDF_PARAM_CHECK(data);
+
+    const mdebug_coredump_stream_t *packet = (const mdebug_coredump_stream_t *)data;
+    static SemaphoreHandle_t s_recv_lock   = NULL;
+    char b64[MDEBUG_COREDUMP_B64_SIZE]     = {0};
+    size_t b64_size                        = 0;
+
+    if (size < sizeof(mdebug_coredump_stream_t) || packet->type < MDEBUG_COREDUMP_STREAM_BEGIN) {
+        return MDF_OK;
+    }
+
+    MDF_ERROR_CHECK(size < sizeof(mdebug_coredump_stream_t) + packet->size
+                    || packet->size > MDEBUG_COREDUMP_FRAME_SIZE, MDF_ERR_INVALID_ARG,
+                    "Invalid core dump packet, size: %d", size);
+
+    if (packet->type == MDEBUG_COREDUMP_STREAM_ACK || packet->type == MDEBUG_COREDUMP_STREAM_NACK) {
+        if (g_coredump_sending && packet->id == g_coredump_id
+                && !memcmp(src_addr, g_coredump_dest_addr, 6)) {
+            xQueueSend(g_coredump_ack_queue, packet, 0);
+        }
+
+        return MDF_OK;
+    }
+
+    /**< The application and mdebug_espnow_send_task may both read the packets */
+    if (!s_recv_lock) {
+        s_recv_lock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(s_recv_lock, portMAX_DELAY);
+
+    if (!g_coredump_receiver) {
+        g_coredump_receiver = MDF_CALLOC(1, sizeof(mdebug_coredump_receiver_t));
+        MDF_ERROR_GOTO(!g_coredump_receiver, EXIT, "");
+    }
+
+    mdebug_coredump_receiver_t *receiver = g_coredump_receiver;
+
+    if (packet->type != MDEBUG_COREDUMP_STREAM_BEGIN
+            && (packet->id != receiver->id || memcmp(src_addr, receiver->src_addr, 6))) {
+        MDF_LOGD("Core dump packet of another transfer, id: %08x", packet->id);
+        goto EXIT;
+    }
+
+    switch (packet->type) {
+        case MDEBUG_COREDUMP_STREAM_BEGIN:
+            if (packet->id != receiver->id || memcmp(src_addr, receiver->src_addr, 6)) {
+                memcpy(receiver->src_addr, src_addr, 6);
+                receiver->id       = packet->id;
+                receiver->offset   = 0;
+                receiver->finished = false;
+            }
+
+            receiver->gap_acked = false;
+            coredump_recv_ack(receiver, MDEBUG_COREDUMP_STREAM_ACK);
+
+            printf("mdebug_coredump: " MACSTR " begin %08x %u %u\n", MAC2STR(src_addr),
+                   packet->id, packet->offset, receiver->offset);
+            break;
+
+        case MDEBUG_COREDUMP_STREAM_DATA:
+            /**< A frame is missing, or sent again after an acknowledgement was lost */
+            if (packet->offset != receiver->offset) {
+                if (!receiver->gap_acked) {
+                    receiver->gap_acked = true;
+                    coredump_recv_ack(receiver, packet->offset > receiver->offset ?
+                                      MDEBUG_COREDUMP_STREAM_NACK : MDEBUG_COREDUMP_STREAM_ACK);
+                }
+
+                break;
+            }
+
+            receiver->offset   += packet->size;
+            receiver->gap_acked = false;
+
+            /**< Acknowledge before printing so the sender is not stopped by the serial port,
+                 the last frame is the only short one */
+            if (++receiver->unacked >= MAX(packet->window / 2, 1) || packet->size < MDEBUG_COREDUMP_FRAME_SIZE) {
+                coredump_recv_ack(receiver, MDEBUG_COREDUMP_STREAM_ACK);
+            }
+
+            mbedtls_base64_encode((uint8_t *)b64, sizeof(b64), &b64_size, packet->data, packet->size);
+            printf("mdebug_coredump: " MACSTR " data %08x %u %s\n", MAC2STR(src_addr),
+                   packet->id, packet->offset, b64);
+            break;
+
+        case MDEBUG_COREDUMP_STREAM_END:
+            coredump_recv_ack(receiver, MDEBUG_COREDUMP_STREAM_ACK);
+
+            if (packet->offset != receiver->offset || receiver->finished) {
+                break;
+            }
+
+            receiver->finished = true;
+
+            if (finished) {
+                *finished = true;
+            }
+
+            printf("mdebug_coredump: " MACSTR " end %08x %u\n", MAC2STR(src_addr),
+                   packet->id, packet->offset);
+            MDF_LOGI("Core dump received, run: python $MDF_PATH/tools/mdebug_coredump.py reassemble <log> "
+                     "and espcoredump.py info_corefile -t b64 -c <output> <elf>");
+            break;
+
+        default:
+            break;
+    }
+
+EXIT:
+    xSemaphoreGive(s_recv_lock);
+
+    return MDF_OK;
+}
@@ -135,6 +135,11 @@ static void mdebug_espnow_send_task(void *arg)
                     break;
                 }
 
+                /**< Acknowledgements of the core dump being sent, or a core dump received */
+                case MDEBUG_ESPNOW_COREDUMP:
+                    mdebug_coredump_recv(src_addr, recv_data, recv_size, NULL);
+                    break;
+
                 default:
                     break;
             }
@@ -19,33 +19,292 @@
 #include "mespnow.h"
 #include "mdebug.h"
 
-#define MDEBUG_FLASH_FILE_MAX_NUM   2                                 /**< Create several files */
+/**
+ * @brief The logs are a ring of sectors written in turn. Each sector starts with a
+ *        header holding its seq and the time of its first log, followed by records
+ *        of a log each. The sector with the highest seq is the one written, the
+ *        headers alone give the order of the logs and the time they cover.
+ *
+ *        - A sector is erased when it is reached, the oldest logs are overwritten
+ *        - The end of a full sector is written to its header, only the records of
+ *          the sector written are walked at boot, and only their headers
+ *        - A sector read entirely is marked in its header, so is not read again
+ *          after a reboot
+ *        - A record cut by a power loss fails its CRC, its sector is closed before it
+ */
 #define MDEBUG_LOG_FILE_MAX_SIZE    CONFIG_MDEBUG_LOG_FILE_MAX_SIZE   /**< File storage size */
+#define MDEBUG_FLASH_SECTOR_NUM     (MDEBUG_LOG_FILE_MAX_SIZE / SPI_FLASH_SEC_SIZE)
+#define MDEBUG_FLASH_SECTOR_MAGIC   (0x474c444d) /**< "MDLG" */
+#define MDEBUG_FLASH_UNSET          (0xffff)     /**< Erased flash, the field is not written yet */
 #define MDEBUG_FLASH_STORE_KEY      "mdebug_log_info"
 
 /**
- * @brief Create files configuration
+ * @brief Header of a sector, size and read are written later on, over the erased flash
+ */
+typedef struct {
+    uint32_t magic;       /**< MDEBUG_FLASH_SECTOR_MAGIC */
+    uint32_t seq;         /**< Incremented at every sector */
+    uint32_t timestamp;   /**< time() of the first log of the sector */
+    uint32_t crc32;       /**< CRC-32 of the fields above */
+    uint16_t end;         /**< Offset of the end of the records once the sector is full */
+    uint16_t read;        /**< 0 once the sector has been read by mdebug_flash_read() */
+} __attribute__((packed)) mdebug_flash_sector_t;
+
+/**
+ * @brief Header of a record, followed by the log
  */
 typedef struct {
-    size_t size; /**< Files size */
-    int offset;  /**< Set file pointer offset */
-    uint32_t addr;
+    uint16_t size;        /**< Size of the log */
+    uint16_t crc16;       /**< CRC-16 of the log */
+} __attribute__((packed)) mdebug_flash_record_t;
+
+/**
+ * @brief The sectors as loaded from their headers
+ */
+typedef struct {
+    uint32_t seq;         /**< Seq of the sector */
+    uint32_t timestamp;   /**< Time of its first log */
+    uint16_t end;         /**< End of its records, 0 if the sector holds no logs */
+    bool closed;          /**< Full, no log is added to it */
+} flash_log_sector_t;
+
+typedef struct {
+    SemaphoreHandle_t lock;
+    flash_log_sector_t sector[MDEBUG_FLASH_SECTOR_NUM];
+    int head;             /**< Sector written, -1 if there are no logs */
+    int read_sector;      /**< Sector of the next log read, -1 if all logs are read */
+    uint16_t read_offset; /**< Offset of the next record, or in the record being read */
+    uint16_t read_left;   /**< Size of the record being read left to read */
+    bool read_until;      /**< The reading stops at read_end, set by mdebug_flash_seek() */
+    uint32_t read_end;    /**< Seq of the first sector not read */
 } flash_log_info_t;
 
-static int g_log_index                   = 0;
 static bool g_mdebug_flash_init_flag     = false;
 static const esp_partition_t *g_log_part = NULL;
-static flash_log_info_t g_log_info[MDEBUG_FLASH_FILE_MAX_NUM] = {0};
+static flash_log_info_t *g_log_info      = NULL;
 static const char *TAG = "mdebug_flash";
 
+static inline size_t mdebug_flash_sector_addr(int index)
+{
+    return CONFIG_MDEBUG_LOG_PARTITION_OFFSET + index * SPI_FLASH_SEC_SIZE;
+}
+
+static inline uint32_t mdebug_flash_sector_crc(const mdebug_flash_sector_t *header)
+{
+    return crc32_le(UINT32_MAX, (uint8_t *)header, offsetof(mdebug_flash_sector_t, crc32));
+}
+
+/**
+ * @brief The sector after index in the order of the logs, -1 if index is the last one
+ */
+static int mdebug_flash_sector_next(int index)
+{
+    int next = (index + 1) % MDEBUG_FLASH_SECTOR_NUM;
+
+    if (index == g_log_info->head || !g_log_info->sector[next].end
+            || g_log_info->sector[next].seq != g_log_info->sector[index].seq + 1) {
+        return -1;
+    }
+
+    return next;
+}
+
+/**
+ * @brief The oldest sector holding logs, -1 if there are none
+ */
+static int mdebug_flash_sector_oldest(void)
+{
+    int index = g_log_info->head;
+
+    if (index < 0) {
+        return -1;
+    }
+
+    for (int i = 1; i < MDEBUG_FLASH_SECTOR_NUM; ++i) {
+        int prev = (index + MDEBUG_FLASH_SECTOR_NUM - 1) % MDEBUG_FLASH_SECTOR_NUM;
+
+        if (!g_log_info->sector[prev].end || g_log_info->sector[prev].seq + 1 != g_log_info->sector[index].seq) {
+            break;
+        }
+
+        index = prev;
+    }
+
+    return index;
+}
+
+/**
+ * @brief Walk the record headers of a sector whose end is not written, stop at the
+ *        first erased or invalid record. The last record is checked in whole since
+ *        a power loss may have cut it.
+ */
+static uint16_t mdebug_flash_sector_walk(int index, bool *closed)
+{
+    size_t addr      = mdebug_flash_sector_addr(index);
+    uint16_t offset  = sizeof(mdebug_flash_sector_t);
+    uint16_t last    = 0;
+    mdebug_flash_record_t record = {0};
+
+    *closed = false;
+
+    while (offset + sizeof(mdebug_flash_record_t) <= SPI_FLASH_SEC_SIZE) {
+        if (esp_partition_read(g_log_part, addr + offset, &record, sizeof(record)) != ESP_OK
+                || record.size == MDEBUG_FLASH_UNSET) {
+            break;
+        }
+
+        if (!record.size || offset + sizeof(record) + record.size > SPI_FLASH_SEC_SIZE) {
+            *closed = true;
+            break;
+        }
+
+        last    = offset;
+        offset += sizeof(record) + record.size;
+    }
+
+    if (last) {
+        uint8_t buffer[64];
+        uint16_t crc16 = UINT16_MAX;
+
+        esp_partition_read(g_log_part, addr + last, &record, sizeof(record));
+
+        for (size_t i = 0, size = 0; i < record.size; i += size) {
+            size = MIN(sizeof(buffer), record.size - i);
+
+            if (esp_partition_read(g_log_part, addr + last + sizeof(record) + i, buffer, size) != ESP_OK) {
+                break;
+            }
+
+            crc16 = crc16_le(crc16, buffer, size);
+        }
+
+        if (crc16 != record.crc16) {
+            MDF_LOGW("The last log of sector %d is incomplete, size: %d", index, record.size);
+            *closed = true;
+            offset  = last;
+        }
+    }
+
+    return offset;
+}
+
+/**
+ * @brief Write the end of the sector written, logs are added to the next sector
+ */
+static mdf_err_t mdebug_flash_sector_close(int index, uint16_t end)
+{
+    g_log_info->sector[index].end    = end;
+    g_log_info->sector[index].closed = true;
+
+    return esp_partition_write(g_log_part, mdebug_flash_sector_addr(index) + offsetof(mdebug_flash_sector_t, end),
+                               &end, sizeof(end));
+}
+
+/**
+ * @brief Erase the sector after the head and write its header, the logs it held are lost
+ */
+static mdf_err_t mdebug_flash_sector_open(void)
+{
+    mdf_err_t ret  = MDF_OK;
+    int head       = g_log_info->head;
+    int index      = (head + 1) % MDEBUG_FLASH_SECTOR_NUM;
+    mdebug_flash_sector_t header = {
+        .magic     = MDEBUG_FLASH_SECTOR_MAGIC,
+        .seq       = head < 0 ? 0 : g_log_info->sector[head].seq + 1,
+        .timestamp = time(NULL),
+        .end       = MDEBUG_FLASH_UNSET,
+        .read      = MDEBUG_FLASH_UNSET,
+    };
+
+    header.crc32 = mdebug_flash_sector_crc(&header);
+
+    /**< The oldest logs are overwritten, move the reading past them */
+    if (g_log_info->read_sector == index) {
+        g_log_info->read_sector = mdebug_flash_sector_next(index);
+        g_log_info->read_offset = sizeof(mdebug_flash_sector_t);
+        g_log_info->read_left   = 0;
+    }
+
+    g_log_info->sector[index].end = 0;
+
+    ret = esp_partition_erase_range(g_log_part, mdebug_flash_sector_addr(index), SPI_FLASH_SEC_SIZE);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "esp_partition_erase_range, sector: %d", index);
+
+    ret = esp_partition_write(g_log_part, mdebug_flash_sector_addr(index), &header, sizeof(header));
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "esp_partition_write, sector: %d", index);
+
+    g_log_info->sector[index].seq       = header.seq;
+    g_log_info->sector[index].timestamp = header.timestamp;
+    g_log_info->sector[index].end       = sizeof(mdebug_flash_sector_t);
+    g_log_info->sector[index].closed    = false;
+    g_log_info->head                    = index;
+
+    if (g_log_info->read_sector < 0) {
+        g_log_info->read_sector = index;
+        g_log_info->read_offset = sizeof(mdebug_flash_sector_t);
+        g_log_info->read_left   = 0;
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Load the sectors from their headers and find where to write and read
+ */
+static void mdebug_flash_load(void)
+{
+    mdebug_flash_sector_t header = {0};
+    int oldest_unread = -1;
+
+    g_log_info->head        = -1;
+    g_log_info->read_sector = -1;
+    g_log_info->read_left   = 0;
+    g_log_info->read_until  = false;
+
+    for (int i = 0; i < MDEBUG_FLASH_SECTOR_NUM; ++i) {
+        flash_log_sector_t *sector = g_log_info->sector + i;
+        memset(sector, 0, sizeof(flash_log_sector_t));
+
+        if (esp_partition_read(g_log_part, mdebug_flash_sector_addr(i), &header, sizeof(header)) != ESP_OK
+                || header.magic != MDEBUG_FLASH_SECTOR_MAGIC || header.crc32 != mdebug_flash_sector_crc(&header)) {
+            continue;
+        }
+
+        sector->seq       = header.seq;
+        sector->timestamp = header.timestamp;
+        sector->closed    = header.end >= sizeof(mdebug_flash_sector_t) && header.end <= SPI_FLASH_SEC_SIZE;
+        sector->end       = sector->closed ? header.end : mdebug_flash_sector_walk(i, &sector->closed);
+
+        /**< Close the sector before its incomplete log, not to walk it at the next boot */
+        if (sector->closed && header.end == MDEBUG_FLASH_UNSET) {
+            mdebug_flash_sector_close(i, sector->end);
+        }
+
+        if (g_log_info->head < 0 || (int32_t)(header.seq - g_log_info->sector[g_log_info->head].seq) > 0) {
+            g_log_info->head = i;
+        }
+    }
+
+    /**< Read from the oldest sector not read, a sector read in part is read again */
+    for (int i = mdebug_flash_sector_oldest(); i >= 0; i = mdebug_flash_sector_next(i)) {
+        esp_partition_read(g_log_part, mdebug_flash_sector_addr(i), &header, sizeof(header));
+
+        if (header.read == MDEBUG_FLASH_UNSET) {
+            oldest_unread = i;
+            break;
+        }
+    }
+
+    g_log_info->read_sector = oldest_unread;
+    g_log_info->read_offset = sizeof(mdebug_flash_sector_t);
+}
+
 mdf_err_t mdebug_flash_init()
 {
     if (g_mdebug_flash_init_flag) {
         return MDF_OK;
     }
 
-    mdf_err_t ret = MDF_OK;
-
     esp_partition_iterator_t part_itra = esp_partition_find(ESP_PARTITION_TYPE_DATA,
                                          ESP_PARTITION_SUBTYPE_ANY, CONFIG_MDEBUG_LOG_PARTITION_LABEL);
     MDF_ERROR_CHECK(!part_itra, MDF_ERR_NOT_SUPPORTED, "partition no find, subtype: 0x%x, label: %s",
@@ -54,33 +313,25 @@ mdf_err_t mdebug_flash_init()
     g_log_part = esp_partition_get(part_itra);
 
     MDF_ERROR_CHECK(!g_log_part, MDF_ERR_NOT_SUPPORTED, "esp_partition_get");
-    MDF_ERROR_CHECK(g_log_part->size < MDEBUG_LOG_FILE_MAX_SIZE, MDF_ERR_NOT_SUPPORTED,
+    MDF_ERROR_CHECK(g_log_part->size < CONFIG_MDEBUG_LOG_PARTITION_OFFSET + MDEBUG_LOG_FILE_MAX_SIZE, MDF_ERR_NOT_SUPPORTED,
                     "Log file (%d Byte) size must be smaller than partition size (%d Byte).",
                     MDEBUG_LOG_FILE_MAX_SIZE, g_log_part->size);
-    MDF_ERROR_CHECK(MDEBUG_LOG_FILE_MAX_SIZE / MDEBUG_FLASH_FILE_MAX_NUM % 4096 != 0, MDF_ERR_NOT_SUPPORTED,
-                    "The size of the log partition must be an integer of %d KB.", MDEBUG_FLASH_FILE_MAX_NUM * 4);
+    MDF_ERROR_CHECK(CONFIG_MDEBUG_LOG_PARTITION_OFFSET % SPI_FLASH_SEC_SIZE || MDEBUG_FLASH_SECTOR_NUM < 2,
+                    MDF_ERR_NOT_SUPPORTED, "The log file must be at least 2 sectors, aligned to a sector");
 
-    if (mdf_info_load(MDEBUG_FLASH_STORE_KEY, g_log_info,
-                      sizeof(flash_log_info_t) * MDEBUG_FLASH_FILE_MAX_NUM) != MDF_OK) {
-        ret = esp_partition_erase_range(g_log_part, CONFIG_MDEBUG_LOG_PARTITION_OFFSET, MDEBUG_LOG_FILE_MAX_SIZE);
-        MDF_ERROR_CHECK(ret != MDF_OK, ret, "esp_partition_erase_range");
+    if (!g_log_info) {
+        g_log_info = MDF_CALLOC(1, sizeof(flash_log_info_t));
+        MDF_ERROR_CHECK(!g_log_info, MDF_ERR_NO_MEM, "");
+        g_log_info->lock = xSemaphoreCreateMutex();
     }
 
-    /**< Create two files */
-    for (size_t i = 0, min_size = MDEBUG_LOG_FILE_MAX_SIZE / MDEBUG_FLASH_FILE_MAX_NUM; i < MDEBUG_FLASH_FILE_MAX_NUM; i++) {
-        g_log_info[i].addr = CONFIG_MDEBUG_LOG_PARTITION_OFFSET + MDEBUG_LOG_FILE_MAX_SIZE / MDEBUG_FLASH_FILE_MAX_NUM * i;
-
-        /**< Whether file is full */
-        if (g_log_info[i].size < MDEBUG_LOG_FILE_MAX_SIZE / MDEBUG_FLASH_FILE_MAX_NUM && g_log_info[i].size < min_size) {
-            min_size = g_log_info[i].size;
-            g_log_index  = i;  /**< File index */
-        }
-    }
+    mdebug_flash_load();
 
     g_mdebug_flash_init_flag = true;
     MDF_LOGI("Mdebug flash initialized successfully");
-    MDF_LOGI("Log save partition subtype: label: %s, addr: 0x%d, offset: %d, size: %d",
-             CONFIG_MDEBUG_LOG_PARTITION_LABEL, g_log_part->address, CONFIG_MDEBUG_LOG_PARTITION_OFFSET, g_log_part->size);
+    MDF_LOGI("Log save partition subtype: label: %s, addr: 0x%x, offset: %d, size: %d, head: %d, unread: %d",
+             CONFIG_MDEBUG_LOG_PARTITION_LABEL, g_log_part->address, CONFIG_MDEBUG_LOG_PARTITION_OFFSET,
+             g_log_part->size, g_log_info->head, mdebug_flash_size());
 
     return MDF_OK;
 }
@@ -100,11 +351,8 @@ mdf_err_t mdebug_flash_deinit()
 
 mdf_err_t mdebug_flash_write(const char *data, size_t size)
 {
-    time_t now           = 0;
-    mdf_err_t ret        = MDF_OK;
-    struct tm timeinfo   = {0};
-    char strtime_buf[32] = {0};
-    static bool flag_timestamp = true;
+    mdf_err_t ret = MDF_OK;
+    mdebug_flash_record_t record = {0};
 
     MDF_PARAM_CHECK(data);
     MDF_PARAM_CHECK(size > 0);
@@ -113,69 +361,57 @@ mdf_err_t mdebug_flash_write(const char *data, size_t size)
         return MDF_FAIL;
     }
 
-    /**
-     * @brief Get the address of the pointer to the next file and clear the file to be written
-     * and clear offset size.
-     */
-    if (g_log_info[g_log_index].size + size > MDEBUG_LOG_FILE_MAX_SIZE / MDEBUG_FLASH_FILE_MAX_NUM) {
-        g_log_index = (g_log_index + 1) % MDEBUG_FLASH_FILE_MAX_NUM;
-        g_log_info[g_log_index].size   = 0;
-        g_log_info[g_log_index].offset = 0;
+    record.size  = MIN(size, SPI_FLASH_SEC_SIZE - sizeof(mdebug_flash_sector_t) - sizeof(mdebug_flash_record_t));
+    record.crc16 = crc16_le(UINT16_MAX, (uint8_t *)data, record.size);
 
-        ret = esp_partition_erase_range(g_log_part, g_log_info[g_log_index].addr, MDEBUG_LOG_FILE_MAX_SIZE / MDEBUG_FLASH_FILE_MAX_NUM);
-        MDF_ERROR_CHECK(ret != MDF_OK, ret, "esp_partition_erase_range, addr: %x", g_log_info[g_log_index].addr);
-    }
+    xSemaphoreTake(g_log_info->lock, portMAX_DELAY);
+
+    int head = g_log_info->head;
 
     /**
-     * @brief Need to know if the file is full, if it is full, it will report the file size
+     * @brief Close the sector once the log does not fit, the next sector is erased
      */
-    static uint32_t s_event_send_tick = 0;
-
-    if (mdebug_flash_size() > MDEBUG_LOG_FILE_MAX_SIZE / MDEBUG_FLASH_FILE_MAX_NUM
-            && (xTaskGetTickCount() - s_event_send_tick > 30000 || !s_event_send_tick)) {
-        s_event_send_tick = xTaskGetTickCount();
-        mdf_event_loop_send(MDF_EVENT_MDEBUG_FLASH_FULL, NULL);
+    if (head >= 0 && !g_log_info->sector[head].closed
+            && g_log_info->sector[head].end + sizeof(record) + record.size > SPI_FLASH_SEC_SIZE) {
+        ret = mdebug_flash_sector_close(head, g_log_info->sector[head].end);
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "esp_partition_write, sector: %d", head);
     }
 
-    MDEBUG_PRINTF("esp_partition_write, addr: %d, offset: %d, log_index: %d, size: %d\n",
-                  g_log_info[g_log_index].addr, g_log_info[g_log_index].size, g_log_index, size);
-
-    if (flag_timestamp) {
-        flag_timestamp = false;
-
-        /**< Get the current timestamp */
-        time(&now);
-        localtime_r(&now, &timeinfo);
-        strftime(strtime_buf, 32, "[%Y-%m-%d %H:%M:%S] ", &timeinfo);
-
-        /**
-         * @brief Change the write file address, then wirte timestamp data
-         */
-        ret = esp_partition_write(g_log_part, g_log_info[g_log_index].addr + g_log_info[g_log_index].size, strtime_buf, strlen(strtime_buf));
-        MDF_ERROR_CHECK(ret != MDF_OK, ret, "esp_partition_write");
-        g_log_info[g_log_index].size += strlen(strtime_buf);
+    if (head < 0 || g_log_info->sector[head].closed) {
+        ret = mdebug_flash_sector_open();
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mdebug_flash_sector_open");
+        head = g_log_info->head;
     }
 
+    MDEBUG_PRINTF("esp_partition_write, sector: %d, seq: %d, end: %d, size: %d\n",
+                  head, g_log_info->sector[head].seq, g_log_info->sector[head].end, record.size);
+
     /**
-     * @brief Change the write file address, then wirte log data after the timestamp.
-     *
-     * @note First need to get the length of the timestamp, then write the log data after the timestamp
+     * @brief A power loss between the header and the log fails the CRC of the record
      */
-    ret = esp_partition_write(g_log_part, g_log_info[g_log_index].addr + g_log_info[g_log_index].size, data, size);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "esp_partition_write");
-    g_log_info[g_log_index].size += size;
+    size_t addr = mdebug_flash_sector_addr(head) + g_log_info->sector[head].end;
+    ret = esp_partition_write(g_log_part, addr, &record, sizeof(record));
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "esp_partition_write, addr: 0x%x", addr);
+    ret = esp_partition_write(g_log_part, addr + sizeof(record), data, record.size);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "esp_partition_write, addr: 0x%x", addr);
+
+    g_log_info->sector[head].end += sizeof(record) + record.size;
+
+EXIT:
+    xSemaphoreGive(g_log_info->lock);
 
     /**
-     * @brief Here in order to read the data address written by the file,Get where the data address is written.
-     *
+     * @brief Need to know if the file is full, if it is full, it will report the file size
      */
-    mdf_info_save(MDEBUG_FLASH_STORE_KEY, g_log_info, sizeof(flash_log_info_t) * MDEBUG_FLASH_FILE_MAX_NUM);
+    static uint32_t s_event_send_tick = 0;
 
-    if (data[size - 1] == '\n') {
-        flag_timestamp = true;
+    if (ret == MDF_OK && mdebug_flash_size() > MDEBUG_LOG_FILE_MAX_SIZE / 2
+            && (xTaskGetTickCount() - s_event_send_tick > 30000 || !s_event_send_tick)) {
+        s_event_send_tick = xTaskGetTickCount();
+        mdf_event_loop_send(MDF_EVENT_MDEBUG_FLASH_FULL, NULL);
     }
 
-    return MDF_OK;
+    return ret;
 }
 
 mdf_err_t mdebug_flash_read(char *data, size_t *size)
@@ -190,38 +426,125 @@ mdf_err_t mdebug_flash_read(char *data, size_t *size)
         return MDF_FAIL;
     }
 
+    xSemaphoreTake(g_log_info->lock, portMAX_DELAY);
+
     /**
-     * @brief First find Target file index address, then read the this files data
-     *
-     * @note The file address read is different from the file address written, so that the same address
-     * can be prevented from being written and read.
+     * @brief Read the records one after the other, a record larger than the buffer is
+     *        read over several calls
      */
-    for (int i = 0; i < MDEBUG_FLASH_FILE_MAX_NUM && *size > read_size; ++i, data += read_size) {
-        flash_log_info_t *log_info = g_log_info + ((g_log_index + 1 + i) % MDEBUG_FLASH_FILE_MAX_NUM);
-        ssize_t data_size = MIN(*size - read_size, log_info->size - log_info->offset);
+    for (int index = g_log_info->read_sector; index >= 0 && read_size < *size;) {
+        flash_log_sector_t *sector = g_log_info->sector + index;
+        size_t addr = mdebug_flash_sector_addr(index) + g_log_info->read_offset;
 
-        if (data_size > 0) {
-            ret = esp_partition_read(g_log_part, log_info->addr + log_info->offset, data, data_size);
+        if (g_log_info->read_until && (int32_t)(sector->seq - g_log_info->read_end) >= 0) {
+            break;
+        }
 
-            if (ret != MDF_OK) {
-                MDF_LOGW("<%s> fread packet, ret: %d, *size: %d, read_size: %d, log_info->offset: %d, log_info->size: %d, index: %d",
-                         strerror(errno), ret, *size, read_size, log_info->offset, log_info->size, i);
-                log_info->offset = log_info->size = 0;
-                break;
+        if (!g_log_info->read_left) {
+            mdebug_flash_record_t record = {0};
+
+            if (g_log_info->read_offset + sizeof(record) > sector->end) {
+                /**< The sector written may still get logs */
+                if (index == g_log_info->head) {
+                    break;
+                }
+
+                uint16_t read = 0;
+                esp_partition_write(g_log_part, mdebug_flash_sector_addr(index) + offsetof(mdebug_flash_sector_t, read),
+                                    &read, sizeof(read));
+
+                index = mdebug_flash_sector_next(index);
+                g_log_info->read_sector = index;
+                g_log_info->read_offset = sizeof(mdebug_flash_sector_t);
+                continue;
+            }
+
+            ret = esp_partition_read(g_log_part, addr, &record, sizeof(record));
+            MDF_ERROR_BREAK(ret != ESP_OK, "esp_partition_read, addr: 0x%x", addr);
+
+            /**< Damaged past the end recorded, such as by an erase cut by a power loss */
+            if (g_log_info->read_offset + sizeof(record) + record.size > sector->end) {
+                MDF_LOGW("Invalid log in sector %d, offset: %d, size: %d", index, g_log_info->read_offset, record.size);
+                g_log_info->read_offset = sector->end;
+                continue;
             }
 
-            read_size += data_size;
-            log_info->offset += data_size;
-            MDEBUG_PRINTF("esp_partition_read, data_size: %d, read_size: %d, log_info->offset: %d, log_info->size: %d, ret: %d, index: %d, data: %.*s\n",
-                          data_size, read_size, log_info->offset, log_info->size, ret, i, data_size, data);
-            mdf_info_save(MDEBUG_FLASH_STORE_KEY, g_log_info, sizeof(flash_log_info_t) * MDEBUG_FLASH_FILE_MAX_NUM);
+            g_log_info->read_offset += sizeof(record);
+            g_log_info->read_left    = record.size;
+            addr += sizeof(record);
         }
+
+        size_t data_size = MIN(*size - read_size, g_log_info->read_left);
+        ret = esp_partition_read(g_log_part, addr, data + read_size, data_size);
+        MDF_ERROR_BREAK(ret != ESP_OK, "esp_partition_read, addr: 0x%x", addr);
+
+        read_size               += data_size;
+        g_log_info->read_offset += data_size;
+        g_log_info->read_left   -= data_size;
+
+        MDEBUG_PRINTF("esp_partition_read, sector: %d, offset: %d, data_size: %d, read_size: %d\n",
+                      index, g_log_info->read_offset, data_size, read_size);
     }
 
+    xSemaphoreGive(g_log_info->lock);
+
     *size = read_size;
     return read_size > 0 ? MDF_OK : MDF_FAIL;
 }
 
+mdf_err_t mdebug_flash_seek(time_t begin, time_t end)
+{
+    if (!g_mdebug_flash_init_flag) {
+        return MDF_FAIL;
+    }
+
+    xSemaphoreTake(g_log_info->lock, portMAX_DELAY);
+
+    int read_sector = mdebug_flash_sector_oldest();
+
+    g_log_info->read_until = false;
+
+    /**
+     * @brief The logs of a sector are between its time and the time of the next one
+     */
+    for (int i = read_sector; i >= 0; i = mdebug_flash_sector_next(i)) {
+        if ((time_t)g_log_info->sector[i].timestamp <= begin) {
+            read_sector = i;
+        }
+
+        if (end && (time_t)g_log_info->sector[i].timestamp > end) {
+            g_log_info->read_until = true;
+            g_log_info->read_end   = g_log_info->sector[i].seq;
+            break;
+        }
+    }
+
+    g_log_info->read_sector = read_sector;
+    g_log_info->read_offset = sizeof(mdebug_flash_sector_t);
+    g_log_info->read_left   = 0;
+
+    xSemaphoreGive(g_log_info->lock);
+
+    return MDF_OK;
+}
+
+mdf_err_t mdebug_flash_get_time(time_t *first, time_t *last)
+{
+    MDF_PARAM_CHECK(first);
+    MDF_PARAM_CHECK(last);
+
+    if (!g_mdebug_flash_init_flag || g_log_info->head < 0) {
+        return MDF_FAIL;
+    }
+
+    xSemaphoreTake(g_log_info->lock, portMAX_DELAY);
+    *first = g_log_info->sector[mdebug_flash_sector_oldest()].timestamp;
+    *last  = g_log_info->sector[g_log_info->head].timestamp;
+    xSemaphoreGive(g_log_info->lock);
+
+    return MDF_OK;
+}
+
 mdf_err_t mdebug_flash_erase()
 {
     if (!g_mdebug_flash_init_flag) {
@@ -232,7 +555,16 @@ mdf_err_t mdebug_flash_erase()
 
     mdf_info_erase(MDEBUG_FLASH_STORE_KEY);
 
+    xSemaphoreTake(g_log_info->lock, portMAX_DELAY);
+
     ret = esp_partition_erase_range(g_log_part, CONFIG_MDEBUG_LOG_PARTITION_OFFSET, MDEBUG_LOG_FILE_MAX_SIZE);
+
+    if (ret == ESP_OK) {
+        mdebug_flash_load();
+    }
+
+    xSemaphoreGive(g_log_info->lock);
+
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "esp_partition_erase_range");
 
     return MDF_OK;
@@ -246,10 +578,14 @@ size_t mdebug_flash_size()
 
     size_t size = 0;
 
-    for (size_t i = 0; i < MDEBUG_FLASH_FILE_MAX_NUM; i++) {
-        if (g_log_info[i].size >= g_log_info[i].offset) {
-            size += g_log_info[i].size - g_log_info[i].offset;
+    /**< The size of the records left to read, their headers included */
+    for (int i = g_log_info->read_sector; i >= 0; i = mdebug_flash_sector_next(i)) {
+        if (g_log_info->read_until && (int32_t)(g_log_info->sector[i].seq - g_log_info->read_end) >= 0) {
+            break;
         }
+
+        size += g_log_info->sector[i].end - (i == g_log_info->read_sector ?
+                                             g_log_info->read_offset : sizeof(mdebug_flash_sector_t));
     }
 
     return size;
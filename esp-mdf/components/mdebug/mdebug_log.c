@@ -14,22 +14,56 @@
 
 #include "esp_wifi.h"
 #include "esp_console.h"
+#include "soc/soc.h"
 
 #include "mdf_common.h"
 #include "mespnow.h"
+#include "miniz.h"
 #include "mdebug.h"
 
 #define MDEBUG_LOG_MAX_SIZE   CONFIG_MDEBUG_LOG_PACKET_MAX_SIZE  /**< Set log length size */
 #define MDEBUG_LOG_STORE_KEY  "mdebug_log"
-#define MDEBUG_LOG_QUEUE_SIZE (30)
 #define MDEBUG_LOG_TIMEOUT_MS (30 * 1000)
-#define MDEBUG_LOG_QUEUE_BUFFER_MAX_SIZE   (10 * 1024)
-
-static xQueueHandle g_log_queue            = NULL;
+#define MDEBUG_LOG_RING_ALIGN(size) (((size) + 7) & ~7)
+#define MDEBUG_LOG_BATCH_FRAME_SIZE (MDEBUG_ESPNOW_PAYLOAD_LEN - sizeof(mdebug_log_batch_t)) /**< Logs sent in a single frame */
+
+#ifdef CONFIG_MDEBUG_LOG_BATCH_COMPRESS
+#define MDEBUG_LOG_BATCH_SIZE       CONFIG_MDEBUG_LOG_BATCH_SIZE
+#else
+#define MDEBUG_LOG_BATCH_SIZE       MDEBUG_LOG_BATCH_FRAME_SIZE
+#endif /**< CONFIG_MDEBUG_LOG_BATCH_COMPRESS */
+
+/**
+ * @brief Ring of the logs waiting to be sent, written by any task and read by mdebug_log_send_task.
+ *        The positions only grow, the offset in the buffer is the position modulo the size.
+ */
+typedef struct {
+    uint8_t *buffer;               /**< Zero where no record is reserved */
+    uint32_t size;                 /**< Power of 2 */
+    volatile uint32_t head;        /**< End of the records reserved by the producers */
+    volatile uint32_t tail;        /**< End of the records released by the consumer */
+    volatile uint32_t drop_count;  /**< Logs dropped as the ring was full */
+    volatile uint32_t drop_size;   /**< Bytes of the dropped logs */
+    uint32_t espnow_fail_count;    /**< Logs not delivered over ESP-NOW */
+} mdebug_log_ring_t;
+
+/**
+ * @brief Logs waiting to be sent over ESP-NOW, only used by mdebug_log_send_task
+ */
+typedef struct {
+    mdebug_log_batch_t *batch;      /**< MAX(MDEBUG_LOG_BATCH_SIZE, MDEBUG_LOG_MAX_SIZE) of logs */
+    mdebug_log_batch_t *compressed; /**< Batch once compressed */
+    size_t compressed_size;         /**< Size of the data of compressed */
+    uint16_t count;                 /**< Number of logs in the batch */
+    uint8_t seq;                    /**< Sequence of the next batch */
+    TickType_t start_ticks;         /**< When the first log of the batch was added */
+} mdebug_log_batcher_t;
+
+static mdebug_log_ring_t g_log_ring        = {0};
+static mdebug_log_batcher_t g_log_batcher  = {0};
 static mdebug_log_config_t *g_log_config   = NULL;
 static TaskHandle_t g_log_send_task_handle = NULL;
 static const char *TAG  = "mdebug_log";
-static uint32_t g_log_queue_buffer_size    = 0;
 
 mdf_err_t mdebug_log_get_config(mdebug_log_config_t *config)
 {
@@ -64,10 +98,312 @@ mdf_err_t mdebug_log_set_config(const mdebug_log_config_t *config)
     return ret;
 }
 
+/**
+ * @brief Set *addr to set if it is equal to compare, safe from both cores and interrupts
+ *
+ * @return The previous value of *addr, equal to compare on success
+ */
+static inline uint32_t mdebug_log_compare_set(volatile uint32_t *addr, uint32_t compare, uint32_t set)
+{
+    uxPortCompareSet(addr, compare, &set);
+    return set;
+}
+
+static void mdebug_log_atomic_add(volatile uint32_t *addr, uint32_t value)
+{
+    uint32_t old  = *addr;
+    uint32_t prev = 0;
+
+    while ((prev = mdebug_log_compare_set(addr, old, old + value)) != old) {
+        old = prev;
+    }
+}
+
+/**
+ * @brief Reserve a record in the ring, never blocks. A record that would cross the end of the
+ *        buffer starts at its beginning, a padding record fills the space skipped.
+ *
+ * @return The record to fill and commit, NULL if the ring is full
+ */
+static mdebug_log_record_t *mdebug_log_ring_reserve(size_t size)
+{
+    uint32_t head  = 0;
+    uint32_t pad   = 0;
+    uint32_t total = MDEBUG_LOG_RING_ALIGN(sizeof(mdebug_log_record_t) + size);
+    mdebug_log_record_t *record = NULL;
+
+    for (;;) {
+        head = g_log_ring.head;
+        uint32_t tail   = g_log_ring.tail;
+        uint32_t offset = head & (g_log_ring.size - 1);
+        pad = (offset + total > g_log_ring.size) ? g_log_ring.size - offset : 0;
+
+        if (head + pad + total - tail > g_log_ring.size) {
+            /**< The tail may have passed a head read before it */
+            if (head != g_log_ring.head) {
+                continue;
+            }
+
+            mdebug_log_atomic_add(&g_log_ring.drop_count, 1);
+            mdebug_log_atomic_add(&g_log_ring.drop_size, size);
+            return NULL;
+        }
+
+        if (mdebug_log_compare_set(&g_log_ring.head, head, head + pad + total) == head) {
+            break;
+        }
+    }
+
+    if (pad) {
+        record = (mdebug_log_record_t *)(g_log_ring.buffer + (head & (g_log_ring.size - 1)));
+        record->total     = pad;
+        record->committed = true;
+    }
+
+    record = (mdebug_log_record_t *)(g_log_ring.buffer + ((head + pad) & (g_log_ring.size - 1)));
+    record->total = total;
+
+    return record;
+}
+
+/**
+ * @brief Publish a record to the consumer. The space not used is given back if no record
+ *        was reserved after this one. A text record keeps the terminator after its data,
+ *        the flash sink reads it as a string.
+ */
+static void mdebug_log_ring_commit(mdebug_log_record_t *record, size_t size, uint16_t type)
+{
+    size_t used    = (type & MDEBUG_LOG_TYPE_BINARY) ? size : size + 1;
+    uint32_t total = MDEBUG_LOG_RING_ALIGN(sizeof(mdebug_log_record_t) + used);
+    uint32_t end   = ((uint8_t *)record - g_log_ring.buffer + record->total) & (g_log_ring.size - 1);
+    uint32_t head  = g_log_ring.head;
+
+    if ((head & (g_log_ring.size - 1)) == end
+            && mdebug_log_compare_set(&g_log_ring.head, head, head - (record->total - total)) == head) {
+        record->total = total;
+    }
+
+    record->size = size;
+    record->type = type;
+
+    /**< The data must be visible before the record is committed */
+    __sync_synchronize();
+    record->committed = true;
+
+    if (!g_log_send_task_handle) {
+        return;
+    } else if (xPortInIsrContext()) {
+        vTaskNotifyGiveFromISR(g_log_send_task_handle, NULL);
+    } else {
+        xTaskNotifyGive(g_log_send_task_handle);
+    }
+}
+
+/**
+ * @brief Give the space of a record back, the space is cleared so that a record reserved
+ *        there is never seen committed before it is
+ */
+static void mdebug_log_ring_release(mdebug_log_record_t *record)
+{
+    uint32_t total = record->total;
+
+    memset(record, 0, total);
+    __sync_synchronize();
+    g_log_ring.tail += total;
+}
+
+/**
+ * @brief The oldest record of the ring, NULL if it is empty or the oldest record is not committed
+ */
+static mdebug_log_record_t *mdebug_log_ring_peek(void)
+{
+    mdebug_log_record_t *record = NULL;
+
+    while (g_log_ring.tail != g_log_ring.head) {
+        record = (mdebug_log_record_t *)(g_log_ring.buffer + (g_log_ring.tail & (g_log_ring.size - 1)));
+
+        if (!record->committed) {
+            return NULL;
+        }
+
+        if (record->type) {
+            return record;
+        }
+
+        /**< Padding before the end of the buffer */
+        mdebug_log_ring_release(record);
+    }
+
+    return NULL;
+}
+
+mdf_err_t mdebug_log_get_stats(mdebug_log_stats_t *stats)
+{
+    MDF_PARAM_CHECK(stats);
+
+    stats->ring_size         = g_log_ring.size;
+    stats->used_size         = g_log_ring.head - g_log_ring.tail;
+    stats->drop_count        = g_log_ring.drop_count;
+    stats->drop_size         = g_log_ring.drop_size;
+    stats->espnow_fail_count = g_log_ring.espnow_fail_count;
+
+    return MDF_OK;
+}
+
+#ifdef CONFIG_MDEBUG_LOG_BINARY
+
+#define MDEBUG_LOG_IN_DROM(ptr) ((intptr_t)(ptr) >= SOC_DROM_LOW && (intptr_t)(ptr) < SOC_DROM_HIGH)
+
+static bool mdebug_log_binary_put(uint8_t **arg, const uint8_t *end, const void *value, size_t size)
+{
+    if (*arg + size > end) {
+        return false;
+    }
+
+    memcpy(*arg, value, size);
+    *arg += size;
+
+    return true;
+}
+
+/**
+ * @brief Seven bits per byte, the highest bit is set if more bytes follow
+ */
+static bool mdebug_log_binary_put_varint(uint8_t **arg, const uint8_t *end, uint32_t value)
+{
+    do {
+        if (*arg >= end) {
+            return false;
+        }
+
+        *(*arg)++ = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+
+    return true;
+}
+
+/**
+ * @brief Encode a log as a mdebug_log_binary_t, the arguments are taken by walking the conversions
+ *        of the format. The strings stored in the firmware are replaced by their offset, the others
+ *        are copied and truncated if the record is full.
+ *
+ * @note The format must be stored in the firmware
+ *
+ * @return Size of the record
+ */
+static size_t mdebug_log_binary_encode(uint8_t *buffer, const char *fmt, va_list vp)
+{
+    mdebug_log_binary_t *record = (mdebug_log_binary_t *)buffer;
+    const uint8_t *end          = buffer + MDEBUG_LOG_BINARY_MAX_SIZE;
+    uint8_t *arg                = record->data;
+    bool full                   = false;
+
+    record->marker = MDEBUG_LOG_BINARY_MARKER;
+    mdebug_log_binary_put_varint(&arg, end, (intptr_t)fmt - SOC_DROM_LOW);
+
+    for (const char *p = strchr(fmt, '%'); p && !full; p = strchr(p, '%')) {
+        int long_num = 0;
+
+        p += strspn(p + 1, "-+ #0") + 1;
+
+        /**< Width and precision given as arguments */
+        for (int i = 0; i < 2; ++i) {
+            if (*p == '*') {
+                int value = va_arg(vp, int);
+                full |= !mdebug_log_binary_put_varint(&arg, end, ((uint32_t)value << 1) ^ (value >> 31));
+                p++;
+            } else {
+                p += strspn(p, "0123456789");
+            }
+
+            if (i == 0 && *p == '.') {
+                p++;
+            } else {
+                break;
+            }
+        }
+
+        for (; *p && strchr("hlLqjzt", *p); ++p) {
+            long_num += (*p == 'l') ? 1 : 0;
+            long_num += (*p == 'q' || *p == 'j') ? 2 : 0;
+        }
+
+        switch (*p) {
+            case '\0':
+                p--;
+                break;
+
+            case '%':
+                break;
+
+            case 'n':
+                va_arg(vp, void *);
+                break;
+
+            case 's': {
+                const char *str = va_arg(vp, const char *);
+                str = str ? str : "(null)";
+
+                if (MDEBUG_LOG_IN_DROM(str)) {
+                    uint8_t tag = MDEBUG_LOG_BINARY_STR_DROM;
+                    full |= !mdebug_log_binary_put(&arg, end, &tag, sizeof(uint8_t))
+                            || !mdebug_log_binary_put_varint(&arg, end, (intptr_t)str - SOC_DROM_LOW);
+                } else if (arg < end) {
+                    uint8_t length = MIN(strlen(str), MIN(end - arg - 1, MDEBUG_LOG_BINARY_STR_DROM - 1));
+                    *arg++ = length;
+                    mdebug_log_binary_put(&arg, end, str, length);
+                    full |= (str[length] != '\0');
+                } else {
+                    full = true;
+                }
+
+                break;
+            }
+
+            case 'a': case 'A': case 'e': case 'E':
+            case 'f': case 'F': case 'g': case 'G': {
+                double value = va_arg(vp, double);
+                full |= !mdebug_log_binary_put(&arg, end, &value, sizeof(double));
+                break;
+            }
+
+            case 'd': case 'i':
+                if (long_num >= 2) {
+                    long long value = va_arg(vp, long long);
+                    full |= !mdebug_log_binary_put(&arg, end, &value, sizeof(long long));
+                } else {
+                    int value = va_arg(vp, int);
+                    full |= !mdebug_log_binary_put_varint(&arg, end, ((uint32_t)value << 1) ^ (value >> 31));
+                }
+
+                break;
+
+            default:
+                if (long_num >= 2) {
+                    long long value = va_arg(vp, long long);
+                    full |= !mdebug_log_binary_put(&arg, end, &value, sizeof(long long));
+                } else {
+                    full |= !mdebug_log_binary_put_varint(&arg, end, va_arg(vp, unsigned int));
+                }
+
+                break;
+        }
+
+        p++;
+    }
+
+    record->size = arg - buffer;
+
+    return record->size;
+}
+
+#endif /**< CONFIG_MDEBUG_LOG_BINARY */
+
 static ssize_t mdebug_log_vprintf(const char *fmt, va_list vp)
 {
-    size_t log_data_size         = 0;
-    mdebug_log_queue_t *log_data = NULL;
+    uint16_t type                 = 0;
+    mdebug_log_record_t *log_data = NULL;
 
     size_t log_size = MDEBUG_LOG_MAX_SIZE;
 
@@ -75,10 +411,13 @@ static ssize_t mdebug_log_vprintf(const char *fmt, va_list vp)
      * @brief Get the enable mode through configuration
      * */
     if (g_log_config->log_uart_enable) {
-        log_size = vprintf(fmt, vp);
+        va_list uart_vp;
+        va_copy(uart_vp, vp);
+        log_size = vprintf(fmt, uart_vp);
+        va_end(uart_vp);
     }
 
-    if (!g_log_config
+    if (!g_log_config || !g_log_ring.buffer
             || ((MDEBUG_ADDR_IS_EMPTY(g_log_config->dest_addr)
                  || !g_log_config->log_espnow_enable)
                 && !g_log_config->log_flash_enable)) {
@@ -94,52 +433,184 @@ static ssize_t mdebug_log_vprintf(const char *fmt, va_list vp)
         log_size = MDEBUG_LOG_MAX_SIZE;
     }
 
-    if (g_log_queue_buffer_size > MDEBUG_LOG_QUEUE_BUFFER_MAX_SIZE) {
-        goto EXIT;
-    }
-
-    log_data_size = sizeof(mdebug_log_queue_t) + log_size + 1;
-    log_data = malloc(log_data_size);
-    MDF_ERROR_GOTO(!log_data, EXIT, "");
-
-    log_data->size = log_size;
-    log_data->type = 0;
-
     if (g_log_config->log_espnow_enable && !MDEBUG_ADDR_IS_EMPTY(g_log_config->dest_addr)) {
-        log_data->type |= MDEBUG_LOG_TYPE_ESPNOW;
+        type |= MDEBUG_LOG_TYPE_ESPNOW;
     }
 
     if (g_log_config->log_flash_enable) {
-        log_data->type |= MDEBUG_LOG_TYPE_FLASH;
+        type |= MDEBUG_LOG_TYPE_FLASH;
     }
 
-    vsnprintf((char *)log_data->data, log_size + 1, fmt, vp);
+#ifdef CONFIG_MDEBUG_LOG_BINARY
+
+    /**
+     * @brief The record is much shorter than the text and no formatting is done,
+     *        the text is rendered on the host from the ELF file.
+     */
+    if (MDEBUG_LOG_IN_DROM(fmt)) {
+        log_data = mdebug_log_ring_reserve(MDEBUG_LOG_BINARY_MAX_SIZE);
 
-    g_log_queue_buffer_size += log_size;
+        if (log_data) {
+            log_size = mdebug_log_binary_encode((uint8_t *)log_data->data, fmt, vp);
+            mdebug_log_ring_commit(log_data, log_size, type | MDEBUG_LOG_TYPE_BINARY);
+        }
 
-    if (xQueueSend(g_log_queue, &log_data, 0) == pdFALSE) {
-        free(log_data);
-        g_log_queue_buffer_size -= log_size;
         goto EXIT;
     }
 
+#endif /**< CONFIG_MDEBUG_LOG_BINARY */
+
+    /**
+     * @brief The record is reserved for the longest log, the space left is given back on commit.
+     */
+    log_data = mdebug_log_ring_reserve(log_size + 1);
+
+    if (log_data) {
+        log_size = MIN(vsnprintf(log_data->data, log_size + 1, fmt, vp), log_size);
+        mdebug_log_ring_commit(log_data, log_size, type);
+    }
+
 EXIT:
 
     return log_size;
 }
 
+/**
+ * @brief Send the batch, the logs of several frames are compressed if it makes them smaller
+ */
+static void mdebug_log_batch_send(void)
+{
+    mdebug_log_batch_t *batch = g_log_batcher.batch;
+    size_t size               = batch->size;
+
+    batch->seq        = g_log_batcher.seq++;
+    batch->compressed = false;
+
+#ifdef CONFIG_MDEBUG_LOG_BATCH_COMPRESS
+
+    if (size > MDEBUG_LOG_BATCH_FRAME_SIZE) {
+        mz_ulong compressed_size = g_log_batcher.compressed_size;
+
+        if (compress2(g_log_batcher.compressed->data, &compressed_size, batch->data, size, MZ_BEST_SPEED) == MZ_OK
+                && compressed_size < size) {
+            memcpy(g_log_batcher.compressed, batch, sizeof(mdebug_log_batch_t));
+            batch = g_log_batcher.compressed;
+            batch->compressed = true;
+            size = compressed_size;
+        }
+    }
+
+#endif /**< CONFIG_MDEBUG_LOG_BATCH_COMPRESS */
+
+    if (mdebug_espnow_write(g_log_config->dest_addr, batch, sizeof(mdebug_log_batch_t) + size,
+                            MDEBUG_ESPNOW_LOG_BATCH, pdMS_TO_TICKS(MDEBUG_LOG_TIMEOUT_MS)) != MDF_OK) {
+        g_log_ring.espnow_fail_count += g_log_batcher.count;
+    }
+
+    g_log_batcher.batch->size = 0;
+    g_log_batcher.count       = 0;
+}
+
+/**
+ * @brief Add a log to the batch, the batch is sent first if the log does not fit
+ *        and once it is full. A log longer than a batch is sent alone.
+ */
+static void mdebug_log_batch_add(const char *data, size_t size)
+{
+    mdebug_log_batch_t *batch = g_log_batcher.batch;
+
+    if (batch->size > 0 && batch->size + size > MDEBUG_LOG_BATCH_SIZE) {
+        mdebug_log_batch_send();
+    }
+
+    if (!g_log_batcher.count) {
+        g_log_batcher.start_ticks = xTaskGetTickCount();
+    }
+
+    memcpy(batch->data + batch->size, data, size);
+    batch->size += size;
+    g_log_batcher.count++;
+
+    if (batch->size >= MDEBUG_LOG_BATCH_SIZE) {
+        mdebug_log_batch_send();
+    }
+}
+
+mdf_err_t mdebug_log_batch_unpack(const mdebug_log_batch_t *batch, size_t size, uint8_t *logs, size_t *logs_size)
+{
+    MDF_PARAM_CHECK(batch);
+    MDF_PARAM_CHECK(logs);
+    MDF_PARAM_CHECK(logs_size);
+    MDF_PARAM_CHECK(size >= sizeof(mdebug_log_batch_t));
+    MDF_ERROR_CHECK(*logs_size < batch->size, MDF_ERR_INVALID_ARG,
+                    "The buffer of the logs is too small, size: %d", batch->size);
+
+    size -= sizeof(mdebug_log_batch_t);
+
+    if (!batch->compressed) {
+        MDF_ERROR_CHECK(size != batch->size, MDF_ERR_INVALID_ARG, "Invalid batch, size: %d", size);
+        memcpy(logs, batch->data, size);
+        *logs_size = size;
+        return MDF_OK;
+    }
+
+    mz_ulong uncompressed_size = *logs_size;
+    int ret = uncompress(logs, &uncompressed_size, batch->data, size);
+    MDF_ERROR_CHECK(ret != MZ_OK || uncompressed_size != batch->size, MDF_FAIL,
+                    "uncompress, ret: %d, size: %d", ret, (int)uncompressed_size);
+    *logs_size = uncompressed_size;
+
+    return MDF_OK;
+}
+
+size_t mdebug_log_next_size(const uint8_t *logs, size_t size)
+{
+    if (!logs || !size) {
+        return 0;
+    }
+
+    if (logs[0] == MDEBUG_LOG_BINARY_MARKER) {
+        const mdebug_log_binary_t *record = (const mdebug_log_binary_t *)logs;
+        return (size >= sizeof(mdebug_log_binary_t) && record->size >= sizeof(mdebug_log_binary_t)) ?
+               MIN(record->size, size) : size;
+    }
+
+    /**< A line of text ends with '\n' or where a binary log starts */
+    for (size_t i = 0; i < size; ++i) {
+        if (logs[i] == '\n') {
+            return i + 1;
+        } else if (logs[i] == MDEBUG_LOG_BINARY_MARKER) {
+            return i;
+        }
+    }
+
+    return size;
+}
+
 static void mdebug_log_send_task(void *arg)
 {
-    mdebug_log_queue_t *log_data = NULL;
+    mdebug_log_record_t *log_data = NULL;
 
     for (; g_log_config;) {
-        if (xQueueReceive(g_log_queue, &log_data, pdMS_TO_TICKS(MDEBUG_LOG_TIMEOUT_MS)) == pdPASS) {
+        TickType_t wait_ticks = pdMS_TO_TICKS(MDEBUG_LOG_TIMEOUT_MS);
+
+        /**< Wake up when the first log of the batch has waited long enough */
+        if (g_log_batcher.count) {
+            TickType_t elapsed_ticks = xTaskGetTickCount() - g_log_batcher.start_ticks;
+            wait_ticks = MAX(pdMS_TO_TICKS(CONFIG_MDEBUG_LOG_BATCH_TIMEOUT_MS), elapsed_ticks) - elapsed_ticks;
+        }
+
+        ulTaskNotifyTake(pdTRUE, wait_ticks);
+
+        while (g_log_config && (log_data = mdebug_log_ring_peek())) {
             /**
              * @brief Control log data type and use param MDEBUG_LOG_TYPE_ESPNOW and param MDEBUG_LOG_TYPE_FLASH.
+             *
+             * @note The logs are sent over ESP-NOW in batches, a transaction per log takes
+             *       too much airtime from the mesh network.
              */
             if (log_data->type & MDEBUG_LOG_TYPE_ESPNOW) {
-                mdebug_espnow_write(g_log_config->dest_addr, log_data->data,
-                                    log_data->size, MDEBUG_ESPNOW_LOG, pdMS_TO_TICKS(MDEBUG_LOG_TIMEOUT_MS));
+                mdebug_log_batch_add(log_data->data, log_data->size);
             }
 
             if (log_data->type & MDEBUG_LOG_TYPE_FLASH && log_data->size > 0) { /**< Valid data only after the data reaches 14 */
@@ -153,7 +624,8 @@ static void mdebug_log_send_task(void *arg)
                  * @brief Remove the header and tail that appear in the string in the log
                  *
                  */
-                if (log_data->data[0] == '\033' && log_data->size > 7) {
+                if (!(log_data->type & MDEBUG_LOG_TYPE_BINARY)
+                        && log_data->data[0] == '\033' && log_data->size > 7) {
                     data = log_data->data + 7;
                     size = log_data->size - 7;
 
@@ -170,8 +642,12 @@ static void mdebug_log_send_task(void *arg)
                 mdebug_flash_write(data, size); /**< Write log data to flash */
             }
 
-            g_log_queue_buffer_size -= log_data->size;
-            MDF_FREE(log_data);
+            mdebug_log_ring_release(log_data);
+        }
+
+        if (g_log_config && g_log_batcher.count
+                && xTaskGetTickCount() - g_log_batcher.start_ticks >= pdMS_TO_TICKS(CONFIG_MDEBUG_LOG_BATCH_TIMEOUT_MS)) {
+            mdebug_log_batch_send();
         }
     }
 
@@ -196,14 +672,27 @@ mdf_err_t mdebug_log_init()
         g_log_config->log_uart_enable = true;
     }
 
-    /**< Register espnow log redirect function */
-    esp_log_set_vprintf(mdebug_log_vprintf);
+    /**< Allocated once, a log never touches the heap */
+    if (!g_log_ring.buffer) {
+        g_log_ring.size   = 1 << (31 - __builtin_clz(CONFIG_MDEBUG_LOG_RING_SIZE));
+        g_log_ring.buffer = MDF_CALLOC(1, g_log_ring.size);
+        MDF_ERROR_CHECK(!g_log_ring.buffer, MDF_ERR_NO_MEM, "g_log_ring create fail");
+    }
+
+    if (!g_log_batcher.batch) {
+        g_log_batcher.batch = MDF_CALLOC(1, sizeof(mdebug_log_batch_t) + MAX(MDEBUG_LOG_BATCH_SIZE, MDEBUG_LOG_MAX_SIZE));
+        MDF_ERROR_CHECK(!g_log_batcher.batch, MDF_ERR_NO_MEM, "g_log_batcher create fail");
 
-    if (!g_log_queue) {
-        g_log_queue = xQueueCreate(MDEBUG_LOG_QUEUE_SIZE, sizeof(mdebug_log_queue_t *));
-        MDF_ERROR_CHECK(!g_log_queue, ESP_FAIL, "g_log_queue create fail");
+#ifdef CONFIG_MDEBUG_LOG_BATCH_COMPRESS
+        g_log_batcher.compressed_size = compressBound(MDEBUG_LOG_BATCH_SIZE);
+        g_log_batcher.compressed = MDF_MALLOC(sizeof(mdebug_log_batch_t) + g_log_batcher.compressed_size);
+        MDF_ERROR_CHECK(!g_log_batcher.compressed, MDF_ERR_NO_MEM, "g_log_batcher create fail");
+#endif /**< CONFIG_MDEBUG_LOG_BATCH_COMPRESS */
     }
 
+    /**< Register espnow log redirect function */
+    esp_log_set_vprintf(mdebug_log_vprintf);
+
     if (!g_log_send_task_handle) {
         xTaskCreatePinnedToCore(mdebug_log_send_task, "mdebug_log_send", 3 * 1024,
                                 NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY - 2,
@@ -219,14 +708,6 @@ mdf_err_t mdebug_log_init()
 mdf_err_t mdebug_log_deinit()
 {
     if (g_log_config) {
-        mdebug_log_queue_t *log_data = NULL;
-
-        while (xQueueReceive(g_log_queue, &log_data, 0) == pdPASS) {
-            MDF_FREE(log_data);
-        }
-
-        g_log_queue_buffer_size = 0;
-
         MDF_FREE(g_log_config);
         g_log_config = NULL;
     }
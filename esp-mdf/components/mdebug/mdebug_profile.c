@@ -0,0 +1,353 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdarg.h>
+
+#include "mdf_common.h"
+#include "miniz.h"
+#include "mdebug.h"
+
+#define MDEBUG_PROFILE_LINE_SIZE (80)
+
+/**
+ * @brief State of the device at the end of a window
+ */
+typedef struct {
+    TaskStatus_t *tasks;                              /**< Tasks and their run time counter */
+    UBaseType_t task_num;                             /**< Number of tasks */
+    uint32_t run_time;                                /**< Run time counter when the tasks were read */
+    mdf_mem_tag_usage_t tags[MDEBUG_PROFILE_TAG_MAX]; /**< Memory of the largest MDF_MALLOC tags */
+    size_t tag_num;                                   /**< Number of tags */
+    uint32_t free_heap;                               /**< Free heap */
+    int64_t timestamp;                                /**< Time of the snapshot, us */
+} mdebug_profile_snapshot_t;
+
+/**
+ * @brief Report of a window, its lines one after the other as a batch of logs
+ */
+typedef struct {
+    mdebug_log_batch_t *batch; /**< Lines, each with the "mdebug_profile: " prefix */
+    size_t dropped;            /**< Lines that did not fit */
+} mdebug_profile_report_t;
+
+static const char *TAG = "mdebug_profile";
+static TaskHandle_t g_profile_task = NULL;
+static bool g_profile_running      = false;
+
+#if ( configUSE_TRACE_FACILITY == 1 ) && ( configGENERATE_RUN_TIME_STATS == 1 )
+
+static mdf_err_t profile_snapshot_take(mdebug_profile_snapshot_t *snapshot)
+{
+    /**< A few more in case tasks are created meanwhile */
+    UBaseType_t task_num = uxTaskGetNumberOfTasks() + 4;
+
+    snapshot->tasks = MDF_MALLOC(task_num * sizeof(TaskStatus_t));
+    MDF_ERROR_CHECK(!snapshot->tasks, MDF_ERR_NO_MEM, "");
+
+    snapshot->task_num  = uxTaskGetSystemState(snapshot->tasks, task_num, &snapshot->run_time);
+    snapshot->free_heap = esp_get_free_heap_size();
+    snapshot->timestamp = esp_timer_get_time();
+    snapshot->tag_num   = MDEBUG_PROFILE_TAG_MAX;
+
+    if (mdf_mem_get_tag_usage(snapshot->tags, &snapshot->tag_num) != MDF_OK) {
+        snapshot->tag_num = 0;
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Print a line of the report and add it to the batch sent to the receiver
+ */
+static void profile_line(mdebug_profile_report_t *report, const char *format, ...)
+{
+    char line[MDEBUG_PROFILE_LINE_SIZE] = {0};
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    MDF_LOGI("%s", line);
+
+    if (!report->batch) {
+        return;
+    }
+
+    int size = snprintf(NULL, 0, "%s: %s\n", TAG, line);
+
+    if (report->batch->size + size >= MDEBUG_LOG_BATCH_MAX_SIZE) {
+        report->dropped++;
+        return;
+    }
+
+    report->batch->size += sprintf((char *)report->batch->data + report->batch->size, "%s: %s\n", TAG, line);
+}
+
+/**
+ * @brief Run time of a task in the window, all of it for a task created in the window
+ */
+static uint32_t profile_task_run_time(const mdebug_profile_snapshot_t *prev, const TaskStatus_t *task)
+{
+    for (int i = 0; i < prev->task_num; ++i) {
+        if (prev->tasks[i].xTaskNumber == task->xTaskNumber) {
+            return task->ulRunTimeCounter - prev->tasks[i].ulRunTimeCounter;
+        }
+    }
+
+    return task->ulRunTimeCounter;
+}
+
+static int profile_task_core(const TaskStatus_t *task)
+{
+#if ( configTASKLIST_INCLUDE_COREID == 1 )
+    return task->xCoreID == tskNO_AFFINITY ? -1 : (int)task->xCoreID;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief Report a window, the tasks by run time in the window, the tags by memory
+ */
+static void profile_report(mdebug_profile_report_t *report, const mdebug_profile_snapshot_t *prev,
+                           const mdebug_profile_snapshot_t *cur)
+{
+    /**< In the unit of the run time counter, CONFIG_FREERTOS_RUN_TIME_STATS_CLK */
+    uint32_t window   = cur->run_time - prev->run_time;
+    uint32_t *deltas  = MDF_CALLOC(cur->task_num, sizeof(uint32_t));
+    char cpus[32]     = {0};
+
+    if (!deltas || !window) {
+        MDF_FREE(deltas);
+        return;
+    }
+
+    for (int i = 0; i < cur->task_num; ++i) {
+        deltas[i] = profile_task_run_time(prev, cur->tasks + i);
+    }
+
+    /**< A core is busy while its idle task does not run */
+    for (int core = 0, len = 0; core < portNUM_PROCESSORS; ++core) {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCPU(core);
+
+        for (int i = 0; i < cur->task_num; ++i) {
+            if (cur->tasks[i].xHandle == idle) {
+                len += snprintf(cpus + len, sizeof(cpus) - len, ", cpu%d %d%%", core,
+                                100 - (int)MIN((uint64_t)deltas[i] * 100 / window, 100));
+                break;
+            }
+        }
+    }
+
+    profile_line(report, "window %u ms%s, heap %u (%+d), minimum %u",
+                 (uint32_t)((cur->timestamp - prev->timestamp) / 1000), cpus,
+                 cur->free_heap, (int)(cur->free_heap - prev->free_heap), esp_get_minimum_free_heap_size());
+    profile_line(report, "%-16s %4s %4s %6s %10s %6s", "task", "core", "prio", "cpu%", "run_time", "stack");
+
+    /**< The tasks by run time, selected one at a time, there are a few dozens */
+    for (int n = 0; n < cur->task_num; ++n) {
+        int next = -1;
+
+        for (int i = 0; i < cur->task_num; ++i) {
+            if (deltas[i] != UINT32_MAX && (next < 0 || deltas[i] > deltas[next])) {
+                next = i;
+            }
+        }
+
+        const TaskStatus_t *task = cur->tasks + next;
+        uint64_t permille = (uint64_t)deltas[next] * 1000 / window;
+
+        profile_line(report, "%-16s %4d %4u %4u.%u %10u %6u", task->pcTaskName, profile_task_core(task),
+                     task->uxCurrentPriority, (uint32_t)(permille / 10), (uint32_t)(permille % 10),
+                     deltas[next], (uint32_t)task->usStackHighWaterMark);
+        deltas[next] = UINT32_MAX;
+    }
+
+    if (cur->tag_num) {
+        profile_line(report, "%-16s %8s %8s %6s", "tag", "size", "delta", "blocks");
+    }
+
+    for (int i = 0; i < cur->tag_num; ++i) {
+        int delta = cur->tags[i].size;
+
+        for (int j = 0; j < prev->tag_num; ++j) {
+            if (!strcmp(cur->tags[i].tag, prev->tags[j].tag)) {
+                delta -= prev->tags[j].size;
+                break;
+            }
+        }
+
+        profile_line(report, "%-16s %8u %+8d %6u", cur->tags[i].tag, cur->tags[i].size, delta, cur->tags[i].count);
+    }
+
+    if (report->dropped) {
+        profile_line(report, "%d lines not sent", report->dropped);
+    }
+
+    MDF_FREE(deltas);
+}
+
+/**
+ * @brief Send the report as a batch of logs, compressed if it is smaller,
+ *        the receiver prints it as the logs of mdebug_log
+ */
+static void profile_report_send(mdebug_profile_report_t *report, const uint8_t *dest_addr)
+{
+    static uint8_t s_seq           = 0;
+    mdebug_log_batch_t *batch      = report->batch;
+    mdebug_log_batch_t *compressed = NULL;
+    mz_ulong compressed_size       = compressBound(batch->size);
+    size_t size                    = batch->size;
+
+    batch->seq = s_seq++;
+
+    if (size > MDEBUG_ESPNOW_PAYLOAD_LEN - sizeof(mdebug_log_batch_t)
+            && (compressed = MDF_MALLOC(sizeof(mdebug_log_batch_t) + compressed_size))
+            && compress2(compressed->data, &compressed_size, batch->data, size, MZ_BEST_SPEED) == MZ_OK
+            && compressed_size < size) {
+        memcpy(compressed, batch, sizeof(mdebug_log_batch_t));
+        compressed->compressed = true;
+        batch = compressed;
+        size  = compressed_size;
+    }
+
+    mdf_err_t ret = mdebug_espnow_write(dest_addr, batch, sizeof(mdebug_log_batch_t) + size,
+                                        MDEBUG_ESPNOW_LOG_BATCH, portMAX_DELAY);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> mdebug_espnow_write", mdf_err_to_name(ret));
+    }
+
+    MDF_FREE(compressed);
+}
+
+/**
+ * @brief A task stopped and replaced by a new start must neither keep running nor reset the new state
+ */
+static bool profile_task_is_current(void)
+{
+    return g_profile_running && g_profile_task == xTaskGetCurrentTaskHandle();
+}
+
+static void mdebug_profile_task(void *arg)
+{
+    mdebug_profile_config_t *config = (mdebug_profile_config_t *)arg;
+    mdebug_profile_snapshot_t *prev = MDF_CALLOC(1, sizeof(mdebug_profile_snapshot_t));
+    mdebug_profile_snapshot_t *cur  = MDF_CALLOC(1, sizeof(mdebug_profile_snapshot_t));
+    mdebug_profile_report_t report  = {0};
+    const uint8_t empty_addr[6]     = {0};
+    bool send = memcmp(config->dest_addr, empty_addr, sizeof(empty_addr));
+
+    MDF_ERROR_GOTO(!prev || !cur || profile_snapshot_take(prev) != MDF_OK, EXIT, "");
+
+    if (send) {
+        report.batch = MDF_MALLOC(sizeof(mdebug_log_batch_t) + MDEBUG_LOG_BATCH_MAX_SIZE);
+        MDF_ERROR_GOTO(!report.batch, EXIT, "");
+    }
+
+    for (int n = 0; profile_task_is_current() && (!config->count || n < config->count); ++n) {
+        /**< Woken up early by mdebug_profile_stop() */
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(config->window_ms));
+
+        if (!profile_task_is_current() || profile_snapshot_take(cur) != MDF_OK) {
+            break;
+        }
+
+        if (report.batch) {
+            memset(report.batch, 0, sizeof(mdebug_log_batch_t));
+            report.dropped = 0;
+        }
+
+        profile_report(&report, prev, cur);
+
+        if (send) {
+            profile_report_send(&report, config->dest_addr);
+        }
+
+        mdebug_profile_snapshot_t *tmp = prev;
+        MDF_FREE(prev->tasks);
+        prev = cur;
+        cur  = tmp;
+    }
+
+EXIT:
+
+    if (prev) {
+        MDF_FREE(prev->tasks);
+    }
+
+    if (cur) {
+        MDF_FREE(cur->tasks);
+    }
+
+    MDF_FREE(prev);
+    MDF_FREE(cur);
+    MDF_FREE(report.batch);
+    MDF_FREE(config);
+
+    if (g_profile_task == xTaskGetCurrentTaskHandle()) {
+        g_profile_task    = NULL;
+        g_profile_running = false;
+    }
+
+    vTaskDelete(NULL);
+}
+
+mdf_err_t mdebug_profile_start(const mdebug_profile_config_t *config)
+{
+    MDF_PARAM_CHECK(config);
+    MDF_PARAM_CHECK(config->window_ms >= 100);
+    MDF_ERROR_CHECK(g_profile_running, MDF_ERR_INVALID_STATE, "The profiler is running");
+
+    mdebug_profile_config_t *task_config = MDF_MALLOC(sizeof(mdebug_profile_config_t));
+    MDF_ERROR_CHECK(!task_config, MDF_ERR_NO_MEM, "");
+
+    memcpy(task_config, config, sizeof(mdebug_profile_config_t));
+    g_profile_running = true;
+
+    /**< Above the tasks of MDF so that the windows are on time even when one of them is busy */
+    if (xTaskCreatePinnedToCore(mdebug_profile_task, "mdebug_profile", 3 * 1024,
+                                task_config, CONFIG_MDF_TASK_DEFAULT_PRIOTY + 1,
+                                &g_profile_task, CONFIG_MDF_TASK_PINNED_TO_CORE) != pdPASS) {
+        g_profile_running = false;
+        MDF_FREE(task_config);
+        return MDF_ERR_NO_MEM;
+    }
+
+    return MDF_OK;
+}
+
+#else
+
+mdf_err_t mdebug_profile_start(const mdebug_profile_config_t *config)
+{
+    MDF_LOGW("Enable CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS");
+    return MDF_ERR_NOT_SUPPORTED;
+}
+
+#endif /**< ( configUSE_TRACE_FACILITY == 1 ) && ( configGENERATE_RUN_TIME_STATS == 1 ) */
+
+mdf_err_t mdebug_profile_stop(void)
+{
+    MDF_ERROR_CHECK(!g_profile_running, MDF_ERR_NOT_INIT, "The profiler is not running");
+
+    g_profile_running = false;
+
+    if (g_profile_task) {
+        xTaskNotifyGive(g_profile_task);
+    }
+
+    return MDF_OK;
+}
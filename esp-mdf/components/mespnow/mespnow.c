@@ -116,6 +116,7 @@ static void mespnow_recv_cb(const uint8_t *addr, const uint8_t *data, int size)
     }
 
     if (g_last_magic[espnow_data->pipe] == espnow_data->magic) {
+        MDF_METRICS_INC(MDF_METRICS_MESPNOW_DUPLICATE);
         MDF_LOGD("Receive duplicate packets, magic: 0x%x", espnow_data->magic);
         return;
     }
@@ -123,6 +124,7 @@ static void mespnow_recv_cb(const uint8_t *addr, const uint8_t *data, int size)
     g_last_magic[espnow_data->pipe] = espnow_data->magic;
 
     if (espnow_data->crc != crc8_le(UINT8_MAX, espnow_data->payload, espnow_data->size)) {
+        MDF_METRICS_INC(MDF_METRICS_MESPNOW_CRC_FAIL);
         MDF_LOGD("Receive cb CRC fail");
         return;
     }
@@ -140,7 +142,10 @@ static void mespnow_recv_cb(const uint8_t *addr, const uint8_t *data, int size)
     }
 
     /**< espnow_queue is full */
-    if (!uxQueueSpacesAvailable(espnow_queue)) {
+    UBaseType_t queue_spaces = uxQueueSpacesAvailable(espnow_queue);
+
+    if (!queue_spaces) {
+        MDF_METRICS_INC(MDF_METRICS_MESPNOW_QUEUE_FULL);
         MDF_LOGD("espnow_queue is full");
         return ;
     }
@@ -155,9 +160,14 @@ static void mespnow_recv_cb(const uint8_t *addr, const uint8_t *data, int size)
     memcpy(q_data->addr, addr, ESP_NOW_ETH_ALEN);
 
     if (xQueueSend(espnow_queue, &q_data, 0) != pdPASS) {
+        MDF_METRICS_INC(MDF_METRICS_MESPNOW_QUEUE_FULL);
         MDF_LOGD("Send receive queue failed");
         MDF_FREE(q_data);
+        return;
     }
+
+    MDF_METRICS_INC(MDF_METRICS_MESPNOW_RECV);
+    MDF_METRICS_MAX(MDF_METRICS_MESPNOW_QUEUE_HIGH, g_espnow_queue_size[espnow_data->pipe] - queue_spaces + 1);
 }
 
 mdf_err_t mespnow_add_peer(wifi_interface_t ifx, const uint8_t *addr, const uint8_t *lmk)
@@ -222,6 +232,7 @@ mdf_err_t mespnow_write(mespnow_trans_pipe_e pipe, const uint8_t *dest_addr,
     ssize_t write_size                   = size;
     TickType_t write_ticks               = 0;
     uint32_t start_ticks                 = xTaskGetTickCount();
+    int64_t start_time                   = MDF_METRICS_TIME();
     static SemaphoreHandle_t s_send_lock = NULL;
 
     if (!s_send_lock) {
@@ -259,6 +270,7 @@ mdf_err_t mespnow_write(mespnow_trans_pipe_e pipe, const uint8_t *dest_addr,
             ret = esp_now_send(dest_addr, (uint8_t *)espnow_data,
                                espnow_data->size + sizeof(mespnow_head_data_t));
             MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_now_send", mdf_err_to_name(ret));
+            MDF_METRICS_INC(retry_count == CONFIG_MESPNOW_RETRANSMIT_NUM ? MDF_METRICS_MESPNOW_SEND : MDF_METRICS_MESPNOW_SEND_RETRY);
 
             /**< Waiting send complete ack from mac layer */
             uxBits = xEventGroupWaitBits(g_event_group, SEND_CB_OK | SEND_CB_FAIL,
@@ -293,6 +305,12 @@ EXIT:
     /**< ESP-NOW send completed, release send lock */
     xSemaphoreGive(s_send_lock);
 
+    if (ret != ESP_OK) {
+        MDF_METRICS_INC(MDF_METRICS_MESPNOW_SEND_FAIL);
+    }
+
+    MDF_METRICS_OBSERVE(MDF_METRICS_MESPNOW_WRITE_US, start_time);
+
     return ret;
 }
 
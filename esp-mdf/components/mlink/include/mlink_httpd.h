@@ -62,6 +62,19 @@ typedef struct {
     char *data;              /**< Pointer of Data */
 } mlink_httpd_t;
 
+/**
+ * @brief Statistics of the http server request and response queues
+ */
+typedef struct {
+    uint32_t queue_depth;       /**< Requests waiting to be read by mlink_httpd_read */
+    uint32_t queue_depth_max;   /**< Largest queue_depth seen since start */
+    uint32_t request_rejected;  /**< Requests answered with 503, the request queue or connection table was full */
+    uint32_t request_throttled; /**< Requests answered with 429, the connection is still waiting for a response */
+    uint32_t output_pending;    /**< Response bytes waiting for the sockets to become writable */
+    uint32_t output_dropped;    /**< Responses dropped because the output queue of a connection was full */
+    uint32_t send_error;        /**< Connections closed because of a send error */
+} mlink_httpd_stats_t;
+
 /**
  * @brief  Start http server
  *
@@ -95,15 +108,32 @@ mdf_err_t mlink_httpd_read(mlink_httpd_t **request, TickType_t wait_ticks);
 /**
  * @brief Send data to http server
  *
+ * @note The response is appended to the output queue of the connection and
+ *       sent by the http server task once the socket is writable, this
+ *       function does not wait for the client.
+ *
  * @param  response   Response data
- * @param  wait_ticks Waiting timeout
+ * @param  wait_ticks Waiting timeout for the connection table
  *
  * @return
  *     - ESP_OK
  *     - ESP_FAIL
+ *     - MDF_ERR_TIMEOUT
+ *     - MDF_ERR_BUF, the output queue of the connection is full, the response is dropped
  */
 mdf_err_t mlink_httpd_write(const mlink_httpd_t *response, TickType_t wait_ticks);
 
+/**
+ * @brief Get the statistics of the http server
+ *
+ * @param  stats Statistics of the request and response queues
+ *
+ * @return
+ *     - ESP_OK
+ *     - MDF_ERR_NOT_INIT
+ */
+mdf_err_t mlink_httpd_get_stats(mlink_httpd_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif /**< _cplusplus */
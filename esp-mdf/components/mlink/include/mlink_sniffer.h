@@ -58,7 +58,7 @@ typedef struct {
  */
 typedef struct {
     sniffer_type_t enable_type; /**< Enable wireless packet type for listening */
-    size_t buffer_num;          /**< Buffer space size */
+    size_t buffer_num;          /**< Number of devices buffered, the oldest one is replaced when full */
     uint8_t notice_percentage;  /**< When the proportion of the buffer space is exceeded, send a UDP notification APP to get */
     bool esp_filter;            /**< Filter the espressif module to eliminate its own interference */
     uint16_t ble_scan_interval; /**< BLE scan interval */
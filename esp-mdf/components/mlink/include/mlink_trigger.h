@@ -61,6 +61,24 @@ bool mlink_trigger_is_exist();
  */
 mdf_err_t mlink_trigger_handle(mlink_communicate_t communicate);
 
+/**
+ * @brief Evaluate only the triggers watching the given characteristic
+ *
+ * @note  A "sync" trigger is only evaluated when the value of its characteristic
+ *        differs from the one seen last time, a "linkage" trigger on every call.
+ *        The optional "trigger_debounce" and "trigger_interval" fields (ms) of an
+ *        event absorb changes that come too close together, the settled value is
+ *        evaluated again when the window expires, and limit how often it is executed.
+ *
+ * @param  communicate The method of sending the package when the event is triggered
+ * @param  cid         Unique identifier of the characteristic that changed
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_FAIL
+ */
+mdf_err_t mlink_trigger_handle_cid(mlink_communicate_t communicate, uint16_t cid);
+
 /**
  * @brief Add event handler
  *
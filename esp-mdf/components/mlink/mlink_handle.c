@@ -16,6 +16,7 @@
 #include "mwifi.h"
 #include "mconfig_chain.h"
 #include "mupgrade.h"
+#include "mbedtls/base64.h"
 
 #define MLINK_RESTART_DELAY_TIME_MS (5000)
 #define MLINK_HANDLES_MAX_SIZE      (64)
@@ -606,6 +607,37 @@ static mdf_err_t mlink_handle_get_ota_progress(mlink_handle_data_t *handle_data)
     return MDF_OK;
 }
 
+/**
+ * @brief The snapshot of mdf_metrics_snapshot() in base64, decoded by tools/mdf_metrics.py
+ */
+static mdf_err_t mlink_handle_get_metrics(mlink_handle_data_t *handle_data)
+{
+    mdf_err_t ret       = MDF_OK;
+    size_t size         = MDF_METRICS_SNAPSHOT_SIZE;
+    size_t b64_size     = 0;
+    char *b64_str       = NULL;
+    mdf_metrics_snapshot_t *snapshot = MDF_MALLOC(size);
+    MDF_ERROR_CHECK(!snapshot, MDF_ERR_NO_MEM, "");
+
+    ret = mdf_metrics_snapshot(snapshot, &size);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mdf_metrics_snapshot");
+
+    ret = MDF_ERR_NO_MEM;
+    b64_str = MDF_MALLOC((size + 2) / 3 * 4 + 1);
+    MDF_ERROR_GOTO(!b64_str, EXIT, "");
+
+    mbedtls_base64_encode((uint8_t *)b64_str, (size + 2) / 3 * 4 + 1, &b64_size, (uint8_t *)snapshot, size);
+    mlink_json_pack(&handle_data->resp_data, "metrics", b64_str);
+
+    handle_data->resp_size = strlen(handle_data->resp_data);
+    ret = MDF_OK;
+
+EXIT:
+    MDF_FREE(b64_str);
+    MDF_FREE(snapshot);
+    return ret;
+}
+
 static mdf_err_t mlink_handle_set_ota_fallback(mlink_handle_data_t *handle_data)
 {
     mdf_err_t ret = MDF_OK;
@@ -961,6 +993,7 @@ static mlink_handle_t g_handles_list[MLINK_HANDLES_MAX_SIZE] = {
     {"set_position",     mlink_handle_set_position},
     {"get_ota_progress", mlink_handle_get_ota_progress},
     {"set_ota_fallback", mlink_handle_set_ota_fallback},
+    {"get_metrics",      mlink_handle_get_metrics},
     {"get_mesh_config",  mlink_handle_get_config},
     {"set_mesh_config",  mlink_handle_set_config},
     {"set_group",        mlink_handle_set_group},
@@ -1033,11 +1066,19 @@ mdf_err_t mlink_handle(const uint8_t *src_addr, const mlink_httpd_type_t *type,
     for (int i = 0; g_handles_list[i].func; i++) {
         if (!strcasecmp(func_name, g_handles_list[i].name)) {
             MDF_LOGD("Function: %s", func_name);
+            int64_t start_time = MDF_METRICS_TIME();
             ret = g_handles_list[i].func(&handle_data);
+            MDF_METRICS_OBSERVE(MDF_METRICS_MLINK_HANDLE_US, start_time);
             break;
         }
     }
 
+    MDF_METRICS_INC(MDF_METRICS_MLINK_REQUEST);
+
+    if (ret != MDF_OK) {
+        MDF_METRICS_INC(MDF_METRICS_MLINK_REQUEST_FAIL);
+    }
+
     /**< Check flag to decide whether reponse */
     if (!type->resp) {
         return MDF_OK;
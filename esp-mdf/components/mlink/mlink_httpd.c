@@ -22,6 +22,17 @@
 #define MLINK_HTTPD_FIRMWARE_URL_LEN (128)
 #define MLINK_HTTPD_RESP_TIMEROUT_MS (15000)
 #define MLINK_HTTPD_MAX_CONNECT      (CONFIG_LWIP_MAX_SOCKETS - 5)
+#define MLINK_HTTPD_QUEUE_SIZE       (3)
+#define MLINK_HTTPD_OUTPUT_MAX_SIZE  (8 * 1024)
+#define MLINK_HTTPD_FLUSH_RETRY_MS   (20)
+#define MLINK_HTTPD_TIMER_WAIT_MS    (100) /**< Wait for the timer command queue, the timer callbacks never block on g_conn_lock */
+#define MLINK_HTTPD_RETRY_AFTER      "1"
+#define MLINK_HTTPD_RECV_RETRY       (5)
+#define MLINK_HTTPD_BODY_MAX_SIZE    (8096 - 1) /**< The largest payload mwifi_root_write() accepts */
+
+#define MLINK_HTTPD_413              "413 Payload Too Large"
+#define MLINK_HTTPD_429              "429 Too Many Requests"
+#define MLINK_HTTPD_503              "503 Service Unavailable"
 
 /**
  * @brief The flag of http chunks
@@ -34,21 +45,38 @@ enum {
     MLINK_HTTPD_CHUNKS_FOOTER,   /**< Add the body of http chunks */
 };
 
+/**
+ * @brief Response data waiting for the socket to become writable
+ */
+typedef struct mlink_httpd_output {
+    struct mlink_httpd_output *next; /**< Next pending response */
+    size_t size;                     /**< Length of data */
+    size_t offset;                   /**< Length already sent */
+    char data[0];                    /**< Response data */
+} mlink_httpd_output_t;
+
 /**
  * @brief Record the connected structure
  */
 typedef struct {
-    httpd_handle_t handle; /**< Every instance of the server will have a unique handle. */
-    TimerHandle_t timer;   /**< Waiting for response timeout */
-    uint16_t sockfd;       /**< Socket descriptor for sending data */
-    uint16_t num;          /**< Number of destination addresses */
-    uint8_t flag;          /**< The flag of http chunks */
+    httpd_handle_t handle;        /**< Every instance of the server will have a unique handle. */
+    TimerHandle_t timer;          /**< Waiting for response timeout */
+    uint16_t sockfd;              /**< Socket descriptor for sending data */
+    uint16_t num;                 /**< Number of destination addresses */
+    uint8_t flag;                 /**< The flag of http chunks */
+    bool finished;                /**< All responses are queued, release after flushing */
+    bool close;                   /**< Close the session after flushing */
+    size_t output_size;           /**< Length of the data waiting in output */
+    mlink_httpd_output_t *output; /**< Responses waiting to be sent */
 } mlink_connection_t;
 
-static const char *TAG                 = "mlink_httpd";
-static httpd_handle_t g_httpd_handle   = NULL;
-static QueueHandle_t g_mlink_queue     = NULL;
-static mlink_connection_t *g_conn_list = NULL;
+static const char *TAG                   = "mlink_httpd";
+static httpd_handle_t g_httpd_handle     = NULL;
+static QueueHandle_t g_mlink_queue       = NULL;
+static mlink_connection_t *g_conn_list   = NULL;
+static SemaphoreHandle_t g_conn_lock     = NULL;
+static TimerHandle_t g_flush_timer       = NULL;
+static mlink_httpd_stats_t g_httpd_stats = {0};
 
 static void mlink_connection_remove(mlink_connection_t *mlink_conn);
 static mlink_connection_t *mlink_connection_find(uint16_t sockfd);
@@ -129,77 +157,260 @@ static bool mlink_socket_iswritable(int sockfd)
     return true;
 }
 
-static int httpd_default_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+static void mlink_connection_output_free(mlink_connection_t *mlink_conn)
 {
-    MDF_PARAM_CHECK(buf);
-    MDF_PARAM_CHECK(sockfd > 0);
-
-    int ret = send(sockfd, buf, buf_len, flags);
-
-    if (ret <= 0) {
-        mlink_connection_t *mlink_conn = mlink_connection_find(sockfd);
-        close(sockfd);
-        mlink_connection_remove(mlink_conn);
-        MDF_LOGW("socket send, err_str: %s, sockfd: %d, buf_len: %d",
-                 strerror(errno), sockfd, buf_len);
+    for (mlink_httpd_output_t *output = mlink_conn->output, *next = NULL; output; output = next) {
+        next = output->next;
+        MDF_FREE(output);
     }
 
-    return ret;
+    mlink_conn->output      = NULL;
+    mlink_conn->output_size = 0;
 }
 
 static void mlink_connection_remove(mlink_connection_t *mlink_conn)
 {
     if (mlink_conn && mlink_conn->timer) {
-        xTimerStop(mlink_conn->timer, 0);
-        xTimerDelete(mlink_conn->timer, 0);
+        /**< A timer that can not be deleted finds its slot released or reused when it expires */
+        if (xTimerDelete(mlink_conn->timer, pdMS_TO_TICKS(MLINK_HTTPD_TIMER_WAIT_MS)) != pdPASS) {
+            MDF_LOGW("xTimerDelete, the timer command queue is full, sockfd: %d", mlink_conn->sockfd);
+        }
+
+        mlink_connection_output_free(mlink_conn);
         memset(mlink_conn, 0, sizeof(mlink_connection_t));
     }
 }
 
-static void mlink_connection_timeout_cb(void *timer)
+static mlink_connection_t *mlink_connection_find(uint16_t sockfd)
 {
-    char *chunk_footer             = "0\r\n\r\n";
-    mlink_connection_t *mlink_conn = (mlink_connection_t *)pvTimerGetTimerID(timer);
+    for (int i = 0; i < MLINK_HTTPD_MAX_CONNECT; ++i) {
+        if (g_conn_list[i].sockfd == sockfd && g_conn_list[i].flag != MLINK_HTTPD_CHUNKS_NONE) {
+            return g_conn_list + i;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs in the context of the http server task, sends the pending
+ *        responses of a connection without blocking. Whatever the socket
+ *        can not take now is left in the output queue for the flush timer.
+ */
+static void mlink_connection_flush(void *arg)
+{
+    uint16_t sockfd = (uint32_t)arg;
+    ssize_t ret     = 0;
+
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+
+    mlink_connection_t *mlink_conn = mlink_connection_find(sockfd);
+    MDF_ERROR_GOTO(!mlink_conn, EXIT, "Mlink connection is closed, sockfd: %d", sockfd);
+
+    while (mlink_conn->output) {
+        mlink_httpd_output_t *output = mlink_conn->output;
+
+        ret = send(sockfd, output->data + output->offset, output->size - output->offset, MSG_DONTWAIT);
+
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            xTimerStart(g_flush_timer, 0);
+            goto EXIT;
+        }
+
+        if (ret <= 0) {
+            MDF_LOGW("<%s> socket send, sockfd: %d, size: %d",
+                     strerror(errno), sockfd, output->size - output->offset);
+            g_httpd_stats.send_error++;
+            mlink_connection_output_free(mlink_conn);
+            mlink_conn->finished = true;
+            mlink_conn->close    = true;
+            break;
+        }
+
+        output->offset          += ret;
+        mlink_conn->output_size -= ret;
+
+        if (output->offset == output->size) {
+            mlink_conn->output = output->next;
+            MDF_FREE(output);
+        }
+    }
 
-    if (mlink_conn->timer == NULL || mlink_conn->flag == MLINK_HTTPD_CHUNKS_NONE) {
-        return ;
+    if (mlink_conn->finished) {
+        if (mlink_conn->close) {
+            httpd_sess_trigger_close(mlink_conn->handle, sockfd);
+        }
+
+        mlink_connection_remove(mlink_conn);
     }
 
-    if (mlink_conn->flag != MLINK_HTTPD_CHUNKS_BODY) {
-        chunk_footer = "HTTP/1.1 400 Bad Request\r\n"
-                       "Content-Type: application/json\r\n"
-                       "Content-Length: 79\r\n\r\n"
-                       "{\"status_code\":-1,\"status_msg\":\"Destination address error, No device response\"}";
+EXIT:
+    xSemaphoreGive(g_conn_lock);
+}
+
+static void mlink_connection_flush_schedule(mlink_connection_t *mlink_conn)
+{
+    if (httpd_queue_work(mlink_conn->handle, mlink_connection_flush,
+                         (void *)(uint32_t)mlink_conn->sockfd) != ESP_OK) {
+        MDF_LOGD("httpd_queue_work, sockfd: %d", mlink_conn->sockfd);
+        xTimerStart(g_flush_timer, 0);
     }
+}
 
-    mlink_conn->flag = MLINK_HTTPD_CHUNKS_DATA;
+/**
+ * @brief Polls the sockets that still have pending output and hands the
+ *        writable ones back to the http server task
+ */
+static void mlink_connection_flush_timer_cb(void *timer)
+{
+    bool pending = false;
+
+    if (xSemaphoreTake(g_conn_lock, 0) != pdTRUE) {
+        xTimerStart(g_flush_timer, 0);
+        return;
+    }
 
-    if (mlink_socket_iswritable(mlink_conn->sockfd)) {
-        if (httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, chunk_footer, strlen(chunk_footer), 0) <= 0) {
-            MDF_LOGW("<%s> httpd_default_send, sockfd: %d", strerror(errno), mlink_conn->sockfd);
+    for (int i = 0; g_conn_list && i < MLINK_HTTPD_MAX_CONNECT; ++i) {
+        mlink_connection_t *mlink_conn = g_conn_list + i;
+
+        if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_NONE || !mlink_conn->output) {
+            continue;
         }
 
-        MDF_LOGW("Mlink httpd response timeout, sockfd: %d, data: %s", mlink_conn->sockfd, chunk_footer);
+        if (mlink_socket_iswritable(mlink_conn->sockfd)) {
+            mlink_connection_flush_schedule(mlink_conn);
+        } else {
+            pending = true;
+        }
     }
 
-    close(mlink_conn->sockfd);
-    mlink_connection_remove(mlink_conn);
+    xSemaphoreGive(g_conn_lock);
+
+    if (pending) {
+        xTimerStart(g_flush_timer, 0);
+    }
 }
 
-static mlink_connection_t *mlink_connection_find(uint16_t sockfd)
+/**
+ * @brief Append data to the output queue of the connection, the caller must hold g_conn_lock
+ */
+static mdf_err_t mlink_connection_output(mlink_connection_t *mlink_conn, const char *header,
+        const char *data, size_t size, const char *footer)
 {
-    for (int i = 0; i < MLINK_HTTPD_MAX_CONNECT; ++i) {
-        if (g_conn_list[i].sockfd == sockfd && g_conn_list[i].flag != MLINK_HTTPD_CHUNKS_NONE) {
-            return g_conn_list + i;
+    size_t header_size = header ? strlen(header) : 0;
+    size_t footer_size = footer ? strlen(footer) : 0;
+    size_t total_size  = header_size + size + footer_size;
+
+    if (mlink_conn->output && mlink_conn->output_size + total_size > MLINK_HTTPD_OUTPUT_MAX_SIZE) {
+        MDF_LOGW("Mlink connection output is full, sockfd: %d, output_size: %d",
+                 mlink_conn->sockfd, mlink_conn->output_size);
+        g_httpd_stats.output_dropped++;
+        return MDF_ERR_BUF;
+    }
+
+    mlink_httpd_output_t *output = MDF_MALLOC(sizeof(mlink_httpd_output_t) + total_size);
+    MDF_ERROR_CHECK(!output, MDF_ERR_NO_MEM, "");
+
+    output->next   = NULL;
+    output->size   = total_size;
+    output->offset = 0;
+
+    if (header_size) {
+        memcpy(output->data, header, header_size);
+    }
+
+    if (size) {
+        memcpy(output->data + header_size, data, size);
+    }
+
+    if (footer_size) {
+        memcpy(output->data + header_size + size, footer, footer_size);
+    }
+
+    mlink_httpd_output_t **tail = &mlink_conn->output;
+
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+
+    *tail = output;
+    mlink_conn->output_size += total_size;
+
+    return MDF_OK;
+}
+
+static void mlink_connection_timeout_cb(void *timer)
+{
+    const char *chunk_footer       = "0\r\n\r\n";
+    uint32_t index                 = (uint32_t)pvTimerGetTimerID(timer);
+    mlink_connection_t *mlink_conn = NULL;
+
+    /**
+     * @brief Never block the timer service task, whoever holds the lock may be
+     *        waiting for it. Check again shortly as the flush timer does.
+     */
+    if (xSemaphoreTake(g_conn_lock, 0) != pdTRUE) {
+        xTimerChangePeriod(timer, pdMS_TO_TICKS(MLINK_HTTPD_FLUSH_RETRY_MS), 0);
+        return;
+    }
+
+    /**
+     * @brief The timer is bound to the index of the slot, not to its address. A late expiry
+     *        of a removed connection must not close the one that reused the slot, nor touch
+     *        the list freed by mlink_httpd_stop()
+     */
+    if (!g_conn_list) {
+        goto EXIT;
+    }
+
+    mlink_conn = g_conn_list + index;
+
+    if (mlink_conn->timer != timer || mlink_conn->flag == MLINK_HTTPD_CHUNKS_NONE) {
+        goto EXIT;
+    }
+
+    /**< The client stopped reading, give up the pending output */
+    if (mlink_conn->finished || mlink_conn->output) {
+        MDF_LOGW("Mlink httpd output timeout, sockfd: %d, output_size: %d",
+                 mlink_conn->sockfd, mlink_conn->output_size);
+        mlink_connection_output_free(mlink_conn);
+    } else {
+        if (mlink_conn->flag != MLINK_HTTPD_CHUNKS_BODY) {
+            chunk_footer = "HTTP/1.1 400 Bad Request\r\n"
+                           "Content-Type: application/json\r\n"
+                           "Content-Length: 79\r\n\r\n"
+                           "{\"status_code\":-1,\"status_msg\":\"Destination address error, No device response\"}";
         }
+
+        mlink_connection_output(mlink_conn, NULL, chunk_footer, strlen(chunk_footer), NULL);
+        MDF_LOGW("Mlink httpd response timeout, sockfd: %d, data: %s", mlink_conn->sockfd, chunk_footer);
     }
 
-    MDF_LOGW("Mlink chunks is no find, sockfd: %d", sockfd);
-    return NULL;
+    mlink_conn->flag     = MLINK_HTTPD_CHUNKS_DATA;
+    mlink_conn->finished = true;
+    mlink_conn->close    = true;
+    mlink_connection_flush_schedule(mlink_conn);
+
+EXIT:
+    xSemaphoreGive(g_conn_lock);
+}
+
+/**
+ * @brief Count an event of the http server, g_httpd_stats is guarded by g_conn_lock
+ */
+static void mlink_httpd_stats_count(uint32_t *counter)
+{
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+    (*counter)++;
+    xSemaphoreGive(g_conn_lock);
 }
 
 static mdf_err_t mlink_connection_add(httpd_req_t *req, uint16_t chunks_num)
 {
+    mdf_err_t ret = MDF_FAIL;
+
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+
     for (int i = 0; i < MLINK_HTTPD_MAX_CONNECT; ++i) {
         if (g_conn_list[i].flag == MLINK_HTTPD_CHUNKS_NONE) {
             g_conn_list[i].num    = chunks_num;
@@ -207,17 +418,50 @@ static mdf_err_t mlink_connection_add(httpd_req_t *req, uint16_t chunks_num)
             g_conn_list[i].handle = req->handle;
             g_conn_list[i].sockfd = httpd_req_to_sockfd(req);
             g_conn_list[i].timer  = xTimerCreate("chunk_timer", MLINK_HTTPD_RESP_TIMEROUT_MS / portTICK_RATE_MS,
-                                                 false, g_conn_list + i, mlink_connection_timeout_cb);
-            MDF_ERROR_CHECK(!g_conn_list[i].timer, MDF_FAIL, "xTimerCreate mlink_conn fail");
-            xTimerStart(g_conn_list[i].timer, portMAX_DELAY);
+                                                 false, (void *)(uint32_t)i, mlink_connection_timeout_cb);
+
+            if (!g_conn_list[i].timer) {
+                MDF_LOGW("xTimerCreate mlink_conn fail");
+                g_conn_list[i].flag = MLINK_HTTPD_CHUNKS_NONE;
+                break;
+            }
+
+            /**< A connection without its timeout would wait for the responses forever */
+            if (xTimerStart(g_conn_list[i].timer, pdMS_TO_TICKS(MLINK_HTTPD_TIMER_WAIT_MS)) != pdPASS) {
+                MDF_LOGW("xTimerStart mlink_conn fail");
+                mlink_connection_remove(g_conn_list + i);
+                break;
+            }
 
             mlink_socket_keepalive(g_conn_list[i].sockfd, 10, 3, 3);
-            return MDF_OK;
+            ret = MDF_OK;
+            break;
         }
     }
 
-    MDF_LOGW("Mlink chunks add");
-    return MDF_FAIL;
+    xSemaphoreGive(g_conn_lock);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("Mlink chunks add");
+    }
+
+    return ret;
+}
+
+static bool mlink_connection_is_busy(uint16_t sockfd)
+{
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+    bool busy = mlink_connection_find(sockfd) != NULL;
+    xSemaphoreGive(g_conn_lock);
+
+    return busy;
+}
+
+static void mlink_connection_cancel(uint16_t sockfd)
+{
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+    mlink_connection_remove(mlink_connection_find(sockfd));
+    xSemaphoreGive(g_conn_lock);
 }
 
 static mdf_err_t mlink_get_mesh_info(httpd_req_t *req)
@@ -302,6 +546,94 @@ static ssize_t mlink_httpd_get_hdr(httpd_req_t *req, const char *field, char **v
     return size;
 }
 
+static inline int mlink_httpd_hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Get the optional SHA-256 of the firmware, 64 hex digits in the Firmware-Sha256 header
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_FOUND, the header is absent
+ *    - MDF_ERR_INVALID_ARG, the digest is malformed
+ */
+static mdf_err_t mlink_httpd_get_sha256(httpd_req_t *req, uint8_t sha256[32])
+{
+    char sha256_str[65] = {0x0};
+
+    if (!httpd_req_get_hdr_value_len(req, "Firmware-Sha256")) {
+        return MDF_ERR_NOT_FOUND;
+    }
+
+    MDF_ERROR_CHECK(httpd_req_get_hdr_value_len(req, "Firmware-Sha256") != 64
+                    || httpd_req_get_hdr_value_str(req, "Firmware-Sha256", sha256_str, sizeof(sha256_str)) != MDF_OK,
+                    MDF_ERR_INVALID_ARG, "The length of Firmware-Sha256 is wrong");
+
+    for (int i = 0; i < 32; ++i) {
+        int high = mlink_httpd_hex_value(sha256_str[i * 2]);
+        int low  = mlink_httpd_hex_value(sha256_str[i * 2 + 1]);
+        MDF_ERROR_CHECK(high < 0 || low < 0, MDF_ERR_INVALID_ARG, "Invalid Firmware-Sha256, offset: %d", i * 2);
+
+        sha256[i] = (high << 4) | low;
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Convert a comma separated list of 12-digit MAC strings to an address list
+ *
+ * @return Number of addresses, or MDF_FAIL if the list is malformed
+ */
+static ssize_t mlink_httpd_parse_addrs(const char *addrs_str, uint8_t **addrs_list)
+{
+    size_t addrs_num = 1;
+    uint8_t *addr    = NULL;
+
+    for (const char *tmp = addrs_str; *tmp; ++tmp) {
+        addrs_num += (*tmp == ',');
+    }
+
+    *addrs_list = MDF_MALLOC(addrs_num * MWIFI_ADDR_LEN);
+    MDF_ERROR_CHECK(!*addrs_list, MDF_FAIL, "");
+
+    addr = *addrs_list;
+
+    for (const char *tmp = addrs_str;; addr += MWIFI_ADDR_LEN) {
+        for (int i = 0; i < MWIFI_ADDR_LEN; ++i, tmp += 2) {
+            int high = mlink_httpd_hex_value(tmp[0]);
+            int low  = (high < 0) ? -1 : mlink_httpd_hex_value(tmp[1]);
+            MDF_ERROR_GOTO(low < 0, ERR, "Invalid address, offset: %d", tmp - addrs_str);
+
+            addr[i] = (high << 4) | low;
+        }
+
+        if (*tmp == '\0') {
+            break;
+        }
+
+        MDF_ERROR_GOTO(*tmp != ',', ERR, "Invalid separator, offset: %d", tmp - addrs_str);
+
+        for (tmp++; *tmp == ' '; tmp++);
+    }
+
+    return addrs_num;
+
+ERR:
+    MDF_FREE(*addrs_list);
+    return MDF_FAIL;
+}
+
 static esp_err_t mlink_httpd_resp(httpd_req_t *req, const char *status_code, const char *message)
 {
     char *data    = NULL;
@@ -324,6 +656,17 @@ EXIT:
     return ret;
 }
 
+/**
+ * @brief Reject a request the root can not take now, the client should retry later
+ */
+static esp_err_t mlink_httpd_resp_busy(httpd_req_t *req, const char *status_code, const char *message)
+{
+    mdf_err_t ret = httpd_resp_set_hdr(req, "Retry-After", MLINK_HTTPD_RETRY_AFTER);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Append any additional headers");
+
+    return mlink_httpd_resp(req, status_code, message);
+}
+
 static esp_err_t mlink_httpd_resp_200(httpd_req_t *req)
 {
     mdf_err_t ret           = MDF_FAIL;
@@ -343,7 +686,29 @@ static esp_err_t mlink_device_request(httpd_req_t *req)
     esp_err_t ret               = MDF_FAIL;
     char *httpd_hdr_value       = NULL;
     ssize_t httpd_hdr_value_len = 0;
-    mlink_httpd_t *httpd_data   = MDF_CALLOC(1, sizeof(mlink_httpd_t));
+    mlink_httpd_t *httpd_data   = NULL;
+
+    /**
+     * @brief A mesh packet carries the whole body, refuse what can not be
+     *        forwarded before anything is allocated or read, mwifi_root_write
+     *        does not send an empty packet either
+     */
+    if (req->content_len == 0) {
+        MDF_LOGW("Request body is empty");
+        return mlink_httpd_resp(req, HTTPD_400, "Request body is empty");
+    }
+
+    if (req->content_len > MLINK_HTTPD_BODY_MAX_SIZE) {
+        MDF_LOGW("Request body is too large, content_len: %d, max_size: %d",
+                 req->content_len, MLINK_HTTPD_BODY_MAX_SIZE);
+        return mlink_httpd_resp(req, MLINK_HTTPD_413, "Request body is too large");
+    }
+
+    httpd_data = MDF_CALLOC(1, sizeof(mlink_httpd_t));
+
+    if (!httpd_data) {
+        return httpd_resp_send_500(req);
+    }
 
     httpd_hdr_value_len = mlink_httpd_get_hdr(req, "Content-Type", &httpd_hdr_value);
     MDF_ERROR_GOTO(httpd_hdr_value_len <= 0, EXIT, "Get 'Content-Type' from the request headers");
@@ -369,6 +734,24 @@ static esp_err_t mlink_device_request(httpd_req_t *req)
 
     MDF_FREE(httpd_hdr_value);
 
+    /**
+     * @brief Reject before reading the body, so a busy root does not
+     *        buffer requests it can not forward
+     */
+    if (!uxQueueSpacesAvailable(g_mlink_queue)) {
+        MDF_LOGW("Mlink data queue is full, sockfd: %d", httpd_req_to_sockfd(req));
+        mlink_httpd_stats_count(&g_httpd_stats.request_rejected);
+        ret = mlink_httpd_resp_busy(req, MLINK_HTTPD_503, "Request queue is full");
+        goto EXIT;
+    }
+
+    if (httpd_data->type.resp && mlink_connection_is_busy(httpd_req_to_sockfd(req))) {
+        MDF_LOGW("Response still pending, sockfd: %d", httpd_req_to_sockfd(req));
+        mlink_httpd_stats_count(&g_httpd_stats.request_throttled);
+        ret = mlink_httpd_resp_busy(req, MLINK_HTTPD_429, "Previous request is still pending");
+        goto EXIT;
+    }
+
     httpd_hdr_value_len = mlink_httpd_get_hdr(req, "Mesh-Node-Group", &httpd_hdr_value);
 
     if (httpd_hdr_value_len > 0) {
@@ -383,80 +766,90 @@ static esp_err_t mlink_device_request(httpd_req_t *req)
         }
     }
 
-    httpd_data->addrs_list = MDF_MALLOC(httpd_hdr_value_len / 2);
-    MDF_ERROR_CHECK(!httpd_data->addrs_list, MDF_ERR_NO_MEM, "");
-
-    for (char *tmp = httpd_hdr_value;; tmp++) {
-        if (*tmp == ',' || *tmp == '\0') {
-            mlink_mac_str2hex(tmp - 12, httpd_data->addrs_list + (httpd_data->addrs_num * MWIFI_ADDR_LEN));
-            httpd_data->addrs_num++;
+    ret = mlink_httpd_parse_addrs(httpd_hdr_value, &httpd_data->addrs_list);
+    MDF_FREE(httpd_hdr_value);
 
-            if (*tmp == '\0') {
-                break;
-            }
-        }
+    if (ret <= 0) {
+        MDF_LOGW("Destination address format error");
+        ret = mlink_httpd_resp(req, HTTPD_400, "Destination address format error");
+        goto EXIT;
     }
 
-    MDF_FREE(httpd_hdr_value);
+    httpd_data->addrs_num = ret;
     MDF_LOGD("dest_addrs_num: %d", httpd_data->addrs_num);
 
-    if (httpd_data->addrs_num == 0) {
-        MDF_LOGW("Destination address format error");
-        mlink_httpd_resp(req, HTTPD_400, "Destination address format error");
+    httpd_data->data = MDF_MALLOC(req->content_len);
+
+    if (!httpd_data->data) {
+        ret = httpd_resp_send_500(req);
         goto EXIT;
     }
 
-    httpd_data->size = req->content_len;
-    httpd_data->data = MDF_MALLOC(req->content_len);
-    MDF_ERROR_CHECK(!httpd_data->data, MDF_ERR_NO_MEM, "");
+    /**
+     * @brief Receive the body one mesh payload at a time, each window gets
+     *        its own timeout budget so a slow sender is not cut off early
+     */
+    for (int retry = MLINK_HTTPD_RECV_RETRY; httpd_data->size < req->content_len;) {
+        ret = httpd_req_recv(req, httpd_data->data + httpd_data->size,
+                             MIN(req->content_len - httpd_data->size, MWIFI_PAYLOAD_LEN));
+
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT && --retry > 0) {
+            MDF_LOGD("<HTTPD_SOCK_ERR_TIMEOUT> Read content data from the HTTP request");
+            continue;
+        } else if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            httpd_resp_send_408(req);
+            ret = ESP_FAIL;
+            goto EXIT;
+        }
 
-    for (int i = 0, recv_size = 0; i < 5 && recv_size < req->content_len; ++i, recv_size += ret) {
-        ret = httpd_req_recv(req, httpd_data->data + recv_size, req->content_len - recv_size);
-        MDF_ERROR_CONTINUE(ret == HTTPD_SOCK_ERR_TIMEOUT, "<HTTPD_SOCK_ERR_TIMEOUT> Read content data from the HTTP request");
         MDF_ERROR_GOTO(ret <= 0, EXIT, "<%s> Read content data from the HTTP request",
                        mdf_err_to_name(ret));
-    }
 
-    if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-        ret = httpd_resp_send_408(req);
-        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Helper function for HTTP 408");
+        httpd_data->size += ret;
+        retry = MLINK_HTTPD_RECV_RETRY;
     }
 
-    if (!httpd_data->type.resp) {
-        mlink_httpd_resp_200(req);
-    } else {
+    if (httpd_data->type.resp) {
+        uint16_t chunks_num = httpd_data->addrs_num;
         httpd_data->type.sockfd = httpd_req_to_sockfd(req);
 
         if (httpd_data->addrs_num == 1
                 && (MWIFI_ADDR_IS_ANY(httpd_data->addrs_list)
                     || MWIFI_ADDR_IS_BROADCAST(httpd_data->addrs_list))) {
-            mlink_connection_add(req, esp_mesh_get_routing_table_size());
-        } else {
-            mlink_connection_add(req, httpd_data->addrs_num);
+            chunks_num = esp_mesh_get_routing_table_size();
         }
-    }
-
-    /**< If g_mlink_queue is full, delete the front item */
-    mlink_httpd_t *q_data = NULL;
 
-    if (!uxQueueSpacesAvailable(g_mlink_queue)
-            && xQueueReceive(g_mlink_queue, &q_data, 0)) {
-        MDF_LOGW("Mlink data queue is full, delete the front item");
-        MDF_FREE(q_data->addrs_list);
-        MDF_FREE(q_data->data);
-        MDF_FREE(q_data);
+        if (mlink_connection_add(req, chunks_num) != MDF_OK) {
+            mlink_httpd_stats_count(&g_httpd_stats.request_rejected);
+            ret = mlink_httpd_resp_busy(req, MLINK_HTTPD_503, "Too many pending responses");
+            goto EXIT;
+        }
     }
 
+    /**< httpd_data belongs to the reader once it is queued */
+    bool root_response = !httpd_data->type.resp;
+
     if (xQueueSend(g_mlink_queue, &httpd_data, 0) == pdFALSE) {
         MDF_LOGW("xQueueSend failed");
-        ret = ESP_FAIL;
+        mlink_httpd_stats_count(&g_httpd_stats.request_rejected);
 
-        ret = httpd_resp_send_500(req);
-        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Helper function for HTTP 408");
+        if (httpd_data->type.resp) {
+            mlink_connection_cancel(httpd_data->type.sockfd);
+        }
 
+        ret = mlink_httpd_resp_busy(req, MLINK_HTTPD_503, "Request queue is full");
         goto EXIT;
     }
 
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+    g_httpd_stats.queue_depth_max = MAX(g_httpd_stats.queue_depth_max,
+                                        uxQueueMessagesWaiting(g_mlink_queue));
+    xSemaphoreGive(g_conn_lock);
+
+    if (root_response) {
+        mlink_httpd_resp_200(req);
+    }
+
     return ESP_OK;
 
 EXIT:
@@ -495,6 +888,7 @@ static esp_err_t mlink_ota_firmware(httpd_req_t *req)
 {
     mdf_err_t ret               = MDF_FAIL;
     char firmware_name[32]      = {0x0};
+    uint8_t firmware_sha256[32] = {0x0};
     int start_time              = xTaskGetTickCount();
     char *buf                   = NULL;
     size_t firmware_size        = req->content_len;
@@ -519,23 +913,28 @@ static esp_err_t mlink_ota_firmware(httpd_req_t *req)
         goto EXIT;
     }
 
-    addrs_list = MDF_REALLOC_RETRY(NULL, httpd_hdr_value_len / 2);
+    ret = mlink_httpd_parse_addrs(httpd_hdr_value, &addrs_list);
 
-    for (char *tmp = httpd_hdr_value;; tmp++) {
-        if (*tmp == ',' || *tmp == '\0') {
-            mlink_mac_str2hex(tmp - 12, addrs_list + addrs_num * MWIFI_ADDR_LEN);
-            addrs_num++;
-
-            if (*tmp == '\0') {
-                break;
-            }
-        }
+    if (ret <= 0) {
+        mlink_httpd_resp(req, HTTPD_400, "Destination address format error");
+        ret = MDF_FAIL;
+        goto EXIT;
     }
 
+    addrs_num = ret;
+
     MDF_LOGD("dest_addrs_num: %d, httpd_data: %s", addrs_num, httpd_hdr_value);
     MDF_FREE(httpd_hdr_value);
 
-    ret = mupgrade_firmware_init(firmware_name, firmware_size);
+    ret = mlink_httpd_get_sha256(req, firmware_sha256);
+
+    if (ret == MDF_ERR_INVALID_ARG) {
+        mlink_httpd_resp(req, HTTPD_400, "Firmware-Sha256 format error");
+        goto EXIT;
+    }
+
+    /**< The root rejects the firmware if it does not match the digest */
+    ret = mupgrade_firmware_init_sha256(firmware_name, firmware_size, (ret == MDF_OK) ? firmware_sha256 : NULL);
 
     if (ret != MDF_OK) {
         MDF_LOGW("<%s> Initialize the upgrade status", mdf_err_to_name(ret));
@@ -596,6 +995,7 @@ static esp_err_t mlink_ota_url(httpd_req_t *req)
 {
     mdf_err_t ret               = MDF_FAIL;
     char *firmware_name         = NULL;
+    uint8_t firmware_sha256[32] = {0x0};
     int start_time              = xTaskGetTickCount();
     char *buf                   = NULL;
     size_t firmware_size        = 0;
@@ -627,19 +1027,16 @@ static esp_err_t mlink_ota_url(httpd_req_t *req)
         goto EXIT;
     }
 
-    addrs_list = MDF_REALLOC_RETRY(NULL, httpd_hdr_value_len / 2);
+    ret = mlink_httpd_parse_addrs(httpd_hdr_value, &addrs_list);
 
-    for (char *tmp = httpd_hdr_value;; tmp++) {
-        if (*tmp == ',' || *tmp == '\0') {
-            mlink_mac_str2hex(tmp - 12, addrs_list + addrs_num * MWIFI_ADDR_LEN);
-            addrs_num++;
-
-            if (*tmp == '\0') {
-                break;
-            }
-        }
+    if (ret <= 0) {
+        mlink_httpd_resp(req, HTTPD_400, "Destination address format error");
+        ret = MDF_FAIL;
+        goto EXIT;
     }
 
+    addrs_num = ret;
+
     MDF_LOGD("dest_addrs_num: %d, httpd_data: %s", addrs_num, httpd_hdr_value);
     MDF_FREE(httpd_hdr_value);
 
@@ -676,7 +1073,14 @@ static esp_err_t mlink_ota_url(httpd_req_t *req)
 
     MDF_LOGD("firmware, name: %s, size: %d", firmware_name, firmware_size);
 
-    ret = mupgrade_firmware_init(firmware_name, firmware_size);
+    ret = mlink_httpd_get_sha256(req, firmware_sha256);
+
+    if (ret == MDF_ERR_INVALID_ARG) {
+        mlink_httpd_resp(req, HTTPD_400, "Firmware-Sha256 format error");
+        goto EXIT;
+    }
+
+    ret = mupgrade_firmware_init_sha256(firmware_name, firmware_size, (ret == MDF_OK) ? firmware_sha256 : NULL);
 
     if (ret != MDF_OK) {
         MDF_LOGW("<%s> Initialize the upgrade status", mdf_err_to_name(ret));
@@ -784,16 +1188,13 @@ mdf_err_t mlink_httpd_write(const mlink_httpd_t *response, TickType_t wait_ticks
     MDF_PARAM_CHECK(response);
     MDF_ERROR_CHECK(!g_httpd_handle, MDF_ERR_NOT_INIT, "mlink_httpd is stop");
 
-    mdf_err_t ret    = MDF_FAIL;
-    char mac_str[13] = {0};
-    size_t resp_size = 0;
-    char *resp_data  = NULL;
-
-    /**
-      * @brief For sending out data in response to an HTTP request.
-      */
-    mlink_connection_t *mlink_conn = mlink_connection_find(response->type.sockfd);
-    MDF_ERROR_CHECK(mlink_conn == NULL, MDF_FAIL, "mlink_connection_find");
+    mdf_err_t ret            = MDF_FAIL;
+    char mac_str[13]         = {0};
+    size_t resp_size         = 0;
+    char *resp_data          = NULL;
+    const char *chunk_header = NULL;
+    const char *chunk_footer = NULL;
+    char chunk_size[128]     = {0};
 
     /**
      * @brief Generate a packet for the http response
@@ -804,77 +1205,89 @@ mdf_err_t mlink_httpd_write(const mlink_httpd_t *response, TickType_t wait_ticks
     mlink_httpd_resp_set_hdr(&resp_data, "Mesh-Node-Mac", mlink_mac_hex2str(response->addrs_list, mac_str));
     resp_size = mlink_httpd_resp_set_data(&resp_data, response->data, response->size);
 
-    if (wait_ticks != portMAX_DELAY) {
-        int send_timeout_ms = wait_ticks * portTICK_PERIOD_MS;
-        struct timeval timeout = {
-            .tv_usec = (send_timeout_ms % 1000) * 1000,
-            .tv_sec = send_timeout_ms / 1000,
-        };
-
-        ret = setsockopt(mlink_conn->sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-        MDF_ERROR_GOTO(ret < 0, EXIT, "<%s> Set send timeout", strerror(errno));
+    if (xSemaphoreTake(g_conn_lock, wait_ticks) != pdTRUE) {
+        MDF_LOGW("Mlink connection list is busy");
+        MDF_FREE(resp_data);
+        return MDF_ERR_TIMEOUT;
     }
 
-    if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_HEADER) {
-        char *chunk_header =
-            "HTTP/1.1 200 OK\r\n"
-            "Content-Type: application/http\r\n"
-            "Transfer-Encoding: chunked\r\n\r\n";
-
-        MDF_LOGD("send chunk_header, sockfd: %d, chunk_header: %s", mlink_conn->sockfd, chunk_header);
-        ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, chunk_header, strlen(chunk_header), 0);
-        MDF_ERROR_GOTO(ret <= 0, EXIT, "This is the low level default send function of the HTTPD");
+    /**
+      * @brief For sending out data in response to an HTTP request.
+      */
+    mlink_connection_t *mlink_conn = mlink_connection_find(response->type.sockfd);
+    MDF_ERROR_GOTO(!mlink_conn || mlink_conn->finished, EXIT,
+                   "Mlink chunks is no find, sockfd: %d", response->type.sockfd);
 
+    if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_HEADER) {
+        strcpy(chunk_size, "HTTP/1.1 200 OK\r\n"
+               "Content-Type: application/http\r\n"
+               "Transfer-Encoding: chunked\r\n\r\n");
         mlink_conn->flag = MLINK_HTTPD_CHUNKS_BODY;
     }
 
     if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_BODY) {
-        char chunk_size[16] = {0};
-        sprintf(chunk_size, "%x\r\n", resp_size);
-
-        if (mlink_conn->timer) {
-            xTimerReset(mlink_conn->timer, portMAX_DELAY);
-        }
-
-        MDF_LOGD("send chunk_size, sockfd: %d, data: %s", mlink_conn->sockfd, chunk_size);
-        ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, chunk_size, strlen(chunk_size), 0);
-        MDF_ERROR_GOTO(ret <= 0, EXIT, "<%s> This is the low level default send function of the HTTPD", strerror(errno));
+        sprintf(chunk_size + strlen(chunk_size), "%x\r\n", resp_size);
+        chunk_header = chunk_size;
 
         resp_data[resp_size++] = '\r';
         resp_data[resp_size++] = '\n';
     }
 
-    resp_data[resp_size] = '\0';
-
-    MDF_LOGD("size: %d, resp_data: %.*s", resp_size, resp_size, resp_data);
-    ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, resp_data, resp_size, 0);
-    MDF_ERROR_GOTO(ret <= 0, EXIT, "<%s> httpd_default_send, sockfd: %d",
-                   strerror(errno), mlink_conn->sockfd);
-
     mlink_conn->num--;
     MDF_LOGD("mlink_conn->num: %d", mlink_conn->num);
 
-    if (mlink_conn->num > 0) {
-        ret = MDF_OK;
-        goto EXIT;
+    if (mlink_conn->num == 0) {
+        if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_BODY) {
+            chunk_footer = "0\r\n\r\n";
+        }
+
+        mlink_conn->finished = true;
     }
 
-    if (mlink_conn->flag == MLINK_HTTPD_CHUNKS_BODY) {
-        char *chunk_footer = "0\r\n\r\n";
+    /**
+     * @brief The response is queued on the connection and sent by the http
+     *        server task, so a slow client never blocks the caller
+     */
+    MDF_LOGD("size: %d, resp_data: %.*s", resp_size, resp_size, resp_data);
+    ret = mlink_connection_output(mlink_conn, chunk_header, resp_data, resp_size, chunk_footer);
 
-        MDF_LOGD("send chunk_footer, sockfd: %d, data: %s", mlink_conn->sockfd, chunk_footer);
-        ret = httpd_default_send(mlink_conn->handle, mlink_conn->sockfd, chunk_footer, strlen(chunk_footer), 0);
-        MDF_ERROR_GOTO(ret <= 0, EXIT, "This is the low level default send function of the HTTPD");
+    if (ret == MDF_ERR_BUF && chunk_footer) {
+        mlink_connection_output(mlink_conn, NULL, chunk_footer, strlen(chunk_footer), NULL);
     }
 
-    mlink_connection_remove(mlink_conn);
-    ret = MDF_OK;
+    /**< Restore the full timeout, the period is shortened while the timeout waits for the lock */
+    if (mlink_conn->timer) {
+        xTimerChangePeriod(mlink_conn->timer, pdMS_TO_TICKS(MLINK_HTTPD_RESP_TIMEROUT_MS), 0);
+    }
+
+    mlink_connection_flush_schedule(mlink_conn);
 
 EXIT:
+    xSemaphoreGive(g_conn_lock);
     MDF_FREE(resp_data);
     return ret;
 }
 
+mdf_err_t mlink_httpd_get_stats(mlink_httpd_stats_t *stats)
+{
+    MDF_PARAM_CHECK(stats);
+    MDF_ERROR_CHECK(!g_conn_lock, MDF_ERR_NOT_INIT, "mlink_httpd is not started");
+
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+
+    memcpy(stats, &g_httpd_stats, sizeof(mlink_httpd_stats_t));
+    stats->queue_depth    = g_mlink_queue ? uxQueueMessagesWaiting(g_mlink_queue) : 0;
+    stats->output_pending = 0;
+
+    for (int i = 0; g_conn_list && i < MLINK_HTTPD_MAX_CONNECT; ++i) {
+        stats->output_pending += g_conn_list[i].output_size;
+    }
+
+    xSemaphoreGive(g_conn_lock);
+
+    return MDF_OK;
+}
+
 mdf_err_t mlink_httpd_read(mlink_httpd_t **request, TickType_t wait_ticks)
 {
     MDF_PARAM_CHECK(request);
@@ -882,7 +1295,7 @@ mdf_err_t mlink_httpd_read(mlink_httpd_t **request, TickType_t wait_ticks)
     mdf_err_t ret = MDF_OK;
 
     if (!g_mlink_queue) {
-        g_mlink_queue = xQueueCreate(3, sizeof(mlink_httpd_t *));
+        g_mlink_queue = xQueueCreate(MLINK_HTTPD_QUEUE_SIZE, sizeof(mlink_httpd_t *));
     }
 
     ret = xQueueReceive(g_mlink_queue, request, wait_ticks);
@@ -929,7 +1342,7 @@ mdf_err_t mlink_httpd_start(void)
     MDF_LOGD("Max stack size    : %d", config.stack_size);
 
     if (!g_mlink_queue) {
-        g_mlink_queue = xQueueCreate(3, sizeof(mlink_httpd_t *));
+        g_mlink_queue = xQueueCreate(MLINK_HTTPD_QUEUE_SIZE, sizeof(mlink_httpd_t *));
     }
 
     if (!g_conn_list) {
@@ -937,6 +1350,17 @@ mdf_err_t mlink_httpd_start(void)
         MDF_ERROR_CHECK(!g_conn_list, MDF_ERR_NO_MEM, "");
     }
 
+    if (!g_conn_lock) {
+        g_conn_lock = xSemaphoreCreateMutex();
+        MDF_ERROR_CHECK(!g_conn_lock, MDF_ERR_NO_MEM, "");
+    }
+
+    if (!g_flush_timer) {
+        g_flush_timer = xTimerCreate("mlink_flush", pdMS_TO_TICKS(MLINK_HTTPD_FLUSH_RETRY_MS),
+                                     false, NULL, mlink_connection_flush_timer_cb);
+        MDF_ERROR_CHECK(!g_flush_timer, MDF_ERR_NO_MEM, "");
+    }
+
     ret = httpd_start(&g_httpd_handle, &config);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "Starts the web server");
 
@@ -963,6 +1387,9 @@ mdf_err_t mlink_httpd_stop(void)
     g_httpd_handle = NULL;
     xQueueSend(g_mlink_queue, &mlink_queue_exit, 0);
 
+    xTimerStop(g_flush_timer, 0);
+    xSemaphoreTake(g_conn_lock, portMAX_DELAY);
+
     if (g_conn_list) {
         for (int i = 0; i < MLINK_HTTPD_MAX_CONNECT; ++i) {
             mlink_connection_remove(g_conn_list + i);
@@ -971,5 +1398,7 @@ mdf_err_t mlink_httpd_stop(void)
         MDF_FREE(g_conn_list);
     }
 
+    xSemaphoreGive(g_conn_lock);
+
     return MDF_OK;
 }
@@ -27,17 +27,43 @@ typedef struct {
     uint8_t payload[0];
 } sniffer_payload_t;
 
-typedef struct sniffer_data_list {
-    struct sniffer_data_list *next;
-    mlink_sniffer_data_t data;
-} __attribute__((packed)) sniffer_data_list_t;
+/**
+ * @brief Largest packet: addr, timestamp and rssi plus name and manufacturer
+ *        taken from at most 62 bytes of advertising and scan response data
+ */
+#define SNIFFER_DATA_MAX_SIZE   (sizeof(mlink_sniffer_data_t) + 21 + 62)
+#define SNIFFER_INDEX_NONE      0xFFFF
+
+/**
+ * @brief A slot of the ring, the packet is kept in the format it is reported in
+ */
+typedef struct {
+    uint8_t addr[6];
+    uint16_t hash_next; /**< Next slot in the same hash bucket */
+    uint32_t seen_time; /**< When the device was last seen, in ms */
+    union {
+        mlink_sniffer_data_t data;
+        uint8_t buffer[SNIFFER_DATA_MAX_SIZE];
+    };
+} sniffer_record_t;
+
+/**
+ * @brief Fixed capacity ring of records, indexed by a hash of the address.
+ *        The first count slots are used, a full ring evicts the device seen the longest time ago
+ */
+typedef struct {
+    uint16_t capacity;     /**< Number of slots */
+    uint16_t count;        /**< Number of records in the ring */
+    uint16_t bucket_mask;  /**< Number of hash buckets minus one */
+    uint16_t *buckets;     /**< First slot of each hash bucket */
+    sniffer_record_t *records;
+} sniffer_ring_t;
 
 #define sniffer_timestamp() (xTaskGetTickCount() * portTICK_RATE_MS)
 
 static const char *TAG       = "mlink_sniffer";
 static void *g_sniffer_lock  = NULL;
-static uint32_t g_device_num = 0;
-static sniffer_data_list_t *g_sniffer_list = NULL;
+static sniffer_ring_t g_sniffer_ring = {0};
 static mlink_sniffer_config_t g_sniffer_config   = {
     .enable_type       = MLINK_SNIFFER_NONE,
     .notice_percentage = 50,
@@ -85,79 +111,161 @@ static uint8_t *ltv_data_get(const uint8_t *data, uint8_t type,
     return NULL;
 }
 
-static mdf_err_t mlink_sniffer_list_insert(const mlink_sniffer_data_t *sniffer_data)
+static uint16_t sniffer_hash(const uint8_t *addr)
 {
-    sniffer_data_list_t *sniffer_node = NULL;
-    uint8_t addr_len                  = 0;
-    static int notice_percentage      = 0;
-    uint8_t *sniffer_data_addr        = ltv_data_get(sniffer_data->data, MLINK_SNIFFER_DATA_ADDR,
-                                        sniffer_data->size - 1, &addr_len);
+    return (mdf_addr_hash(addr) >> 16) & g_sniffer_ring.bucket_mask;
+}
+
+static void sniffer_ring_clear()
+{
+    g_sniffer_ring.count = 0;
+    memset(g_sniffer_ring.buckets, 0xFF, (g_sniffer_ring.bucket_mask + 1) * sizeof(uint16_t));
+}
+
+static void sniffer_ring_free()
+{
+    MDF_FREE(g_sniffer_ring.buckets);
+    MDF_FREE(g_sniffer_ring.records);
+    memset(&g_sniffer_ring, 0, sizeof(sniffer_ring_t));
+}
+
+/**
+ * @brief Allocate the ring once for config.buffer_num devices,
+ *        no memory is allocated while packets are captured
+ */
+static mdf_err_t sniffer_ring_create()
+{
+    uint16_t capacity    = MIN(MAX(g_sniffer_config.buffer_num, 1), SNIFFER_INDEX_NONE - 1);
+    uint16_t bucket_num  = 1;
 
-    if (!g_sniffer_list) {
-        g_sniffer_list       = MDF_MALLOC(sizeof(sniffer_data_list_t));
-        g_sniffer_list->next = NULL;
+    if (g_sniffer_ring.records && g_sniffer_ring.capacity == capacity) {
+        return MDF_OK;
     }
 
-    if (!g_sniffer_lock) {
-        g_sniffer_lock  = xSemaphoreCreateMutex();
+    sniffer_ring_free();
+
+    for (; bucket_num < capacity; bucket_num <<= 1);
+
+    g_sniffer_ring.records = MDF_MALLOC(capacity * sizeof(sniffer_record_t));
+    g_sniffer_ring.buckets = MDF_MALLOC(bucket_num * sizeof(uint16_t));
+
+    if (!g_sniffer_ring.records || !g_sniffer_ring.buckets) {
+        sniffer_ring_free();
+        return MDF_ERR_NO_MEM;
     }
 
-    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+    g_sniffer_ring.capacity    = capacity;
+    g_sniffer_ring.bucket_mask = bucket_num - 1;
+    sniffer_ring_clear();
 
-    if (/* esp_get_free_heap_size() < 20 * 1024 || */ g_device_num > g_sniffer_config.buffer_num) {
-        g_device_num = 0;
+    return MDF_OK;
+}
+
+static uint16_t sniffer_ring_find(const uint8_t *addr)
+{
+    uint16_t index = g_sniffer_ring.buckets[sniffer_hash(addr)];
 
-        for (sniffer_node = g_sniffer_list->next; sniffer_node; sniffer_node = g_sniffer_list->next) {
-            g_sniffer_list->next = sniffer_node->next;
-            MDF_FREE(sniffer_node);
+    for (; index != SNIFFER_INDEX_NONE; index = g_sniffer_ring.records[index].hash_next) {
+        if (!memcmp(g_sniffer_ring.records[index].addr, addr, 6)) {
+            break;
         }
     }
 
-    notice_percentage = (!g_device_num) ? g_sniffer_config.notice_percentage : notice_percentage;
+    return index;
+}
+
+static void sniffer_ring_unlink(uint16_t index)
+{
+    uint16_t *next = g_sniffer_ring.buckets + sniffer_hash(g_sniffer_ring.records[index].addr);
 
-    if (notice_percentage && g_device_num > g_sniffer_config.buffer_num * notice_percentage / 100) {
-        mdf_event_loop_send(MDF_EVENT_MLINK_BUFFER_FULL, NULL);
-        MDF_LOGD("sniffer notice percentage: %d%%, g_device_num: %d",
-                 notice_percentage, g_device_num);
-        notice_percentage += notice_percentage;
+    for (; *next != SNIFFER_INDEX_NONE; next = &g_sniffer_ring.records[*next].hash_next) {
+        if (*next == index) {
+            *next = g_sniffer_ring.records[index].hash_next;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Slot of the device seen the longest time ago
+ */
+static uint16_t sniffer_ring_oldest()
+{
+    uint32_t timestamp = sniffer_timestamp();
+    uint16_t oldest    = 0;
+
+    for (uint16_t index = 1; index < g_sniffer_ring.count; ++index) {
+        if (timestamp - g_sniffer_ring.records[index].seen_time
+                > timestamp - g_sniffer_ring.records[oldest].seen_time) {
+            oldest = index;
+        }
     }
 
+    return oldest;
+}
+
+static mdf_err_t mlink_sniffer_list_insert(const mlink_sniffer_data_t *sniffer_data)
+{
+    uint16_t index                    = SNIFFER_INDEX_NONE;
+    uint8_t addr_len                  = 0;
+    static int notice_percentage      = 0;
+    uint8_t *sniffer_data_addr        = ltv_data_get(sniffer_data->data, MLINK_SNIFFER_DATA_ADDR,
+                                        sniffer_data->size - 1, &addr_len);
+
+    if (!sniffer_data_addr || addr_len != 6 || sniffer_data->size + sizeof(sniffer_data->size) > SNIFFER_DATA_MAX_SIZE) {
+        return MDF_ERR_INVALID_ARG;
+    }
 
     for (int i = 0; g_sniffer_config.esp_filter && i < 32; ++i) {
         if (!memcmp(sniffer_data_addr, esp_module_addr[i], 3)) {
-            xSemaphoreGive(g_sniffer_lock);
             return MDF_OK;
         }
     }
 
-    for (sniffer_node = g_sniffer_list->next; sniffer_node; sniffer_node = sniffer_node->next) {
-        uint8_t *sniffer_node_addr = ltv_data_get(sniffer_node->data.data, MLINK_SNIFFER_DATA_ADDR,
-                                     sniffer_node->data.size - 1, &addr_len);
-
-        if (!sniffer_node_addr) {
-            esp_log_buffer_hex(TAG, sniffer_node->data.data, sniffer_node->data.size);
-        }
+    if (!g_sniffer_lock) {
+        g_sniffer_lock  = xSemaphoreCreateMutex();
+    }
 
-        MDF_ERROR_BREAK(!sniffer_node_addr, "ltv_data_get, ret: %p", sniffer_node_addr);
+    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
 
-        if (!memcmp(sniffer_node_addr, sniffer_data_addr, addr_len)) {
-            if (sniffer_node->data.size < sniffer_data->size) {
-                MDF_LOGD("new broadcast packet data length changes");
-                sniffer_node = NULL;
-            }
+    if (sniffer_ring_create() != MDF_OK) {
+        xSemaphoreGive(g_sniffer_lock);
+        return MDF_ERR_NO_MEM;
+    }
 
-            break;
+    index = sniffer_ring_find(sniffer_data_addr);
+
+    /**
+     * @brief A device seen before only has its rssi, timestamp and data updated,
+     *        a new one takes the next free slot, evicting the device seen the
+     *        longest time ago when the ring is full
+     */
+    if (index == SNIFFER_INDEX_NONE) {
+        if (g_sniffer_ring.count == g_sniffer_ring.capacity) {
+            index = sniffer_ring_oldest();
+            sniffer_ring_unlink(index);
+        } else {
+            index = g_sniffer_ring.count++;
         }
-    }
 
-    if (!sniffer_node) {
-        sniffer_node         = MDF_MALLOC(sizeof(sniffer_data_list_t) + sniffer_data->size);
-        sniffer_node->next   = g_sniffer_list->next;
-        g_sniffer_list->next = sniffer_node;
+        uint16_t *bucket = g_sniffer_ring.buckets + sniffer_hash(sniffer_data_addr);
+        memcpy(g_sniffer_ring.records[index].addr, sniffer_data_addr, 6);
+        g_sniffer_ring.records[index].hash_next = *bucket;
+        *bucket = index;
     }
 
-    memcpy(&sniffer_node->data, sniffer_data, sniffer_data->size + sizeof(sniffer_data->size));
-    g_device_num++;
+    memcpy(&g_sniffer_ring.records[index].data, sniffer_data, sniffer_data->size + sizeof(sniffer_data->size));
+    g_sniffer_ring.records[index].seen_time = sniffer_timestamp();
+
+    notice_percentage = (g_sniffer_ring.count <= 1) ? g_sniffer_config.notice_percentage : notice_percentage;
+
+    if (notice_percentage && notice_percentage <= 100
+            && g_sniffer_ring.count >= g_sniffer_ring.capacity * notice_percentage / 100) {
+        mdf_event_loop_send(MDF_EVENT_MLINK_BUFFER_FULL, NULL);
+        MDF_LOGD("sniffer notice percentage: %d%%, device_num: %d",
+                 notice_percentage, g_sniffer_ring.count);
+        notice_percentage += notice_percentage;
+    }
 
     xSemaphoreGive(g_sniffer_lock);
 
@@ -176,7 +284,8 @@ static void sniffer_wifi_cb(void *recv_buf, wifi_promiscuous_pkt_type_t type)
     int8_t rssi        = wifi_promiscuous_pkt->rx_ctrl.rssi;
     uint8_t channel    = wifi_promiscuous_pkt->rx_ctrl.channel;
     uint32_t timestamp = sniffer_timestamp();
-    mlink_sniffer_data_t *sniffer_data = MDF_CALLOC(1, 22);
+    uint8_t sniffer_buffer[22] = {0};
+    mlink_sniffer_data_t *sniffer_data = (mlink_sniffer_data_t *)sniffer_buffer;
 
     MDF_LOGD("Wi-Fi, addr: "MACSTR", rssi: %d, channel: %d",
              MAC2STR(sniffer_payload->source_addr), rssi, channel);
@@ -193,8 +302,6 @@ static void sniffer_wifi_cb(void *recv_buf, wifi_promiscuous_pkt_type_t type)
     sniffer_data->size += sizeof(sniffer_data->type);
 
     mlink_sniffer_list_insert(sniffer_data);
-
-    MDF_FREE(sniffer_data);
 }
 
 #if CONFIG_BT_ENABLED
@@ -224,7 +331,12 @@ static mdf_err_t mlink_sniffer_ble_cb(void *data, size_t size)
              (adv_manufacturer_len ? * ((uint16_t *)adv_manufacturer) : 0));
 
     uint32_t timestamp = sniffer_timestamp();
-    mlink_sniffer_data_t *sniffer_data = MDF_CALLOC(1, sizeof(mlink_sniffer_data_t) + 21 + adv_name_len + adv_manufacturer_len);
+    uint8_t sniffer_buffer[SNIFFER_DATA_MAX_SIZE] = {0};
+    mlink_sniffer_data_t *sniffer_data = (mlink_sniffer_data_t *)sniffer_buffer;
+
+    if (sizeof(mlink_sniffer_data_t) + 21 + adv_name_len + adv_manufacturer_len > sizeof(sniffer_buffer)) {
+        return MDF_ERR_INVALID_SIZE;
+    }
 
     sniffer_data->type = MLINK_SNIFFER_BLE;
     sniffer_data->size += ltv_data_insert(sniffer_data->data, MLINK_SNIFFER_DATA_ADDR,
@@ -239,8 +351,6 @@ static mdf_err_t mlink_sniffer_ble_cb(void *data, size_t size)
                                           adv_manufacturer_len, adv_manufacturer);
     sniffer_data->size += sizeof(sniffer_data->type);
     mlink_sniffer_list_insert(sniffer_data);
-
-    MDF_FREE(sniffer_data);
 #endif /**< !CONFIG_BT_NIMBLE_ENABLED */
 #endif /**< CONFIG_BT_ENABLED */
 
@@ -274,37 +384,56 @@ mdf_err_t mlink_sniffer_data(uint8_t **data, size_t *size)
     *size = 0;
     *data = NULL;
 
-    if (!g_sniffer_list || !g_sniffer_list->next || !g_sniffer_lock) {
+    if (!g_sniffer_lock) {
         MDF_LOGD("sniffer data NULL");
         return ESP_OK;
     }
 
     xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
 
-    uint32_t timestamp  = sniffer_timestamp();
+    if (!g_sniffer_ring.count) {
+        xSemaphoreGive(g_sniffer_lock);
+        MDF_LOGD("sniffer data NULL");
+        return ESP_OK;
+    }
 
-    for (sniffer_data_list_t *sniffer_node = g_sniffer_list->next; sniffer_node;
-            sniffer_node = g_sniffer_list->next) {
-        size_t data_size       = *size;
-        uint8_t timestamp_len  = 0;
-        uint8_t *timestamp_ptr = ltv_data_get(sniffer_node->data.data, MLINK_SNIFFER_DATA_TIMESTAMP,
-                                              sniffer_node->data.size - 1, &timestamp_len);
+    /**
+     * @brief The records are already in the reported format, they are copied
+     *        straight from the ring into a single buffer of the exact size
+     */
+    size_t total_size  = 0;
+    uint32_t timestamp = sniffer_timestamp();
+
+    for (uint16_t index = 0; index < g_sniffer_ring.count; ++index) {
+        total_size += g_sniffer_ring.records[index].data.size + sizeof(g_sniffer_ring.records[index].data.size);
+    }
 
-        *size += sniffer_node->data.size + sizeof(sniffer_node->data.size);
+    if (!(*data = MDF_MALLOC(total_size))) {
+        xSemaphoreGive(g_sniffer_lock);
+        return MDF_ERR_NO_MEM;
+    }
 
-        if (!(*data = MDF_REALLOC(*data, *size))) {
-            MDF_FREE(*data);
-            return MDF_ERR_NO_MEM;
-        }
+    for (uint16_t index = 0; index < g_sniffer_ring.count; ++index) {
+        mlink_sniffer_data_t *sniffer_data = (mlink_sniffer_data_t *)(*data + *size);
+        uint8_t timestamp_len  = 0;
+        uint32_t record_time   = 0;
+        uint8_t *timestamp_ptr = NULL;
+
+        memcpy(sniffer_data, &g_sniffer_ring.records[index].data,
+               g_sniffer_ring.records[index].data.size + sizeof(sniffer_data->size));
+        *size += sniffer_data->size + sizeof(sniffer_data->size);
 
-        *((uint32_t *)timestamp_ptr) = timestamp - *((uint32_t *)timestamp_ptr);
-        memcpy(*data + data_size, &sniffer_node->data, sniffer_node->data.size + sizeof(sniffer_node->data.size));
+        timestamp_ptr = ltv_data_get(sniffer_data->data, MLINK_SNIFFER_DATA_TIMESTAMP,
+                                     sniffer_data->size - 1, &timestamp_len);
 
-        g_sniffer_list->next = sniffer_node->next;
-        MDF_FREE(sniffer_node);
+        if (timestamp_ptr && timestamp_len == sizeof(uint32_t)) {
+            memcpy(&record_time, timestamp_ptr, sizeof(uint32_t));
+            record_time = timestamp - record_time;
+            memcpy(timestamp_ptr, &record_time, sizeof(uint32_t));
+        }
     }
 
-    g_device_num = 0;
+    sniffer_ring_clear();
     MDF_LOGD("sniffer_node, total_size: %d", *size);
 
     xSemaphoreGive(g_sniffer_lock);
@@ -371,15 +500,18 @@ mdf_err_t mlink_sniffer_ble_stop()
 
 mdf_err_t mlink_sniffer_init()
 {
-    if (!g_sniffer_list) {
-        g_sniffer_list = MDF_MALLOC(sizeof(sniffer_data_list_t));
-        g_sniffer_list->next = NULL;
-    }
+    mdf_err_t ret = MDF_OK;
 
     if (!g_sniffer_lock) {
         g_sniffer_lock  = xSemaphoreCreateMutex();
     }
 
+    xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
+    ret = sniffer_ring_create();
+    xSemaphoreGive(g_sniffer_lock);
+
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "sniffer_ring_create, buffer_num: %d", g_sniffer_config.buffer_num);
+
     return MDF_OK;
 }
 
@@ -390,15 +522,7 @@ mdf_err_t mlink_sniffer_deinit()
     }
 
     xSemaphoreTake(g_sniffer_lock, portMAX_DELAY);
-
-    g_device_num = 0;
-
-    for (sniffer_data_list_t *sniffer_node = g_sniffer_list->next; sniffer_node;
-            sniffer_node = g_sniffer_list->next) {
-        g_sniffer_list->next = sniffer_node->next;
-        MDF_FREE(sniffer_node);
-    }
-
+    sniffer_ring_free();
     xSemaphoreGive(g_sniffer_lock);
 
     return MDF_OK;
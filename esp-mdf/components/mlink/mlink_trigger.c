@@ -16,8 +16,27 @@
 #include "mwifi.h"
 #include "mlink_trigger.h"
 
-#define MLINK_TRIGGER_LIST_MAX_NUM 32
-#define MLINK_TRIGGER_STORE_KEY    "MLINK_TRIGGER"
+#ifndef CONFIG_MLINK_TRIGGER_LIST_MAX_NUM
+#define CONFIG_MLINK_TRIGGER_LIST_MAX_NUM 32
+#endif /**< CONFIG_MLINK_TRIGGER_LIST_MAX_NUM */
+#define MLINK_TRIGGER_LIST_MAX_NUM     CONFIG_MLINK_TRIGGER_LIST_MAX_NUM
+
+#define MLINK_TRIGGER_INDEX_KEY        "MLINK_TRIG_IDX"
+#define MLINK_TRIGGER_INDEX_VERSION    1
+#define MLINK_TRIGGER_RECORD_KEY       "MLINK_TRIG_%03d"
+#define MLINK_TRIGGER_RECORD_MAX_SIZE  4000
+#define MLINK_TRIGGER_SLOT_MAX_NUM     256
+#define MLINK_TRIGGER_SLOT_IS_USED(slot) (g_trigger_index.slots[(slot) / 32] & (1U << ((slot) % 32)))
+
+#define MLINK_TRIGGER_STORE_KEY        "MLINK_TRIGGER"
+#define MLINK_TRIGGER_STORE_MAX_NUM    32
+#define MLINK_TRIGGER_TABLE_KEY        "MLINK_TRIG_TBL"
+#define MLINK_TRIGGER_TABLE_VERSION    1
+#define MLINK_TRIGGER_TABLE_MAX_SIZE   (8 * 1024)
+
+#define MLINK_TRIGGER_SYNC_PREFIX  "{\"request\":\"set_status\",\"characteristics\":[{\"cid\":%d,\"value\":"
+#define MLINK_TRIGGER_SYNC_SUFFIX  "%d}]}"
+#define MLINK_TRIGGER_SYNC_VALUE_MAX_SIZE (11 + 4 + 1)
 
 /**
  * @brief Used to compare whether the trigger condition is met
@@ -65,25 +84,126 @@ typedef struct mlink_trigger {
     int trigger_params[3];
     uint32_t communicate_type;
     trigger_compare_t trigger_compare;
-    uint16_t raw_data_size;
+    TickType_t debounce_ticks;    /**< Changes closer together than this are absorbed */
+    TickType_t interval_ticks;    /**< Minimum interval between two executions */
+    TickType_t change_ticks;      /**< Time of the last accepted change */
+    int change_value;             /**< Value seen at change_ticks, another value restarts the window */
+    TickType_t execute_ticks;     /**< Time of the last execution */
+    bool debounce_pending;        /**< A change was absorbed or rate limited, evaluated again when the window expires */
     uint16_t addrs_num;
     uint8_t *addrs_list;
     char *execute_content;
+    uint16_t execute_size;        /**< Length of the rendered execute_content */
+    uint16_t execute_prefix_size; /**< Length of the constant part of a SYNC payload */
+    int16_t slot;                 /**< Flash record of the trigger, -1 if it has none */
+    bool saved;                   /**< The flash record matches the trigger */
     struct mlink_trigger *next;
+    struct mlink_trigger *cid_next;
 } mlink_trigger_t;
 
 /**
- * @brief Store trigger function
+ * @brief Request of a trigger that fired, copied out of the trigger so that
+ *        it is sent after g_trigger_lock is released
+ */
+typedef struct mlink_trigger_action {
+    uint8_t communicate_type;
+    uint16_t addrs_num;
+    uint8_t *addrs_list;
+    uint16_t execute_size;
+    char *execute_content;
+    struct mlink_trigger_action *next;
+    uint8_t data[0];              /**< addrs_list followed by execute_content */
+} mlink_trigger_action_t;
+
+/**
+ * @brief Triggers indexed by the characteristic they watch
+ */
+typedef struct mlink_trigger_cid {
+    uint8_t cid;
+    mlink_trigger_t *trigger_list;
+    struct mlink_trigger_cid *next;
+} mlink_trigger_cid_t;
+
+/**
+ * @brief Index of the triggers stored as raw json by earlier versions,
+ *        only read to migrate them to the trigger records
  */
 typedef struct {
     uint16_t size;
     char name[16];
 } mlink_trigger_store_t;
 
+/**
+ * @brief Header of the trigger table written by earlier versions, followed
+ *        by the records, only read to migrate them to the trigger records
+ */
+typedef struct {
+    uint8_t version;  /**< MLINK_TRIGGER_TABLE_VERSION */
+    uint8_t num;      /**< Number of records */
+    uint16_t size;    /**< Size of the table including this header */
+} __attribute__((packed)) mlink_trigger_table_t;
+
+/**
+ * @brief Slots of the trigger records, each trigger is stored under
+ *        MLINK_TRIGGER_RECORD_KEY so a change only writes its own record
+ */
+typedef struct {
+    uint8_t version;                                 /**< MLINK_TRIGGER_INDEX_VERSION */
+    uint32_t slots[MLINK_TRIGGER_SLOT_MAX_NUM / 32]; /**< Bitmap of the slots holding a record */
+} __attribute__((packed)) mlink_trigger_index_t;
+
+/**
+ * @brief Compiled trigger as it is persisted, followed by the address list
+ *        and, for TRIGGER_LINKAGE, the execute content without terminator
+ */
+typedef struct {
+    uint16_t size;               /**< Size of the record including data */
+    char name[16];
+    uint8_t trigger_cid;
+    uint8_t trigger_type;
+    uint8_t communicate_type;
+    uint8_t compare_flag;
+    int32_t compare[7];          /**< Operands in the order of trigger_compare_t */
+    int32_t execute_cid;
+    uint32_t debounce_ms;
+    uint32_t interval_ms;
+    uint16_t addrs_num;
+    uint16_t content_size;
+    uint8_t data[0];
+} __attribute__((packed)) mlink_trigger_record_t;
+
 static const char *TAG                 = "mlink_trigger";
 static mlink_trigger_t *g_trigger_list = NULL;
+static mlink_trigger_cid_t *g_trigger_cid_list = NULL;
+static SemaphoreHandle_t g_trigger_lock        = NULL;
+static mlink_trigger_index_t g_trigger_index   = {0};
+static size_t g_trigger_num                    = 0;
+
+/**
+ * @brief The triggers with debounce_pending set are evaluated again by
+ *        mlink_trigger_debounce_task when the window expires
+ */
+static mlink_communicate_t g_debounce_communicate       = MLINK_COMMUNICATE_NONE;
+static TimerHandle_t g_debounce_timer                   = NULL;
+static TaskHandle_t g_debounce_task                     = NULL;
+static TickType_t g_debounce_expiry_ticks               = 0;
 extern mlink_characteristic_func_t mlink_device_get_value;
 
+static mdf_err_t mlink_trigger_render(mlink_trigger_t *trigger_item)
+{
+    /**
+     * @brief Render the constant part of the set_status request once,
+     *        only the value is written when the trigger fires
+     */
+    int ret = asprintf(&trigger_item->execute_content, MLINK_TRIGGER_SYNC_PREFIX "%*s",
+                       trigger_item->trigger_params[0], MLINK_TRIGGER_SYNC_VALUE_MAX_SIZE, "");
+    MDF_ERROR_CHECK(ret < 0, MDF_ERR_NO_MEM, "asprintf, ret: %d", ret);
+
+    trigger_item->execute_prefix_size = ret - MLINK_TRIGGER_SYNC_VALUE_MAX_SIZE;
+
+    return MDF_OK;
+}
+
 static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
 {
     mdf_err_t ret                      = MDF_OK;
@@ -92,19 +212,26 @@ static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
     char *trigger_content_str          = NULL;
     char *trigger_compare_str          = NULL;
     char **addrs_list_str              = NULL;
+    int trigger_cid                    = 0;
+    int debounce_ms                    = 0;
+    int interval_ms                    = 0;
     mlink_trigger_t *trigger_item      = MDF_CALLOC(1, sizeof(mlink_trigger_t));
     trigger_compare_t *trigger_compare = &trigger_item->trigger_compare;
 
     memset(trigger_item, 0, sizeof(trigger_compare_t));
-
-    trigger_item->raw_data_size = strlen(raw_data) + 1;
+    trigger_item->slot = -1;
 
     ret = mlink_json_parse(raw_data, "name", trigger_item->name);
     MDF_ERROR_GOTO(ret < 0, EXIT, "Parse the json formatted string");
 
-    ret = mlink_json_parse(raw_data, "trigger_cid", &trigger_item->trigger_cid);
+    ret = mlink_json_parse(raw_data, "trigger_cid", &trigger_cid);
     MDF_ERROR_GOTO(ret < 0, EXIT, "Parse the json formatted string");
 
+    /**< The cid is indexed and persisted in one byte */
+    ret = MDF_ERR_INVALID_ARG;
+    MDF_ERROR_GOTO(trigger_cid < 0 || trigger_cid > UINT8_MAX, EXIT, "Invalid trigger_cid: %d", trigger_cid);
+    trigger_item->trigger_cid = trigger_cid;
+
     MDF_LOGD("name: %s, cid: %d", trigger_item->name, trigger_item->trigger_cid);
 
     ret = mlink_json_parse(raw_data, "execute_mac", &trigger_item->addrs_num);
@@ -134,7 +261,8 @@ static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
     trigger_compare->flag.rising       = (mlink_json_parse(trigger_compare_str, "/",  &trigger_compare->rising) == ESP_OK) ? true : false;
     trigger_compare->flag.falling      = (mlink_json_parse(trigger_compare_str, "\\", &trigger_compare->falling) == ESP_OK) ? true : false;
 
-    trigger_compare->value = -1;
+    trigger_compare->value     = -1;
+    trigger_item->change_value = -1;
 
     MDF_FREE(trigger_compare_str);
 
@@ -148,10 +276,15 @@ static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
         trigger_item->trigger_type = TRIGGER_SYNC;
         ret = mlink_json_parse(trigger_content_str, "execute_cid", (int *)trigger_item->trigger_params);
         MDF_ERROR_GOTO(ret < 0, EXIT, "Parse the json formatted string");
+
+        ret = mlink_trigger_render(trigger_item);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_trigger_render");
     } else if (!strcasecmp(request_str, "linkage")) {
         trigger_item->trigger_type = TRIGGER_LINKAGE;
         ret = mlink_json_parse(raw_data, "execute_content", &trigger_item->execute_content);
         MDF_ERROR_GOTO(ret < 0, EXIT, "Parse the json formatted string");
+
+        trigger_item->execute_size = strlen(trigger_item->execute_content);
     } else {
         ret = ESP_FAIL;
         MDF_LOGW("no support request: %s", request_str);
@@ -164,6 +297,14 @@ static mlink_trigger_t *mlink_trigger_parse(const char *raw_data)
         }
     }
 
+    if (mlink_json_parse(raw_data, "trigger_debounce", &debounce_ms) == MDF_OK && debounce_ms > 0) {
+        trigger_item->debounce_ticks = pdMS_TO_TICKS(debounce_ms);
+    }
+
+    if (mlink_json_parse(raw_data, "trigger_interval", &interval_ms) == MDF_OK && interval_ms > 0) {
+        trigger_item->interval_ticks = pdMS_TO_TICKS(interval_ms);
+    }
+
 EXIT:
 
     if (ret != MDF_OK) {
@@ -179,54 +320,637 @@ EXIT:
     return (ret == MDF_OK) ? trigger_item : NULL;
 }
 
-mdf_err_t mlink_trigger_store_update()
+static void mlink_trigger_free(mlink_trigger_t *trigger_item)
 {
-    mdf_err_t ret   = MDF_OK;
-    int trigger_num = 0;
-    mlink_trigger_store_t *trigger_store = MDF_CALLOC(MLINK_TRIGGER_LIST_MAX_NUM, sizeof(mlink_trigger_store_t));
+    MDF_FREE(trigger_item->addrs_list);
+    MDF_FREE(trigger_item->execute_content);
+    MDF_FREE(trigger_item);
+}
 
-    for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next, trigger_num++) {
-        strncpy(trigger_store[trigger_num].name, trigger_idex->name, sizeof(trigger_store[trigger_num].name));
-        trigger_store[trigger_num].size = trigger_idex->raw_data_size;
+static mdf_err_t mlink_trigger_index_insert(mlink_trigger_t *trigger_item)
+{
+    mlink_trigger_cid_t *trigger_cid = g_trigger_cid_list;
+
+    for (; trigger_cid && trigger_cid->cid != trigger_item->trigger_cid; trigger_cid = trigger_cid->next);
+
+    if (!trigger_cid) {
+        trigger_cid = MDF_CALLOC(1, sizeof(mlink_trigger_cid_t));
+        MDF_ERROR_CHECK(!trigger_cid, MDF_ERR_NO_MEM, "");
+
+        trigger_cid->cid   = trigger_item->trigger_cid;
+        trigger_cid->next  = g_trigger_cid_list;
+        g_trigger_cid_list = trigger_cid;
     }
 
-    if (trigger_num > 0) {
-        ret = mdf_info_save(MLINK_TRIGGER_STORE_KEY, trigger_store, trigger_num * sizeof(mlink_trigger_store_t));
+    trigger_item->cid_next    = trigger_cid->trigger_list;
+    trigger_cid->trigger_list = trigger_item;
+
+    return MDF_OK;
+}
+
+static void mlink_trigger_index_remove(mlink_trigger_t *trigger_item)
+{
+    mlink_trigger_cid_t **trigger_cid = &g_trigger_cid_list;
+
+    for (; *trigger_cid && (*trigger_cid)->cid != trigger_item->trigger_cid; trigger_cid = &(*trigger_cid)->next);
+
+    if (!*trigger_cid) {
+        return;
+    }
+
+    for (mlink_trigger_t **trigger_idex = &(*trigger_cid)->trigger_list; *trigger_idex;
+            trigger_idex = &(*trigger_idex)->cid_next) {
+        if (*trigger_idex == trigger_item) {
+            *trigger_idex = trigger_item->cid_next;
+            break;
+        }
+    }
+
+    if (!(*trigger_cid)->trigger_list) {
+        mlink_trigger_cid_t *trigger_cid_empty = *trigger_cid;
+        *trigger_cid = trigger_cid_empty->next;
+        MDF_FREE(trigger_cid_empty);
+    }
+}
+
+static mlink_trigger_t *mlink_trigger_find(const char *name)
+{
+    for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
+        if (!strcasecmp(trigger_idex->name, name)) {
+            return trigger_idex;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Unlink the trigger with the given name from the list and the cid index
+ */
+static bool mlink_trigger_remove(const char *name)
+{
+    for (mlink_trigger_t *trigger_idex_prior = g_trigger_list, *trigger_idex = trigger_idex_prior->next;
+            trigger_idex; trigger_idex_prior = trigger_idex, trigger_idex = trigger_idex->next) {
+        if (!strcasecmp(trigger_idex->name, name)) {
+            MDF_LOGD("remove event: %s", trigger_idex->name);
+
+            trigger_idex_prior->next = trigger_idex->next;
+            mlink_trigger_index_remove(trigger_idex);
+            mlink_trigger_free(trigger_idex);
+            g_trigger_num--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Link a compiled trigger into the list, replacing the one with the same name
+ */
+static mdf_err_t mlink_trigger_insert(mlink_trigger_t *trigger_item)
+{
+    mdf_err_t ret                 = MDF_OK;
+    mlink_trigger_t *trigger_prev = mlink_trigger_find(trigger_item->name);
+
+    /**< The replacement overwrites the flash record of the trigger it replaces */
+    if (trigger_prev) {
+        if (trigger_item->slot < 0) {
+            trigger_item->slot = trigger_prev->slot;
+        }
+
+        mlink_trigger_remove(trigger_prev->name);
+    }
+
+    MDF_ERROR_CHECK(g_trigger_num >= MLINK_TRIGGER_LIST_MAX_NUM, MDF_ERR_NOT_SUPPORTED,
+                    "The number of events reaches the limit: %d", MLINK_TRIGGER_LIST_MAX_NUM);
+
+    ret = mlink_trigger_index_insert(trigger_item);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_index_insert");
+
+    trigger_item->next   = g_trigger_list->next;
+    g_trigger_list->next = trigger_item;
+    g_trigger_num++;
+
+    return MDF_OK;
+}
+
+static size_t mlink_trigger_record_size(const mlink_trigger_t *trigger_item)
+{
+    size_t content_size = (trigger_item->trigger_type == TRIGGER_LINKAGE) ? trigger_item->execute_size : 0;
+
+    return sizeof(mlink_trigger_record_t) + trigger_item->addrs_num * 6 + content_size;
+}
+
+static size_t mlink_trigger_record_pack(const mlink_trigger_t *trigger_item, mlink_trigger_record_t *record)
+{
+    const trigger_compare_t *cmp = &trigger_item->trigger_compare;
+
+    memset(record, 0, sizeof(mlink_trigger_record_t));
+    record->size             = mlink_trigger_record_size(trigger_item);
+    record->trigger_cid      = trigger_item->trigger_cid;
+    record->trigger_type     = trigger_item->trigger_type;
+    record->communicate_type = trigger_item->communicate_type;
+    record->compare_flag     = cmp->flag.val;
+    record->compare[0]       = cmp->equal;
+    record->compare[1]       = cmp->unequal;
+    record->compare[2]       = cmp->greater_than;
+    record->compare[3]       = cmp->less_than;
+    record->compare[4]       = cmp->variation;
+    record->compare[5]       = cmp->rising;
+    record->compare[6]       = cmp->falling;
+    record->execute_cid      = trigger_item->trigger_params[0];
+    record->debounce_ms      = trigger_item->debounce_ticks * portTICK_PERIOD_MS;
+    record->interval_ms      = trigger_item->interval_ticks * portTICK_PERIOD_MS;
+    record->addrs_num        = trigger_item->addrs_num;
+    record->content_size     = record->size - sizeof(mlink_trigger_record_t) - record->addrs_num * 6;
+    strncpy(record->name, trigger_item->name, sizeof(record->name));
+
+    memcpy(record->data, trigger_item->addrs_list, record->addrs_num * 6);
+    memcpy(record->data + record->addrs_num * 6, trigger_item->execute_content, record->content_size);
+
+    return record->size;
+}
+
+static mlink_trigger_t *mlink_trigger_record_unpack(const mlink_trigger_record_t *record)
+{
+    mdf_err_t ret                 = MDF_OK;
+    mlink_trigger_t *trigger_item = NULL;
+
+    if (record->size != sizeof(mlink_trigger_record_t) + record->addrs_num * 6 + record->content_size) {
+        MDF_LOGW("Corrupted trigger record, size: %d, addrs_num: %d, content_size: %d",
+                 record->size, record->addrs_num, record->content_size);
+        return NULL;
+    }
+
+    trigger_item = MDF_CALLOC(1, sizeof(mlink_trigger_t));
+
+    if (!trigger_item) {
+        return NULL;
+    }
+
+    trigger_compare_t *cmp = &trigger_item->trigger_compare;
+
+    memcpy(trigger_item->name, record->name, sizeof(record->name));
+    trigger_item->name[sizeof(trigger_item->name) - 1] = '\0';
+    trigger_item->trigger_cid       = record->trigger_cid;
+    trigger_item->trigger_type      = record->trigger_type;
+    trigger_item->communicate_type  = record->communicate_type;
+    trigger_item->trigger_params[0] = record->execute_cid;
+    trigger_item->debounce_ticks    = pdMS_TO_TICKS(record->debounce_ms);
+    trigger_item->interval_ticks    = pdMS_TO_TICKS(record->interval_ms);
+    trigger_item->slot              = -1;
+    trigger_item->change_value      = -1;
+    cmp->flag.val     = record->compare_flag;
+    cmp->equal        = record->compare[0];
+    cmp->unequal      = record->compare[1];
+    cmp->greater_than = record->compare[2];
+    cmp->less_than    = record->compare[3];
+    cmp->variation    = record->compare[4];
+    cmp->rising       = record->compare[5];
+    cmp->falling      = record->compare[6];
+    cmp->value        = -1;
+
+    trigger_item->addrs_num  = record->addrs_num;
+    trigger_item->addrs_list = MDF_MALLOC(record->addrs_num * 6);
+    MDF_ERROR_GOTO(!trigger_item->addrs_list, EXIT, "");
+    memcpy(trigger_item->addrs_list, record->data, record->addrs_num * 6);
+
+    if (trigger_item->trigger_type == TRIGGER_SYNC) {
+        ret = mlink_trigger_render(trigger_item);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_trigger_render");
     } else {
-        ret = mdf_info_erase(MLINK_TRIGGER_STORE_KEY);
+        trigger_item->execute_size    = record->content_size;
+        trigger_item->execute_content = MDF_MALLOC(record->content_size + 1);
+        MDF_ERROR_GOTO(!trigger_item->execute_content, EXIT, "");
+
+        memcpy(trigger_item->execute_content, record->data + record->addrs_num * 6, record->content_size);
+        trigger_item->execute_content[record->content_size] = '\0';
     }
 
-    MDF_FREE(trigger_store);
+    return trigger_item;
+
+EXIT:
+    mlink_trigger_free(trigger_item);
+    return NULL;
+}
+
+static mdf_err_t mlink_trigger_store_index_save()
+{
+    mdf_err_t ret = MDF_OK;
+
+    g_trigger_index.version = MLINK_TRIGGER_INDEX_VERSION;
+    ret = mdf_info_save(MLINK_TRIGGER_INDEX_KEY, &g_trigger_index, sizeof(mlink_trigger_index_t));
+    MDF_ERROR_CHECK(ret < 0, ESP_FAIL, "mdf_info_save, ret: %d", ret);
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Write the record of a trigger, a trigger without a record takes a free slot
+ */
+static mdf_err_t mlink_trigger_store_save(mlink_trigger_t *trigger_item)
+{
+    mdf_err_t ret                  = MDF_OK;
+    int slot                       = trigger_item->slot;
+    char record_key[16]            = {0};
+    size_t record_size             = mlink_trigger_record_size(trigger_item);
+    mlink_trigger_record_t *record = NULL;
+
+    MDF_ERROR_CHECK(record_size > MLINK_TRIGGER_RECORD_MAX_SIZE, MDF_ERR_INVALID_SIZE,
+                    "The event is too large, name: %s, size: %d", trigger_item->name, record_size);
+
+    if (slot < 0) {
+        for (slot = 0; slot < MLINK_TRIGGER_SLOT_MAX_NUM && MLINK_TRIGGER_SLOT_IS_USED(slot); ++slot);
+        MDF_ERROR_CHECK(slot == MLINK_TRIGGER_SLOT_MAX_NUM, MDF_ERR_NOT_SUPPORTED, "No free trigger record");
+    }
+
+    record = MDF_MALLOC(record_size);
+    MDF_ERROR_CHECK(!record, MDF_ERR_NO_MEM, "");
+
+    mlink_trigger_record_pack(trigger_item, record);
+    sprintf(record_key, MLINK_TRIGGER_RECORD_KEY, slot);
+    ret = mdf_info_save(record_key, record, record_size);
+    MDF_FREE(record);
     MDF_ERROR_CHECK(ret < 0, ESP_FAIL, "mdf_info_save, ret: %d", ret);
 
+    /**< A new record is only loaded once the index lists it */
+    if (!MLINK_TRIGGER_SLOT_IS_USED(slot)) {
+        g_trigger_index.slots[slot / 32] |= 1U << (slot % 32);
+        ret = mlink_trigger_store_index_save();
+
+        if (ret != MDF_OK) {
+            g_trigger_index.slots[slot / 32] &= ~(1U << (slot % 32));
+            mdf_info_erase(record_key);
+            return ret;
+        }
+    }
+
+    trigger_item->slot  = slot;
+    trigger_item->saved = true;
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Release the record of a removed trigger
+ */
+static mdf_err_t mlink_trigger_store_erase(int slot)
+{
+    mdf_err_t ret       = MDF_OK;
+    char record_key[16] = {0};
+
+    /**< The slot is released first, a record left behind is overwritten when the slot is taken again */
+    g_trigger_index.slots[slot / 32] &= ~(1U << (slot % 32));
+    ret = mlink_trigger_store_index_save();
+
+    if (ret != MDF_OK) {
+        g_trigger_index.slots[slot / 32] |= 1U << (slot % 32);
+        return ret;
+    }
+
+    sprintf(record_key, MLINK_TRIGGER_RECORD_KEY, slot);
+    mdf_info_erase(record_key);
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Write the records of the triggers changed in RAM, the others are not touched
+ */
+mdf_err_t mlink_trigger_store_update()
+{
+    mdf_err_t ret = MDF_OK;
+
+    for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
+        if (!trigger_idex->saved) {
+            ret = mlink_trigger_store_save(trigger_idex);
+            MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_store_save, name: %s", trigger_idex->name);
+        }
+    }
+
     return MDF_OK;
 }
 
+/**
+ * @brief Load the records listed by the index
+ */
+static mdf_err_t mlink_trigger_store_load()
+{
+    mdf_err_t ret                  = MDF_OK;
+    char record_key[16]            = {0};
+    size_t record_size             = 0;
+    mlink_trigger_t *trigger_item  = NULL;
+    mlink_trigger_record_t *record = NULL;
+
+    memset(&g_trigger_index, 0, sizeof(mlink_trigger_index_t));
+
+    ret = mdf_info_load(MLINK_TRIGGER_INDEX_KEY, &g_trigger_index, sizeof(mlink_trigger_index_t));
+
+    if (ret != MDF_OK) {
+        memset(&g_trigger_index, 0, sizeof(mlink_trigger_index_t));
+        return ret;
+    }
+
+    if (g_trigger_index.version != MLINK_TRIGGER_INDEX_VERSION) {
+        MDF_LOGW("Invalid trigger index, version: %d", g_trigger_index.version);
+        memset(&g_trigger_index, 0, sizeof(mlink_trigger_index_t));
+        return MDF_ERR_INVALID_VERSION;
+    }
+
+    record = MDF_MALLOC(MLINK_TRIGGER_RECORD_MAX_SIZE);
+    MDF_ERROR_CHECK(!record, MDF_ERR_NO_MEM, "");
+
+    for (int slot = 0; slot < MLINK_TRIGGER_SLOT_MAX_NUM; ++slot) {
+        if (!MLINK_TRIGGER_SLOT_IS_USED(slot)) {
+            continue;
+        }
+
+        sprintf(record_key, MLINK_TRIGGER_RECORD_KEY, slot);
+        record_size = MLINK_TRIGGER_RECORD_MAX_SIZE;
+        ret = mdf_info_load(record_key, record, &record_size);
+
+        if (ret == MDF_OK && record_size >= sizeof(mlink_trigger_record_t) && record->size == record_size) {
+            trigger_item = mlink_trigger_record_unpack(record);
+        } else {
+            trigger_item = NULL;
+        }
+
+        /**< An unreadable record frees its slot, the index is written with the next change */
+        if (!trigger_item) {
+            MDF_LOGW("Invalid trigger record, slot: %d, size: %d", slot, record_size);
+            g_trigger_index.slots[slot / 32] &= ~(1U << (slot % 32));
+            continue;
+        }
+
+        trigger_item->slot  = slot;
+        trigger_item->saved = true;
+
+        if (mlink_trigger_insert(trigger_item) != MDF_OK) {
+            mlink_trigger_free(trigger_item);
+        }
+    }
+
+    MDF_FREE(record);
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Insert a trigger converted from the store of an earlier version and
+ *        write its record, a trigger that cannot be written is dropped from RAM
+ *        so it does not hold back later changes and is converted again next time
+ */
+static mdf_err_t mlink_trigger_migrate(mlink_trigger_t *trigger_item)
+{
+    mdf_err_t ret = MDF_OK;
+
+    ret = mlink_trigger_insert(trigger_item);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> Drop the event: %s", mdf_err_to_name(ret), trigger_item->name);
+        mlink_trigger_free(trigger_item);
+        return MDF_OK;
+    }
+
+    ret = mlink_trigger_store_save(trigger_item);
+
+    if (ret != MDF_OK) {
+        mlink_trigger_remove(trigger_item->name);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Load the trigger table written by earlier versions and
+ *        convert it to the trigger records
+ */
+static mdf_err_t mlink_trigger_table_load()
+{
+    mdf_err_t ret                 = MDF_OK;
+    mdf_err_t migrate_ret         = MDF_OK;
+    size_t table_size             = MLINK_TRIGGER_TABLE_MAX_SIZE;
+    mlink_trigger_t *trigger_item = NULL;
+    mlink_trigger_table_t *table  = MDF_MALLOC(MLINK_TRIGGER_TABLE_MAX_SIZE);
+    MDF_ERROR_CHECK(!table, MDF_ERR_NO_MEM, "");
+
+    ret = mdf_info_load(MLINK_TRIGGER_TABLE_KEY, table, &table_size);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Load the trigger table");
+
+    if (table_size < sizeof(mlink_trigger_table_t) || table->version != MLINK_TRIGGER_TABLE_VERSION
+            || table->size != table_size) {
+        MDF_LOGW("Invalid trigger table, version: %d, size: %d", table->version, table_size);
+        ret = MDF_ERR_INVALID_VERSION;
+        goto EXIT;
+    }
+
+    for (size_t offset = sizeof(mlink_trigger_table_t), i = 0; i < table->num; ++i) {
+        mlink_trigger_record_t *record = (mlink_trigger_record_t *)((uint8_t *)table + offset);
+
+        if (offset + sizeof(mlink_trigger_record_t) > table_size || record->size < sizeof(mlink_trigger_record_t)
+                || offset + record->size > table_size) {
+            MDF_LOGW("Truncated trigger table, record: %d", i);
+            break;
+        }
+
+        offset += record->size;
+
+        trigger_item = mlink_trigger_record_unpack(record);
+        MDF_ERROR_CONTINUE(!trigger_item, "mlink_trigger_record_unpack");
+
+        if (mlink_trigger_migrate(trigger_item) != MDF_OK) {
+            migrate_ret = MDF_FAIL;
+        }
+    }
+
+    ret = migrate_ret;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_trigger_migrate");
+
+    mdf_info_erase(MLINK_TRIGGER_TABLE_KEY);
+    MDF_LOGI("Migrated the trigger table to the trigger records");
+
+EXIT:
+    MDF_FREE(table);
+    return ret;
+}
+
+/**
+ * @brief Load the triggers saved as raw json by earlier versions and
+ *        convert them to the trigger records
+ */
+static mdf_err_t mlink_trigger_legacy_load()
+{
+    mdf_err_t ret                 = MDF_OK;
+    mdf_err_t migrate_ret         = MDF_OK;
+    char *trigger_raw_data        = NULL;
+    mlink_trigger_t *trigger_item = NULL;
+    mlink_trigger_store_t *trigger_store = MDF_CALLOC(MLINK_TRIGGER_STORE_MAX_NUM, sizeof(mlink_trigger_store_t));
+    MDF_ERROR_CHECK(!trigger_store, MDF_ERR_NO_MEM, "");
+
+    ret = mdf_info_load(MLINK_TRIGGER_STORE_KEY, trigger_store,
+                        MLINK_TRIGGER_STORE_MAX_NUM * sizeof(mlink_trigger_store_t));
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Load the information");
+
+    for (int i = 0; i < MLINK_TRIGGER_STORE_MAX_NUM && trigger_store[i].size; ++i) {
+        MDF_FREE(trigger_raw_data);
+        trigger_raw_data = MDF_CALLOC(1, trigger_store[i].size);
+        ret = mdf_info_load(trigger_store[i].name, trigger_raw_data, trigger_store[i].size);
+        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Load the information", mdf_err_to_name(ret));
+
+        trigger_item = mlink_trigger_parse(trigger_raw_data);
+        MDF_ERROR_CONTINUE(!trigger_item, "<%s> mlink_trigger_parse", mdf_err_to_name(ret));
+
+        if (mlink_trigger_migrate(trigger_item) != MDF_OK) {
+            migrate_ret = MDF_FAIL;
+        }
+    }
+
+    ret = migrate_ret;
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mlink_trigger_migrate");
+
+    for (int i = 0; i < MLINK_TRIGGER_STORE_MAX_NUM && trigger_store[i].size; ++i) {
+        mdf_info_erase(trigger_store[i].name);
+    }
+
+    mdf_info_erase(MLINK_TRIGGER_STORE_KEY);
+    MDF_LOGI("Migrated the triggers to the trigger records");
+
+EXIT:
+    MDF_FREE(trigger_store);
+    MDF_FREE(trigger_raw_data);
+    return ret;
+}
+
+/**
+ * @brief Load the trigger records, then convert the stores of earlier
+ *        versions left in flash, their triggers replace the loaded ones
+ */
+static void mlink_trigger_load()
+{
+    mlink_trigger_store_load();
+    mlink_trigger_table_load();
+    mlink_trigger_legacy_load();
+}
+
+/**
+ * @brief Drop the triggers in RAM and load them again from flash,
+ *        undoes the changes that could not be saved
+ */
+static void mlink_trigger_reload()
+{
+    while (g_trigger_list->next) {
+        mlink_trigger_remove(g_trigger_list->next->name);
+    }
+
+    mlink_trigger_load();
+}
+
+/**
+ * @brief Rebuild the json description of a compiled trigger
+ */
+static char *mlink_trigger_to_json(const mlink_trigger_t *trigger_item)
+{
+    char *trigger_json           = NULL;
+    char *compare_json           = NULL;
+    char *content_json           = NULL;
+    char *addrs_json             = NULL;
+    char mac_str[13]             = {0};
+    const trigger_compare_t *cmp = &trigger_item->trigger_compare;
+
+    mlink_json_pack(&trigger_json, "name", trigger_item->name);
+    mlink_json_pack(&trigger_json, "trigger_cid", trigger_item->trigger_cid);
+
+    if (cmp->flag.equal) {
+        mlink_json_pack(&compare_json, "==", cmp->equal);
+    }
+
+    if (cmp->flag.unequal) {
+        mlink_json_pack(&compare_json, "!=", cmp->unequal);
+    }
+
+    if (cmp->flag.greater_than) {
+        mlink_json_pack(&compare_json, ">", cmp->greater_than);
+    }
+
+    if (cmp->flag.less_than) {
+        mlink_json_pack(&compare_json, "<", cmp->less_than);
+    }
+
+    if (cmp->flag.variation) {
+        mlink_json_pack(&compare_json, "~", cmp->variation);
+    }
+
+    if (cmp->flag.rising) {
+        mlink_json_pack(&compare_json, "/", cmp->rising);
+    }
+
+    if (cmp->flag.falling) {
+        mlink_json_pack(&compare_json, "\\", cmp->falling);
+    }
+
+    mlink_json_pack(&trigger_json, "trigger_compare", compare_json ? compare_json : "{}");
+
+    if (trigger_item->trigger_type == TRIGGER_SYNC) {
+        mlink_json_pack(&content_json, "request", "sync");
+        mlink_json_pack(&content_json, "execute_cid", trigger_item->trigger_params[0]);
+    } else {
+        mlink_json_pack(&content_json, "request", "linkage");
+        mlink_json_pack(&trigger_json, "execute_content", trigger_item->execute_content);
+    }
+
+    mlink_json_pack(&trigger_json, "trigger_content", content_json);
+
+    for (int i = 0; i < trigger_item->addrs_num; ++i) {
+        mlink_json_pack(&addrs_json, "[]", mlink_mac_hex2str(trigger_item->addrs_list + 6 * i, mac_str));
+    }
+
+    mlink_json_pack(&trigger_json, "execute_mac", addrs_json ? addrs_json : "[]");
+
+    if (trigger_item->communicate_type == MLINK_ESPNOW_COMMUNICATE_GROUP) {
+        mlink_json_pack(&trigger_json, "communicate_type", "group");
+    }
+
+    if (trigger_item->debounce_ticks) {
+        mlink_json_pack(&trigger_json, "trigger_debounce", trigger_item->debounce_ticks * portTICK_PERIOD_MS);
+    }
+
+    if (trigger_item->interval_ticks) {
+        mlink_json_pack(&trigger_json, "trigger_interval", trigger_item->interval_ticks * portTICK_PERIOD_MS);
+    }
+
+    MDF_FREE(compare_json);
+    MDF_FREE(content_json);
+    MDF_FREE(addrs_json);
+
+    return trigger_json;
+}
+
 static mdf_err_t mlink_handle_get_trigger(mlink_handle_data_t *handle_data)
 {
-    mdf_err_t ret      = ESP_OK;
     char *trigger_json = NULL;
     char *raw_data     = NULL;
 
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+
     for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
-        raw_data = MDF_MALLOC(trigger_idex->raw_data_size);
-        ret = mdf_info_load(trigger_idex->name, raw_data, trigger_idex->raw_data_size);
-        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, " Load the information");
+        raw_data = mlink_trigger_to_json(trigger_idex);
+        MDF_ERROR_CONTINUE(!raw_data, "mlink_trigger_to_json");
 
         mlink_json_pack(&trigger_json, "[]", raw_data);
         MDF_FREE(raw_data);
     }
 
+    xSemaphoreGive(g_trigger_lock);
+
     if (!trigger_json) {
         return MDF_OK;
     }
 
     handle_data->resp_size = mlink_json_pack(&handle_data->resp_data, "trigger", trigger_json);
-
-EXIT:
-    MDF_FREE(raw_data);
     MDF_FREE(trigger_json);
-    return ret;
+
+    return MDF_OK;
 }
 
 mdf_err_t mlink_trigger_add(const char *trigger_raw_data)
@@ -235,35 +959,28 @@ mdf_err_t mlink_trigger_add(const char *trigger_raw_data)
     MDF_ERROR_CHECK(!g_trigger_list, MDF_ERR_NOT_INIT, "mlink_trigger is not initialized");
 
     mdf_err_t ret = MDF_OK;
-    mlink_trigger_t *trigger_list = g_trigger_list;
     mlink_trigger_t *trigger_item = NULL;
 
     trigger_item = mlink_trigger_parse(trigger_raw_data);
     MDF_ERROR_CHECK(!trigger_item, MDF_FAIL, "mlink_trigger_parse");
 
-    for (mlink_trigger_t *trigger_idex = trigger_list->next; trigger_idex;
-            trigger_list = trigger_idex, trigger_idex = trigger_idex->next) {
-        if (!strcasecmp(trigger_idex->name, trigger_item->name)) {
-            MDF_LOGD("remove event: %s", trigger_idex->name);
-            ret = mdf_info_erase(trigger_idex->name);
-            MDF_ERROR_CONTINUE(ret != MDF_OK, "mdf_info_erase, ret: %d", ret);
-
-            trigger_list->next = trigger_idex->next;
-            MDF_FREE(trigger_idex->addrs_list);
-            MDF_FREE(trigger_idex->execute_content);
-            MDF_FREE(trigger_idex);
-            trigger_idex = trigger_list;
-            break;
-        }
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+    ret = mlink_trigger_insert(trigger_item);
+
+    if (ret != MDF_OK) {
+        xSemaphoreGive(g_trigger_lock);
+        mlink_trigger_free(trigger_item);
+        MDF_LOGW("<%s> mlink_trigger_insert", mdf_err_to_name(ret));
+        return ret;
     }
 
-    trigger_item->next   = g_trigger_list->next;
-    g_trigger_list->next = trigger_item;
+    ret = mlink_trigger_store_update();
 
-    ret = mdf_info_save(trigger_item->name, trigger_raw_data, strlen(trigger_raw_data) + 1);
-    MDF_ERROR_CHECK(ret < 0, ret, "Save the information");
+    if (ret != MDF_OK) {
+        mlink_trigger_reload();
+    }
 
-    ret = mlink_trigger_store_update();
+    xSemaphoreGive(g_trigger_lock);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_store_update");
 
     return MDF_OK;
@@ -277,17 +994,51 @@ static mdf_err_t mlink_handle_set_trigger(mlink_handle_data_t *handle_data)
 
     ret = mlink_json_parse(handle_data->req_data, "events", &trigger_num);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
+    MDF_ERROR_CHECK(trigger_num > MLINK_TRIGGER_LIST_MAX_NUM, MDF_ERR_NOT_SUPPORTED,
+                    "The number of events exceeds the limit: %d", MLINK_TRIGGER_LIST_MAX_NUM);
 
     ret = mlink_json_parse(handle_data->req_data, "events", trigger_raw_data);
     MDF_ERROR_CHECK(ret != MDF_OK, ret, "Parse the json formatted string");
 
+    /**
+     * @brief All events of the request are checked before any of them is
+     *        written, then only the records of these events are written
+     */
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+
     for (int i = 0; i < trigger_num; ++i) {
-        ret = mlink_trigger_add(trigger_raw_data[i]);
-        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_add");
+        mlink_trigger_t *trigger_item = NULL;
+
+        if (ret == MDF_OK) {
+            trigger_item = mlink_trigger_parse(trigger_raw_data[i]);
+            ret = trigger_item ? mlink_trigger_insert(trigger_item) : MDF_ERR_INVALID_ARG;
+
+            if (ret != MDF_OK) {
+                MDF_LOGW("<%s> Add the event: %s", mdf_err_to_name(ret), trigger_raw_data[i]);
 
-        MDF_LOGD("mlink_handle_set_trigger success");
+                if (trigger_item) {
+                    mlink_trigger_free(trigger_item);
+                }
+            }
+        }
+
+        MDF_FREE(trigger_raw_data[i]);
     }
 
+    /**< The request is applied as a whole, a rejected event undoes the others */
+    if (ret == MDF_OK) {
+        ret = mlink_trigger_store_update();
+    }
+
+    if (ret != MDF_OK) {
+        mlink_trigger_reload();
+    }
+
+    xSemaphoreGive(g_trigger_lock);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "Set the events");
+
+    MDF_LOGD("mlink_handle_set_trigger success");
+
     mdf_event_loop_send(MDF_EVENT_MLINK_SET_TRIGGER, NULL);
 
     return MDF_OK;
@@ -295,152 +1046,409 @@ static mdf_err_t mlink_handle_set_trigger(mlink_handle_data_t *handle_data)
 
 static mdf_err_t mlink_handle_remove_trigger(mlink_handle_data_t *handle_data)
 {
-    mdf_err_t ret         = ESP_OK;
-    char trigger_name[16] = {0};
-    int trigger_num       = 0;
+    mdf_err_t ret                 = ESP_OK;
+    mdf_err_t store_ret           = MDF_OK;
+    char trigger_name[16]         = {0};
+    int trigger_num               = 0;
+    int slot                      = 0;
+    mlink_trigger_t *trigger_item = NULL;
     char *trigger_list[MLINK_TRIGGER_LIST_MAX_NUM] = {0};
 
     ret = mlink_json_parse(handle_data->req_data, "events", &trigger_num);
     MDF_ERROR_CHECK(ret < 0, ret, "Parse the json formatted string");
+    MDF_ERROR_CHECK(trigger_num > MLINK_TRIGGER_LIST_MAX_NUM, MDF_ERR_NOT_SUPPORTED,
+                    "The number of events exceeds the limit: %d", MLINK_TRIGGER_LIST_MAX_NUM);
 
     ret = mlink_json_parse(handle_data->req_data, "events", trigger_list);
     MDF_ERROR_CHECK(ret < 0, ret, "Parse the json formatted string");
 
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+
     for (int i = 0; i < trigger_num; ++i) {
         ret = mlink_json_parse(trigger_list[i], "name", trigger_name);
         MDF_FREE(trigger_list[i]);
         MDF_ERROR_CONTINUE(ret < 0, "Parse the json formatted string");
 
-        mlink_trigger_t *trigger_idex_prior = g_trigger_list;
-
-        for (mlink_trigger_t *trigger_idex = trigger_idex_prior->next; trigger_idex;
-                trigger_idex_prior = trigger_idex, trigger_idex = trigger_idex->next) {
-            if (!strcasecmp(trigger_idex->name, trigger_name)) {
-                MDF_LOGD("remove event: %s", trigger_idex->name);
-                ret = mdf_info_erase(trigger_idex->name);
-                MDF_ERROR_CHECK(ret < 0, ESP_FAIL, "mdf_info_erase, ret: %d", ret);
-
-                trigger_idex_prior->next = trigger_idex->next;
-                MDF_FREE(trigger_idex->addrs_list);
-                MDF_FREE(trigger_idex->execute_content);
-                MDF_FREE(trigger_idex);
-                trigger_idex = trigger_idex_prior;
-                break;
-            }
+        trigger_item = mlink_trigger_find(trigger_name);
+
+        if (!trigger_item) {
+            continue;
+        }
+
+        slot = trigger_item->slot;
+        mlink_trigger_remove(trigger_name);
+
+        if (slot >= 0 && mlink_trigger_store_erase(slot) != MDF_OK) {
+            store_ret = MDF_FAIL;
         }
     }
 
-    ret = mlink_trigger_store_update();
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mlink_trigger_store_update");
+    /**< A trigger whose record could not be released comes back as it is in flash */
+    if (store_ret != MDF_OK) {
+        mlink_trigger_reload();
+    }
+
+    xSemaphoreGive(g_trigger_lock);
+    MDF_ERROR_CHECK(store_ret != MDF_OK, store_ret, "mlink_trigger_store_erase");
 
     return ESP_OK;
 }
 
-mdf_err_t mlink_trigger_handle(mlink_communicate_t communicate)
+static bool mlink_trigger_compare(const trigger_compare_t *cmp, int value)
 {
-    mdf_err_t ret = ESP_OK;
-    int value     = -1;
+    if (!cmp->flag.val) {
+        return true;
+    }
 
-    MDF_ERROR_CHECK(!g_trigger_list, MDF_ERR_NOT_INIT, "mlink_trigger is not initialized");
+    if ((cmp->flag.equal && cmp->equal != value)
+            || (cmp->flag.unequal && cmp->unequal == value)
+            || (cmp->flag.greater_than && cmp->greater_than >= value)
+            || (cmp->flag.less_than && cmp->less_than <= value)) {
+        return false;
+    }
 
-    for (mlink_trigger_t *trigger_idex = g_trigger_list->next; trigger_idex; trigger_idex = trigger_idex->next) {
+    bool variation = !cmp->flag.variation || cmp->variation <= abs(value - cmp->value);
+
+    if (!variation
+            || (cmp->flag.rising && value - cmp->value < variation)
+            || (cmp->flag.falling && cmp->value - value < variation)) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Copy the request of a trigger that fired, called with g_trigger_lock held
+ */
+static mlink_trigger_action_t *mlink_trigger_action_create(mlink_trigger_t *trigger_item, int value)
+{
+    mlink_trigger_action_t *action = NULL;
+
+    if (trigger_item->trigger_type == TRIGGER_SYNC) {
+        trigger_item->execute_size = trigger_item->execute_prefix_size
+                                     + sprintf(trigger_item->execute_content + trigger_item->execute_prefix_size,
+                                               MLINK_TRIGGER_SYNC_SUFFIX, value);
+    }
+
+    action = MDF_MALLOC(sizeof(mlink_trigger_action_t) + trigger_item->addrs_num * 6 + trigger_item->execute_size);
+
+    if (!action) {
+        return NULL;
+    }
+
+    action->communicate_type = trigger_item->communicate_type;
+    action->addrs_num        = trigger_item->addrs_num;
+    action->addrs_list       = action->data;
+    action->execute_size     = trigger_item->execute_size;
+    action->execute_content  = (char *)action->data + action->addrs_num * 6;
+    action->next             = NULL;
+
+    memcpy(action->addrs_list, trigger_item->addrs_list, action->addrs_num * 6);
+    memcpy(action->execute_content, trigger_item->execute_content, action->execute_size);
+
+    return action;
+}
+
+static mdf_err_t mlink_trigger_execute(const mlink_trigger_action_t *trigger_item, mlink_communicate_t communicate)
+{
+    mdf_err_t ret = MDF_OK;
+
+    if (communicate == MLINK_COMMUNICATE_MESH) {
+        mwifi_data_type_t data_type  = {
+            .protocol = MLINK_PROTO_HTTPD,
+            .group    = (trigger_item->communicate_type == MLINK_ESPNOW_COMMUNICATE_GROUP) ? true : false,
+        };
+        mlink_httpd_type_t httpd_type = {
+            .format = MLINK_HTTPD_FORMAT_JSON,
+            .from   = MLINK_HTTPD_FROM_DEVICE,
+            .resp   = false,
+        };
+
+        memcpy(&data_type.custom, &httpd_type, sizeof(mlink_httpd_type_t));
+
+        for (int i = 0; i < trigger_item->addrs_num; ++i) {
+            ret = mwifi_write(trigger_item->addrs_list + 6 * i, &data_type,
+                              trigger_item->execute_content, trigger_item->execute_size, true);
+        }
+    } else if (communicate == MLINK_COMMUNICATE_ESPNOW) {
+        ret = mlink_espnow_write(trigger_item->addrs_list, trigger_item->addrs_num, trigger_item->execute_content,
+                                 trigger_item->execute_size, trigger_item->communicate_type, portMAX_DELAY);
+    }
+
+    MDF_LOGD("addrs_num: %d, addrs_list: " MACSTR ", execute_content: %.*s",
+             trigger_item->addrs_num, MAC2STR(trigger_item->addrs_list),
+             trigger_item->execute_size, trigger_item->execute_content);
+
+    return ret;
+}
+
+/**
+ * @brief Send the requests collected by mlink_trigger_evaluate and free them,
+ *        called without g_trigger_lock as the writes may block
+ */
+static mdf_err_t mlink_trigger_action_send(mlink_trigger_action_t *action_list, mlink_communicate_t communicate)
+{
+    mdf_err_t ret                  = MDF_OK;
+    mlink_trigger_action_t *action = NULL;
+
+    while (action_list) {
+        action      = action_list;
+        action_list = action->next;
+
+        if (mlink_trigger_execute(action, communicate) != MDF_OK) {
+            MDF_LOGW("mlink_trigger_execute, addrs_num: %d", action->addrs_num);
+            ret = MDF_FAIL;
+        }
+
+        MDF_FREE(action);
+    }
+
+    return ret;
+}
+
+static void mlink_trigger_debounce_timercb(TimerHandle_t timer)
+{
+    xTaskNotifyGive(g_debounce_task);
+}
+
+static mdf_err_t mlink_trigger_evaluate(const mlink_trigger_cid_t *trigger_cid, mlink_communicate_t communicate,
+                                        bool debounced_only, mlink_trigger_action_t **action_list);
+
+static void mlink_trigger_debounce_task(void *arg)
+{
+    mdf_err_t ret                       = MDF_OK;
+    mlink_communicate_t communicate     = MLINK_COMMUNICATE_NONE;
+    mlink_trigger_action_t *action_list = NULL;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+
+        /**< Only the triggers whose change was absorbed, the others have already run for it */
+        communicate = g_debounce_communicate;
+
+        for (mlink_trigger_cid_t *trigger_cid = g_trigger_cid_list; trigger_cid; trigger_cid = trigger_cid->next) {
+            ret = mlink_trigger_evaluate(trigger_cid, communicate, true, &action_list);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "mlink_trigger_evaluate, cid: %d", trigger_cid->cid);
+        }
+
+        xSemaphoreGive(g_trigger_lock);
+
+        mlink_trigger_action_send(action_list, communicate);
+        action_list = NULL;
+    }
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Evaluate the trigger again once its debounce window expires,
+ *        so that the settled value is not lost
+ */
+static mdf_err_t mlink_trigger_debounce_defer(mlink_trigger_t *trigger_item, TickType_t remain_ticks,
+                                              mlink_communicate_t communicate)
+{
+    if (!g_debounce_task) {
+        g_debounce_timer = xTimerCreate("mlink_debounce", remain_ticks, false, NULL, mlink_trigger_debounce_timercb);
+        MDF_ERROR_CHECK(!g_debounce_timer, MDF_ERR_NO_MEM, "xTimerCreate");
+
+        if (xTaskCreatePinnedToCore(mlink_trigger_debounce_task, "mlink_debounce", 3 * 1024,
+                                    NULL, CONFIG_MDF_TASK_DEFAULT_PRIOTY, &g_debounce_task,
+                                    CONFIG_MDF_TASK_PINNED_TO_CORE) != pdPASS) {
+            xTimerDelete(g_debounce_timer, 0);
+            g_debounce_timer = NULL;
+            g_debounce_task  = NULL;
+            return MDF_ERR_NO_MEM;
+        }
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    remain_ticks   = MAX(remain_ticks, 1);
+
+    trigger_item->debounce_pending = true;
+    g_debounce_communicate         = communicate;
+
+    /**< Only bring the timer forward, an early expiry defers the triggers still in their window again */
+    if (!xTimerIsTimerActive(g_debounce_timer) || g_debounce_expiry_ticks - now > remain_ticks) {
+        g_debounce_expiry_ticks = now + remain_ticks;
+        xTimerChangePeriod(g_debounce_timer, remain_ticks, 0);
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Evaluate only the triggers that watch this characteristic,
+ *        its value is read once for all of them. With debounced_only,
+ *        only the triggers whose debounce window has expired are evaluated.
+ *        The requests of the triggers that fire are appended to action_list
+ */
+static mdf_err_t mlink_trigger_evaluate(const mlink_trigger_cid_t *trigger_cid, mlink_communicate_t communicate,
+                                        bool debounced_only, mlink_trigger_action_t **action_list)
+{
+    mdf_err_t ret                  = MDF_OK;
+    int value                      = -1;
+    TickType_t now                 = xTaskGetTickCount();
+    mlink_trigger_action_t *action = NULL;
+
+    for (; *action_list; action_list = &(*action_list)->next);
+
+    if (debounced_only) {
+        mlink_trigger_t *trigger_idex = trigger_cid->trigger_list;
+        for (; trigger_idex && !trigger_idex->debounce_pending; trigger_idex = trigger_idex->cid_next);
+
+        if (!trigger_idex) {
+            return MDF_OK;
+        }
+    }
+
+    ret = mlink_device_get_value(trigger_cid->cid, &value);
+
+    if (ret < 0) {
+        MDF_LOGW("<%s> mlink_device_get_value, cid: %d", mdf_err_to_name(ret), trigger_cid->cid);
+        return MDF_OK;
+    }
+
+    for (mlink_trigger_t *trigger_idex = trigger_cid->trigger_list; trigger_idex; trigger_idex = trigger_idex->cid_next) {
         trigger_compare_t *cmp = &trigger_idex->trigger_compare;
-        ret = mlink_device_get_value(trigger_idex->trigger_cid, &value);
-        MDF_ERROR_CONTINUE(ret < 0, "<%s> mlink_device_get_value, cid: %d", mdf_err_to_name(ret), trigger_idex->trigger_cid);
-
-        bool equal        = (!cmp->flag.equal        || (cmp->flag.equal        && cmp->equal == value)) ? true       : false;
-        bool unequal      = (!cmp->flag.unequal      || (cmp->flag.unequal      && cmp->unequal != value)) ? true     : false;
-        bool greater_than = (!cmp->flag.greater_than || (cmp->flag.greater_than && cmp->greater_than < value)) ? true : false;
-        bool less_than    = (!cmp->flag.less_than    || (cmp->flag.less_than    && cmp->less_than > value)) ? true    : false;
-        bool variation    = (!cmp->flag.variation    || (cmp->flag.variation    && cmp->variation <= abs(value - cmp->value))) ? true : false;
-        bool rising       = (!cmp->flag.rising       || (cmp->flag.rising       && (value - cmp->value >= variation))) ? true : false;
-        bool falling      = (!cmp->flag.falling      || (cmp->flag.falling      && (cmp->value - value >= variation))) ? true : false;
-
-        MDF_LOGD("name: %s, cid: %d, value: %d, trigger_type: %d, variation: %d, trigger: %d, rising: %d",
-                 trigger_idex->name, trigger_idex->trigger_cid, value,
-                 trigger_idex->trigger_type, variation, cmp->value, cmp->rising);
-
-        if (trigger_idex->trigger_type == TRIGGER_SYNC) {
-            if (cmp->value == value) {
-                continue;
-            }
+        bool changed           = cmp->value != value;
+        bool moved             = trigger_idex->change_value != value;
 
-            asprintf(&trigger_idex->execute_content, "{\"request\":\"set_status\",\"characteristics\":[{\"cid\":%d,\"value\":%d}]}",
-                     trigger_idex->trigger_params[0], value);
+        if (debounced_only && !trigger_idex->debounce_pending) {
+            continue;
         }
 
-        cmp->value = value;
+        trigger_idex->debounce_pending = false;
 
-        if (!equal || !unequal || !greater_than || !less_than || !variation || !rising || !falling) {
+        /**< A SYNC trigger copies the value, there is nothing to do until it changes */
+        if (trigger_idex->trigger_type == TRIGGER_SYNC && !changed) {
             continue;
         }
 
-        if (communicate == MLINK_COMMUNICATE_MESH) {
-            mwifi_data_type_t data_type  = {
-                .protocol = MLINK_PROTO_HTTPD,
-                .group    = (trigger_idex->communicate_type == MLINK_ESPNOW_COMMUNICATE_GROUP) ? true : false,
-            };
-            mlink_httpd_type_t httpd_type = {
-                .format = MLINK_HTTPD_FORMAT_JSON,
-                .from   = MLINK_HTTPD_FROM_DEVICE,
-                .resp   = false,
-            };
-
-            memcpy(&data_type.custom, &httpd_type, sizeof(mlink_httpd_type_t));
-
-            for (int i = 0; i < trigger_idex->addrs_num; ++i) {
-                ret = mwifi_write(trigger_idex->addrs_list + 6 * i, &data_type,
-                                  trigger_idex->execute_content, strlen(trigger_idex->execute_content), true);
+        /**
+         * @brief Absorb changes that follow the previous one too closely, the
+         *        settled value is evaluated again when the window expires
+         */
+        if (trigger_idex->debounce_ticks && trigger_idex->change_ticks
+                && now - trigger_idex->change_ticks < trigger_idex->debounce_ticks) {
+            if (moved) {
+                trigger_idex->change_ticks = now;
+                trigger_idex->change_value = value;
             }
-        } else if (communicate == MLINK_COMMUNICATE_ESPNOW) {
-            ret = mlink_espnow_write(trigger_idex->addrs_list, trigger_idex->addrs_num, trigger_idex->execute_content,
-                                     strlen(trigger_idex->execute_content), trigger_idex->communicate_type, portMAX_DELAY);
+
+            ret = mlink_trigger_debounce_defer(trigger_idex,
+                                               trigger_idex->debounce_ticks - (now - trigger_idex->change_ticks),
+                                               communicate);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mlink_trigger_debounce_defer", mdf_err_to_name(ret));
+            continue;
         }
 
-        MDF_LOGD("addrs_num: %d, addrs_list: " MACSTR ", execute_content: %s",
-                 trigger_idex->addrs_num, MAC2STR(trigger_idex->addrs_list),
-                 trigger_idex->execute_content);
+        if (moved) {
+            trigger_idex->change_ticks = now;
+            trigger_idex->change_value = value;
+        }
 
-        if (trigger_idex->trigger_type == TRIGGER_SYNC) {
-            MDF_FREE(trigger_idex->execute_content);
+        bool match = mlink_trigger_compare(cmp, value);
+
+        MDF_LOGD("name: %s, cid: %d, value: %d, last value: %d, trigger_type: %d, match: %d",
+                 trigger_idex->name, trigger_idex->trigger_cid, value, cmp->value,
+                 trigger_idex->trigger_type, match);
+
+        if (!match) {
+            cmp->value = value;
+            continue;
+        }
+
+        /**
+         * @brief A rate limited trigger keeps the last value it ran for, so the
+         *        change is evaluated again against it when the interval expires
+         */
+        if (trigger_idex->interval_ticks && trigger_idex->execute_ticks
+                && now - trigger_idex->execute_ticks < trigger_idex->interval_ticks) {
+            MDF_LOGD("name: %s, rate limited", trigger_idex->name);
+
+            ret = mlink_trigger_debounce_defer(trigger_idex,
+                                               trigger_idex->interval_ticks - (now - trigger_idex->execute_ticks),
+                                               communicate);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> mlink_trigger_debounce_defer", mdf_err_to_name(ret));
+            continue;
         }
 
-        MDF_ERROR_CHECK(ret != ESP_OK, ret, "mlink_espnow_write");
+        action = mlink_trigger_action_create(trigger_idex, value);
+        MDF_ERROR_CHECK(!action, MDF_ERR_NO_MEM, "mlink_trigger_action_create");
+
+        cmp->value                  = value;
+        trigger_idex->execute_ticks = now;
+        *action_list                = action;
+        action_list                 = &action->next;
     }
 
     return MDF_OK;
 }
 
-mdf_err_t mlink_trigger_init()
+mdf_err_t mlink_trigger_handle_cid(mlink_communicate_t communicate, uint16_t cid)
 {
-    if (g_trigger_list) {
-        return MDF_OK;
+    MDF_ERROR_CHECK(!g_trigger_list, MDF_ERR_NOT_INIT, "mlink_trigger is not initialized");
+
+    mdf_err_t ret                       = MDF_OK;
+    mlink_trigger_action_t *action_list = NULL;
+
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+
+    for (mlink_trigger_cid_t *trigger_cid = g_trigger_cid_list; trigger_cid; trigger_cid = trigger_cid->next) {
+        if (trigger_cid->cid == cid) {
+            ret = mlink_trigger_evaluate(trigger_cid, communicate, false, &action_list);
+            break;
+        }
     }
 
-    mdf_err_t ret                 = MDF_OK;
-    g_trigger_list                = MDF_CALLOC(1, sizeof(mlink_trigger_t));
-    char *trigger_raw_data        = NULL;
-    mlink_trigger_t *trigger_item = NULL;
-    mlink_trigger_store_t *trigger_store = MDF_CALLOC(MLINK_TRIGGER_LIST_MAX_NUM, sizeof(mlink_trigger_store_t));
+    xSemaphoreGive(g_trigger_lock);
 
-    if (mdf_info_load(MLINK_TRIGGER_STORE_KEY, trigger_store,
-                      MLINK_TRIGGER_LIST_MAX_NUM * sizeof(mlink_trigger_store_t)) == MDF_OK) {
-        for (int i = 0; i < MLINK_TRIGGER_LIST_MAX_NUM && trigger_store[i].size; ++i) {
-            MDF_FREE(trigger_raw_data);
-            trigger_raw_data = MDF_CALLOC(1, trigger_store[i].size);
-            ret = mdf_info_load(trigger_store[i].name, trigger_raw_data, trigger_store[i].size);
-            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Load the information", mdf_err_to_name(ret));
+    if (mlink_trigger_action_send(action_list, communicate) != MDF_OK && ret == MDF_OK) {
+        ret = MDF_FAIL;
+    }
 
-            trigger_item = mlink_trigger_parse(trigger_raw_data);
-            MDF_ERROR_CONTINUE(!trigger_item, "<%s> mlink_trigger_parse", mdf_err_to_name(ret));
+    return ret;
+}
 
-            trigger_item->next   = g_trigger_list->next;
-            g_trigger_list->next = trigger_item;
-        }
+mdf_err_t mlink_trigger_handle(mlink_communicate_t communicate)
+{
+    mdf_err_t ret                       = MDF_OK;
+    mlink_trigger_action_t *action_list = NULL;
+
+    MDF_ERROR_CHECK(!g_trigger_list, MDF_ERR_NOT_INIT, "mlink_trigger is not initialized");
+
+    xSemaphoreTake(g_trigger_lock, portMAX_DELAY);
+
+    for (mlink_trigger_cid_t *trigger_cid = g_trigger_cid_list; trigger_cid; trigger_cid = trigger_cid->next) {
+        ret = mlink_trigger_evaluate(trigger_cid, communicate, false, &action_list);
+        MDF_ERROR_BREAK(ret != MDF_OK, "mlink_trigger_evaluate, cid: %d", trigger_cid->cid);
     }
 
-    MDF_FREE(trigger_store);
-    MDF_FREE(trigger_raw_data);
+    xSemaphoreGive(g_trigger_lock);
+
+    if (mlink_trigger_action_send(action_list, communicate) != MDF_OK && ret == MDF_OK) {
+        ret = MDF_FAIL;
+    }
+
+    return ret;
+}
+
+mdf_err_t mlink_trigger_init()
+{
+    if (g_trigger_list) {
+        return MDF_OK;
+    }
+
+    g_trigger_lock = xSemaphoreCreateMutex();
+    MDF_ERROR_CHECK(!g_trigger_lock, MDF_ERR_NO_MEM, "");
+
+    g_trigger_list = MDF_CALLOC(1, sizeof(mlink_trigger_t));
+    MDF_ERROR_CHECK(!g_trigger_list, MDF_ERR_NO_MEM, "");
+
+    mlink_trigger_load();
 
     mlink_set_handle("set_event", mlink_handle_set_trigger);
     mlink_set_handle("get_event", mlink_handle_get_trigger);
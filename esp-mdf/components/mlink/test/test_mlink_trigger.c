@@ -0,0 +1,112 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "mdf_common.h"
+#include "mlink.h"
+#include "unity.h"
+
+#define TEST_TRIGGER_NUM    (CONFIG_MLINK_TRIGGER_LIST_MAX_NUM)
+#define TEST_TRIGGER_CID    (TEST_TRIGGER_NUM / 4 + 1)
+#define TEST_HANDLE_LOOPS   (100)
+
+static const char *TAG = "test_mlink_trigger";
+static uint32_t g_get_value_count = 0;
+
+static mdf_err_t test_get_value(uint16_t cid, void *arg)
+{
+    g_get_value_count++;
+    *((int *)arg) = cid;
+
+    return MDF_OK;
+}
+
+static mdf_err_t test_set_value(uint16_t cid, void *arg)
+{
+    return MDF_OK;
+}
+
+static void test_trigger_erase()
+{
+    char record_key[16] = {0};
+
+    mdf_info_erase("MLINK_TRIG_IDX");
+
+    for (int i = 0; i < TEST_TRIGGER_NUM; ++i) {
+        sprintf(record_key, "MLINK_TRIG_%03d", i);
+        mdf_info_erase(record_key);
+    }
+}
+
+/**
+ * @brief As many linkage triggers as the device keeps, about 4 per characteristic,
+ *        a change of one characteristic only needs to evaluate the triggers that watch it
+ */
+TEST_CASE("mlink_trigger_handle_cid full trigger list", "[mlink]")
+{
+    char trigger_raw_data[256] = {0};
+    int64_t start_us           = 0;
+    int64_t handle_us          = 0;
+    int64_t handle_cid_us      = 0;
+    uint32_t handle_reads      = 0;
+    uint32_t handle_cid_reads  = 0;
+
+    TEST_ASSERT_EQUAL(MDF_OK, mdf_info_init());
+    test_trigger_erase();
+
+    TEST_ASSERT_EQUAL(MDF_OK, mlink_add_device(0x0001, "test_trigger", "v1.0"));
+    TEST_ASSERT_EQUAL(MDF_OK, mlink_add_characteristic_handle(test_get_value, test_set_value));
+    TEST_ASSERT_EQUAL(MDF_OK, mlink_trigger_init());
+
+    for (int i = 0; i <= TEST_TRIGGER_NUM; ++i) {
+        sprintf(trigger_raw_data, "{\"name\":\"t%d\",\"trigger_cid\":%d,\"trigger_content\":{\"request\":\"linkage\"},"
+                "\"trigger_compare\":{\"==\":-1},\"execute_mac\":[\"30aea4000001\"],"
+                "\"execute_content\":{\"request\":\"set_status\"}}", i, i % TEST_TRIGGER_CID);
+
+        /**< Every trigger is saved in its own record, one more than the limit is refused */
+        TEST_ASSERT_EQUAL((i < TEST_TRIGGER_NUM) ? MDF_OK : MDF_ERR_NOT_SUPPORTED, mlink_trigger_add(trigger_raw_data));
+    }
+
+    g_get_value_count = 0;
+    start_us = esp_timer_get_time();
+
+    for (int i = 0; i < TEST_HANDLE_LOOPS; ++i) {
+        TEST_ASSERT_EQUAL(MDF_OK, mlink_trigger_handle(MLINK_COMMUNICATE_NONE));
+    }
+
+    handle_us    = (esp_timer_get_time() - start_us) / TEST_HANDLE_LOOPS;
+    handle_reads = g_get_value_count / TEST_HANDLE_LOOPS;
+
+    g_get_value_count = 0;
+    start_us = esp_timer_get_time();
+
+    for (int i = 0; i < TEST_HANDLE_LOOPS; ++i) {
+        TEST_ASSERT_EQUAL(MDF_OK, mlink_trigger_handle_cid(MLINK_COMMUNICATE_NONE, i % TEST_TRIGGER_CID));
+    }
+
+    handle_cid_us    = (esp_timer_get_time() - start_us) / TEST_HANDLE_LOOPS;
+    handle_cid_reads = g_get_value_count / TEST_HANDLE_LOOPS;
+
+    /**< The timings depend on the load of the device, only the reads are checked */
+    MDF_LOGI("mlink_trigger_handle: %lld us, get_value: %d", handle_us, handle_reads);
+    MDF_LOGI("mlink_trigger_handle_cid: %lld us, get_value: %d", handle_cid_us, handle_cid_reads);
+
+    TEST_ASSERT_EQUAL(TEST_TRIGGER_CID, handle_reads);
+    TEST_ASSERT_EQUAL(1, handle_cid_reads);
+
+    test_trigger_erase();
+}
@@ -38,6 +38,7 @@ extern "C" {
 #define MDF_ERR_MUPGRADE_SEND_PACKET_LOSS    (MDF_ERR_MUPGRADE_BASE + 8) /**< Request device upgrade status failed */
 #define MDF_ERR_MUPGRADE_NOT_INIT            (MDF_ERR_MUPGRADE_BASE + 9) /**< Upgrade configuration is not initialized */
 #define MDF_ERR_MUPGRADE_STOP                (MDF_ERR_MUPGRADE_BASE + 10) /**< Upgrade configuration is not initialized */
+#define MDF_ERR_MUPGRADE_DELTA_BASE          (MDF_ERR_MUPGRADE_BASE + 11) /**< The running firmware is not the base of the delta */
 
 /**
  * @brief enumerated list OF MDF event id
@@ -52,8 +53,15 @@ extern "C" {
 /**
  * @brief Firmware subcontract upgrade
  */
-#define MUPGRADE_PACKET_MAX_SIZE             (1024)  /**< Maximum length of a single packet transmitted */
+#define MUPGRADE_PACKET_MAX_SIZE             (1344) /**< Maximum length of a single packet transmitted, a packet multicast to 16 devices fits one mesh frame */
 #define MUPGRADE_PACKET_MAX_NUM              (4096) /**< The maximum number of packets */
+#define MUPGRADE_LEGACY_PACKET_SIZE          (1024) /**< Length of the packets of the devices that do not advertise MUPGRADE_STATUS_VERSION */
+
+/**
+ * @brief Version of the status packet, the devices without it use the legacy status
+ *        that ends at written_size and only take full images in legacy packets
+ */
+#define MUPGRADE_STATUS_VERSION              (1)
 
 /**
  * @brief Bit operations to get and modify a bit in an array
@@ -67,6 +75,13 @@ extern "C" {
 #define MUPGRADE_TYPE_DATA                   (0x1)
 #define MUPGRADE_TYPE_STATUS                 (0x2)
 
+/**
+ * @brief Type of the image transmitted to the nodes
+ */
+#define MUPGRADE_IMAGE_TYPE_FULL             (0x0) /**< Complete firmware, written to the update partition as is */
+#define MUPGRADE_IMAGE_TYPE_DELTA            (0x1) /**< Delta against the running firmware, generated by tools/mupgrade_delta.py */
+#define MUPGRADE_IMAGE_TYPE_COMPRESSED       (0x2) /**< Firmware compressed in blocks, generated by tools/mupgrade_compress.py */
+
 /**
  * @brief Firmware packet
  */
@@ -86,6 +101,11 @@ typedef struct {
     mdf_err_t error_code;      /**< Upgrade status */
     size_t total_size;         /**< Total length of firmware */
     size_t written_size;       /**< The length of the flash has been written */
+    uint8_t version;           /**< MUPGRADE_STATUS_VERSION, the fields above are the legacy status */
+    uint8_t image_type;        /**< Type of the transmitted image, MUPGRADE_IMAGE_TYPE_FULL, MUPGRADE_IMAGE_TYPE_DELTA
+                                    or MUPGRADE_IMAGE_TYPE_COMPRESSED */
+    size_t image_size;         /**< Length of the decompressed image, only used by MUPGRADE_IMAGE_TYPE_COMPRESSED */
+    uint16_t packet_size;      /**< Length of the firmware packets, only the last packet is shorter */
     uint8_t progress_array[0]; /**< Identify if each packet of data has been written */
 } __attribute__((packed)) mupgrade_status_t;
 
@@ -113,6 +133,16 @@ typedef struct {
 
     size_t requested_num;     /**< The number of devices to be upgraded */
     uint8_t *requested_addr;  /**< This address is used to buffer the result of the request during the upgrade process */
+
+    uint64_t total_us;        /**< Time spent in mupgrade_firmware_send() */
+    uint64_t read_us;         /**< Time spent reading the firmware from flash, overlaps with sending */
+    uint64_t send_us;         /**< Time spent in mwifi_root_write() */
+    uint64_t wait_us;         /**< Time spent in flow control and waiting for packets read from flash */
+    uint64_t status_us;       /**< Time spent requesting the upgrade status of the devices */
+
+    size_t pass_num;          /**< Number of passes sending the missing packets */
+    uint32_t send_rate;       /**< Send rate at the end of the last pass, packets per second */
+    uint32_t packet_loss;     /**< Percentage of the packets of the last pass missed by at least one device */
 } mupgrade_result_t;
 
 /**
@@ -132,6 +162,27 @@ typedef struct {
  */
 mdf_err_t mupgrade_firmware_init(const char *name, size_t size);
 
+/**
+ * @brief  Initialize the upgrade status with the expected digest of the firmware
+ *
+ * @attention Only called at the root
+ *
+ * @note The firmware is hashed while it is downloaded, mupgrade_firmware_download_finished()
+ *       fails with MDF_ERR_MUPGRADE_FIRMWARE_INVALID if it does not match
+ *
+ * @param  name   Unique identifier of the firmware
+ * @param  size   Total length of firmware, or OTA_SIZE_UNKNOWN
+ * @param  sha256 SHA-256 of the firmware as downloaded, NULL if unknown
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_INVALID_ARG
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ *    - Errors of esp_ota_begin(), the firmware is then not downloaded
+ */
+mdf_err_t mupgrade_firmware_init_sha256(const char *name, size_t size, const uint8_t sha256[32]);
+
 /**
  * @brief  Write firmware to flash
  *
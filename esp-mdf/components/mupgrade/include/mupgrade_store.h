@@ -0,0 +1,146 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MUPGRADE_STORE_H__
+#define __MUPGRADE_STORE_H__
+
+#include "mupgrade.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Image of the firmware store, a data partition of the root holding several firmware
+ *
+ * The images are keyed by the SHA-256 of their content, uploading a binary that is already
+ * stored under another name or version only adds an entry. Each image is followed by its
+ * manifest, so a stored image is sent without being hashed again.
+ */
+typedef struct {
+    char name[32];             /**< Name of the firmware sent to the devices, as mupgrade_status_t */
+    char version[32];          /**< Version of the firmware */
+    uint8_t sha256[32];        /**< SHA-256 of the image */
+    uint32_t offset;           /**< Offset of the image in the store partition, sector aligned */
+    uint32_t size;             /**< Length of the image as sent to the devices */
+    uint8_t image_type;        /**< MUPGRADE_IMAGE_TYPE_FULL, MUPGRADE_IMAGE_TYPE_DELTA or MUPGRADE_IMAGE_TYPE_COMPRESSED */
+    uint32_t image_size;       /**< Length of the decompressed image, only used by MUPGRADE_IMAGE_TYPE_COMPRESSED */
+    uint16_t packet_size;      /**< Length of the firmware packets */
+    uint16_t manifest_size;    /**< Length of the manifest following the image */
+} __attribute__((packed)) mupgrade_store_entry_t;
+
+/**
+ * @brief  Start storing a firmware in the firmware store
+ *
+ * @attention Only called at the root, one firmware is stored at a time
+ *
+ * @param  name    Name of the firmware sent to the devices
+ * @param  version Version of the firmware, an image of the same name and version is replaced
+ * @param  size    Length of the firmware
+ * @param  sha256  Expected SHA-256 of the firmware, NULL if unknown. If it is already stored,
+ *                 the data is not written again.
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_INVALID_ARG
+ *    - MDF_ERR_INVALID_STATE, another firmware is being stored
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_store_begin(const char *name, const char *version, size_t size, const uint8_t sha256[32]);
+
+/**
+ * @brief  Write the next part of the firmware to the firmware store
+ *
+ * @param  data Pointer to the firmware
+ * @param  size The length of the data
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_INVALID_ARG
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_store_write(const void *data, size_t size);
+
+/**
+ * @brief  Check the stored firmware and add it to the index of the firmware store
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_NOT_SUPPORTED, the image replaced is being sent
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_store_finish(void);
+
+/**
+ * @brief  Delete a firmware from the firmware store
+ *
+ * @param  name    Name of the firmware
+ * @param  version Version of the firmware
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_FOUND
+ *    - MDF_ERR_NOT_SUPPORTED, the firmware is being sent
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_store_delete(const char *name, const char *version);
+
+/**
+ * @brief  List the firmware of the firmware store
+ *
+ * @param  entries Entries of the stored firmware
+ * @param  num     Number of entries, set to the number of entries filled
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_store_list(mupgrade_store_entry_t *entries, size_t *num);
+
+/**
+ * @brief  Send a firmware of the firmware store to the devices
+ *
+ * @attention Only called at the root
+ *
+ * @note  Different firmware can be sent at the same time to different devices, each from its
+ *        own task. The answers of the devices are dispatched by the name of the firmware, so
+ *        the firmware sent at the same time must have different names. The firmware sent with
+ *        mupgrade_firmware_send() may be sent at the same time too.
+ *
+ * @param  name            Name of the firmware
+ * @param  version         Version of the firmware, NULL for the first one of this name
+ * @param  dest_addrs      Destination address of the devices, MWIFI_ADDR_ANY and MWIFI_ADDR_BROADCAST
+ *                         are not supported since the other devices run another firmware
+ * @param  dest_addrs_num  Number of destination addresses
+ * @param  result          Must call mupgrade_result_free to free memory
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_FOUND
+ *    - MDF_ERR_NOT_SUPPORTED, a firmware of the same name is being sent
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID, the image was stored with packets longer than MUPGRADE_PACKET_MAX_SIZE
+ */
+mdf_err_t mupgrade_store_send(const char *name, const char *version, const uint8_t *dest_addrs,
+                              size_t dest_addrs_num, mupgrade_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+#endif /**< __MUPGRADE_STORE_H__ */
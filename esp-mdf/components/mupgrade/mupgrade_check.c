@@ -11,7 +11,9 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
-#include "mupgrade.h"
+#include "mupgrade_priv.h"
+#include "esp_image_format.h"
+#include "soc/soc.h"
 
 #ifdef CONFIG_IDF_TARGET_ESP32C3
 #include "esp32c3/rom/rtc.h"
@@ -130,9 +132,15 @@ static void mupgrade_version_fallback_task(void *arg)
 
 #endif /**< CONFIG_MUPGRADE_VERSION_FALLBACK_RESTART */
 
+/**
+ * @brief Identifier of the firmware generated by this project, kept in the read-only data
+ */
+static const uint8_t __attribute__((used)) g_firmware_flag[MUPGRADE_FIRMWARE_FLAG_SIZE] = MUPGRADE_FIRMWARE_FLAG;
+
 __attribute((constructor)) mdf_err_t mupgrade_partition_switch()
 {
-    const volatile uint8_t firmware_flag[MUPGRADE_FIRMWARE_FLAG_SIZE] = MUPGRADE_FIRMWARE_FLAG;
+    /**< Referenced through a volatile pointer so that the linker keeps the flag */
+    const uint8_t *volatile firmware_flag = g_firmware_flag;
 
     (void)firmware_flag;
     MDF_LOGD("Add an identifier to the firmware: %s", firmware_flag);
@@ -148,74 +156,206 @@ __attribute((constructor)) mdf_err_t mupgrade_partition_switch()
 }
 
 #ifdef CONFIG_MUPGRADE_FIRMWARE_CHECK
+
+#define MUPGRADE_ONES_WORD   (0x01010101)
+#define MUPGRADE_HIGHS_WORD  (0x80808080)
+
+/**
+ * @brief Offset of the flag found by the last check, the flag is looked for there first
+ */
+static uint32_t g_flag_partition_address = UINT32_MAX;
+static size_t g_flag_offset              = 0;
+
 /**
- * @brief Knuth–Morris–Pratt algorithm, a search algorithm
+ * @brief Look for the flag a word at a time, only the bytes equal to the first byte of
+ *        the flag are compared. Flash mapped by the cache is read faster by words.
  */
-static void kmp_next(const uint8_t *target, size_t size, uint8_t *next)
+static const uint8_t *mupgrade_flag_find(const uint8_t *src, size_t src_size,
+        const uint8_t *flag, size_t flag_size)
 {
-    next[0] = 0;
+    const uint8_t *end    = NULL;
+    const uint8_t *cursor = src;
+    uint32_t first_word   = flag[0] * MUPGRADE_ONES_WORD;
+
+    if (src_size < flag_size) {
+        return NULL;
+    }
+
+    end = src + src_size - flag_size + 1;
 
-    for (int i = 1, j = 0; i < size; i++) {
-        while (j > 0 && target[j] != target[i]) {
-            j = next[j - 1];
+    /**< Bytes up to the first aligned word */
+    for (; cursor < end && ((uintptr_t)cursor & 0x3); ++cursor) {
+        if (*cursor == flag[0] && !memcmp(cursor, flag, flag_size)) {
+            return cursor;
         }
+    }
+
+    for (; cursor + sizeof(uint32_t) <= end; cursor += sizeof(uint32_t)) {
+        /**< A zero byte of the xor is a byte equal to flag[0] */
+        uint32_t word = *(const uint32_t *)cursor ^ first_word;
 
-        if (target[j] == target[i]) {
-            j = j + 1;
+        if (!((word - MUPGRADE_ONES_WORD) & ~word & MUPGRADE_HIGHS_WORD)) {
+            continue;
         }
 
-        next[i] = j;
+        for (int i = 0; i < sizeof(uint32_t); ++i) {
+            if (cursor[i] == flag[0] && !memcmp(cursor + i, flag, flag_size)) {
+                return cursor + i;
+            }
+        }
+    }
+
+    for (; cursor < end; ++cursor) {
+        if (*cursor == flag[0] && !memcmp(cursor, flag, flag_size)) {
+            return cursor;
+        }
     }
+
+    return NULL;
 }
 
-static mdf_err_t kmp_find(const uint8_t *src, int src_size,
-                          const uint8_t *target, int target_size, const uint8_t *next)
+/**
+ * @brief Look for the flag in [offset, offset + size) of the partition
+ */
+static mdf_err_t mupgrade_flag_find_range(const esp_partition_t *partition, size_t offset, size_t size,
+        const uint8_t *flag, size_t flag_size, size_t *flag_offset)
 {
-    for (int i = 0, next_index = 0; i <= src_size - target_size; i++) {
-        while (next_index != 0 && (src[i] != target[next_index])) {
-            next_index = next[next_index - 1];
-        }
+    mdf_err_t ret                      = MDF_OK;
+    const uint8_t *data                = NULL;
+    const uint8_t *found               = NULL;
+    spi_flash_mmap_handle_t map_handle = 0;
+
+    if (offset >= partition->size || size < flag_size) {
+        return MDF_ERR_NOT_FOUND;
+    }
+
+    size = MIN(size, partition->size - offset);
+
+    ret = esp_partition_mmap(partition, offset, size, SPI_FLASH_MMAP_DATA, (const void **)&data, &map_handle);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_mmap", mdf_err_to_name(ret));
+
+    found = mupgrade_flag_find(data, size, flag, flag_size);
 
-        if (src[i] == target[next_index]) {
-            next_index++;
+    if (found) {
+        *flag_offset = offset + (found - data);
+    }
+
+    spi_flash_munmap(map_handle);
+
+    return found ? MDF_OK : MDF_ERR_NOT_FOUND;
+}
 
-            if (next_index == target_size) {
+/**
+ * @brief The flag is g_firmware_flag, it is in the read-only data of a segment mapped to DROM.
+ *        The segments are listed by the image header, the first one starts with the app
+ *        descriptor. Only these segments are searched instead of the whole partition.
+ *
+ * @return MDF_ERR_NOT_FOUND if the flag is not in the DROM segments, MDF_ERR_NOT_SUPPORTED
+ *         if the image does not have this layout
+ */
+static mdf_err_t mupgrade_flag_find_drom(const esp_partition_t *partition, const uint8_t *flag,
+        size_t flag_size, size_t *flag_offset)
+{
+    mdf_err_t ret                      = MDF_OK;
+    esp_image_header_t image_header    = {0};
+    esp_image_segment_header_t segment = {0};
+    esp_app_desc_t app_desc            = {0};
+    size_t offset                      = sizeof(esp_image_header_t);
+
+    ret = esp_partition_read(partition, 0, &image_header, sizeof(esp_image_header_t));
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read", mdf_err_to_name(ret));
+    MDF_ERROR_CHECK(image_header.magic != ESP_IMAGE_HEADER_MAGIC || image_header.segment_count > ESP_IMAGE_MAX_SEGMENTS,
+                    MDF_ERR_NOT_SUPPORTED, "Invalid image header, magic: 0x%x", image_header.magic);
+
+    ret = esp_partition_read(partition, offset + sizeof(esp_image_segment_header_t),
+                             &app_desc, sizeof(esp_app_desc_t));
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read", mdf_err_to_name(ret));
+    MDF_ERROR_CHECK(app_desc.magic_word != ESP_APP_DESC_MAGIC_WORD, MDF_ERR_NOT_SUPPORTED,
+                    "Invalid app descriptor, magic_word: 0x%x", app_desc.magic_word);
+
+    for (int i = 0; i < image_header.segment_count; ++i) {
+        ret = esp_partition_read(partition, offset, &segment, sizeof(esp_image_segment_header_t));
+        MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+        offset += sizeof(esp_image_segment_header_t);
+        MDF_ERROR_CHECK(offset + segment.data_len > partition->size, MDF_ERR_NOT_SUPPORTED,
+                        "Invalid segment, load_addr: 0x%x, data_len: %d", segment.load_addr, segment.data_len);
+
+        if (segment.load_addr >= SOC_DROM_LOW && segment.load_addr < SOC_DROM_HIGH) {
+            ret = mupgrade_flag_find_range(partition, offset, segment.data_len, flag, flag_size, flag_offset);
+
+            if (ret == MDF_OK) {
                 return MDF_OK;
             }
         }
+
+        offset += segment.data_len;
     }
 
-    return MDF_FAIL;
+    return MDF_ERR_NOT_FOUND;
 }
 
-mdf_err_t mupgrade_firmware_check(const esp_partition_t *partition)
+mdf_err_t mupgrade_firmware_check_offset(const esp_partition_t *partition, size_t *flag_offset)
 {
     MDF_PARAM_CHECK(partition);
 
-    mdf_err_t ret            = MDF_OK;
-    const void *firmware_ptr;
-    uint8_t firmware_flag[MUPGRADE_FIRMWARE_FLAG_SIZE]   = MUPGRADE_FIRMWARE_FLAG;
-    uint8_t kmp_next_buffer[MUPGRADE_FIRMWARE_FLAG_SIZE] = {0};
-    size_t flag_size = strlen((char *)firmware_flag);
-
-    if (flag_size > MUPGRADE_FIRMWARE_FLAG_SIZE) {
-        flag_size = MUPGRADE_FIRMWARE_FLAG_SIZE;
+    mdf_err_t ret = MDF_OK;
+    size_t offset = 0;
+    uint8_t flag[MUPGRADE_FIRMWARE_FLAG_SIZE] = MUPGRADE_FIRMWARE_FLAG;
+    uint8_t data[MUPGRADE_FIRMWARE_FLAG_SIZE] = {0};
+    size_t flag_size = strnlen((char *)flag, MUPGRADE_FIRMWARE_FLAG_SIZE);
+
+    /**< The same firmware is usually checked again, e.g. by the fallback after an upgrade */
+    if (g_flag_partition_address == partition->address && g_flag_offset + flag_size <= partition->size
+            && esp_partition_read(partition, g_flag_offset, data, flag_size) == ESP_OK
+            && !memcmp(data, flag, flag_size)) {
+        offset = g_flag_offset;
+        MDF_LOGD("The flag is at the offset of the last check, offset: 0x%x", offset);
+        goto EXIT;
     }
 
-    spi_flash_mmap_handle_t map_handle;
-    ret = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &firmware_ptr, &map_handle);
-    MDF_ERROR_CHECK(ret != ESP_OK, ret, "mmap ota partition failed");
+    ret = mupgrade_flag_find_drom(partition, flag, flag_size, &offset);
 
-    kmp_next(firmware_flag, flag_size, kmp_next_buffer);
-    ret = kmp_find(firmware_ptr, partition->size, firmware_flag, flag_size, kmp_next_buffer);
+    /**
+     * @brief An image of another layout is searched entirely, and so is an image built
+     *        by an earlier version, which may have the flag outside the DROM segments
+     */
+    if (ret != MDF_OK) {
+        MDF_LOGD("<%s> The flag is not in DROM, search the partition", mdf_err_to_name(ret));
+        ret = mupgrade_flag_find_range(partition, 0, partition->size, flag, flag_size, &offset);
+    }
 
     MDF_ERROR_CHECK(ret != MDF_OK, MDF_ERR_MUPGRADE_FIRMWARE_INVALID,
                     "The firmware is not generated by this project");
+
+    g_flag_partition_address = partition->address;
+    g_flag_offset            = offset;
+
+EXIT:
+
+    if (flag_offset) {
+        *flag_offset = offset;
+    }
+
     return MDF_OK;
 }
 
+mdf_err_t mupgrade_firmware_check(const esp_partition_t *partition)
+{
+    return mupgrade_firmware_check_offset(partition, NULL);
+}
+
 #else
 
+mdf_err_t mupgrade_firmware_check_offset(const esp_partition_t *partition, size_t *flag_offset)
+{
+    if (flag_offset) {
+        *flag_offset = 0;
+    }
+
+    return MDF_OK;
+}
+
 mdf_err_t mupgrade_firmware_check(const esp_partition_t *partition)
 {
     return MDF_OK;
@@ -0,0 +1,254 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mbedtls/sha256.h"
+#include "miniz.h"
+
+#include "mdf_common.h"
+#include "mupgrade_priv.h"
+
+static const char *TAG = "mupgrade_compress";
+
+/**
+ * @brief The decompressor and its output are allocated once per upgrade,
+ *        every block is inflated in place with the same context
+ */
+static mz_stream *g_inflate_stream = NULL;
+static uint8_t *g_inflate_buffer   = NULL;
+
+bool mupgrade_compress_is_valid(const void *data, size_t size)
+{
+    const mupgrade_compress_header_t *header = (const mupgrade_compress_header_t *)data;
+
+    return data && size >= sizeof(mupgrade_compress_header_t) && header->magic == MUPGRADE_COMPRESS_MAGIC;
+}
+
+static mdf_err_t mupgrade_compress_init(void)
+{
+    if (g_inflate_stream) {
+        return MDF_OK;
+    }
+
+    g_inflate_stream = MDF_CALLOC(1, sizeof(mz_stream));
+    g_inflate_buffer = MDF_MALLOC(MUPGRADE_COMPRESS_BLOCK_SIZE);
+
+    if (!g_inflate_stream || !g_inflate_buffer
+            || mz_inflateInit2(g_inflate_stream, -MZ_DEFAULT_WINDOW_BITS) != MZ_OK) {
+        MDF_FREE(g_inflate_stream);
+        MDF_FREE(g_inflate_buffer);
+        MDF_LOGW("Initialize the decompressor");
+        return MDF_ERR_NO_MEM;
+    }
+
+    return MDF_OK;
+}
+
+void mupgrade_compress_deinit(void)
+{
+    if (g_inflate_stream) {
+        mz_inflateEnd(g_inflate_stream);
+    }
+
+    MDF_FREE(g_inflate_stream);
+    MDF_FREE(g_inflate_buffer);
+}
+
+static mdf_err_t mupgrade_compress_header_check(const mupgrade_compress_header_t *header)
+{
+    MDF_ERROR_CHECK(header->magic != MUPGRADE_COMPRESS_MAGIC || header->version != MUPGRADE_COMPRESS_VERSION
+                    || header->header_size < sizeof(mupgrade_compress_header_t)
+                    || header->header_size > MUPGRADE_COMPRESS_PACKET_SIZE
+                    || header->block_size > MUPGRADE_COMPRESS_BLOCK_SIZE,
+                    MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "Invalid compressed header, magic: 0x%x, version: %d",
+                    header->magic, header->version);
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Inflate one block into g_inflate_buffer, the block header is followed by its deflate stream
+ */
+static mdf_err_t mupgrade_compress_inflate(const mupgrade_compress_block_t *block,
+        const uint8_t *data, size_t size)
+{
+    mdf_err_t ret = MDF_OK;
+
+    MDF_ERROR_CHECK(!block->raw_size || block->raw_size > MUPGRADE_COMPRESS_BLOCK_SIZE
+                    || sizeof(mupgrade_compress_block_t) + block->data_size > size,
+                    MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "Invalid compressed block, raw_size: %d, data_size: %d",
+                    block->raw_size, block->data_size);
+
+    ret = mupgrade_compress_init();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_compress_init");
+
+    mz_inflateReset(g_inflate_stream);
+    g_inflate_stream->next_in   = data + sizeof(mupgrade_compress_block_t);
+    g_inflate_stream->avail_in  = block->data_size;
+    g_inflate_stream->next_out  = g_inflate_buffer;
+    g_inflate_stream->avail_out = block->raw_size;
+
+    /**< MZ_FINISH on the first call decodes the whole block straight into the output buffer */
+    ret = mz_inflate(g_inflate_stream, MZ_FINISH);
+    MDF_ERROR_CHECK(ret != MZ_STREAM_END || g_inflate_stream->total_out != block->raw_size,
+                    MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "mz_inflate, ret: %d, offset: %d, total_out: %d",
+                    ret, block->offset, (int)g_inflate_stream->total_out);
+
+    MDF_ERROR_CHECK(mz_crc32(MZ_CRC32_INIT, g_inflate_buffer, block->raw_size) != block->crc32,
+                    MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "The crc32 of the block does not match, offset: %d",
+                    block->offset);
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_compress_write(const esp_partition_t *partition, size_t image_size,
+                                  uint16_t seq, const uint8_t *data, size_t size)
+{
+    MDF_PARAM_CHECK(partition);
+    MDF_PARAM_CHECK(data);
+
+    mdf_err_t ret = MDF_OK;
+
+    if (seq == 0) {
+        mupgrade_compress_header_t header = {0};
+
+        MDF_ERROR_CHECK(size < sizeof(mupgrade_compress_header_t), MDF_ERR_MUPGRADE_FIRMWARE_INVALID,
+                        "The compressed header is truncated, size: %d", size);
+        memcpy(&header, data, sizeof(mupgrade_compress_header_t));
+
+        ret = mupgrade_compress_header_check(&header);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_compress_header_check");
+        MDF_ERROR_CHECK(header.image_size != image_size, MDF_ERR_MUPGRADE_FIRMWARE_INVALID,
+                        "The image size does not match, image_size: %d, expected: %d",
+                        header.image_size, image_size);
+
+        return MDF_OK;
+    }
+
+    mupgrade_compress_block_t block = {0};
+
+    MDF_ERROR_CHECK(size < sizeof(mupgrade_compress_block_t), MDF_ERR_MUPGRADE_FIRMWARE_INVALID,
+                    "The compressed block is truncated, seq: %d, size: %d", seq, size);
+    memcpy(&block, data, sizeof(mupgrade_compress_block_t));
+
+    MDF_ERROR_CHECK(block.offset + block.raw_size > image_size, MDF_ERR_MUPGRADE_FIRMWARE_INVALID,
+                    "The block exceeds the image, offset: %d, raw_size: %d", block.offset, block.raw_size);
+
+    ret = mupgrade_compress_inflate(&block, data, size);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> Inflate the block, seq: %d", mdf_err_to_name(ret), seq);
+
+    ret = esp_partition_write(partition, block.offset, g_inflate_buffer, block.raw_size);
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_DOWNLOAD,
+                    "esp_partition_write %s", esp_err_to_name(ret));
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_compress_apply(const esp_partition_t *partition, size_t offset,
+                                  size_t size, esp_ota_handle_t *handle)
+{
+    MDF_PARAM_CHECK(partition);
+    MDF_PARAM_CHECK(handle);
+    MDF_PARAM_CHECK(size >= sizeof(mupgrade_compress_header_t));
+
+    mdf_err_t ret                     = MDF_OK;
+    bool ota_started                  = false;
+    size_t image_size                 = 0;
+    uint16_t block_num                = 0;
+    uint8_t sha256[32]                = {0};
+    mupgrade_compress_header_t header = {0};
+    mupgrade_compress_block_t block   = {0};
+    uint8_t *packet                   = NULL;
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+
+    ret = esp_partition_read(partition, offset, &header, sizeof(mupgrade_compress_header_t));
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+    ret = mupgrade_compress_header_check(&header);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_compress_header_check");
+
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+    MDF_ERROR_GOTO(MUPGRADE_ALIGN_SECTOR(header.image_size) > offset, EXIT,
+                   "The new image overlaps the compressed firmware, image_size: %d, offset: %d",
+                   header.image_size, offset);
+
+    packet = MDF_MALLOC(MUPGRADE_COMPRESS_PACKET_SIZE);
+    ret    = MDF_ERR_NO_MEM;
+    MDF_ERROR_GOTO(!packet, EXIT, "");
+
+    ret = esp_ota_begin(partition, header.image_size, handle);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_ota_begin", mdf_err_to_name(ret));
+    ota_started = true;
+
+    mbedtls_sha256_starts_ret(&ctx, 0);
+
+    /**< Blocks are stored in image order, the new image is written front to back */
+    for (size_t packet_offset = MUPGRADE_COMPRESS_PACKET_SIZE; packet_offset < size;
+            packet_offset += MUPGRADE_COMPRESS_PACKET_SIZE, block_num++) {
+        size_t packet_size = MIN(size - packet_offset, MUPGRADE_COMPRESS_PACKET_SIZE);
+
+        ret = esp_partition_read(partition, offset + packet_offset, packet, packet_size);
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        MDF_ERROR_GOTO(packet_size < sizeof(mupgrade_compress_block_t), EXIT,
+                       "The compressed block is truncated, size: %d", packet_size);
+        memcpy(&block, packet, sizeof(mupgrade_compress_block_t));
+
+        MDF_ERROR_GOTO(block.offset != image_size || image_size + block.raw_size > header.image_size, EXIT,
+                       "Invalid block offset, offset: %d, expected: %d", block.offset, image_size);
+
+        ret = mupgrade_compress_inflate(&block, packet, packet_size);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Inflate the block", mdf_err_to_name(ret));
+
+        mbedtls_sha256_update_ret(&ctx, g_inflate_buffer, block.raw_size);
+
+        ret = esp_ota_write(*handle, g_inflate_buffer, block.raw_size);
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_ota_write", mdf_err_to_name(ret));
+
+        image_size += block.raw_size;
+    }
+
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE;
+    MDF_ERROR_GOTO(image_size != header.image_size || block_num != header.block_num, EXIT,
+                   "The compressed firmware is truncated, image_size: %d, expected: %d",
+                   image_size, header.image_size);
+
+    mbedtls_sha256_finish_ret(&ctx, sha256);
+
+    if (memcmp(sha256, header.image_sha256, sizeof(sha256))) {
+        MDF_LOGW("The sha256 of the new image does not match");
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        goto EXIT;
+    }
+
+    ota_started = false;
+    ret = esp_ota_end(*handle);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_ota_end", mdf_err_to_name(ret));
+
+    MDF_LOGI("Firmware decompressed, size: %d, image_size: %d, block_num: %d",
+             size, header.image_size, header.block_num);
+
+EXIT:
+
+    if (ota_started) {
+        esp_ota_abort(*handle);
+    }
+
+    mbedtls_sha256_free(&ctx);
+    mupgrade_compress_deinit();
+    MDF_FREE(packet);
+    return ret;
+}
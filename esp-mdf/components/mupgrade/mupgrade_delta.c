@@ -0,0 +1,195 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mbedtls/sha256.h"
+
+#include "mdf_common.h"
+#include "mupgrade_priv.h"
+
+static const char *TAG = "mupgrade_delta";
+
+bool mupgrade_delta_is_valid(const void *data, size_t size)
+{
+    const mupgrade_delta_header_t *header = (const mupgrade_delta_header_t *)data;
+
+    return data && size >= sizeof(header->magic) && header->magic == MUPGRADE_DELTA_MAGIC;
+}
+
+size_t mupgrade_delta_offset(const esp_partition_t *partition, size_t delta_size)
+{
+    size_t aligned_size = MUPGRADE_ALIGN_SECTOR(delta_size);
+
+    return (partition && aligned_size < partition->size) ? partition->size - aligned_size : 0;
+}
+
+static mdf_err_t mupgrade_partition_sha256(const esp_partition_t *partition, size_t size,
+        uint8_t *buffer, uint8_t sha256[32])
+{
+    mdf_err_t ret = MDF_OK;
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+
+    for (size_t offset = 0, read_size = 0; offset < size; offset += read_size) {
+        read_size = MIN(size - offset, MUPGRADE_PACKET_MAX_SIZE);
+
+        ret = esp_partition_read(partition, offset, buffer, read_size);
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_partition_read, offset: %d",
+                       mdf_err_to_name(ret), offset);
+
+        mbedtls_sha256_update_ret(&ctx, buffer, read_size);
+    }
+
+    mbedtls_sha256_finish_ret(&ctx, sha256);
+
+EXIT:
+    mbedtls_sha256_free(&ctx);
+    return ret;
+}
+
+/**
+ * @brief Copy a range of the delta or of the base image to the new image
+ */
+static mdf_err_t mupgrade_delta_copy(esp_ota_handle_t handle, const esp_partition_t *partition,
+                                     size_t offset, size_t size, uint8_t *buffer)
+{
+    mdf_err_t ret = MDF_OK;
+
+    for (size_t copy_size = 0; size > 0; offset += copy_size, size -= copy_size) {
+        copy_size = MIN(size, MUPGRADE_PACKET_MAX_SIZE);
+
+        ret = esp_partition_read(partition, offset, buffer, copy_size);
+        MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read, offset: %d",
+                        mdf_err_to_name(ret), offset);
+
+        ret = esp_ota_write(handle, buffer, copy_size);
+        MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_ota_write", mdf_err_to_name(ret));
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_delta_apply(const esp_partition_t *partition, size_t delta_offset,
+                               size_t delta_size, esp_ota_handle_t *handle)
+{
+    MDF_PARAM_CHECK(partition);
+    MDF_PARAM_CHECK(handle);
+    MDF_PARAM_CHECK(delta_size >= sizeof(mupgrade_delta_header_t));
+
+    mdf_err_t ret                  = MDF_OK;
+    bool ota_started               = false;
+    size_t offset                  = 0;
+    size_t target_size             = 0;
+    uint8_t sha256[32]             = {0};
+    mupgrade_delta_header_t header = {0};
+    mupgrade_delta_op_t op         = {0};
+    uint8_t *buffer                = NULL;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+
+    ret = esp_partition_read(partition, delta_offset, &header, sizeof(mupgrade_delta_header_t));
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+    MDF_ERROR_CHECK(header.magic != MUPGRADE_DELTA_MAGIC || header.version != MUPGRADE_DELTA_VERSION
+                    || header.header_size < sizeof(mupgrade_delta_header_t) || header.header_size > delta_size,
+                    MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "Invalid delta header, magic: 0x%x, version: %d",
+                    header.magic, header.version);
+    MDF_ERROR_CHECK(!running || header.base_size > running->size, MDF_ERR_MUPGRADE_DELTA_BASE,
+                    "The base image is larger than the running partition, base_size: %d", header.base_size);
+    MDF_ERROR_CHECK(MUPGRADE_ALIGN_SECTOR(header.target_size) > delta_offset, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "The new image overlaps the delta, target_size: %d, delta_offset: %d",
+                    header.target_size, delta_offset);
+
+    buffer = MDF_MALLOC(MUPGRADE_PACKET_MAX_SIZE);
+    MDF_ERROR_CHECK(!buffer, MDF_ERR_NO_MEM, "");
+
+    /**< The delta only applies to the image it was generated from */
+    ret = mupgrade_partition_sha256(running, header.base_size, buffer, sha256);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Calculate the sha256 of the running image");
+
+    if (memcmp(sha256, header.base_sha256, sizeof(sha256))) {
+        MDF_LOGW("The running image does not match the base of the delta");
+        ret = MDF_ERR_MUPGRADE_DELTA_BASE;
+        goto EXIT;
+    }
+
+    ret = esp_ota_begin(partition, header.target_size, handle);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_ota_begin", mdf_err_to_name(ret));
+    ota_started = true;
+
+    /**
+     * @brief Stream the operations, the new image is written front to back
+     *        and only one flash block is buffered at a time
+     */
+    for (offset = header.header_size; offset + sizeof(mupgrade_delta_op_t) <= delta_size;) {
+        ret = esp_partition_read(partition, delta_offset + offset, &op, sizeof(mupgrade_delta_op_t));
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+        offset += sizeof(mupgrade_delta_op_t);
+
+        if (op.type == MUPGRADE_DELTA_OP_END) {
+            break;
+        }
+
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        MDF_ERROR_GOTO(target_size + op.size > header.target_size, EXIT,
+                       "The delta exceeds the new image, target_size: %d, op_size: %d",
+                       target_size, op.size);
+
+        if (op.type == MUPGRADE_DELTA_OP_COPY) {
+            MDF_ERROR_GOTO(op.offset + op.size > header.base_size, EXIT,
+                           "Copy out of the base image, offset: %d, size: %d", op.offset, op.size);
+            ret = mupgrade_delta_copy(*handle, running, op.offset, op.size, buffer);
+        } else if (op.type == MUPGRADE_DELTA_OP_INSERT) {
+            MDF_ERROR_GOTO(offset + op.size > delta_size, EXIT,
+                           "Insert out of the delta, offset: %d, size: %d", offset, op.size);
+            ret = mupgrade_delta_copy(*handle, partition, delta_offset + offset, op.size, buffer);
+            offset += op.size;
+        } else {
+            MDF_LOGW("Unknown delta operation, type: %d", op.type);
+            goto EXIT;
+        }
+
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Apply the delta", mdf_err_to_name(ret));
+        target_size += op.size;
+    }
+
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE;
+    MDF_ERROR_GOTO(op.type != MUPGRADE_DELTA_OP_END || target_size != header.target_size, EXIT,
+                   "The delta is truncated, target_size: %d, expected: %d", target_size, header.target_size);
+
+    ota_started = false;
+    ret = esp_ota_end(*handle);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_ota_end", mdf_err_to_name(ret));
+
+    ret = mupgrade_partition_sha256(partition, header.target_size, buffer, sha256);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "Calculate the sha256 of the new image");
+
+    if (memcmp(sha256, header.target_sha256, sizeof(sha256))) {
+        MDF_LOGW("The sha256 of the new image does not match");
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        goto EXIT;
+    }
+
+    MDF_LOGI("Delta applied, delta_size: %d, base_size: %d, target_size: %d",
+             delta_size, header.base_size, header.target_size);
+
+EXIT:
+
+    if (ota_started) {
+        esp_ota_abort(*handle);
+    }
+
+    MDF_FREE(buffer);
+    return ret;
+}
@@ -0,0 +1,221 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mdf_common.h"
+#include "mupgrade_priv.h"
+
+/**
+ * @brief Without the journal partition the status is saved to NVS as before
+ */
+#define MUPGRADE_JOURNAL_STORE_KEY "mupgrade_status"
+
+static const char *TAG = "mupgrade_journal";
+static const esp_partition_t *g_journal_partition = NULL;
+static bool g_journal_partition_searched          = false;
+static uint32_t g_journal_saved_step              = 0; /**< Report interval of the progress last saved to NVS */
+
+static uint32_t mupgrade_journal_step(const mupgrade_status_t *status)
+{
+    if (!status->total_size) {
+        return 0;
+    }
+
+    return status->written_size * 100 / status->total_size / CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL;
+}
+
+static const esp_partition_t *mupgrade_journal_partition(void)
+{
+    if (!g_journal_partition_searched) {
+        g_journal_partition_searched = true;
+        g_journal_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                              CONFIG_MUPGRADE_JOURNAL_PARTITION_LABEL);
+
+        if (!g_journal_partition || g_journal_partition->size < SPI_FLASH_SEC_SIZE) {
+            MDF_LOGW("No journal partition, the progress is saved to NVS, label: %s",
+                     CONFIG_MUPGRADE_JOURNAL_PARTITION_LABEL);
+            g_journal_partition = NULL;
+        }
+    }
+
+    return g_journal_partition;
+}
+
+mdf_err_t mupgrade_journal_load(mupgrade_status_t *status)
+{
+    MDF_PARAM_CHECK(status);
+
+    mdf_err_t ret                    = MDF_OK;
+    const esp_partition_t *partition = mupgrade_journal_partition();
+    mupgrade_journal_header_t header = {0};
+    uint16_t packet_num              = 0;
+
+    if (!partition) {
+        ret = mdf_info_load(MUPGRADE_JOURNAL_STORE_KEY, status,
+                            sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+
+        if (ret == MDF_OK) {
+            g_journal_saved_step = mupgrade_journal_step(status);
+        }
+
+        return ret;
+    }
+
+    ret = esp_partition_read(partition, 0, &header, sizeof(mupgrade_journal_header_t));
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+    if (header.magic != MUPGRADE_JOURNAL_MAGIC || header.version != MUPGRADE_JOURNAL_VERSION
+            || header.header_size != sizeof(mupgrade_journal_header_t)
+            || !header.status.packet_size || header.status.packet_size > MUPGRADE_PACKET_MAX_SIZE
+            || !header.status.total_size
+            || header.status.total_size > header.status.packet_size * MUPGRADE_PACKET_MAX_NUM) {
+        return MDF_ERR_NOT_FOUND;
+    }
+
+    memcpy(status, &header.status, sizeof(mupgrade_status_t));
+
+    ret = esp_partition_read(partition, MUPGRADE_JOURNAL_BITMAP_OFFSET,
+                             status->progress_array, MUPGRADE_PACKET_MAX_NUM / 8);
+    MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+    /**< A cleared bit is a packet written to flash */
+    status->error_code   = MDF_OK;
+    status->written_size = 0;
+    packet_num           = (status->total_size + status->packet_size - 1) / status->packet_size;
+
+    for (uint16_t i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; ++i) {
+        status->progress_array[i] = ~status->progress_array[i];
+    }
+
+    for (uint16_t seq = 0; seq < packet_num; ++seq) {
+        if (MUPGRADE_GET_BITS(status->progress_array, seq)) {
+            status->written_size += (seq == packet_num - 1) ?
+                                    status->total_size - seq * status->packet_size : status->packet_size;
+        }
+    }
+
+    MDF_LOGI("Resume the upgrade, name: %s, total_size: %d, written_size: %d",
+             status->name, status->total_size, status->written_size);
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_journal_start(const mupgrade_status_t *status)
+{
+    MDF_PARAM_CHECK(status);
+
+    mdf_err_t ret                    = MDF_OK;
+    const esp_partition_t *partition = mupgrade_journal_partition();
+    mupgrade_journal_header_t header = {
+        .magic       = MUPGRADE_JOURNAL_MAGIC,
+        .version     = MUPGRADE_JOURNAL_VERSION,
+        .header_size = sizeof(mupgrade_journal_header_t),
+    };
+
+    if (!partition) {
+        ret = mdf_info_save(MUPGRADE_JOURNAL_STORE_KEY, status,
+                            sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mdf_info_save");
+
+        /**< The steps of a previous upgrade of this boot must not be skipped */
+        g_journal_saved_step = mupgrade_journal_step(status);
+        return MDF_OK;
+    }
+
+    memcpy(&header.status, status, sizeof(mupgrade_status_t));
+
+    ret = esp_partition_erase_range(partition, 0, SPI_FLASH_SEC_SIZE);
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_erase_range", mdf_err_to_name(ret));
+
+    /**< The magic is written last, a header torn by a reset is never replayed */
+    ret = esp_partition_write(partition, sizeof(header.magic), (uint8_t *)&header + sizeof(header.magic),
+                              sizeof(mupgrade_journal_header_t) - sizeof(header.magic));
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_write", mdf_err_to_name(ret));
+
+    /**< Restarted with some packets kept, e.g. a block dropped by the verification */
+    if (status->written_size) {
+        uint8_t *bitmap = MDF_MALLOC(MUPGRADE_PACKET_MAX_NUM / 8);
+        MDF_ERROR_CHECK(!bitmap, MDF_ERR_NO_MEM, "");
+
+        for (uint16_t i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; ++i) {
+            bitmap[i] = ~status->progress_array[i];
+        }
+
+        ret = esp_partition_write(partition, MUPGRADE_JOURNAL_BITMAP_OFFSET, bitmap, MUPGRADE_PACKET_MAX_NUM / 8);
+        MDF_FREE(bitmap);
+        MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                        "<%s> esp_partition_write", mdf_err_to_name(ret));
+    }
+
+    ret = esp_partition_write(partition, 0, &header, sizeof(header.magic));
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_write", mdf_err_to_name(ret));
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_journal_mark(const mupgrade_status_t *status, uint16_t seq)
+{
+    MDF_PARAM_CHECK(status);
+    MDF_PARAM_CHECK(seq < MUPGRADE_PACKET_MAX_NUM);
+
+    mdf_err_t ret                    = MDF_OK;
+    const esp_partition_t *partition = mupgrade_journal_partition();
+
+    if (!partition) {
+        /**< Each save rewrites the whole blob, only save once per report interval */
+        uint32_t written_step = mupgrade_journal_step(status);
+
+        if (written_step == g_journal_saved_step) {
+            return MDF_OK;
+        }
+
+        g_journal_saved_step = written_step;
+
+        ret = mdf_info_save(MUPGRADE_JOURNAL_STORE_KEY, status,
+                            sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mdf_info_save");
+        return MDF_OK;
+    }
+
+    /**< Flash writes only clear bits, the other packets of the byte are left as they are */
+    uint8_t value = ~(1 << (seq & 0x7));
+
+    ret = esp_partition_write(partition, MUPGRADE_JOURNAL_BITMAP_OFFSET + (seq >> 0x3), &value, sizeof(value));
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_write, seq: %d", mdf_err_to_name(ret), seq);
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_journal_erase(void)
+{
+    mdf_err_t ret                    = MDF_OK;
+    const esp_partition_t *partition = mupgrade_journal_partition();
+    uint32_t magic                   = 0;
+
+    if (!partition) {
+        mdf_info_erase(MUPGRADE_JOURNAL_STORE_KEY);
+        g_journal_saved_step = 0;
+        return MDF_OK;
+    }
+
+    /**< Clear the magic instead of erasing the sector, the next upgrade erases it */
+    ret = esp_partition_write(partition, 0, &magic, sizeof(magic));
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_write", mdf_err_to_name(ret));
+
+    return MDF_OK;
+}
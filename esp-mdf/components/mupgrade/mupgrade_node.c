@@ -12,28 +12,102 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include "mupgrade.h"
-
-#define MUPGRADE_STORE_CONFIG_KEY "mupugrad_config"
+#include "mupgrade_priv.h"
 
 static const char *TAG = "mupgrade_node";
 static mupgrade_config_t *g_upgrade_config = NULL;
 static bool g_upgrade_finished_flag        = false;
+static SemaphoreHandle_t g_upgrade_lock    = NULL; /**< Protects g_upgrade_config and the update partition from the relay task */
 
-static mdf_err_t mupgrade_status(const mupgrade_status_t *status, size_t size)
+/**
+ * @brief Offset of the transmitted image in the update partition
+ */
+static size_t mupgrade_image_offset(void)
+{
+    if (g_upgrade_config->status.image_type != MUPGRADE_IMAGE_TYPE_DELTA) {
+        return 0;
+    }
+
+    return mupgrade_delta_offset(g_upgrade_config->partition, g_upgrade_config->status.total_size);
+}
+
+/**
+ * @brief Send the status to the root in the layout of its request, a root that does not
+ *        advertise MUPGRADE_STATUS_VERSION expects the progress right after written_size
+ */
+static mdf_err_t mupgrade_status_write(size_t progress_size)
 {
-    mdf_err_t ret               = MDF_ERR_NO_MEM;
-    size_t response_size        = sizeof(mupgrade_status_t);
-    mwifi_data_type_t data_type = {
+    mdf_err_t ret                   = MDF_OK;
+    const mupgrade_status_t *status = &g_upgrade_config->status;
+    uint8_t *legacy_status          = NULL;
+    mwifi_data_type_t data_type     = {
         .upgrade = true
     };
 
+    if (status->version >= MUPGRADE_STATUS_VERSION) {
+        return mwifi_write(NULL, &data_type, status, sizeof(mupgrade_status_t) + progress_size, true);
+    }
+
+    legacy_status = MDF_MALLOC(MUPGRADE_STATUS_LEGACY_SIZE + progress_size);
+    MDF_ERROR_CHECK(!legacy_status, MDF_ERR_NO_MEM, "");
+
+    memcpy(legacy_status, status, MUPGRADE_STATUS_LEGACY_SIZE);
+    memcpy(legacy_status + MUPGRADE_STATUS_LEGACY_SIZE, status->progress_array, progress_size);
+
+    ret = mwifi_write(NULL, &data_type, legacy_status, MUPGRADE_STATUS_LEGACY_SIZE + progress_size, true);
+    MDF_FREE(legacy_status);
+
+    return ret;
+}
+
+/**
+ * @brief Answer the status request of the root, with the progress if the firmware is partly written
+ */
+static mdf_err_t mupgrade_status_response(void)
+{
+    mdf_err_t ret        = MDF_OK;
+    size_t progress_size = 0;
+
+    if (g_upgrade_config->status.written_size
+            && g_upgrade_config->status.written_size != g_upgrade_config->status.total_size) {
+        progress_size = MUPGRADE_PACKET_MAX_NUM / 8;
+        ESP_LOG_BUFFER_CHAR_LEVEL(TAG, g_upgrade_config->status.progress_array,
+                                  MUPGRADE_PACKET_MAX_NUM / 8, ESP_LOG_VERBOSE);
+    } else if (g_upgrade_config->status.written_size == g_upgrade_config->status.total_size) {
+        mdf_event_loop_send(MDF_EVENT_MUPGRADE_STATUS, (void *)100);
+    }
+
+    MDF_LOGD("Response mupgrade status, written_size: %d, progress_size: %d, version: %d",
+             g_upgrade_config->status.written_size, progress_size, g_upgrade_config->status.version);
+    ret = mupgrade_status_write(progress_size);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mwifi_write");
+
+    return MDF_OK;
+}
+
+static mdf_err_t mupgrade_status(const mupgrade_status_t *status, size_t size)
+{
+    mdf_err_t ret                   = MDF_ERR_NO_MEM;
+    mupgrade_status_t legacy_status = {0};
+
+    /**< A root without MUPGRADE_STATUS_VERSION sends the legacy status, a full image in legacy packets */
+    if (size < sizeof(mupgrade_status_t)) {
+        MDF_ERROR_CHECK(size < MUPGRADE_STATUS_LEGACY_SIZE, MDF_ERR_INVALID_ARG,
+                        "The status is truncated, size: %d", size);
+
+        memcpy(&legacy_status, status, MUPGRADE_STATUS_LEGACY_SIZE);
+        legacy_status.image_type  = MUPGRADE_IMAGE_TYPE_FULL;
+        legacy_status.packet_size = MUPGRADE_LEGACY_PACKET_SIZE;
+        status = &legacy_status;
+        size   = sizeof(mupgrade_status_t);
+    }
+
     if (!g_upgrade_config) {
         size_t config_size = sizeof(mupgrade_config_t) + MUPGRADE_PACKET_MAX_NUM / 8;
         g_upgrade_config   = MDF_CALLOC(1, config_size);
         MDF_ERROR_GOTO(!g_upgrade_config, EXIT, "<MDF_ERR_NO_MEM> g_upgrade_config");
 
-        mdf_info_load(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config, &config_size);
+        mupgrade_journal_load(&g_upgrade_config->status);
 
         g_upgrade_config->start_time = xTaskGetTickCount();
         g_upgrade_config->partition = esp_ota_get_next_update_partition(NULL);
@@ -42,11 +116,17 @@ static mdf_err_t mupgrade_status(const mupgrade_status_t *status, size_t size)
     /**< If g_upgrade_config->status has been created and
          once again upgrade the same name bin, just return MDF_OK */
     if (!strcmp(g_upgrade_config->status.name, status->name)
-            && g_upgrade_config->status.total_size == status->total_size) {
+            && g_upgrade_config->status.total_size == status->total_size
+            && g_upgrade_config->status.image_type == status->image_type
+            && g_upgrade_config->status.image_size == status->image_size
+            && g_upgrade_config->status.packet_size == status->packet_size) {
+        g_upgrade_config->status.version = status->version;
         ret = MDF_OK;
         goto EXIT;
     }
 
+    mupgrade_verify_deinit();
+
     memset(g_upgrade_config, 0, sizeof(mupgrade_config_t));
     memcpy(&g_upgrade_config->status, status, sizeof(mupgrade_status_t));
     memset(&g_upgrade_config->status.progress_array, 0, MUPGRADE_PACKET_MAX_NUM / 8);
@@ -70,6 +150,11 @@ static mdf_err_t mupgrade_status(const mupgrade_status_t *status, size_t size)
         goto EXIT;
     }
 
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+    MDF_ERROR_GOTO(!status->packet_size || status->packet_size > MUPGRADE_PACKET_MAX_SIZE
+                   || status->total_size > status->packet_size * MUPGRADE_PACKET_MAX_NUM, EXIT,
+                   "Invalid packet size, packet_size: %d, total_size: %d", status->packet_size, status->total_size);
+
     g_upgrade_finished_flag = false;
     /**< Get partition info of currently running app
     Return the next OTA app partition which should be written with a new firmware.*/
@@ -92,30 +177,54 @@ static mdf_err_t mupgrade_status(const mupgrade_status_t *status, size_t size)
     uint32_t assoc_expire = esp_mesh_get_ap_assoc_expire();
     ESP_ERROR_CHECK(esp_mesh_set_ap_assoc_expire(60));
 
-    /**< Commence an OTA update writing to the specified partition. */
-    ret = esp_ota_begin(update, g_upgrade_config->status.total_size, &g_upgrade_config->handle);
-    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "esp_ota_begin failed");
+    if (g_upgrade_config->status.image_type == MUPGRADE_IMAGE_TYPE_DELTA) {
+        /**< The delta is received at the end of the update partition, the OTA
+             update of the new image starts when the delta is complete */
+        size_t delta_offset = mupgrade_image_offset();
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+        MDF_ERROR_GOTO(!delta_offset, EXIT, "The delta does not fit the update partition, size: %d",
+                       g_upgrade_config->status.total_size);
+
+        ret = esp_partition_erase_range(update, delta_offset,
+                                        MUPGRADE_ALIGN_SECTOR(g_upgrade_config->status.total_size));
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "esp_partition_erase_range failed");
+    } else if (g_upgrade_config->status.image_type == MUPGRADE_IMAGE_TYPE_COMPRESSED) {
+        /**< Blocks are inflated straight into the update partition, erase the decompressed length */
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+        MDF_ERROR_GOTO(g_upgrade_config->status.image_size > update->size, EXIT,
+                       "The decompressed image does not fit the update partition, image_size: %d",
+                       g_upgrade_config->status.image_size);
+
+        ret = esp_ota_begin(update, g_upgrade_config->status.image_size, &g_upgrade_config->handle);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "esp_ota_begin failed");
+    } else {
+        /**< Commence an OTA update writing to the specified partition. */
+        ret = esp_ota_begin(update, g_upgrade_config->status.total_size, &g_upgrade_config->handle);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "esp_ota_begin failed");
+    }
 
     ESP_ERROR_CHECK(esp_mesh_set_ap_assoc_expire(assoc_expire));
     MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_start, ret: %d", ret);
 
-    /**< Save upgrade infomation to flash. */
-    ret = mdf_info_save(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config,
-                        sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
-    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "info_store_save, ret: %d", ret);
+    /**< Start the progress journal, the upgrade resumes from it after a reset */
+    ret = mupgrade_journal_start(&g_upgrade_config->status);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_journal_start, ret: %d", ret);
 
     /**< Send MDF_EVENT_MUPGRADE_STARTED event to the event handler */
     mdf_event_loop_send(MDF_EVENT_MUPGRADE_STARTED, NULL);
 
 EXIT:
 
-    if (g_upgrade_config->status.written_size
+    /**< The block hashes of the firmware follow the status */
+    if (ret == MDF_OK && size > sizeof(mupgrade_status_t)
+            && g_upgrade_config->status.image_type != MUPGRADE_IMAGE_TYPE_COMPRESSED
             && g_upgrade_config->status.written_size != g_upgrade_config->status.total_size) {
-        response_size += MUPGRADE_PACKET_MAX_NUM / 8;
-        ESP_LOG_BUFFER_CHAR_LEVEL(TAG, g_upgrade_config->status.progress_array,
-                                  MUPGRADE_PACKET_MAX_NUM / 8, ESP_LOG_VERBOSE);
-    } else if (g_upgrade_config->status.written_size == g_upgrade_config->status.total_size) {
-        mdf_event_loop_send(MDF_EVENT_MUPGRADE_STATUS, (void *)100);
+        ret = mupgrade_verify_init((const mupgrade_manifest_t *)status->progress_array, size - sizeof(mupgrade_status_t));
+
+        if (ret != MDF_OK) {
+            MDF_LOGW("<%s> mupgrade_verify_init", mdf_err_to_name(ret));
+            ret = MDF_OK;
+        }
     }
 
     g_upgrade_config->status.type = MUPGRADE_TYPE_DATA;
@@ -124,12 +233,15 @@ EXIT:
         g_upgrade_config->status.error_code = ret;
     }
 
-    MDF_LOGD("Response mupgrade status, written_size: %d, response_size: %d",
-             g_upgrade_config->status.written_size, response_size);
-    ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, response_size, true);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mwifi_write");
+    /**< Serve the children from flash before answering, the root only sends what the parents could not */
+    if (status->type == MUPGRADE_TYPE_RELAY && ret == MDF_OK
+            && g_upgrade_config->status.image_type != MUPGRADE_IMAGE_TYPE_COMPRESSED
+            && mupgrade_relay_start(g_upgrade_config, g_upgrade_lock, mupgrade_image_offset(),
+                                    mupgrade_status_response) == MDF_OK) {
+        return MDF_OK;
+    }
 
-    return MDF_OK;
+    return mupgrade_status_response();
 }
 
 static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
@@ -144,8 +256,8 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
         g_upgrade_config   = MDF_CALLOC(1, config_size);
         MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_NO_MEM, "<MDF_ERR_NO_MEM> g_upgrade_config");
 
-        /**< Get upgrade infomation to flash. */
-        ret = mdf_info_load(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config, &config_size);
+        /**< Replay the progress journal of the upgrade interrupted by a reset */
+        ret = mupgrade_journal_load(&g_upgrade_config->status);
 
         g_upgrade_config->start_time = xTaskGetTickCount();
         g_upgrade_config->partition = esp_ota_get_next_update_partition(NULL);
@@ -158,21 +270,22 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
     }
 
     if (g_upgrade_config->status.error_code == MDF_ERR_MUPGRADE_STOP) {
-        mwifi_data_type_t data_type = {
-            .upgrade = true
-        };
         g_upgrade_config->status.type         = MUPGRADE_TYPE_DATA;
         g_upgrade_config->status.written_size = 0;
         memset(&g_upgrade_config->status.progress_array, 0, MUPGRADE_PACKET_MAX_NUM / 8);
-        mdf_info_erase(MUPGRADE_STORE_CONFIG_KEY);
+        mupgrade_journal_erase();
 
-        ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, sizeof(mupgrade_status_t), true);
+        ret = mupgrade_status_write(0);
         MDF_ERROR_CHECK(ret != MDF_OK, ret, "mwifi_write");
 
         return MDF_OK;
     }
 
-    MDF_ERROR_CHECK(packet->seq * MUPGRADE_PACKET_MAX_SIZE > g_upgrade_config->status.total_size,
+    uint16_t packet_size = g_upgrade_config->status.packet_size;
+    MDF_ERROR_CHECK(size < sizeof(mupgrade_packet_t) - MUPGRADE_PACKET_MAX_SIZE + packet->size
+                    || packet->size > packet_size, MDF_ERR_INVALID_ARG,
+                    "The packet is truncated, size: %d, packet_size: %d", size, packet->size);
+    MDF_ERROR_CHECK(packet->seq * packet_size > g_upgrade_config->status.total_size,
                     MDF_ERR_INVALID_ARG, "packet->seq: %d", packet->seq);
 
     /**< Received a duplicate packet */
@@ -181,18 +294,41 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
         return MDF_OK;
     }
 
-    /**< Write firmware data to the update partition */
-    ret = esp_partition_write(g_upgrade_config->partition, packet->seq * MUPGRADE_PACKET_MAX_SIZE,
-                              packet->data, packet->size);
-    MDF_ERROR_CHECK(ret != MDF_OK, MDF_ERR_MUPGRADE_FIRMWARE_DOWNLOAD,
-                    "esp_partition_write %s", esp_err_to_name(ret));
+    if (g_upgrade_config->status.image_type == MUPGRADE_IMAGE_TYPE_COMPRESSED) {
+        /**< Inflate the block into the update partition, the packet is requested again on failure */
+        ret = mupgrade_compress_write(g_upgrade_config->partition, g_upgrade_config->status.image_size,
+                                      packet->seq, packet->data, packet->size);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_compress_write, seq: %d", packet->seq);
+    } else {
+        /**< Write firmware data to the update partition */
+        ret = esp_partition_write(g_upgrade_config->partition, mupgrade_image_offset() + packet->seq * packet_size,
+                                  packet->data, packet->size);
+        MDF_ERROR_CHECK(ret != MDF_OK, MDF_ERR_MUPGRADE_FIRMWARE_DOWNLOAD,
+                        "esp_partition_write %s", esp_err_to_name(ret));
+    }
 
     /**< Update g_upgrade_config->status */
     MUPGRADE_SET_BITS(g_upgrade_config->status.progress_array, packet->seq);
     g_upgrade_config->status.written_size += packet->size;
 
-    /**< Save OTA status periodically, it can be used to
-         resumable data transfers from breakpoint after system reset */
+    if (g_upgrade_config->status.image_type != MUPGRADE_IMAGE_TYPE_COMPRESSED) {
+        /**< Check the block once all of its packets are written, a corrupted block is requested again */
+        ret = mupgrade_verify_write(&g_upgrade_config->status, g_upgrade_config->partition,
+                                    mupgrade_image_offset(), packet->seq, packet->data);
+
+        if (ret == MDF_ERR_MUPGRADE_FIRMWARE_INVALID) {
+            mupgrade_journal_start(&g_upgrade_config->status);
+            return ret;
+        }
+    }
+
+    /**< Checkpoint every packet, the transfer resumes from here after a reset */
+    ret = mupgrade_journal_mark(&g_upgrade_config->status, packet->seq);
+
+    if (ret != MDF_OK) {
+        MDF_LOGW("<%s> mupgrade_journal_mark, seq: %d", mdf_err_to_name(ret), packet->seq);
+    }
+
     static uint32_t s_next_written_percentage = CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL;
     uint32_t written_percentage = g_upgrade_config->status.written_size * 100 / g_upgrade_config->status.total_size;
 
@@ -200,18 +336,25 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
              packet->seq, packet->size, g_upgrade_config->status.written_size, written_percentage, s_next_written_percentage);
 
     if (written_percentage == s_next_written_percentage) {
-        MDF_LOGD("Save the data of upgrade status to flash");
         s_next_written_percentage += CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL;
 
-        mdf_info_save(MUPGRADE_STORE_CONFIG_KEY, g_upgrade_config,
-                      sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
-
         /**< Send MDF_EVENT_MUPGRADE_STATUS event to the event handler */
         mdf_event_loop_send(MDF_EVENT_MUPGRADE_STATUS, (void *)written_percentage);
     } else if (written_percentage > s_next_written_percentage) {
         s_next_written_percentage = (written_percentage / CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL + 1) * CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL;
     }
 
+    /**< The blocks written before a reset are checked before the image is used */
+    if (g_upgrade_config->status.written_size == g_upgrade_config->status.total_size
+            && g_upgrade_config->status.image_type != MUPGRADE_IMAGE_TYPE_COMPRESSED) {
+        ret = mupgrade_verify_finish(&g_upgrade_config->status, g_upgrade_config->partition, mupgrade_image_offset());
+
+        if (ret != MDF_OK) {
+            mupgrade_journal_start(&g_upgrade_config->status);
+            return ret;
+        }
+    }
+
     if (g_upgrade_config->status.written_size == g_upgrade_config->status.total_size) {
         ESP_LOG_BUFFER_CHAR_LEVEL(TAG, g_upgrade_config->status.progress_array,
                                   MUPGRADE_PACKET_MAX_NUM / 8, ESP_LOG_VERBOSE);
@@ -219,10 +362,34 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
                  g_upgrade_config->status.total_size, g_upgrade_config->status.written_size,
                  (xTaskGetTickCount() - g_upgrade_config->start_time) * portTICK_RATE_MS / 1000);
 
-        /**< If ESP32 was reset duration OTA, and after restart, the update_handle will be invalid,
-             but it still can switch boot partition and reboot successful */
-        esp_ota_end(g_upgrade_config->handle);
-        mdf_info_erase(MUPGRADE_STORE_CONFIG_KEY);
+        if (g_upgrade_config->status.image_type == MUPGRADE_IMAGE_TYPE_DELTA) {
+            /**< Rebuild the new image from the running image and the received delta */
+            ret = mupgrade_delta_apply(g_upgrade_config->partition, mupgrade_image_offset(),
+                                       g_upgrade_config->status.total_size, &g_upgrade_config->handle);
+
+            if (ret != MDF_OK) {
+                MDF_LOGW("<%s> mupgrade_delta_apply", mdf_err_to_name(ret));
+
+                /**< The delta can not be used on this node, report it as stopped
+                     so that the root removes it from the upgrade list */
+                g_upgrade_config->status.written_size = 0;
+                g_upgrade_config->status.error_code   = MDF_ERR_MUPGRADE_STOP;
+                memset(&g_upgrade_config->status.progress_array, 0, MUPGRADE_PACKET_MAX_NUM / 8);
+                mupgrade_journal_erase();
+
+                mupgrade_status_write(0);
+                return ret;
+            }
+        } else {
+            mupgrade_compress_deinit();
+
+            /**< If ESP32 was reset duration OTA, and after restart, the update_handle will be invalid,
+                 but it still can switch boot partition and reboot successful */
+            esp_ota_end(g_upgrade_config->handle);
+        }
+
+        mupgrade_verify_deinit();
+        mupgrade_journal_erase();
 
         const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
         ret = esp_ota_set_boot_partition(update_partition);
@@ -239,8 +406,7 @@ static mdf_err_t mupgrade_write(const mupgrade_packet_t *packet, size_t size)
         g_upgrade_finished_flag = true;
 
         /**< Response firmware upgrade status to root node. */
-        mwifi_data_type_t data_type = {.upgrade = true,};
-        ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, sizeof(mupgrade_status_t), true);
+        ret = mupgrade_status_write(0);
         MDF_ERROR_CHECK(ret != MDF_OK, ret, "Send the status of the upgrade to the root");
     }
 
@@ -256,15 +422,32 @@ mdf_err_t mupgrade_handle(const uint8_t *addr, const void *data, size_t size)
     mdf_err_t ret     = MDF_OK;
     uint8_t data_type = ((uint8_t *)data)[0];
 
+    if (!g_upgrade_lock) {
+        g_upgrade_lock = xSemaphoreCreateMutex();
+        MDF_ERROR_CHECK(!g_upgrade_lock, MDF_ERR_NO_MEM, "");
+    }
+
     switch (data_type) {
         case MUPGRADE_TYPE_STATUS:
+        case MUPGRADE_TYPE_RELAY:
             MDF_LOGV("MUPGRADE_TYPE_STATUS");
+            xSemaphoreTake(g_upgrade_lock, portMAX_DELAY);
             ret = mupgrade_status((mupgrade_status_t *)data, size);
+            xSemaphoreGive(g_upgrade_lock);
+            break;
+
+        case MUPGRADE_TYPE_RELAY_REQUEST:
+        case MUPGRADE_TYPE_RELAY_STATUS:
+        case MUPGRADE_TYPE_RELAY_FINISH:
+            MDF_LOGV("MUPGRADE_TYPE_RELAY, type: %d", data_type);
+            ret = mupgrade_relay_handle(g_upgrade_config, g_upgrade_lock, addr, data, size);
             break;
 
         case MUPGRADE_TYPE_DATA:
             MDF_LOGV("MUPGRADE_TYPE_DATA");
+            xSemaphoreTake(g_upgrade_lock, portMAX_DELAY);
             ret = mupgrade_write((mupgrade_packet_t *)data, size);
+            xSemaphoreGive(g_upgrade_lock);
             break;
 
         default:
@@ -280,7 +463,9 @@ mdf_err_t mupgrade_get_status(mupgrade_status_t *status)
     MDF_PARAM_CHECK(status);
     MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_NOT_SUPPORTED, "Mupgrade firmware is not initialized");
 
+    xSemaphoreTake(g_upgrade_lock, portMAX_DELAY);
     memcpy(status, &g_upgrade_config->status, sizeof(mupgrade_status_t));
+    xSemaphoreGive(g_upgrade_lock);
 
     return MDF_OK;
 }
@@ -288,28 +473,32 @@ mdf_err_t mupgrade_get_status(mupgrade_status_t *status)
 mdf_err_t mupgrade_stop()
 {
     mdf_err_t ret = MDF_OK;
-    mwifi_data_type_t data_type = {
-        .upgrade = true
-    };
 
     if (!g_upgrade_config) {
         return MDF_OK;
     }
 
+    xSemaphoreTake(g_upgrade_lock, portMAX_DELAY);
+
     if (g_upgrade_finished_flag) {
         const esp_partition_t *running = esp_ota_get_running_partition();
         ret = esp_ota_set_boot_partition(running);
-        MDF_ERROR_CHECK(ret != MDF_OK, ret, "esp_ota_set_boot_partition");
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "esp_ota_set_boot_partition");
     }
 
+    mupgrade_compress_deinit();
+    mupgrade_verify_deinit();
+
     g_upgrade_config->status.type       = MUPGRADE_TYPE_DATA;
     g_upgrade_config->status.error_code = MDF_ERR_MUPGRADE_STOP;
     g_upgrade_config->status.written_size = 0;
     memset(&g_upgrade_config->status.progress_array, 0, MUPGRADE_PACKET_MAX_NUM / 8);
-    mdf_info_erase(MUPGRADE_STORE_CONFIG_KEY);
+    mupgrade_journal_erase();
 
-    ret = mwifi_write(NULL, &data_type, &g_upgrade_config->status, sizeof(mupgrade_status_t), true);
-    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mwifi_write");
+    ret = mupgrade_status_write(0);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mwifi_write");
 
-    return MDF_OK;
+EXIT:
+    xSemaphoreGive(g_upgrade_lock);
+    return ret;
 }
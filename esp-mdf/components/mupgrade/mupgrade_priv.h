@@ -0,0 +1,540 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __MUPGRADE_PRIV_H__
+#define __MUPGRADE_PRIV_H__
+
+#include <stddef.h>
+
+#include "mupgrade.h"
+#include "mupgrade_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /**< _cplusplus */
+
+/**
+ * @brief Type of the relay packets, following MUPGRADE_TYPE_STATUS
+ */
+#define MUPGRADE_TYPE_RELAY                  (0x3) /**< Status request of the root, the node relays to its children before it answers */
+#define MUPGRADE_TYPE_RELAY_REQUEST          (0x4) /**< A parent requests the progress of its child */
+#define MUPGRADE_TYPE_RELAY_STATUS           (0x5) /**< Progress of a child sent to its parent */
+#define MUPGRADE_TYPE_RELAY_FINISH           (0x6) /**< The parent has sent all it could to its child */
+
+/**
+ * @brief Length of the legacy status, the progress of a legacy device follows written_size
+ */
+#define MUPGRADE_STATUS_LEGACY_SIZE          (offsetof(mupgrade_status_t, version))
+#define MUPGRADE_STATUS_IS_LEGACY(size)      ((size) == MUPGRADE_STATUS_LEGACY_SIZE \
+                                              || (size) == MUPGRADE_STATUS_LEGACY_SIZE + MUPGRADE_PACKET_MAX_NUM / 8)
+
+/**
+ * @brief  Convert a status answered by a node to the current layout. A legacy status gets
+ *         version 0 and the progress that follows its written_size is moved to progress_array
+ *
+ * @param  data   Status answered by the node
+ * @param  size   The length of the data, a legacy size or at least sizeof(mupgrade_status_t)
+ * @param  status Converted status, NULL to only get its length
+ *
+ * @return The length of the converted status
+ */
+size_t mupgrade_status_unpack(const void *data, size_t size, mupgrade_status_t *status);
+
+/**
+ * @brief Delta firmware, generated by tools/mupgrade_delta.py
+ *
+ * A delta is a mupgrade_delta_header_t followed by a list of mupgrade_delta_op_t,
+ * the data of MUPGRADE_DELTA_OP_INSERT follows its operation. The delta is stored
+ * at the end of the update partition and the new image is rebuilt at its start.
+ */
+#define MUPGRADE_DELTA_MAGIC                 (0x544c444d) /**< "MDLT" */
+#define MUPGRADE_DELTA_VERSION               (1)
+#define MUPGRADE_DELTA_OP_END                (0x0) /**< End of the delta */
+#define MUPGRADE_DELTA_OP_COPY               (0x1) /**< Copy size bytes at offset of the running image */
+#define MUPGRADE_DELTA_OP_INSERT             (0x2) /**< Insert size bytes following the operation */
+
+#define MUPGRADE_ALIGN_SECTOR(size)          (((size) + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1))
+
+/**
+ * @brief Header of the delta firmware
+ */
+typedef struct {
+    uint32_t magic;             /**< MUPGRADE_DELTA_MAGIC */
+    uint16_t version;           /**< MUPGRADE_DELTA_VERSION */
+    uint16_t header_size;       /**< Length of the header, operations start here */
+    uint32_t base_size;         /**< Length of the image the delta was generated from */
+    uint32_t target_size;       /**< Length of the new image */
+    uint8_t base_sha256[32];    /**< SHA-256 of the image the delta was generated from */
+    uint8_t target_sha256[32];  /**< SHA-256 of the new image */
+} __attribute__((packed)) mupgrade_delta_header_t;
+
+/**
+ * @brief Operation of the delta firmware
+ */
+typedef struct {
+    uint8_t type;    /**< MUPGRADE_DELTA_OP_END, MUPGRADE_DELTA_OP_COPY or MUPGRADE_DELTA_OP_INSERT */
+    uint32_t offset; /**< Offset in the running image, only used by MUPGRADE_DELTA_OP_COPY */
+    uint32_t size;   /**< Length of the data */
+} __attribute__((packed)) mupgrade_delta_op_t;
+
+/**
+ * @brief Compressed firmware, generated by tools/mupgrade_compress.py
+ *
+ * The first packet carries a mupgrade_compress_header_t, every following packet
+ * carries one mupgrade_compress_block_t and its raw deflate stream. Blocks are
+ * independent of each other, so each packet is inflated on its own and written
+ * to the update partition at the offset of the block. Every packet but the last
+ * is padded to MUPGRADE_COMPRESS_PACKET_SIZE.
+ */
+#define MUPGRADE_COMPRESS_MAGIC              (0x504d434d) /**< "MCMP" */
+#define MUPGRADE_COMPRESS_VERSION            (1)
+#define MUPGRADE_COMPRESS_PACKET_SIZE        (1024) /**< Length of the packets of the compressed firmware */
+#define MUPGRADE_COMPRESS_BLOCK_SIZE         (4096) /**< Maximum decompressed length of a block */
+
+/**
+ * @brief Header of the compressed firmware
+ */
+typedef struct {
+    uint32_t magic;             /**< MUPGRADE_COMPRESS_MAGIC */
+    uint16_t version;           /**< MUPGRADE_COMPRESS_VERSION */
+    uint16_t header_size;       /**< Length of the header */
+    uint32_t image_size;        /**< Length of the decompressed image */
+    uint16_t block_num;         /**< Number of blocks, one per packet after the header */
+    uint16_t block_size;        /**< Maximum decompressed length of a block */
+    uint8_t image_sha256[32];   /**< SHA-256 of the decompressed image */
+} __attribute__((packed)) mupgrade_compress_header_t;
+
+/**
+ * @brief Block of the compressed firmware
+ */
+typedef struct {
+    uint32_t offset;    /**< Offset of the block in the decompressed image */
+    uint16_t raw_size;  /**< Decompressed length of the block */
+    uint16_t data_size; /**< Length of the raw deflate stream following this header */
+    uint32_t crc32;     /**< CRC-32 of the decompressed block */
+} __attribute__((packed)) mupgrade_compress_block_t;
+
+/**
+ * @brief Progress journal of the node, kept in its own data partition
+ *
+ * The header is written once when an upgrade starts, followed by a bitmap where
+ * every packet is marked by clearing its bit. Clearing bits does not need an erase,
+ * so a packet is checkpointed with a one byte write and the sector is only erased
+ * when the next upgrade starts. The journal is replayed when the node restarts.
+ */
+#define MUPGRADE_JOURNAL_MAGIC               (0x4c4a4d4d) /**< "MMJL" */
+#define MUPGRADE_JOURNAL_VERSION             (2)
+#define MUPGRADE_JOURNAL_BITMAP_OFFSET       (256) /**< Offset of the bitmap in the journal */
+
+typedef struct {
+    uint32_t magic;            /**< MUPGRADE_JOURNAL_MAGIC, written last and cleared when the upgrade ends */
+    uint16_t version;          /**< MUPGRADE_JOURNAL_VERSION */
+    uint16_t header_size;      /**< Length of the header */
+    mupgrade_status_t status;  /**< Status of the upgrade when it started, without the progress */
+} __attribute__((packed)) mupgrade_journal_header_t;
+
+/**
+ * @brief Hashes of the transmitted firmware, appended by the root to the status request
+ *
+ * The firmware is hashed in blocks of MUPGRADE_MANIFEST_BLOCK_PACKETS packets. A node checks
+ * each block once all of its packets are written, hashing the packets as they arrive when they
+ * arrive in order and reading the block back otherwise. A block that does not match is dropped
+ * and requested again, so a corrupted image is never booted. The compressed firmware is not
+ * covered, each of its blocks carries a CRC-32 of the decompressed data.
+ */
+#define MUPGRADE_MANIFEST_BLOCK_PACKETS      (64)
+#define MUPGRADE_MANIFEST_BLOCK_MAX_NUM      (MUPGRADE_PACKET_MAX_NUM / MUPGRADE_MANIFEST_BLOCK_PACKETS)
+#define MUPGRADE_MANIFEST_HASH_SIZE          (16) /**< Leading bytes of the SHA-256 of a block */
+#define MUPGRADE_MANIFEST_MAX_SIZE           (sizeof(mupgrade_manifest_t) + MUPGRADE_MANIFEST_BLOCK_MAX_NUM * MUPGRADE_MANIFEST_HASH_SIZE)
+
+typedef struct {
+    uint16_t block_packets;   /**< Packets in a block, MUPGRADE_MANIFEST_BLOCK_PACKETS */
+    uint16_t block_num;       /**< Number of blocks */
+    uint8_t block_sha256[0];  /**< MUPGRADE_MANIFEST_HASH_SIZE bytes for every block */
+} __attribute__((packed)) mupgrade_manifest_t;
+
+/**
+ * @brief  Check whether the data starts with a delta header
+ *
+ * @param  data Pointer to the firmware
+ * @param  size The length of the data
+ *
+ * @return true if the firmware is a delta
+ */
+bool mupgrade_delta_is_valid(const void *data, size_t size);
+
+/**
+ * @brief  Get the offset in the update partition where a delta or a compressed firmware is stored
+ *
+ * @param  partition  The update partition
+ * @param  delta_size Total length of the delta or of the compressed firmware
+ *
+ * @return Offset of the delta, 0 if the partition is too small
+ */
+size_t mupgrade_delta_offset(const esp_partition_t *partition, size_t delta_size);
+
+/**
+ * @brief  Rebuild the new image from the running image and the delta stored in the update partition
+ *
+ * @note The running image and the new image are checked against the SHA-256 in the delta header,
+ *       the new image is written with esp_ota_write() and finished with esp_ota_end().
+ *
+ * @param  partition    The update partition
+ * @param  delta_offset Offset of the delta in the update partition
+ * @param  delta_size   Total length of the delta
+ * @param  handle       OTA handle used to write the new image
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ *    - MDF_ERR_MUPGRADE_DELTA_BASE
+ */
+mdf_err_t mupgrade_delta_apply(const esp_partition_t *partition, size_t delta_offset,
+                               size_t delta_size, esp_ota_handle_t *handle);
+
+/**
+ * @brief  Check whether the data starts with a compressed firmware header
+ *
+ * @param  data Pointer to the firmware
+ * @param  size The length of the data
+ *
+ * @return true if the firmware is compressed
+ */
+bool mupgrade_compress_is_valid(const void *data, size_t size);
+
+/**
+ * @brief  Inflate one packet of the compressed firmware into the update partition
+ *
+ * @attention Only called at the non-root, the range of the image must have been erased
+ *
+ * @param  partition  The update partition
+ * @param  image_size Length of the decompressed image
+ * @param  seq        Sequence of the packet, the packet 0 is the header
+ * @param  data       Data of the packet
+ * @param  size       The length of the data
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_DOWNLOAD
+ */
+mdf_err_t mupgrade_compress_write(const esp_partition_t *partition, size_t image_size,
+                                  uint16_t seq, const uint8_t *data, size_t size);
+
+/**
+ * @brief  Decompress the firmware stored in the update partition into a new image
+ *
+ * @attention Only called at the root
+ *
+ * @note The new image is written with esp_ota_write(), finished with esp_ota_end()
+ *       and checked against the SHA-256 in the header.
+ *
+ * @param  partition The update partition
+ * @param  offset    Offset of the compressed firmware in the update partition
+ * @param  size      Total length of the compressed firmware
+ * @param  handle    OTA handle used to write the new image
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_compress_apply(const esp_partition_t *partition, size_t offset,
+                                  size_t size, esp_ota_handle_t *handle);
+
+/**
+ * @brief  Free the decompressor used by mupgrade_compress_write()
+ */
+void mupgrade_compress_deinit(void);
+
+/**
+ * @brief  Replay the progress journal of an interrupted upgrade
+ *
+ * @attention Only called at the non-root
+ *
+ * @param  status Status followed by MUPGRADE_PACKET_MAX_NUM / 8 bytes of progress,
+ *                written_size is recalculated from the progress
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_FOUND
+ */
+mdf_err_t mupgrade_journal_load(mupgrade_status_t *status);
+
+/**
+ * @brief  Erase the progress journal and record the status of a new upgrade
+ *
+ * @attention Only called at the non-root
+ *
+ * @param  status Status of the upgrade
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_journal_start(const mupgrade_status_t *status);
+
+/**
+ * @brief  Record a packet written to flash
+ *
+ * @note Without the journal partition the status is saved with mdf_info_save()
+ *       every CONFIG_MUPGRADE_STATUS_REPORT_INTERVAL percent instead
+ *
+ * @param  status Status of the upgrade, the packet is already set in its progress
+ * @param  seq    Sequence of the packet
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_journal_mark(const mupgrade_status_t *status, uint16_t seq);
+
+/**
+ * @brief  Invalidate the progress journal when the upgrade finishes or stops
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_journal_erase(void);
+
+/**
+ * @brief  Start hashing the firmware downloaded by the root
+ *
+ * @attention Only called at the root
+ *
+ * @param  sha256      Expected SHA-256 of the firmware, NULL if unknown
+ * @param  packet_size Length of the firmware packets
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ */
+mdf_err_t mupgrade_manifest_init(const uint8_t sha256[32], uint16_t packet_size);
+
+/**
+ * @brief  Hash the next part of the firmware downloaded by the root
+ *
+ * @param  data Pointer to the firmware
+ * @param  size The length of the data
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT
+ *    - MDF_ERR_INVALID_SIZE
+ */
+mdf_err_t mupgrade_manifest_update(const void *data, size_t size);
+
+/**
+ * @brief  Finish the hashes when the firmware is downloaded, check the expected digest
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ */
+mdf_err_t mupgrade_manifest_finish(void);
+
+/**
+ * @brief  Get the manifest sent to the nodes
+ *
+ * @param  size The length of the manifest
+ *
+ * @return The manifest, NULL if the firmware is not downloaded
+ */
+const mupgrade_manifest_t *mupgrade_manifest_get(size_t *size);
+
+/**
+ * @brief  Hash a firmware kept in flash
+ *
+ * @param  partition     Partition of the firmware
+ * @param  offset        Offset of the firmware in the partition
+ * @param  size          Length of the firmware
+ * @param  packet_size   Length of the firmware packets
+ * @param  sha256        SHA-256 of the whole firmware
+ * @param  manifest      Manifest sent to the nodes, of MUPGRADE_MANIFEST_MAX_SIZE bytes
+ * @param  manifest_size The length of the manifest
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_INVALID_SIZE
+ */
+mdf_err_t mupgrade_manifest_build(const esp_partition_t *partition, size_t offset, size_t size,
+                                  uint16_t packet_size, uint8_t sha256[32],
+                                  mupgrade_manifest_t *manifest, size_t *manifest_size);
+
+/**
+ * @brief  Set the manifest received from the root, the blocks already checked are kept if it is unchanged
+ *
+ * @attention Only called at the non-root
+ *
+ * @param  manifest Manifest appended to the status request
+ * @param  size     The length of the manifest
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_INVALID_ARG
+ */
+mdf_err_t mupgrade_verify_init(const mupgrade_manifest_t *manifest, size_t size);
+
+/**
+ * @brief  Check the block of a packet just written to flash
+ *
+ * @note   Call after the packet is set in the progress. If its block is complete and does not
+ *         match the manifest, the packets of the block are cleared from the progress.
+ *
+ * @param  status       Status of the upgrade
+ * @param  partition    The update partition
+ * @param  image_offset Offset of the transmitted firmware in the update partition
+ * @param  seq          Sequence of the packet
+ * @param  data         Data of the packet
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ */
+mdf_err_t mupgrade_verify_write(mupgrade_status_t *status, const esp_partition_t *partition,
+                                size_t image_offset, uint16_t seq, const uint8_t *data);
+
+/**
+ * @brief  Check the blocks completed before a reset once the firmware is complete
+ *
+ * @param  status       Status of the upgrade
+ * @param  partition    The update partition
+ * @param  image_offset Offset of the transmitted firmware in the update partition
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ */
+mdf_err_t mupgrade_verify_finish(mupgrade_status_t *status, const esp_partition_t *partition,
+                                 size_t image_offset);
+
+/**
+ * @brief  Whether the block of a packet has been checked against the manifest
+ *
+ * @param  seq Sequence of the packet
+ *
+ * @return true if the block matches the manifest or if there is no manifest
+ */
+bool mupgrade_verify_is_checked(uint16_t seq);
+
+/**
+ * @brief  Free the manifest of the node
+ */
+void mupgrade_verify_deinit(void);
+
+/**
+ * @brief Called when the relay to the children has finished, the node answers the root
+ */
+typedef mdf_err_t (*mupgrade_relay_done_cb_t)(void);
+
+/**
+ * @brief  Send the children the packets they miss and this node has, from the update partition
+ *
+ * @attention Only called at the non-root, when the root requests the status with MUPGRADE_TYPE_RELAY
+ *
+ * @note  The children are asked for their progress and served once, then again when the parent
+ *        of this node has finished serving it. done_cb is called with the lock taken when the
+ *        children are served and the parent has finished, or after CONFIG_MUPGRADE_RELAY_TIMEOUT.
+ *        Only the blocks checked against the manifest are relayed.
+ *
+ * @param  config       Upgrade configuration of the node
+ * @param  lock         Lock of the configuration, taken while it and the update partition are read
+ * @param  image_offset Offset of the transmitted firmware in the update partition
+ * @param  done_cb      Called at the end of the relay
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NO_MEM
+ *    - MDF_ERR_NOT_SUPPORTED, the relay of the previous request is still running
+ */
+mdf_err_t mupgrade_relay_start(mupgrade_config_t *config, SemaphoreHandle_t lock, size_t image_offset,
+                               mupgrade_relay_done_cb_t done_cb);
+
+/**
+ * @brief  Handle the relay packets between a node and its parent or children
+ *
+ * @param  config Upgrade configuration of the node, NULL if there is no upgrade
+ * @param  lock   Lock of the configuration, not held by the caller
+ * @param  addr   Address of the parent or the child
+ * @param  data   MUPGRADE_TYPE_RELAY_REQUEST, MUPGRADE_TYPE_RELAY_STATUS or MUPGRADE_TYPE_RELAY_FINISH
+ * @param  size   The length of the data
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_SUPPORTED
+ */
+mdf_err_t mupgrade_relay_handle(const mupgrade_config_t *config, SemaphoreHandle_t lock,
+                                const uint8_t *addr, const void *data, size_t size);
+
+/**
+ * @brief  Check if the firmware is generated by this project and get where its flag is
+ *
+ * @note   The flag is looked for in the read-only data segments listed by the image header,
+ *         the whole partition is searched only if the image has another layout. The offset
+ *         found is checked first the next time.
+ *
+ * @param  partition   The partition where the firmware to be checked is located
+ * @param  flag_offset Offset of the flag in the partition, NULL if not needed
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_INVALID
+ */
+mdf_err_t mupgrade_firmware_check_offset(const esp_partition_t *partition, size_t *flag_offset);
+
+/**
+ * @brief  Find a stored firmware and keep it from being deleted until mupgrade_store_close()
+ *
+ * @param  name    Name of the firmware
+ * @param  version Version of the firmware, NULL for the first one of this name
+ * @param  entry   Entry of the stored firmware
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_FOUND
+ *    - MDF_ERR_MUPGRADE_FIRMWARE_PARTITION
+ */
+mdf_err_t mupgrade_store_open(const char *name, const char *version, mupgrade_store_entry_t *entry);
+
+/**
+ * @brief  Release a firmware found by mupgrade_store_open()
+ *
+ * @param  entry Entry of the stored firmware
+ *
+ * @return
+ *    - MDF_OK
+ *    - MDF_ERR_NOT_FOUND
+ */
+mdf_err_t mupgrade_store_close(const mupgrade_store_entry_t *entry);
+
+/**
+ * @brief  Get the partition of the firmware store
+ *
+ * @return The partition, NULL if there is none
+ */
+const esp_partition_t *mupgrade_store_partition(void);
+
+#ifdef __cplusplus
+}
+#endif /**< _cplusplus */
+#endif /**< __MUPGRADE_PRIV_H__ */
@@ -0,0 +1,329 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mdf_common.h"
+#include "mupgrade_priv.h"
+
+/**
+ * @brief Progress of a child, answer to MUPGRADE_TYPE_RELAY_REQUEST
+ */
+typedef struct {
+    uint8_t src_addr[MWIFI_ADDR_LEN];
+    size_t size;
+    uint8_t data[0];
+} mupgrade_relay_answer_t;
+
+typedef struct {
+    QueueHandle_t queue;          /**< Progress of the children */
+    SemaphoreHandle_t parent_sem; /**< Given when the parent has finished serving this node */
+    bool running;
+    mupgrade_config_t *config;
+    SemaphoreHandle_t lock;       /**< Lock of config, the node writes and drops packets meanwhile */
+    size_t image_offset;
+    mupgrade_relay_done_cb_t done_cb;
+} mupgrade_relay_t;
+
+static const char *TAG = "mupgrade_relay";
+static mupgrade_relay_t *g_relay = NULL;
+
+static bool mupgrade_relay_same_firmware(const mupgrade_status_t *a, const mupgrade_status_t *b)
+{
+    return !strncmp(a->name, b->name, sizeof(a->name)) && a->total_size == b->total_size
+           && a->image_type == b->image_type && a->packet_size == b->packet_size;
+}
+
+/**
+ * @brief Send a child the packets it misses and this node has written to flash and checked.
+ *        The progress and the flash are read with the lock taken, the packet is sent without it.
+ */
+static mdf_err_t mupgrade_relay_send(const uint8_t *child_addr, const mupgrade_status_t *child_status,
+                                     mupgrade_packet_t *packet, size_t *sent_num)
+{
+    mdf_err_t ret                   = MDF_OK;
+    const mupgrade_status_t *status = &g_relay->config->status;
+    uint16_t packet_num             = (child_status->total_size + child_status->packet_size - 1) / child_status->packet_size;
+    mwifi_data_type_t data_type     = {.upgrade = true};
+    bool relayed                    = false;
+
+    for (uint16_t seq = 0; seq < packet_num && g_relay->running; ++seq) {
+        if (MUPGRADE_GET_BITS(child_status->progress_array, seq)) {
+            continue;
+        }
+
+        xSemaphoreTake(g_relay->lock, portMAX_DELAY);
+
+        /**< The node may have started another firmware meanwhile */
+        if (!mupgrade_relay_same_firmware(child_status, status)) {
+            xSemaphoreGive(g_relay->lock);
+            return MDF_ERR_NOT_SUPPORTED;
+        }
+
+        relayed = MUPGRADE_GET_BITS(status->progress_array, seq) && mupgrade_verify_is_checked(seq);
+
+        if (relayed) {
+            packet->type = MUPGRADE_TYPE_DATA;
+            packet->seq  = seq;
+            packet->size = MIN(status->total_size - seq * status->packet_size, status->packet_size);
+            ret = esp_partition_read(g_relay->config->partition, g_relay->image_offset + seq * status->packet_size,
+                                     packet->data, packet->size);
+        }
+
+        xSemaphoreGive(g_relay->lock);
+
+        if (!relayed) {
+            continue;
+        }
+
+        MDF_ERROR_CHECK(ret != ESP_OK, ret, "<%s> esp_partition_read, seq: %d", mdf_err_to_name(ret), seq);
+
+        ret = mwifi_write(child_addr, &data_type, packet,
+                          sizeof(mupgrade_packet_t) - MUPGRADE_PACKET_MAX_SIZE + packet->size, true);
+        MDF_ERROR_CHECK(ret != MDF_OK, ret, "<%s> mwifi_write, seq: %d", mdf_err_to_name(ret), seq);
+
+        (*sent_num)++;
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Request the progress of the children and serve each of them as its answer arrives
+ */
+static void mupgrade_relay_serve(const wifi_sta_list_t *sta, mupgrade_packet_t *packet)
+{
+    mdf_err_t ret                   = MDF_OK;
+    mupgrade_relay_answer_t *answer = NULL;
+    mupgrade_status_t request       = {0x0};
+    mwifi_data_type_t data_type     = {.upgrade = true};
+    size_t sent_num                 = 0;
+    int answer_num                  = 0;
+
+    xSemaphoreTake(g_relay->lock, portMAX_DELAY);
+    memcpy(&request, &g_relay->config->status, sizeof(mupgrade_status_t));
+    xSemaphoreGive(g_relay->lock);
+    request.type = MUPGRADE_TYPE_RELAY_REQUEST;
+
+    for (int i = 0; i < sta->num; ++i) {
+        ret = mwifi_write(sta->sta[i].mac, &data_type, &request, sizeof(mupgrade_status_t), true);
+        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Request the progress of the child, addr: " MACSTR,
+                           mdf_err_to_name(ret), MAC2STR(sta->sta[i].mac));
+        answer_num++;
+    }
+
+    while (answer_num > 0 && g_relay->running
+            && xQueueReceive(g_relay->queue, &answer, CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
+        mupgrade_status_t *child_status = (mupgrade_status_t *)answer->data;
+        answer_num--;
+
+        if (answer->size >= sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8
+                && mupgrade_relay_same_firmware(child_status, &request)
+                && child_status->written_size != child_status->total_size) {
+            ret = mupgrade_relay_send(answer->src_addr, child_status, packet, &sent_num);
+
+            if (ret != MDF_OK) {
+                MDF_LOGW("<%s> Relay to the child, addr: " MACSTR, mdf_err_to_name(ret), MAC2STR(answer->src_addr));
+            }
+        }
+
+        MDF_FREE(answer);
+    }
+
+    MDF_LOGD("Relay, children: %d, no answer: %d, sent: %d", sta->num, answer_num, sent_num);
+}
+
+static bool mupgrade_relay_has_written(void)
+{
+    xSemaphoreTake(g_relay->lock, portMAX_DELAY);
+    bool written = g_relay->config->status.written_size > 0;
+    xSemaphoreGive(g_relay->lock);
+
+    return written;
+}
+
+static void mupgrade_relay_task(void *arg)
+{
+    mwifi_data_type_t data_type = {.upgrade = true};
+    mupgrade_packet_t *packet   = MDF_MALLOC(sizeof(mupgrade_packet_t));
+    mupgrade_status_t finish    = {0x0};
+    TickType_t start_ticks      = xTaskGetTickCount();
+    TickType_t timeout_ticks    = CONFIG_MUPGRADE_RELAY_TIMEOUT / portTICK_RATE_MS;
+    wifi_sta_list_t sta         = {0};
+
+    /**< The root serves its own children */
+    bool parent_finished = esp_mesh_get_layer() <= 2;
+
+    if (!packet || esp_mesh_get_type() == MESH_LEAF || esp_wifi_ap_get_sta_list(&sta) != ESP_OK) {
+        sta.num = 0;
+    }
+
+    /**< Serve what this node already has, then what the parent has sent meanwhile */
+    if (sta.num > 0 && mupgrade_relay_has_written()) {
+        mupgrade_relay_serve(&sta, packet);
+    }
+
+    if (!parent_finished) {
+        TickType_t elapsed_ticks = xTaskGetTickCount() - start_ticks;
+        parent_finished = xSemaphoreTake(g_relay->parent_sem,
+                                         elapsed_ticks < timeout_ticks ? timeout_ticks - elapsed_ticks : 0);
+
+        if (sta.num > 0 && mupgrade_relay_has_written()) {
+            mupgrade_relay_serve(&sta, packet);
+        }
+    }
+
+    xSemaphoreTake(g_relay->lock, portMAX_DELAY);
+    memcpy(&finish, &g_relay->config->status, sizeof(mupgrade_status_t));
+    xSemaphoreGive(g_relay->lock);
+    finish.type = MUPGRADE_TYPE_RELAY_FINISH;
+
+    for (int i = 0; i < sta.num; ++i) {
+        if (mwifi_write(sta.sta[i].mac, &data_type, &finish, sizeof(mupgrade_status_t), true) != MDF_OK) {
+            MDF_LOGW("Finish the relay to the child, addr: " MACSTR, MAC2STR(sta.sta[i].mac));
+        }
+    }
+
+    MDF_LOGI("Relay finished, children: %d, parent finished: %d, spend time: %dms", sta.num, parent_finished,
+             (xTaskGetTickCount() - start_ticks) * portTICK_RATE_MS);
+
+    MDF_FREE(packet);
+
+    for (mupgrade_relay_answer_t *answer = NULL; xQueueReceive(g_relay->queue, &answer, 0);) {
+        MDF_FREE(answer);
+    }
+
+    xSemaphoreTake(g_relay->lock, portMAX_DELAY);
+    g_relay->running = false;
+    g_relay->done_cb();
+    xSemaphoreGive(g_relay->lock);
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief The parent may finish before the root request reaches this node, the state is kept between requests
+ */
+static mdf_err_t mupgrade_relay_init(void)
+{
+    if (g_relay) {
+        return MDF_OK;
+    }
+
+    g_relay = MDF_CALLOC(1, sizeof(mupgrade_relay_t));
+    MDF_ERROR_CHECK(!g_relay, MDF_ERR_NO_MEM, "");
+
+    g_relay->queue      = xQueueCreate(4, sizeof(mupgrade_relay_answer_t *));
+    g_relay->parent_sem = xSemaphoreCreateBinary();
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_relay_start(mupgrade_config_t *config, SemaphoreHandle_t lock, size_t image_offset,
+                               mupgrade_relay_done_cb_t done_cb)
+{
+    MDF_PARAM_CHECK(config);
+    MDF_PARAM_CHECK(lock);
+    MDF_PARAM_CHECK(done_cb);
+
+    mdf_err_t ret = mupgrade_relay_init();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_relay_init");
+    MDF_ERROR_CHECK(g_relay->running, MDF_ERR_NOT_SUPPORTED, "The relay is running");
+
+    g_relay->running      = true;
+    g_relay->config       = config;
+    g_relay->lock         = lock;
+    g_relay->image_offset = image_offset;
+    g_relay->done_cb      = done_cb;
+
+    if (xTaskCreatePinnedToCore(mupgrade_relay_task, "mupgrade_relay", 3 * 1024, NULL,
+                                CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL, CONFIG_MDF_TASK_PINNED_TO_CORE) != pdPASS) {
+        g_relay->running = false;
+        MDF_LOGW("Create the mupgrade_relay task");
+        return MDF_ERR_NO_MEM;
+    }
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_relay_handle(const mupgrade_config_t *config, SemaphoreHandle_t lock,
+                                const uint8_t *addr, const void *data, size_t size)
+{
+    MDF_PARAM_CHECK(lock);
+    MDF_PARAM_CHECK(addr);
+    MDF_PARAM_CHECK(data);
+    MDF_PARAM_CHECK(size >= sizeof(mupgrade_status_t));
+    MDF_ERROR_CHECK(!config, MDF_ERR_NOT_SUPPORTED, "Relay without upgrade, addr: " MACSTR, MAC2STR(addr));
+
+    mdf_err_t ret                   = MDF_OK;
+    const mupgrade_status_t *status = (const mupgrade_status_t *)data;
+    mwifi_data_type_t data_type     = {.upgrade = true};
+    mupgrade_relay_answer_t *answer = NULL;
+    mupgrade_status_t *response     = MDF_MALLOC(sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+    MDF_ERROR_CHECK(!response, MDF_ERR_NO_MEM, "");
+
+    /**< The progress is copied with the lock taken, it is not held while waiting for the relay task */
+    xSemaphoreTake(lock, portMAX_DELAY);
+    memcpy(response, &config->status, sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8);
+    xSemaphoreGive(lock);
+
+    ret = MDF_ERR_NOT_SUPPORTED;
+    MDF_ERROR_GOTO(!mupgrade_relay_same_firmware(status, response), EXIT,
+                   "Relay of another firmware, addr: " MACSTR, MAC2STR(addr));
+
+    switch (status->type) {
+        case MUPGRADE_TYPE_RELAY_REQUEST:
+            /**< Answer the parent with the progress, the packets it has and this node misses are sent back */
+            response->type = MUPGRADE_TYPE_RELAY_STATUS;
+
+            ret = mwifi_write(addr, &data_type, response, sizeof(mupgrade_status_t) + MUPGRADE_PACKET_MAX_NUM / 8, true);
+            MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "<%s> Answer the relay request", mdf_err_to_name(ret));
+            break;
+
+        case MUPGRADE_TYPE_RELAY_STATUS:
+            ret = MDF_ERR_NOT_SUPPORTED;
+            MDF_ERROR_GOTO(!g_relay || !g_relay->running, EXIT, "The relay is not running");
+
+            answer = MDF_MALLOC(sizeof(mupgrade_relay_answer_t) + size);
+            ret    = MDF_ERR_NO_MEM;
+            MDF_ERROR_GOTO(!answer, EXIT, "");
+
+            answer->size = size;
+            memcpy(answer->src_addr, addr, MWIFI_ADDR_LEN);
+            memcpy(answer->data, data, size);
+
+            if (!xQueueSend(g_relay->queue, &answer, CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
+                MDF_LOGW("xQueueSend failed");
+                MDF_FREE(answer);
+                ret = MDF_ERR_TIMEOUT;
+                goto EXIT;
+            }
+
+            break;
+
+        case MUPGRADE_TYPE_RELAY_FINISH:
+            ret = mupgrade_relay_init();
+            MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_relay_init");
+
+            xSemaphoreGive(g_relay->parent_sem);
+            break;
+
+        default:
+            break;
+    }
+
+    ret = MDF_OK;
+
+EXIT:
+    MDF_FREE(response);
+    return ret;
+}
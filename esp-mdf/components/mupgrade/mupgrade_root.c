@@ -13,21 +13,136 @@
 // limitations under the License.
 
 #include "mdf_common.h"
-#include "mupgrade.h"
+#include "mupgrade_priv.h"
 #include "mwifi.h"
 
+/**
+ * @brief Rate control of the firmware sending, additive increase while the packets are
+ *        delivered and multiplicative decrease when the devices report lost packets
+ */
+#define MUPGRADE_RATE_MIN           (20)  /**< Packets per second */
+#define MUPGRADE_RATE_MAX           (1000)
+#define MUPGRADE_RATE_INCREASE      (20)  /**< Added every MUPGRADE_RATE_WINDOW packets sent without error */
+#define MUPGRADE_RATE_WINDOW        (32)
+#define MUPGRADE_LOSS_THRESHOLD     (5)   /**< Percentage of lost packets of a pass that halves the rate */
+
+/**
+ * @brief mwifi_root_write() prepends the address of every device of a multicast to the data before
+ *        it fragments at MWIFI_PAYLOAD_LEN, a packet is multicast to at most this many devices at once
+ */
+#define MUPGRADE_MULTICAST_ADDRS_NUM(size) ((MWIFI_PAYLOAD_LEN - (size)) / MWIFI_ADDR_LEN)
+
+/**
+ * @brief The devices that answered a status request are split into at most MUPGRADE_GROUP_MAX
+ *        groups of similar progress, each packet is only sent to the groups missing it
+ */
+#define MUPGRADE_GROUP_MAX          (8)
+#define MUPGRADE_INDEX_NONE         (0xFFFF)
+
+/**
+ * @brief Firmware sent at the same time, each firmware of the store and the downloaded one
+ */
+#define MUPGRADE_SESSION_MAX        (CONFIG_MUPGRADE_STORE_IMAGE_MAX_NUM + 1)
+
 typedef struct {
     uint8_t src_addr[MWIFI_ADDR_LEN];
     size_t size;
     uint8_t data[0];
 } mupgrade_queue_t;
 
+typedef struct {
+    uint8_t addr[MWIFI_ADDR_LEN];
+    uint8_t group;             /**< Missing-packet group, valid while the device is requested */
+    uint16_t hash_next;        /**< Next device in the same bucket */
+    uint16_t unfinished_index; /**< Index in unfinished_addr, MUPGRADE_INDEX_NONE once finished or stopped */
+    uint16_t requested_index;  /**< Index in requested_addr, MUPGRADE_INDEX_NONE if not requested */
+} mupgrade_node_t;
+
+/**
+ * @brief Devices of one firmware sending, indexed by address so that finding and removing
+ *        a device does not depend on the number of devices
+ */
+typedef struct {
+    mupgrade_result_t *result;
+    uint16_t node_num;
+    uint16_t bucket_mask;
+    uint16_t *buckets;                        /**< First device of each bucket */
+    mupgrade_node_t *nodes;
+    uint8_t group_num;
+    uint16_t group_size[MUPGRADE_GROUP_MAX];  /**< Requested devices in each group */
+    uint8_t *group_progress;                  /**< Packets received by every device of each group */
+    uint8_t *send_addrs;                      /**< Devices of the groups missing the current packet */
+    size_t send_num;
+    uint8_t send_mask;                        /**< Groups of send_addrs */
+    uint32_t send_version;                    /**< version when send_addrs was built */
+    uint32_t version;                         /**< Changed whenever requested_addr changes */
+    uint8_t *legacy_addrs;                    /**< Devices without MUPGRADE_STATUS_VERSION, sent in legacy packets */
+    size_t legacy_num;
+} mupgrade_table_t;
+
+/**
+ * @brief One firmware being sent, the firmware downloaded by mupgrade_firmware_download() or
+ *        a firmware of the store. Firmware of different names are sent at the same time, the
+ *        answers of the devices are dispatched to the session by the name of the firmware.
+ */
+typedef struct {
+    mupgrade_status_t *status;           /**< Sent in the status requests, status->name identifies the session */
+    QueueHandle_t queue;                 /**< Answers of the devices */
+    const esp_partition_t *partition;    /**< Partition of the transmitted image */
+    size_t image_offset;                 /**< Offset of the transmitted image in the partition */
+    const mupgrade_manifest_t *manifest; /**< Appended to the status requests, NULL if there is none */
+    size_t manifest_size;
+    volatile bool running;               /**< Cleared by mupgrade_firmware_stop() */
+} mupgrade_session_t;
+
+/**
+ * @brief Packets of one sending pass flow from the reader task to the sender through
+ *        free_queue and ready_queue, responses are handled by the status task
+ */
+typedef struct {
+    const uint8_t *progress_array; /**< Packets already received by every device of the pass */
+    uint16_t packet_num;
+    uint16_t packet_size;
+    uint16_t last_packet_size;
+    size_t image_offset;
+    uint32_t rate;                 /**< Send rate, packets per second */
+    mupgrade_packet_t *packets;    /**< Ring of CONFIG_MUPGRADE_PREFETCH_NUM packets */
+    QueueHandle_t free_queue;      /**< Packets to be read from flash */
+    QueueHandle_t ready_queue;     /**< Packets to be sent, NULL ends the pass */
+    SemaphoreHandle_t lock;        /**< Protects the node table and the address lists of the result */
+    SemaphoreHandle_t exit_sem;    /**< Given by the reader and the status task when they exit */
+    mupgrade_session_t *session;
+    mupgrade_result_t *result;
+    mupgrade_table_t *table;
+    volatile bool running;
+    mdf_err_t read_error;
+} mupgrade_pipeline_t;
+
 static const char *TAG = "mupgrade_root";
 static mupgrade_config_t *g_upgrade_config = NULL;
 static bool g_mupgrade_send_running_flag   = false;
 static SemaphoreHandle_t g_mupgrade_send_exit_sem = NULL;
+static mupgrade_session_t *g_sessions[MUPGRADE_SESSION_MAX] = {NULL};
+static SemaphoreHandle_t g_sessions_lock = NULL;
+
+/**
+ * @brief Offset of the transmitted image in the update partition
+ */
+static size_t mupgrade_image_offset(void)
+{
+    if (g_upgrade_config->status.image_type == MUPGRADE_IMAGE_TYPE_FULL) {
+        return 0;
+    }
+
+    return mupgrade_delta_offset(g_upgrade_config->partition, g_upgrade_config->status.total_size);
+}
 
 mdf_err_t mupgrade_firmware_init(const char *name, size_t size)
+{
+    return mupgrade_firmware_init_sha256(name, size, NULL);
+}
+
+mdf_err_t mupgrade_firmware_init_sha256(const char *name, size_t size, const uint8_t sha256[32])
 {
     MDF_PARAM_CHECK(name);
     MDF_PARAM_CHECK(size > 0);
@@ -61,12 +176,21 @@ mdf_err_t mupgrade_firmware_init(const char *name, size_t size)
     g_upgrade_config->partition           = update;
     g_upgrade_config->status.total_size   = size;
     g_upgrade_config->status.written_size = 0;
+    g_upgrade_config->status.image_type   = MUPGRADE_IMAGE_TYPE_FULL;
+    g_upgrade_config->status.image_size   = 0;
+    g_upgrade_config->status.packet_size  = MUPGRADE_PACKET_MAX_SIZE;
+    g_upgrade_config->status.version      = MUPGRADE_STATUS_VERSION;
     memcpy(g_upgrade_config->status.name, name, sizeof(g_upgrade_config->status.name));
 
+    /**< Hash the firmware while it is downloaded, the block hashes are sent to the nodes */
+    ret = mupgrade_manifest_init(sha256, MUPGRADE_PACKET_MAX_SIZE);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_manifest_init");
+
     /**< Commence an OTA update writing to the specified partition. */
     g_upgrade_config->status.error_code   = esp_ota_begin(update, g_upgrade_config->status.total_size,
                                             &g_upgrade_config->handle);
-    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_OK, ret, "esp_ota_begin failed");
+    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_OK, g_upgrade_config->status.error_code,
+                    "<%s> esp_ota_begin failed", mdf_err_to_name(g_upgrade_config->status.error_code));
 
     return MDF_OK;
 }
@@ -83,13 +207,55 @@ mdf_err_t mupgrade_firmware_download(const void *data, size_t size)
     if (g_upgrade_config->status.written_size == 0) {
         /**< Send MDF_EVENT_MUPGRADE_FIRMWARE_DOWNLOAD event to the event handler */
         mdf_event_loop_send(MDF_EVENT_MUPGRADE_FIRMWARE_DOWNLOAD, NULL);
+
+        /**< A delta or a compressed firmware is kept at the end of the update partition and sent
+             to the nodes as is, the new image is rebuilt in front of it once it is complete */
+        if (mupgrade_delta_is_valid(data, size) || mupgrade_compress_is_valid(data, size)) {
+            size_t delta_offset = mupgrade_delta_offset(g_upgrade_config->partition,
+                                  g_upgrade_config->status.total_size);
+            g_upgrade_config->status.error_code = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+            MDF_ERROR_CHECK(g_upgrade_config->status.total_size == OTA_SIZE_UNKNOWN || !delta_offset,
+                            g_upgrade_config->status.error_code, "The size of the delta is wrong");
+
+            esp_ota_abort(g_upgrade_config->handle);
+
+            if (mupgrade_compress_is_valid(data, size)) {
+                g_upgrade_config->status.image_type = MUPGRADE_IMAGE_TYPE_COMPRESSED;
+                g_upgrade_config->status.image_size = ((mupgrade_compress_header_t *)data)->image_size;
+                g_upgrade_config->status.packet_size = MUPGRADE_COMPRESS_PACKET_SIZE;
+                MDF_ERROR_CHECK(MUPGRADE_ALIGN_SECTOR(g_upgrade_config->status.image_size) > delta_offset,
+                                g_upgrade_config->status.error_code, "The decompressed image does not fit, image_size: %d",
+                                g_upgrade_config->status.image_size);
+            } else {
+                g_upgrade_config->status.image_type = MUPGRADE_IMAGE_TYPE_DELTA;
+            }
+
+            g_upgrade_config->status.error_code = esp_partition_erase_range(g_upgrade_config->partition, delta_offset,
+                                                  MUPGRADE_ALIGN_SECTOR(g_upgrade_config->status.total_size));
+            MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK, g_upgrade_config->status.error_code,
+                            "esp_partition_erase_range failed, error_code: %x", g_upgrade_config->status.error_code);
+        }
+    }
+
+    if (g_upgrade_config->status.image_type != MUPGRADE_IMAGE_TYPE_FULL) {
+        MDF_ERROR_CHECK(g_upgrade_config->status.written_size + size > g_upgrade_config->status.total_size,
+                        MDF_ERR_INVALID_ARG, "The delta is larger than expected, size: %d", size);
+
+        /**< Write the delta or the compressed firmware to the end of the update partition */
+        g_upgrade_config->status.error_code = esp_partition_write(g_upgrade_config->partition,
+                                              mupgrade_image_offset() + g_upgrade_config->status.written_size, data, size);
+    } else {
+        /**< Write OTA update data to partition */
+        g_upgrade_config->status.error_code = esp_ota_write(g_upgrade_config->handle, data, size);
     }
 
-    /**< Write OTA update data to partition */
-    g_upgrade_config->status.error_code = esp_ota_write(g_upgrade_config->handle, data, size);
     MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK, g_upgrade_config->status.error_code,
                     "esp_ota_write failed, error_code: %x", g_upgrade_config->status.error_code);
 
+    g_upgrade_config->status.error_code = mupgrade_manifest_update(data, size);
+    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_OK, g_upgrade_config->status.error_code,
+                    "mupgrade_manifest_update");
+
     g_upgrade_config->status.written_size += size;
     MDF_LOGD("Firmware download size: %d, progress rate: %d%%",
              g_upgrade_config->status.written_size,
@@ -113,10 +279,29 @@ mdf_err_t mupgrade_firmware_download_finished(size_t total_size)
 
     g_upgrade_config->status.total_size = total_size;
 
-    /**< Finish OTA update and validate newly written app image. */
-    g_upgrade_config->status.error_code = esp_ota_end(g_upgrade_config->handle);
-    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK,
-                    MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "esp_ota_end");
+    /**< Reject the firmware before it is applied if it is not the expected one */
+    g_upgrade_config->status.error_code = mupgrade_manifest_finish();
+    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_OK,
+                    g_upgrade_config->status.error_code, "mupgrade_manifest_finish");
+
+    if (g_upgrade_config->status.image_type == MUPGRADE_IMAGE_TYPE_DELTA) {
+        /**< Rebuild the new image from the running image, the root upgrades from the same base as the nodes */
+        g_upgrade_config->status.error_code = mupgrade_delta_apply(update_partition, mupgrade_image_offset(),
+                                              total_size, &g_upgrade_config->handle);
+        MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK,
+                        g_upgrade_config->status.error_code, "mupgrade_delta_apply");
+    } else if (g_upgrade_config->status.image_type == MUPGRADE_IMAGE_TYPE_COMPRESSED) {
+        /**< Decompress the firmware for the root, the nodes receive the compressed blocks */
+        g_upgrade_config->status.error_code = mupgrade_compress_apply(update_partition, mupgrade_image_offset(),
+                                              total_size, &g_upgrade_config->handle);
+        MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK,
+                        g_upgrade_config->status.error_code, "mupgrade_compress_apply");
+    } else {
+        /**< Finish OTA update and validate newly written app image. */
+        g_upgrade_config->status.error_code = esp_ota_end(g_upgrade_config->handle);
+        MDF_ERROR_CHECK(g_upgrade_config->status.error_code != ESP_OK,
+                        MDF_ERR_MUPGRADE_FIRMWARE_INVALID, "esp_ota_end");
+    }
 
     /**< Check if the firmware is generated by this project */
     g_upgrade_config->status.error_code = mupgrade_firmware_check(update_partition);
@@ -128,34 +313,131 @@ mdf_err_t mupgrade_firmware_download_finished(size_t total_size)
     return MDF_OK;
 }
 
+size_t mupgrade_status_unpack(const void *data, size_t size, mupgrade_status_t *status)
+{
+    /**< A legacy status with progress, 45 + 512 bytes, is longer than the current one without */
+    bool legacy        = MUPGRADE_STATUS_IS_LEGACY(size);
+    size_t status_size = legacy ? size - MUPGRADE_STATUS_LEGACY_SIZE + sizeof(mupgrade_status_t) : size;
+
+    if (!status) {
+        return status_size;
+    }
+
+    if (legacy) {
+        memset(status, 0, sizeof(mupgrade_status_t));
+        memcpy(status, data, MUPGRADE_STATUS_LEGACY_SIZE);
+        memcpy(status->progress_array, (const uint8_t *)data + MUPGRADE_STATUS_LEGACY_SIZE,
+               size - MUPGRADE_STATUS_LEGACY_SIZE);
+    } else {
+        memcpy(status, data, size);
+    }
+
+    return status_size;
+}
+
 mdf_err_t mupgrade_root_handle(const uint8_t *addr, const void *data, size_t size)
 {
     MDF_PARAM_CHECK(addr);
     MDF_PARAM_CHECK(data);
-    MDF_PARAM_CHECK(size);
-    MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT,
+    MDF_PARAM_CHECK(size >= sizeof(mupgrade_status_t) || MUPGRADE_STATUS_IS_LEGACY(size));
+    MDF_ERROR_CHECK(!g_sessions_lock, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT,
                     "Mupgrade firmware is not initialized");
-    MDF_ERROR_CHECK(!g_mupgrade_send_running_flag, MDF_ERR_NOT_SUPPORTED,
-                    "Mupgrade has stopped running");
 
-    mupgrade_queue_t *q_data = MDF_MALLOC(sizeof(mupgrade_queue_t) + size);
+    mdf_err_t ret                   = MDF_OK;
+    mupgrade_session_t *session     = NULL;
+    const mupgrade_status_t *status = NULL;
+    size_t queue_size               = mupgrade_status_unpack(data, size, NULL);
+    mupgrade_queue_t *q_data        = MDF_CALLOC(1, sizeof(mupgrade_queue_t) + queue_size);
     MDF_ERROR_CHECK(!q_data, MDF_ERR_NO_MEM, "");
 
-    q_data->size = size;
+    q_data->size = queue_size;
     memcpy(q_data->src_addr, addr, MWIFI_ADDR_LEN);
-    memcpy(q_data->data, data, size);
-    MDF_LOGD("addr: " MACSTR ", size: %d", MAC2STR(addr), size);
 
-    if (!xQueueSend(g_upgrade_config->queue, &q_data,
-                    CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
+    /**< The legacy status is queued in the current layout with version 0 */
+    mupgrade_status_unpack(data, size, (mupgrade_status_t *)q_data->data);
+
+    status = (const mupgrade_status_t *)q_data->data;
+    MDF_LOGD("addr: " MACSTR ", size: %d, legacy: %d", MAC2STR(addr), size, MUPGRADE_STATUS_IS_LEGACY(size));
+
+    /**< The session is not removed while the lock is held, its queue stays valid */
+    xSemaphoreTake(g_sessions_lock, portMAX_DELAY);
+
+    for (int i = 0; i < MUPGRADE_SESSION_MAX && !session; ++i) {
+        if (g_sessions[i] && g_sessions[i]->running
+                && !strncmp(g_sessions[i]->status->name, status->name, sizeof(status->name))) {
+            session = g_sessions[i];
+        }
+    }
+
+    if (!session) {
+        ret = MDF_ERR_NOT_SUPPORTED;
+        MDF_LOGW("Mupgrade has stopped running, name: %.32s", status->name);
+    } else if (!xQueueSend(session->queue, &q_data,
+                           CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
+        ret = MDF_ERR_TIMEOUT;
         MDF_LOGW("xQueueSend failed");
+    }
+
+    xSemaphoreGive(g_sessions_lock);
+
+    if (ret != MDF_OK) {
         MDF_FREE(q_data);
-        return MDF_ERR_TIMEOUT;
     }
 
+    return ret;
+}
+
+/**
+ * @brief Register a sending, a firmware of the same name must not be sent at the same time
+ */
+static mdf_err_t mupgrade_session_add(mupgrade_session_t *session)
+{
+    mdf_err_t ret  = MDF_ERR_NOT_SUPPORTED;
+    int free_index = -1;
+
+    if (!g_sessions_lock) {
+        g_sessions_lock = xSemaphoreCreateMutex();
+        MDF_ERROR_CHECK(!g_sessions_lock, MDF_ERR_NO_MEM, "");
+    }
+
+    xSemaphoreTake(g_sessions_lock, portMAX_DELAY);
+
+    for (int i = 0; i < MUPGRADE_SESSION_MAX; ++i) {
+        if (!g_sessions[i]) {
+            free_index = (free_index < 0) ? i : free_index;
+        } else if (!strncmp(g_sessions[i]->status->name, session->status->name, sizeof(session->status->name))) {
+            free_index = -1;
+            break;
+        }
+    }
+
+    if (free_index >= 0) {
+        session->running       = true;
+        g_sessions[free_index] = session;
+        ret = MDF_OK;
+    }
+
+    xSemaphoreGive(g_sessions_lock);
+
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "The firmware is being sent, name: %.32s", session->status->name);
+
     return MDF_OK;
 }
 
+static void mupgrade_session_remove(mupgrade_session_t *session)
+{
+    xSemaphoreTake(g_sessions_lock, portMAX_DELAY);
+
+    for (int i = 0; i < MUPGRADE_SESSION_MAX; ++i) {
+        if (g_sessions[i] == session) {
+            g_sessions[i] = NULL;
+        }
+    }
+
+    session->running = false;
+    xSemaphoreGive(g_sessions_lock);
+}
+
 static bool addrs_remove(uint8_t *addrs_list, size_t *addrs_num, const uint8_t *addr)
 {
     for (int i = 0; i < *addrs_num; i++, addrs_list += MWIFI_ADDR_LEN) {
@@ -171,42 +453,307 @@ static bool addrs_remove(uint8_t *addrs_list, size_t *addrs_num, const uint8_t *
     return false;
 }
 
-static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_result_t *result)
+static uint16_t mupgrade_table_hash(const mupgrade_table_t *table, const uint8_t *addr)
+{
+    return (mdf_addr_hash(addr) >> 16) & table->bucket_mask;
+}
+
+static mupgrade_node_t *mupgrade_table_find(const mupgrade_table_t *table, const uint8_t *addr)
+{
+    for (uint16_t index = table->buckets[mupgrade_table_hash(table, addr)];
+            index != MUPGRADE_INDEX_NONE; index = table->nodes[index].hash_next) {
+        if (!memcmp(table->nodes[index].addr, addr, MWIFI_ADDR_LEN)) {
+            return table->nodes + index;
+        }
+    }
+
+    return NULL;
+}
+
+static void mupgrade_table_destroy(mupgrade_table_t *table)
+{
+    MDF_FREE(table->buckets);
+    MDF_FREE(table->nodes);
+    MDF_FREE(table->group_progress);
+    MDF_FREE(table->send_addrs);
+    MDF_FREE(table->legacy_addrs);
+    MDF_FREE(table);
+}
+
+/**
+ * @brief Index the devices of result->unfinished_addr, duplicated addresses are dropped.
+ *        The lists of the result are allocated for every device once, so that moving
+ *        a device between them never reallocates.
+ */
+static mupgrade_table_t *mupgrade_table_create(mupgrade_result_t *result)
+{
+    mupgrade_table_t *table = MDF_CALLOC(1, sizeof(mupgrade_table_t));
+
+    if (!table) {
+        return NULL;
+    }
+
+    uint16_t bucket_num = 16;
+
+    while (bucket_num < result->unfinished_num) {
+        bucket_num <<= 1;
+    }
+
+    table->result         = result;
+    table->bucket_mask    = bucket_num - 1;
+    table->buckets        = MDF_MALLOC(bucket_num * sizeof(uint16_t));
+    table->nodes          = MDF_CALLOC(result->unfinished_num, sizeof(mupgrade_node_t));
+    table->group_progress = MDF_MALLOC(MUPGRADE_GROUP_MAX * MUPGRADE_PACKET_MAX_NUM / 8);
+    table->send_addrs     = MDF_MALLOC(result->unfinished_num * MWIFI_ADDR_LEN);
+    table->legacy_addrs   = MDF_MALLOC(result->unfinished_num * MWIFI_ADDR_LEN);
+    result->requested_addr = MDF_MALLOC(result->unfinished_num * MWIFI_ADDR_LEN);
+    result->successed_addr = MDF_MALLOC(result->unfinished_num * MWIFI_ADDR_LEN);
+
+    if (!table->buckets || !table->nodes || !table->group_progress || !table->send_addrs || !table->legacy_addrs
+            || !result->requested_addr || !result->successed_addr) {
+        MDF_LOGW("Create the table of the devices, num: %d", result->unfinished_num);
+        mupgrade_table_destroy(table);
+        return NULL;
+    }
+
+    memset(table->buckets, 0xFF, bucket_num * sizeof(uint16_t));
+
+    for (size_t i = 0; i < result->unfinished_num; ++i) {
+        const uint8_t *addr = result->unfinished_addr + i * MWIFI_ADDR_LEN;
+
+        if (mupgrade_table_find(table, addr)) {
+            MDF_LOGD("Duplicate address: " MACSTR, MAC2STR(addr));
+            continue;
+        }
+
+        uint16_t bucket       = mupgrade_table_hash(table, addr);
+        mupgrade_node_t *node = table->nodes + table->node_num;
+
+        memcpy(node->addr, addr, MWIFI_ADDR_LEN);
+        memcpy(result->unfinished_addr + table->node_num * MWIFI_ADDR_LEN, addr, MWIFI_ADDR_LEN);
+        node->unfinished_index = table->node_num;
+        node->requested_index  = MUPGRADE_INDEX_NONE;
+        node->hash_next        = table->buckets[bucket];
+        table->buckets[bucket] = table->node_num++;
+    }
+
+    result->unfinished_num = table->node_num;
+
+    return table;
+}
+
+/**
+ * @brief Remove an entry from an address list by moving the last entry into its place
+ */
+static void mupgrade_table_list_remove(mupgrade_table_t *table, uint8_t *addrs_list, size_t *addrs_num,
+                                       uint16_t index, bool requested)
+{
+    uint16_t last = --(*addrs_num);
+
+    if (index == last) {
+        return;
+    }
+
+    memcpy(addrs_list + index * MWIFI_ADDR_LEN, addrs_list + last * MWIFI_ADDR_LEN, MWIFI_ADDR_LEN);
+    mupgrade_node_t *moved = mupgrade_table_find(table, addrs_list + index * MWIFI_ADDR_LEN);
+
+    if (requested) {
+        moved->requested_index = index;
+    } else {
+        moved->unfinished_index = index;
+    }
+}
+
+static void mupgrade_table_unrequest(mupgrade_table_t *table, mupgrade_node_t *node)
+{
+    if (node->requested_index == MUPGRADE_INDEX_NONE) {
+        return;
+    }
+
+    mupgrade_table_list_remove(table, table->result->requested_addr, &table->result->requested_num,
+                               node->requested_index, true);
+    table->group_size[node->group]--;
+    node->requested_index = MUPGRADE_INDEX_NONE;
+    table->version++;
+}
+
+/**
+ * @brief Remove a device that has completed or stopped the upgrade from the unfinished list
+ */
+static bool mupgrade_table_finish(mupgrade_table_t *table, const uint8_t *addr, bool successed)
+{
+    mupgrade_result_t *result = table->result;
+    mupgrade_node_t *node     = mupgrade_table_find(table, addr);
+
+    if (!node || node->unfinished_index == MUPGRADE_INDEX_NONE) {
+        return false;
+    }
+
+    mupgrade_table_unrequest(table, node);
+    mupgrade_table_list_remove(table, result->unfinished_addr, &result->unfinished_num,
+                               node->unfinished_index, false);
+    node->unfinished_index = MUPGRADE_INDEX_NONE;
+
+    if (successed) {
+        memcpy(result->successed_addr + result->successed_num * MWIFI_ADDR_LEN, addr, MWIFI_ADDR_LEN);
+        result->successed_num++;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Select the group of a device from the packets it has received, NULL if none.
+ *
+ * @note  A device joins a group with the same progress, or a new group while there are
+ *        free ones. Otherwise it joins the group where the merge sends the fewest packets
+ *        that are already received: the packets only the device misses, once per device
+ *        of the group, plus the packets only the group misses, once.
+ */
+static uint8_t mupgrade_table_group_select(const mupgrade_table_t *table, const uint8_t *progress_array,
+        size_t progress_size)
+{
+    uint8_t best_group = 0;
+    uint32_t best_cost = UINT32_MAX;
+
+    for (uint8_t group = 0; group < table->group_num; ++group) {
+        const uint8_t *group_progress = table->group_progress + group * MUPGRADE_PACKET_MAX_NUM / 8;
+        uint32_t group_only = 0;
+        uint32_t node_only  = 0;
+
+        for (size_t i = 0; i < progress_size; ++i) {
+            uint8_t received = progress_array ? progress_array[i] : 0;
+            group_only += __builtin_popcount(group_progress[i] & ~received);
+            node_only  += __builtin_popcount(received & ~group_progress[i]);
+        }
+
+        if (!group_only && !node_only) {
+            return group;
+        }
+
+        uint32_t cost = group_only * table->group_size[group] + node_only;
+
+        if (cost < best_cost) {
+            best_cost  = cost;
+            best_group = group;
+        }
+    }
+
+    return (table->group_num < MUPGRADE_GROUP_MAX) ? table->group_num : best_group;
+}
+
+/**
+ * @brief Add a device that answered the status request to the list of the next pass
+ */
+static void mupgrade_table_request(mupgrade_table_t *table, mupgrade_node_t *node,
+                                   const uint8_t *progress_array, size_t progress_size)
+{
+    mupgrade_result_t *result = table->result;
+    uint8_t group             = mupgrade_table_group_select(table, progress_array, progress_size);
+    uint8_t *group_progress   = table->group_progress + group * MUPGRADE_PACKET_MAX_NUM / 8;
+
+    if (group == table->group_num) {
+        memset(group_progress, 0xFF, MUPGRADE_PACKET_MAX_NUM / 8);
+        table->group_size[group] = 0;
+        table->group_num++;
+    }
+
+    for (size_t i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; ++i) {
+        group_progress[i] &= progress_array ? progress_array[i] : 0;
+    }
+
+    node->group           = group;
+    node->requested_index = result->requested_num;
+    memcpy(result->requested_addr + result->requested_num * MWIFI_ADDR_LEN, node->addr, MWIFI_ADDR_LEN);
+    result->requested_num++;
+    table->group_size[group]++;
+    table->version++;
+}
+
+/**
+ * @brief Devices of the groups that have not received a packet
+ */
+static const uint8_t *mupgrade_table_send_addrs(mupgrade_table_t *table, uint16_t seq, size_t *addrs_num)
+{
+    mupgrade_result_t *result = table->result;
+    uint8_t mask              = 0;
+
+    for (uint8_t group = 0; group < table->group_num; ++group) {
+        if (table->group_size[group]
+                && !MUPGRADE_GET_BITS(table->group_progress + group * MUPGRADE_PACKET_MAX_NUM / 8, seq)) {
+            mask |= BIT(group);
+        }
+    }
+
+    /**< Every group misses the packet, the common case while nothing has been received */
+    if (mask == BIT(table->group_num) - 1) {
+        *addrs_num = result->requested_num;
+        return result->requested_addr;
+    }
+
+    /**< Consecutive packets are mostly missed by the same groups, the list is kept until they change */
+    if (mask != table->send_mask || table->version != table->send_version) {
+        table->send_num     = 0;
+        table->send_mask    = mask;
+        table->send_version = table->version;
+
+        for (size_t i = 0; i < result->requested_num; ++i) {
+            const uint8_t *addr = result->requested_addr + i * MWIFI_ADDR_LEN;
+
+            if (mask & BIT(mupgrade_table_find(table, addr)->group)) {
+                memcpy(table->send_addrs + table->send_num * MWIFI_ADDR_LEN, addr, MWIFI_ADDR_LEN);
+                table->send_num++;
+            }
+        }
+    }
+
+    *addrs_num = table->send_num;
+    return table->send_addrs;
+}
+
+/**
+ * @brief Request the progress of the unfinished devices, every answer is a negative
+ *        acknowledgement of the packets the device misses. progress_array is set to
+ *        the packets received by every requested device, the reader sends the others.
+ */
+static mdf_err_t mupgrade_request_status(mupgrade_session_t *session, mupgrade_table_t *table,
+                                         uint8_t *progress_array, uint16_t packet_num)
 {
     mdf_err_t ret                      = MDF_OK;
+    mupgrade_result_t *result          = table->result;
     mupgrade_queue_t *q_data           = NULL;
+    mupgrade_node_t *node              = NULL;
     size_t request_num                 = 0;
-    uint8_t *request_addrs             = NULL;
+    size_t relay_num                   = 0;
+    uint32_t response_timeout          = CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT;
+    size_t progress_size               = (packet_num + 7) / 8;
+    uint8_t *request_addrs             = table->send_addrs;
     mupgrade_status_t *response_status = NULL;
-    mupgrade_status_t request_status   = {0x0};
+    mupgrade_status_t *request_status  = NULL;
+    size_t request_size                = sizeof(mupgrade_status_t);
     mwifi_data_type_t data_type        = {
         .upgrade = true,
         .communicate = MWIFI_COMMUNICATE_MULTICAST
     };
 
-    result->requested_num = 0;
-    MDF_FREE(result->requested_addr);
+    while (result->requested_num > 0) {
+        mupgrade_table_unrequest(table, mupgrade_table_find(table, result->requested_addr));
+    }
+
+    table->group_num = 0;
 
     /**
      * @brief Remove the device that the firmware upgrade has completed.
      */
-    while (xQueueReceive(g_upgrade_config->queue, &q_data, CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
+    while (xQueueReceive(session->queue, &q_data, CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS)) {
         mupgrade_status_t *status = (mupgrade_status_t *)q_data->data;
 
         if (status->written_size == status->total_size) {
-            if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr)) {
+            if (!mupgrade_table_finish(table, q_data->src_addr, true)) {
                 MDF_LOGW("The device has been removed from the list waiting for the upgrade");
-                MDF_FREE(q_data);
-                continue;
             }
-
-            result->successed_num++;
-            result->successed_addr = MDF_REALLOC_RETRY(result->successed_addr,
-                                     result->successed_num * MWIFI_ADDR_LEN);
-            memcpy(result->successed_addr + (result->successed_num - 1) * MWIFI_ADDR_LEN,
-                   q_data->src_addr, MWIFI_ADDR_LEN);
         } else if (status->error_code == MDF_ERR_MUPGRADE_STOP) {
-            addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr);
+            mupgrade_table_finish(table, q_data->src_addr, false);
         }
 
         MDF_FREE(q_data);
@@ -216,27 +763,73 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
         }
     }
 
-    request_num   = result->unfinished_num;
-    request_addrs = MDF_REALLOC_RETRY(NULL, result->unfinished_num * MWIFI_ADDR_LEN);
+    /**< The block hashes of the firmware are appended, the compressed blocks carry their own CRC-32 */
+    if (session->manifest && session->status->image_type != MUPGRADE_IMAGE_TYPE_COMPRESSED) {
+        request_size += session->manifest_size;
+    }
 
-    memcpy(request_addrs, result->unfinished_addr, MWIFI_ADDR_LEN * request_num);
-    memset(progress_array, 0xFF, MUPGRADE_PACKET_MAX_NUM / 8);
+    request_status = MDF_MALLOC(request_size);
+    MDF_ERROR_CHECK(!request_status, MDF_ERR_NO_MEM, "");
+
+    memcpy(request_status, session->status, sizeof(mupgrade_status_t));
 
-    memcpy(&request_status, &g_upgrade_config->status, sizeof(mupgrade_status_t));
-    request_status.type = MUPGRADE_TYPE_STATUS;
+    if (request_size > sizeof(mupgrade_status_t)) {
+        memcpy(request_status->progress_array, session->manifest, session->manifest_size);
+    }
+
+    /**< The legacy devices are requested with the legacy status, they answer in the same layout */
+    if (session->status->version < MUPGRADE_STATUS_VERSION) {
+        request_size = MUPGRADE_STATUS_LEGACY_SIZE;
+    }
 
     /**
      * @brief Request all devices upgrade status from unfinished device.
      */
-    for (int i = 0; i < 3 && request_num > 0; ++i) {
-        if (mwifi_root_write(request_addrs, request_num, &data_type,
-                             &request_status, sizeof(mupgrade_status_t), true) != MDF_OK) {
+    for (int i = 0; i < 3; ++i) {
+        /**< Only the devices that have not answered yet are requested again */
+        request_num = 0;
+
+        for (size_t j = 0; j < result->unfinished_num; ++j) {
+            node = mupgrade_table_find(table, result->unfinished_addr + j * MWIFI_ADDR_LEN);
+
+            if (node->requested_index == MUPGRADE_INDEX_NONE) {
+                memcpy(request_addrs + request_num * MWIFI_ADDR_LEN, node->addr, MWIFI_ADDR_LEN);
+                request_num++;
+            }
+        }
+
+        if (request_num == 0) {
+            break;
+        }
+
+        request_status->type = MUPGRADE_TYPE_STATUS;
+        relay_num            = 0;
+        response_timeout     = CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT;
+
+#ifdef CONFIG_MUPGRADE_TREE_RELAY
+        /**
+         * @brief After a pass, the devices first send their children the packets they miss from
+         *        their own flash and answer once their parent has finished. The finished devices
+         *        relay as well but are not waited for. The devices not answering are requested
+         *        again without relay.
+         */
+        if (i == 0 && result->pass_num > 0 && session->status->image_type != MUPGRADE_IMAGE_TYPE_COMPRESSED
+                && session->status->version >= MUPGRADE_STATUS_VERSION) {
+            request_status->type = MUPGRADE_TYPE_RELAY;
+            relay_num            = result->successed_num;
+            response_timeout     = CONFIG_MUPGRADE_RELAY_TIMEOUT + CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT;
+            memcpy(request_addrs + request_num * MWIFI_ADDR_LEN, result->successed_addr,
+                   relay_num * MWIFI_ADDR_LEN);
+        }
+#endif /**< CONFIG_MUPGRADE_TREE_RELAY */
+
+        if (mwifi_root_write(request_addrs, request_num + relay_num, &data_type,
+                             request_status, request_size, true) != MDF_OK) {
             MDF_LOGW("Request devices upgrade status");
         }
 
         while (request_num > 0) {
-            ret = xQueueReceive(g_upgrade_config->queue, &q_data,
-                                CONFIG_MUPGRADE_WAIT_RESPONSE_TIMEOUT / portTICK_RATE_MS);
+            ret = xQueueReceive(session->queue, &q_data, response_timeout / portTICK_RATE_MS);
 
             if (ret != pdTRUE) {
                 MDF_LOGD("xQueueReceive failed");
@@ -244,11 +837,11 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
             }
 
             response_status = (mupgrade_status_t *)q_data->data;
-            ret = (response_status->error_code != MDF_OK) ? response_status->error_code : MDF_OK;
+            node            = mupgrade_table_find(table, q_data->src_addr);
 
-            if (response_status->error_code == MDF_ERR_MUPGRADE_STOP) {
-                addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr);
-                addrs_remove(request_addrs, &request_num, q_data->src_addr);
+            /**< Unknown devices, finished devices and repeated answers are ignored */
+            if (!node || node->unfinished_index == MUPGRADE_INDEX_NONE
+                    || node->requested_index != MUPGRADE_INDEX_NONE) {
                 MDF_FREE(q_data);
                 continue;
             }
@@ -257,62 +850,58 @@ static mdf_err_t mupgrade_request_status(uint8_t *progress_array, mupgrade_resul
                      MAC2STR(q_data->src_addr), request_num, response_status->total_size,
                      response_status->written_size, mdf_err_to_name(response_status->error_code));
 
-            /**< Remove the device that upgrade status has been received */
-            if (!addrs_remove(request_addrs, &request_num, q_data->src_addr)) {
-                MDF_FREE(q_data);
-                continue;
-            }
+            request_num--;
 
-            /**< The device have not completed firmware upgrade. */
-            if (response_status->written_size != response_status->total_size) {
-                result->requested_num++;
-                result->requested_addr = MDF_REALLOC_RETRY(result->requested_addr,
-                                         result->requested_num * MWIFI_ADDR_LEN);
-                memcpy(result->requested_addr + (result->requested_num - 1) * MWIFI_ADDR_LEN,
-                       q_data->src_addr, MWIFI_ADDR_LEN);
-            }
-
-            if (response_status->written_size == 0) {
-                memset(progress_array, 0x0, MUPGRADE_PACKET_MAX_NUM / 8);
-            } else if (response_status->written_size == response_status->total_size) {
-                if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr)) {
-                    MDF_LOGW("The device has been removed from the list waiting for the upgrade");
-                    MDF_FREE(q_data);
-                    continue;
+            if (response_status->error_code == MDF_ERR_MUPGRADE_STOP) {
+                mupgrade_table_finish(table, q_data->src_addr, false);
+            } else if (response_status->version < session->status->version) {
+                /**< A legacy device places the packets at seq * MUPGRADE_LEGACY_PACKET_SIZE and only
+                     takes full images, it is sent the firmware in legacy packets after this session */
+                mupgrade_table_finish(table, q_data->src_addr, false);
+
+                if (session->status->image_type == MUPGRADE_IMAGE_TYPE_FULL) {
+                    memcpy(table->legacy_addrs + table->legacy_num * MWIFI_ADDR_LEN, q_data->src_addr, MWIFI_ADDR_LEN);
+                    table->legacy_num++;
+                } else {
+                    MDF_LOGW("The device does not advertise MUPGRADE_STATUS_VERSION, addr: " MACSTR,
+                             MAC2STR(q_data->src_addr));
                 }
-
-                result->successed_num++;
-                result->successed_addr = MDF_REALLOC_RETRY(result->successed_addr,
-                                         result->successed_num * MWIFI_ADDR_LEN);
-                memcpy(result->successed_addr + (result->successed_num - 1) * MWIFI_ADDR_LEN,
-                       q_data->src_addr, MWIFI_ADDR_LEN);
+            } else if (response_status->written_size == response_status->total_size) {
+                mupgrade_table_finish(table, q_data->src_addr, true);
             } else {
-                /**< Update upgrade progress. */
-                for (int i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; i++) {
-                    progress_array[i] &= response_status->progress_array[i];
-                }
+                mupgrade_table_request(table, node, response_status->written_size ? response_status->progress_array : NULL,
+                                       progress_size);
             }
 
             MDF_FREE(q_data);
         }
     }
 
+    MDF_FREE(request_status);
     ret = MDF_OK;
 
-    if (request_num > 0) {
+    if (result->requested_num < result->unfinished_num) {
         MDF_LOGD("MDF_ERR_MUPGRADE_SEND_PACKET_LOSS");
         ret = MDF_ERR_MUPGRADE_SEND_PACKET_LOSS;
     }
 
-    for (int i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; ++i) {
-        if (progress_array[i] != 0xFF) {
-            ret = MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE;
-            MDF_LOGD("MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE");
-            break;
+    /**< The reader sends the union of the packets missed by the groups */
+    memset(progress_array, 0xFF, MUPGRADE_PACKET_MAX_NUM / 8);
+
+    for (uint8_t group = 0; group < table->group_num; ++group) {
+        for (size_t i = 0; i < MUPGRADE_PACKET_MAX_NUM / 8; ++i) {
+            progress_array[i] &= table->group_progress[group * MUPGRADE_PACKET_MAX_NUM / 8 + i];
         }
     }
 
-    MDF_FREE(request_addrs);
+    if (result->requested_num > 0) {
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE;
+        MDF_LOGD("MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE, groups: %d", table->group_num);
+    }
+
+    /**< send_addrs held the requested devices, it is rebuilt on the next packet */
+    table->version++;
+
     return ret;
 }
 
@@ -330,29 +919,308 @@ mdf_err_t mupgrade_result_free(mupgrade_result_t *result)
     return MDF_OK;
 }
 
-mdf_err_t mupgrade_firmware_send(const uint8_t *addrs_list, size_t addrs_num,
-                                 mupgrade_result_t *res)
+/**
+ * @brief Number of packets that at least one device has not received
+ */
+static uint16_t mupgrade_progress_missing(const uint8_t *progress_array, uint16_t packet_num)
 {
-    MDF_PARAM_CHECK(addrs_list);
-    MDF_PARAM_CHECK(addrs_num);
-    MDF_PARAM_CHECK(!MWIFI_ADDR_IS_EMPTY(addrs_list));
-    MDF_PARAM_CHECK(addrs_num > 0 && addrs_num <= esp_mesh_get_routing_table_size());
-    MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT,
-                    "Mupgrade firmware is not initialized");
-    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_ERR_MUPGRADE_FIRMWARE_FINISH,
-                    MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE, "mupgrade_firmware_download");
+    uint16_t missing_num = 0;
 
-    mdf_err_t ret             = MDF_ERR_NO_MEM;
-    mwifi_data_type_t type    = {.upgrade = true, .communicate = MWIFI_COMMUNICATE_MULTICAST};
-    mupgrade_packet_t *packet = MDF_MALLOC(sizeof(mupgrade_packet_t));
-    uint8_t *progress_array   = MDF_MALLOC(MUPGRADE_PACKET_MAX_NUM / 8);
-    mupgrade_result_t *result = MDF_CALLOC(1, sizeof(mupgrade_result_t));
-    g_mupgrade_send_running_flag = true;
+    for (uint16_t seq = 0; seq < packet_num; ++seq) {
+        if (!MUPGRADE_GET_BITS(progress_array, seq)) {
+            missing_num++;
+        }
+    }
+
+    return missing_num;
+}
+
+/**
+ * @brief Update the node table with a status sent by a device during the pass
+ */
+static void mupgrade_result_update(mupgrade_table_t *table, const mupgrade_queue_t *q_data)
+{
+    const mupgrade_status_t *status = (const mupgrade_status_t *)q_data->data;
+
+    if (status->written_size && status->written_size == status->total_size) {
+        if (!mupgrade_table_finish(table, q_data->src_addr, true)) {
+            MDF_LOGW("The device has been removed from the list waiting for the upgrade");
+        }
+    } else if (status->error_code == MDF_ERR_MUPGRADE_STOP) {
+        mupgrade_table_finish(table, q_data->src_addr, false);
+    }
+}
+
+static void mupgrade_status_task(void *arg)
+{
+    mupgrade_pipeline_t *pipeline = (mupgrade_pipeline_t *)arg;
+    mupgrade_queue_t *q_data      = NULL;
+
+    while (pipeline->running) {
+        if (!xQueueReceive(pipeline->session->queue, &q_data, pdMS_TO_TICKS(100))) {
+            continue;
+        }
+
+        xSemaphoreTake(pipeline->lock, portMAX_DELAY);
+        mupgrade_result_update(pipeline->table, q_data);
+        xSemaphoreGive(pipeline->lock);
+
+        MDF_FREE(q_data);
+    }
+
+    xSemaphoreGive(pipeline->exit_sem);
+    vTaskDelete(NULL);
+}
+
+static void mupgrade_read_task(void *arg)
+{
+    mupgrade_pipeline_t *pipeline = (mupgrade_pipeline_t *)arg;
+    mupgrade_packet_t *packet     = NULL;
+
+    for (uint16_t seq = 0; seq < pipeline->packet_num && pipeline->running; ++seq) {
+        if (MUPGRADE_GET_BITS(pipeline->progress_array, seq)) {
+            continue;
+        }
+
+        while (pipeline->running && !xQueueReceive(pipeline->free_queue, &packet, pdMS_TO_TICKS(100)));
+
+        if (!pipeline->running) {
+            break;
+        }
+
+        packet->type = MUPGRADE_TYPE_DATA;
+        packet->seq  = seq;
+        packet->size = (seq == pipeline->packet_num - 1) ? pipeline->last_packet_size : pipeline->packet_size;
+
+        /**
+         * @brief Read firmware data from Flash while the previous packets are being sent.
+         */
+        uint64_t start_us = esp_timer_get_time();
+        pipeline->read_error = esp_partition_read(pipeline->session->partition,
+                               pipeline->image_offset + seq * pipeline->packet_size,
+                               packet->data, packet->size);
+        pipeline->result->read_us += esp_timer_get_time() - start_us;
+
+        if (pipeline->read_error != ESP_OK) {
+            MDF_LOGW("<%s> Read data from Flash", mdf_err_to_name(pipeline->read_error));
+            xQueueSend(pipeline->free_queue, &packet, 0);
+            break;
+        }
+
+        xQueueSend(pipeline->ready_queue, &packet, portMAX_DELAY);
+    }
+
+    packet = NULL;
+    xQueueSend(pipeline->ready_queue, &packet, portMAX_DELAY);
+
+    xSemaphoreGive(pipeline->exit_sem);
+    vTaskDelete(NULL);
+}
+
+static void mupgrade_pipeline_delete(mupgrade_pipeline_t *pipeline)
+{
+    if (pipeline->free_queue) {
+        vQueueDelete(pipeline->free_queue);
+    }
+
+    if (pipeline->ready_queue) {
+        vQueueDelete(pipeline->ready_queue);
+    }
+
+    if (pipeline->lock) {
+        vSemaphoreDelete(pipeline->lock);
+    }
+
+    if (pipeline->exit_sem) {
+        vSemaphoreDelete(pipeline->exit_sem);
+    }
+
+    MDF_FREE(pipeline->packets);
+    MDF_FREE(pipeline);
+}
+
+static mupgrade_pipeline_t *mupgrade_pipeline_create(mupgrade_session_t *session, mupgrade_result_t *result,
+        const uint8_t *progress_array)
+{
+    mupgrade_pipeline_t *pipeline = MDF_CALLOC(1, sizeof(mupgrade_pipeline_t));
+
+    if (!pipeline) {
+        return NULL;
+    }
+
+    pipeline->session        = session;
+    pipeline->result         = result;
+    pipeline->progress_array = progress_array;
+    pipeline->image_offset   = session->image_offset;
+    pipeline->rate           = CONFIG_MUPGRADE_SEND_RATE;
+    pipeline->packet_size    = session->status->packet_size;
+    pipeline->packet_num     = (session->status->total_size + pipeline->packet_size - 1) / pipeline->packet_size;
+    pipeline->last_packet_size = session->status->total_size % pipeline->packet_size;
+    pipeline->last_packet_size = (!pipeline->last_packet_size) ? pipeline->packet_size : pipeline->last_packet_size;
+
+    pipeline->packets     = MDF_MALLOC(CONFIG_MUPGRADE_PREFETCH_NUM * sizeof(mupgrade_packet_t));
+    pipeline->free_queue  = xQueueCreate(CONFIG_MUPGRADE_PREFETCH_NUM, sizeof(mupgrade_packet_t *));
+    pipeline->ready_queue = xQueueCreate(CONFIG_MUPGRADE_PREFETCH_NUM + 1, sizeof(mupgrade_packet_t *));
+    pipeline->lock        = xSemaphoreCreateMutex();
+    pipeline->exit_sem    = xSemaphoreCreateCounting(2, 0);
+
+    if (!pipeline->packets || !pipeline->free_queue || !pipeline->ready_queue
+            || !pipeline->lock || !pipeline->exit_sem) {
+        MDF_LOGW("Create the pipeline of the firmware sending");
+        mupgrade_pipeline_delete(pipeline);
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+/**
+ * @brief Start the reader and the status task for one sending pass
+ */
+static mdf_err_t mupgrade_pipeline_start(mupgrade_pipeline_t *pipeline)
+{
+    mupgrade_packet_t *packet = NULL;
+
+    xQueueReset(pipeline->free_queue);
+    xQueueReset(pipeline->ready_queue);
+
+    for (int i = 0; i < CONFIG_MUPGRADE_PREFETCH_NUM; ++i) {
+        packet = pipeline->packets + i;
+        xQueueSend(pipeline->free_queue, &packet, 0);
+    }
+
+    pipeline->running    = true;
+    pipeline->read_error = ESP_OK;
+
+    if (xTaskCreatePinnedToCore(mupgrade_status_task, "mupgrade_status", 3 * 1024, pipeline,
+                                CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL, CONFIG_MDF_TASK_PINNED_TO_CORE) != pdPASS) {
+        pipeline->running = false;
+        MDF_LOGW("Create the mupgrade_status task");
+        return MDF_ERR_NO_MEM;
+    }
+
+    if (xTaskCreatePinnedToCore(mupgrade_read_task, "mupgrade_read", 3 * 1024, pipeline,
+                                CONFIG_MDF_TASK_DEFAULT_PRIOTY, NULL, CONFIG_MDF_TASK_PINNED_TO_CORE) != pdPASS) {
+        pipeline->running = false;
+        xSemaphoreTake(pipeline->exit_sem, portMAX_DELAY);
+        MDF_LOGW("Create the mupgrade_read task");
+        return MDF_ERR_NO_MEM;
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Stop the pass and wait for the reader and the status task to exit
+ */
+static void mupgrade_pipeline_stop(mupgrade_pipeline_t *pipeline, bool reader_finished)
+{
+    mupgrade_packet_t *packet = NULL;
+
+    pipeline->running = false;
+
+    /**< Hand the prefetched packets back so that the reader is never blocked */
+    while (!reader_finished && xQueueReceive(pipeline->ready_queue, &packet, portMAX_DELAY)) {
+        if (!packet) {
+            break;
+        }
+
+        xQueueSend(pipeline->free_queue, &packet, 0);
+    }
+
+    xSemaphoreTake(pipeline->exit_sem, portMAX_DELAY);
+    xSemaphoreTake(pipeline->exit_sem, portMAX_DELAY);
+}
+
+static mdf_err_t mupgrade_session_send(mupgrade_session_t *session, const uint8_t *addrs_list,
+                                       size_t addrs_num, mupgrade_result_t *res);
+
+/**
+ * @brief Send a full image to the devices that answered with the legacy status, in packets of
+ *        MUPGRADE_LEGACY_PACKET_SIZE without manifest. Their results are added to result.
+ */
+static void mupgrade_session_send_legacy(mupgrade_session_t *session, const uint8_t *addrs_list,
+        size_t addrs_num, mupgrade_result_t *result)
+{
+    mupgrade_result_t legacy_result     = {0};
+    mupgrade_status_t legacy_status     = {0};
+    mupgrade_status_t *status           = session->status;
+    const mupgrade_manifest_t *manifest = session->manifest;
+    size_t manifest_size                = session->manifest_size;
+
+    memcpy(&legacy_status, status, sizeof(mupgrade_status_t));
+    legacy_status.version     = 0;
+    legacy_status.packet_size = MUPGRADE_LEGACY_PACKET_SIZE;
+
+    MDF_LOGI("Send the firmware in legacy packets, name: %.32s, addrs_num: %d", status->name, addrs_num);
+
+    /**< The answers are still dispatched to the session by the name, which is unchanged */
+    xSemaphoreTake(g_sessions_lock, portMAX_DELAY);
+    session->status        = &legacy_status;
+    session->manifest      = NULL;
+    session->manifest_size = 0;
+    xSemaphoreGive(g_sessions_lock);
+
+    mupgrade_session_send(session, addrs_list, addrs_num, &legacy_result);
+
+    xSemaphoreTake(g_sessions_lock, portMAX_DELAY);
+    session->status        = status;
+    session->manifest      = manifest;
+    session->manifest_size = manifest_size;
+    xSemaphoreGive(g_sessions_lock);
+
+    /**< The legacy devices were removed from the lists of result, which have room for them.
+         If the sending failed before listing the devices, none of them is upgraded. */
+    if (!legacy_result.unfinished_addr) {
+        memcpy(result->unfinished_addr + result->unfinished_num * MWIFI_ADDR_LEN, addrs_list,
+               addrs_num * MWIFI_ADDR_LEN);
+        result->unfinished_num += addrs_num;
+    } else {
+        memcpy(result->unfinished_addr + result->unfinished_num * MWIFI_ADDR_LEN, legacy_result.unfinished_addr,
+               legacy_result.unfinished_num * MWIFI_ADDR_LEN);
+        result->unfinished_num += legacy_result.unfinished_num;
+    }
+
+    if (legacy_result.successed_num > 0) {
+        memcpy(result->successed_addr + result->successed_num * MWIFI_ADDR_LEN, legacy_result.successed_addr,
+               legacy_result.successed_num * MWIFI_ADDR_LEN);
+        result->successed_num += legacy_result.successed_num;
+    }
+
+    result->pass_num  += legacy_result.pass_num;
+    result->read_us   += legacy_result.read_us;
+    result->send_us   += legacy_result.send_us;
+    result->wait_us   += legacy_result.wait_us;
+    result->status_us += legacy_result.status_us;
+
+    mupgrade_result_free(&legacy_result);
+}
+
+static mdf_err_t mupgrade_session_send(mupgrade_session_t *session, const uint8_t *addrs_list,
+                                       size_t addrs_num, mupgrade_result_t *res)
+{
+    mdf_err_t ret                 = MDF_ERR_NO_MEM;
+    mwifi_data_type_t type        = {.upgrade = true, .communicate = MWIFI_COMMUNICATE_MULTICAST};
+    mupgrade_packet_t *packet     = NULL;
+    mupgrade_pipeline_t *pipeline = NULL;
+    mupgrade_table_t *table       = NULL;
+    uint8_t *send_addrs           = NULL;
+    size_t send_num               = 0;
+    bool broadcast                = false;
+    uint8_t *progress_array       = MDF_MALLOC(MUPGRADE_PACKET_MAX_NUM / 8);
+    mupgrade_result_t *result     = MDF_CALLOC(1, sizeof(mupgrade_result_t));
+    uint64_t start_us             = esp_timer_get_time();
+    uint64_t next_send_us         = 0;
+    uint16_t sent_num             = 0;
 
-    MDF_ERROR_GOTO(!packet, EXIT, "");
     MDF_ERROR_GOTO(!progress_array, EXIT, "");
     MDF_ERROR_GOTO(!result, EXIT, "");
 
+    pipeline = mupgrade_pipeline_create(session, result, progress_array);
+    MDF_ERROR_GOTO(!pipeline, EXIT, "");
+    MDF_ERROR_GOTO(pipeline->packet_num > MUPGRADE_PACKET_MAX_NUM, EXIT, "Too many packets, packet_num: %d",
+                   pipeline->packet_num);
+
     /**
      * @brief If addrs_list is MWIFI_ADDR_ANY or MWIFI_ADDR_BROADCAST,
      * Get all node addresses for firmware upgrades.
@@ -384,20 +1252,43 @@ mdf_err_t mupgrade_firmware_send(const uint8_t *addrs_list, size_t addrs_num,
         memcpy(result->unfinished_addr, addrs_list, result->unfinished_num * MWIFI_ADDR_LEN);
     }
 
-    uint16_t packet_num = (g_upgrade_config->status.total_size + MUPGRADE_PACKET_MAX_SIZE - 1) / MUPGRADE_PACKET_MAX_SIZE;
-    uint16_t last_packet_size = g_upgrade_config->status.total_size % MUPGRADE_PACKET_MAX_SIZE;
-    last_packet_size = (!last_packet_size) ? MUPGRADE_PACKET_MAX_SIZE : last_packet_size;
-    packet->type = MUPGRADE_TYPE_DATA;
-    packet->size = MUPGRADE_PACKET_MAX_SIZE;
-    g_upgrade_config->status.written_size = 0;
-    MDF_LOGD("packet_num: %d, total_size: %d", packet_num, g_upgrade_config->status.total_size);
+    table = mupgrade_table_create(result);
+    ret   = MDF_ERR_NO_MEM;
+    MDF_ERROR_GOTO(!table, EXIT, "mupgrade_table_create");
+    pipeline->table = table;
+
+    /**< Destinations of the packet being sent, copied from the table, at least one address */
+    send_addrs = MDF_MALLOC(MAX(result->unfinished_num, 1) * MWIFI_ADDR_LEN);
+    MDF_ERROR_GOTO(!send_addrs, EXIT, "");
+
+    session->status->written_size = 0;
+    MDF_LOGD("name: %.32s, packet_num: %d, total_size: %d", session->status->name,
+             pipeline->packet_num, session->status->total_size);
 
-    for (int i = 0; i < CONFIG_MUPGRADE_RETRY_COUNT && result->unfinished_num > 0 && g_mupgrade_send_running_flag; ++i) {
+    for (int i = 0; i < CONFIG_MUPGRADE_RETRY_COUNT && result->unfinished_num > 0 && session->running; ++i) {
 
         /**
          * @brief Request all devices upgrade status.
          */
-        if ((ret = mupgrade_request_status(progress_array, result)) == ESP_OK) {
+        uint64_t status_start_us = esp_timer_get_time();
+        ret = mupgrade_request_status(session, table, progress_array, pipeline->packet_num);
+        result->status_us += esp_timer_get_time() - status_start_us;
+
+        /**< The packets of the last pass still missing are the loss of the pass, halve the rate on loss */
+        if (sent_num > 0) {
+            result->packet_loss = MIN(mupgrade_progress_missing(progress_array, pipeline->packet_num), sent_num)
+                                  * 100 / sent_num;
+
+            if (result->packet_loss > MUPGRADE_LOSS_THRESHOLD) {
+                pipeline->rate = MAX(pipeline->rate / 2, MUPGRADE_RATE_MIN);
+            }
+
+            MDF_LOGI("Pass: %d, sent: %d, loss: %d%%, rate: %d packets/s", result->pass_num, sent_num,
+                     result->packet_loss, pipeline->rate);
+            sent_num = 0;
+        }
+
+        if (ret == ESP_OK) {
             break;
         }
 
@@ -407,90 +1298,140 @@ mdf_err_t mupgrade_firmware_send(const uint8_t *addrs_list, size_t addrs_num,
             MDF_LOGD("Count: %d, addr: " MACSTR, i, MAC2STR(result->unfinished_addr + i * MWIFI_ADDR_LEN));
         }
 
-        for (packet->seq = 0; result->requested_num > 0 && packet->seq < packet_num && g_mupgrade_send_running_flag; ++packet->seq) {
-            if (!MUPGRADE_GET_BITS(progress_array, packet->seq)) {
-                packet->size = (packet->seq == packet_num - 1) ? last_packet_size : MUPGRADE_PACKET_MAX_SIZE;
-
-                /**
-                 * @brief Read firmware data from Flash to send to unfinished device.
-                 */
-                ret = esp_partition_read(g_upgrade_config->partition, packet->seq * MUPGRADE_PACKET_MAX_SIZE,
-                                         packet->data, packet->size);
-                MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", mdf_err_to_name(ret));
-
-                /**
-                 * @brief Remove the device have already completed firmware upgrade from unfinished and requested address list.
-                 */
-                for (mupgrade_queue_t *q_data = NULL; xQueueReceive(g_upgrade_config->queue, &q_data, 0);) {
-                    mupgrade_status_t *status = (mupgrade_status_t *)q_data->data;
-
-                    if (!status->written_size && (status->written_size == status->total_size)) {
-                        if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr)) {
-                            MDF_LOGW("The device has been removed from the list waiting for the upgrade");
-                            MDF_FREE(q_data);
-                            continue;
-                        }
-
-                        if (!addrs_remove(result->requested_addr, &result->requested_num, q_data->src_addr)) {
-                            MDF_LOGW("The device has been removed from the list of data sent for upgrade");
-                            MDF_FREE(q_data);
-                            continue;
-                        }
-
-                        result->successed_num++;
-                        result->successed_addr = MDF_REALLOC_RETRY(result->successed_addr,
-                                                 result->successed_num * MWIFI_ADDR_LEN);
-                        memcpy(result->successed_addr + (result->successed_num - 1) * MWIFI_ADDR_LEN,
-                               q_data->src_addr, MWIFI_ADDR_LEN);
-                    } else if (status->error_code == MDF_ERR_MUPGRADE_STOP) {
-                        addrs_remove(result->unfinished_addr, &result->unfinished_num, q_data->src_addr);
-                        addrs_remove(result->requested_addr, &result->requested_num, q_data->src_addr);
-                    }
-
-                    MDF_FREE(q_data);
-
-                    if (!result->unfinished_num) {
-                        goto EXIT;
-                    }
-                }
+        if (!result->requested_num) {
+            continue;
+        }
 
-                /**
-                 * @brief Send firmware data to unfinished devide.
-                 */
-                uint64_t start_us = esp_timer_get_time();
-
-                if ((MWIFI_ADDR_IS_ANY(addrs_list) || MWIFI_ADDR_IS_BROADCAST(addrs_list))
-                        && result->successed_num < 2 && addrs_num == 1) {
-                    MDF_LOGD("seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, addrs_num);
-
-                    if (MWIFI_ADDR_IS_ANY(addrs_list) && result->successed_num == 1) {
-                        uint8_t broadcast_addr[] = MWIFI_ADDR_BROADCAST;
-                        ret = mwifi_root_write(broadcast_addr, addrs_num, &type,
-                                               packet, sizeof(mupgrade_packet_t), true);
-                    } else {
-                        ret = mwifi_root_write(addrs_list, addrs_num, &type,
-                                               packet, sizeof(mupgrade_packet_t), true);
-                    }
-                } else {
-                    MDF_LOGD("seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, result->requested_num);
-                    ret = mwifi_root_write(result->requested_addr, result->requested_num, &type,
-                                           packet, sizeof(mupgrade_packet_t), true);
+        /**
+         * @brief The reader task prefetches the missing packets from flash and the status task
+         *        removes the devices that have completed, this task only sends.
+         */
+        ret = mupgrade_pipeline_start(pipeline);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_pipeline_start");
+        result->pass_num++;
+
+        for (;;) {
+            uint64_t wait_start_us = esp_timer_get_time();
+            xQueueReceive(pipeline->ready_queue, &packet, portMAX_DELAY);
+            result->wait_us += esp_timer_get_time() - wait_start_us;
+
+            if (!packet) {
+                break;
+            }
+
+            /**
+             * @brief Send firmware data to unfinished devide.
+             */
+            size_t packet_size = sizeof(mupgrade_packet_t) - MUPGRADE_PACKET_MAX_SIZE + packet->size;
+
+            /**< The destinations are copied under the lock and the packet is sent without it,
+                 the status task is not blocked for the time of the mesh sending */
+            xSemaphoreTake(pipeline->lock, portMAX_DELAY);
+
+            /**< The packets are broadcast until a legacy device answers, it would misplace them */
+            broadcast = (MWIFI_ADDR_IS_ANY(addrs_list) || MWIFI_ADDR_IS_BROADCAST(addrs_list))
+                        && result->successed_num < 2 && addrs_num == 1 && !table->legacy_num;
+
+            if (broadcast && MWIFI_ADDR_IS_ANY(addrs_list) && result->successed_num == 1) {
+                uint8_t broadcast_addr[] = MWIFI_ADDR_BROADCAST;
+                memcpy(send_addrs, broadcast_addr, MWIFI_ADDR_LEN);
+                send_num = addrs_num;
+            } else if (broadcast) {
+                memcpy(send_addrs, addrs_list, MWIFI_ADDR_LEN);
+                send_num = addrs_num;
+            } else {
+                /**< Only the devices of the groups that reported the packet missing receive it */
+                const uint8_t *group_addrs = mupgrade_table_send_addrs(table, packet->seq, &send_num);
+                memcpy(send_addrs, group_addrs, send_num * MWIFI_ADDR_LEN);
+            }
+
+            xSemaphoreGive(pipeline->lock);
+
+            uint64_t send_start_us = esp_timer_get_time();
+            ret = MDF_OK;
+
+            if (broadcast) {
+                MDF_LOGD("seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, send_num);
+                ret = mwifi_root_write(send_addrs, send_num, &type, packet, packet_size, true);
+            } else {
+                /**< The devices are split so that each packet goes out as a single frame */
+                for (size_t i = 0, num = 0; i < send_num && ret == MDF_OK; i += num) {
+                    num = MIN(send_num - i, MUPGRADE_MULTICAST_ADDRS_NUM(packet_size));
+                    MDF_LOGD("seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, num);
+                    ret = mwifi_root_write(send_addrs + i * MWIFI_ADDR_LEN, num, &type, packet, packet_size, true);
                 }
+            }
+
+            uint64_t send_us = esp_timer_get_time() - send_start_us;
+            result->send_us += send_us;
+            sent_num++;
+
+            xSemaphoreTake(pipeline->lock, portMAX_DELAY);
+            bool pass_finished = !result->unfinished_num || !result->requested_num;
+            xSemaphoreGive(pipeline->lock);
+
+            xQueueSend(pipeline->free_queue, &packet, 0);
 
-                uint64_t wait = (esp_timer_get_time() - start_us) * CONFIG_MUPGRADE_FLOW_CONTROL_LEVEL / 10;
-                vTaskDelay(pdMS_TO_TICKS(wait / 1000)); // flow control for sending data in ota
+            if (pass_finished || !session->running) {
+                break;
+            }
 
-                MDF_ERROR_CONTINUE(ret != ESP_OK, "<%s> Mwifi root write", mdf_err_to_name(ret));
+            /**< A failed write means the mesh queues are full, back off at once */
+            if (ret != ESP_OK) {
+                pipeline->rate = MAX(pipeline->rate / 2, MUPGRADE_RATE_MIN);
+            } else if (sent_num % MUPGRADE_RATE_WINDOW == 0) {
+                pipeline->rate = MIN(pipeline->rate + MUPGRADE_RATE_INCREASE, MUPGRADE_RATE_MAX);
             }
+
+            /**
+             * @brief Pace the packets at the current rate, but leave at least the flow control
+             *        gap after a slow write. Sleeps are rounded down to ticks, the remainder is
+             *        carried over to the next packet.
+             */
+            uint64_t interval_us = MAX(1000000 / pipeline->rate,
+                                       send_us * (10 + CONFIG_MUPGRADE_FLOW_CONTROL_LEVEL) / 10);
+            next_send_us = MAX(next_send_us, send_start_us) + interval_us;
+
+            uint64_t pace_start_us = esp_timer_get_time();
+
+            if (next_send_us > pace_start_us) {
+                vTaskDelay(pdMS_TO_TICKS((next_send_us - pace_start_us) / 1000));
+            }
+
+            result->wait_us += esp_timer_get_time() - pace_start_us;
+
+            MDF_ERROR_CONTINUE(ret != ESP_OK, "<%s> Mwifi root write", mdf_err_to_name(ret));
+        }
+
+        mupgrade_pipeline_stop(pipeline, !packet);
+        MDF_ERROR_GOTO(pipeline->read_error != ESP_OK, EXIT, "<%s> Read data from Flash",
+                       mdf_err_to_name(pipeline->read_error));
+
+        if (!result->unfinished_num) {
+            goto EXIT;
         }
     }
 
 EXIT:
 
+    if (table && table->legacy_num > 0 && session->running) {
+        mupgrade_session_send_legacy(session, table->legacy_addrs, table->legacy_num, result);
+    }
+
     ret = (result->unfinished_num > 0) ? MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE : MDF_OK;
-    g_mupgrade_send_running_flag = false;
 
-    mdf_event_loop_send(MDF_EVENT_MUPGRADE_SEND_FINISH, (void *)ret);
+    /**< The legacy sending is part of the sending of the firmware */
+    if (session->status->version >= MUPGRADE_STATUS_VERSION) {
+        mdf_event_loop_send(MDF_EVENT_MUPGRADE_SEND_FINISH, (void *)ret);
+    }
+
+    if (result) {
+        result->total_us  = esp_timer_get_time() - start_us;
+        result->send_rate = pipeline ? pipeline->rate : 0;
+        MDF_LOGI("Firmware sent, name: %.32s, passes: %d, total: %dms, flash read: %dms, send: %dms, wait: %dms, status request: %dms",
+                 session->status->name, result->pass_num, (int)(result->total_us / 1000), (int)(result->read_us / 1000),
+                 (int)(result->send_us / 1000), (int)(result->wait_us / 1000), (int)(result->status_us / 1000));
+    }
 
     if (res) {
         memcpy(res, result, sizeof(mupgrade_result_t));
@@ -498,14 +1439,56 @@ EXIT:
         mupgrade_result_free(result);
     }
 
-    for (mupgrade_queue_t *q_data = NULL; xQueueReceive(g_upgrade_config->queue, &q_data, 0);) {
+    for (mupgrade_queue_t *q_data = NULL; xQueueReceive(session->queue, &q_data, 0);) {
         MDF_FREE(q_data);
     }
 
-    MDF_FREE(packet);
+    if (pipeline) {
+        mupgrade_pipeline_delete(pipeline);
+    }
+
+    if (table) {
+        mupgrade_table_destroy(table);
+    }
+
+    MDF_FREE(send_addrs);
     MDF_FREE(progress_array);
     MDF_FREE(result);
 
+    return ret;
+}
+
+mdf_err_t mupgrade_firmware_send(const uint8_t *addrs_list, size_t addrs_num,
+                                 mupgrade_result_t *res)
+{
+    MDF_PARAM_CHECK(addrs_list);
+    MDF_PARAM_CHECK(addrs_num);
+    MDF_PARAM_CHECK(!MWIFI_ADDR_IS_EMPTY(addrs_list));
+    MDF_PARAM_CHECK(addrs_num > 0 && addrs_num <= esp_mesh_get_routing_table_size());
+    MDF_ERROR_CHECK(!g_upgrade_config, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT,
+                    "Mupgrade firmware is not initialized");
+    MDF_ERROR_CHECK(g_upgrade_config->status.error_code != MDF_ERR_MUPGRADE_FIRMWARE_FINISH,
+                    MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE, "mupgrade_firmware_download");
+
+    mdf_err_t ret              = MDF_OK;
+    mupgrade_session_t session = {
+        .status       = &g_upgrade_config->status,
+        .queue        = g_upgrade_config->queue,
+        .partition    = g_upgrade_config->partition,
+        .image_offset = mupgrade_image_offset(),
+    };
+
+    session.manifest = mupgrade_manifest_get(&session.manifest_size);
+
+    ret = mupgrade_session_add(&session);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_session_add");
+
+    g_mupgrade_send_running_flag = true;
+    ret = mupgrade_session_send(&session, addrs_list, addrs_num, res);
+    g_mupgrade_send_running_flag = false;
+
+    mupgrade_session_remove(&session);
+
     if (g_mupgrade_send_exit_sem) {
         xSemaphoreGive(g_mupgrade_send_exit_sem);
     }
@@ -513,8 +1496,92 @@ EXIT:
     return ret;
 }
 
+mdf_err_t mupgrade_store_send(const char *name, const char *version, const uint8_t *addrs_list,
+                              size_t addrs_num, mupgrade_result_t *res)
+{
+    MDF_PARAM_CHECK(name);
+    MDF_PARAM_CHECK(addrs_list);
+    MDF_PARAM_CHECK(!MWIFI_ADDR_IS_EMPTY(addrs_list));
+    MDF_PARAM_CHECK(!MWIFI_ADDR_IS_ANY(addrs_list) && !MWIFI_ADDR_IS_BROADCAST(addrs_list));
+    MDF_PARAM_CHECK(addrs_num > 0 && addrs_num <= esp_mesh_get_routing_table_size());
+
+    mdf_err_t ret                 = MDF_OK;
+    mupgrade_store_entry_t entry  = {0};
+    mupgrade_status_t status      = {0};
+    mupgrade_manifest_t *manifest = NULL;
+    mupgrade_session_t session    = {0};
+
+    ret = mupgrade_store_open(name, version, &entry);
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_open, name: %s", name);
+
+    /**< The status requests carry the same fields as those of the downloaded firmware */
+    memcpy(status.name, entry.name, sizeof(status.name));
+    status.error_code  = MDF_ERR_MUPGRADE_FIRMWARE_FINISH;
+    status.total_size  = entry.size;
+    status.image_type  = entry.image_type;
+    status.image_size  = entry.image_size;
+    status.packet_size = entry.packet_size;
+    status.version     = MUPGRADE_STATUS_VERSION;
+
+    /**< An image stored before MUPGRADE_PACKET_MAX_SIZE was lowered has to be uploaded again */
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+    MDF_ERROR_GOTO(!entry.packet_size || entry.packet_size > MUPGRADE_PACKET_MAX_SIZE, EXIT,
+                   "The packets of the stored image are too long, packet_size: %d", entry.packet_size);
+
+    manifest      = MDF_MALLOC(entry.manifest_size);
+    session.queue = xQueueCreate(3, sizeof(void *));
+    ret           = MDF_ERR_NO_MEM;
+    MDF_ERROR_GOTO(!manifest || !session.queue, EXIT, "");
+
+    session.status        = &status;
+    session.partition     = mupgrade_store_partition();
+    session.image_offset  = entry.offset;
+    session.manifest      = manifest;
+    session.manifest_size = entry.manifest_size;
+
+    ret = esp_partition_read(session.partition, entry.offset + entry.size, manifest, entry.manifest_size);
+    MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+    ret = mupgrade_session_add(&session);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_session_add");
+
+    MDF_LOGI("Send the stored firmware, name: %s, version: %s, size: %d, addrs_num: %d",
+             entry.name, entry.version, entry.size, addrs_num);
+
+    ret = mupgrade_session_send(&session, addrs_list, addrs_num, res);
+    mupgrade_session_remove(&session);
+
+EXIT:
+
+    if (session.queue) {
+        for (mupgrade_queue_t *q_data = NULL; xQueueReceive(session.queue, &q_data, 0);) {
+            MDF_FREE(q_data);
+        }
+
+        vQueueDelete(session.queue);
+    }
+
+    MDF_FREE(manifest);
+    mupgrade_store_close(&entry);
+
+    return ret;
+}
+
 mdf_err_t mupgrade_firmware_stop()
 {
+    /**< The firmware of the store being sent are stopped as well */
+    if (g_sessions_lock) {
+        xSemaphoreTake(g_sessions_lock, portMAX_DELAY);
+
+        for (int i = 0; i < MUPGRADE_SESSION_MAX; ++i) {
+            if (g_sessions[i]) {
+                g_sessions[i]->running = false;
+            }
+        }
+
+        xSemaphoreGive(g_sessions_lock);
+    }
+
     if (!g_mupgrade_send_running_flag) {
         return MDF_OK;
     }
@@ -0,0 +1,564 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mdf_common.h"
+#include "mupgrade_priv.h"
+
+/**
+ * @brief The index is kept twice, in sector 0 and 1 of the store partition. An update is
+ *        written to the other sector with the next seq, the copy with a valid CRC and the
+ *        highest seq is loaded, so a reset during an update leaves the previous index.
+ */
+#define MUPGRADE_STORE_MAGIC         (0x54534d4d) /**< "MMST" */
+#define MUPGRADE_STORE_VERSION       (1)
+#define MUPGRADE_STORE_INDEX_SECTORS (2)
+#define MUPGRADE_STORE_DATA_OFFSET   (MUPGRADE_STORE_INDEX_SECTORS * SPI_FLASH_SEC_SIZE)
+
+typedef struct {
+    uint32_t magic;            /**< MUPGRADE_STORE_MAGIC */
+    uint16_t version;          /**< MUPGRADE_STORE_VERSION */
+    uint16_t entry_num;        /**< Number of stored images */
+    uint32_t seq;              /**< Incremented on every update of the index */
+    uint32_t crc32;            /**< CRC-32 of the entries */
+    mupgrade_store_entry_t entry[CONFIG_MUPGRADE_STORE_IMAGE_MAX_NUM];
+} __attribute__((packed)) mupgrade_store_index_t;
+
+/**
+ * @brief Image being written, its extent is reserved until mupgrade_store_finish()
+ */
+typedef struct {
+    mupgrade_store_entry_t entry;
+    size_t written_size;
+    size_t extent_size;        /**< Length of the extent reserved for the image and its manifest */
+    size_t erased_size;        /**< Length of the extent erased so far, sectors are erased as they are reached */
+    bool sha256_expected;
+    bool duplicate;            /**< The same content is already stored, the data is only counted */
+} mupgrade_store_writer_t;
+
+typedef struct {
+    const esp_partition_t *partition;
+    SemaphoreHandle_t lock;
+    uint8_t sector;            /**< Sector of the current index */
+    mupgrade_store_index_t index;
+    uint8_t busy[CONFIG_MUPGRADE_STORE_IMAGE_MAX_NUM]; /**< Sendings reading each entry */
+    mupgrade_store_writer_t *writer;
+} mupgrade_store_t;
+
+static const char *TAG = "mupgrade_store";
+static mupgrade_store_t *g_store = NULL;
+
+static size_t mupgrade_store_extent_size(const mupgrade_store_entry_t *entry)
+{
+    return MUPGRADE_ALIGN_SECTOR(entry->size + entry->manifest_size);
+}
+
+static bool mupgrade_store_entry_match(const mupgrade_store_entry_t *entry, const char *name, const char *version)
+{
+    return !strncmp(entry->name, name, sizeof(entry->name))
+           && (!version || !strncmp(entry->version, version, sizeof(entry->version)));
+}
+
+static bool mupgrade_store_index_read(uint8_t sector, mupgrade_store_index_t *index)
+{
+    if (esp_partition_read(g_store->partition, sector * SPI_FLASH_SEC_SIZE, index,
+                           sizeof(mupgrade_store_index_t)) != ESP_OK) {
+        return false;
+    }
+
+    return index->magic == MUPGRADE_STORE_MAGIC && index->version == MUPGRADE_STORE_VERSION
+           && index->entry_num <= CONFIG_MUPGRADE_STORE_IMAGE_MAX_NUM
+           && index->crc32 == crc32_le(UINT32_MAX, (uint8_t *)index->entry,
+                                       index->entry_num * sizeof(mupgrade_store_entry_t));
+}
+
+/**
+ * @brief Find the store partition and load the newest valid index, called with the lock taken
+ */
+static mdf_err_t mupgrade_store_load(void)
+{
+    mupgrade_store_index_t *index = NULL;
+    bool valid[MUPGRADE_STORE_INDEX_SECTORS] = {false};
+    uint32_t seq[MUPGRADE_STORE_INDEX_SECTORS] = {0};
+
+    g_store->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                         CONFIG_MUPGRADE_STORE_PARTITION_LABEL);
+    MDF_ERROR_CHECK(!g_store->partition || g_store->partition->size <= MUPGRADE_STORE_DATA_OFFSET,
+                    MDF_ERR_MUPGRADE_FIRMWARE_PARTITION, "No firmware store partition, label: %s",
+                    CONFIG_MUPGRADE_STORE_PARTITION_LABEL);
+
+    index = MDF_MALLOC(sizeof(mupgrade_store_index_t));
+    MDF_ERROR_CHECK(!index, MDF_ERR_NO_MEM, "");
+
+    for (uint8_t sector = 0; sector < MUPGRADE_STORE_INDEX_SECTORS; ++sector) {
+        valid[sector] = mupgrade_store_index_read(sector, index);
+        seq[sector]   = index->seq;
+    }
+
+    g_store->sector = (valid[1] && (!valid[0] || seq[1] > seq[0])) ? 1 : 0;
+
+    if (valid[g_store->sector] && mupgrade_store_index_read(g_store->sector, index)) {
+        memcpy(&g_store->index, index, sizeof(mupgrade_store_index_t));
+    } else {
+        /**< An empty store, the first update is written to the other sector */
+        g_store->index.magic     = MUPGRADE_STORE_MAGIC;
+        g_store->index.version   = MUPGRADE_STORE_VERSION;
+        g_store->index.entry_num = 0;
+        g_store->index.seq       = 0;
+    }
+
+    MDF_FREE(index);
+
+    MDF_LOGI("Firmware store, label: %s, size: %d, images: %d, seq: %d", g_store->partition->label,
+             g_store->partition->size, g_store->index.entry_num, g_store->index.seq);
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Take the lock of the store, the index is loaded on the first call
+ */
+static mdf_err_t mupgrade_store_lock(void)
+{
+    mdf_err_t ret = MDF_OK;
+
+    if (!g_store) {
+        mupgrade_store_t *store = MDF_CALLOC(1, sizeof(mupgrade_store_t));
+        MDF_ERROR_CHECK(!store, MDF_ERR_NO_MEM, "");
+
+        store->lock = xSemaphoreCreateMutex();
+
+        if (!store->lock) {
+            MDF_FREE(store);
+            return MDF_ERR_NO_MEM;
+        }
+
+        g_store = store;
+    }
+
+    xSemaphoreTake(g_store->lock, portMAX_DELAY);
+
+    if (!g_store->partition) {
+        ret = mupgrade_store_load();
+
+        if (ret != MDF_OK) {
+            g_store->partition = NULL;
+            xSemaphoreGive(g_store->lock);
+        }
+    }
+
+    return ret;
+}
+
+static void mupgrade_store_unlock(void)
+{
+    xSemaphoreGive(g_store->lock);
+}
+
+/**
+ * @brief Write the index to the other sector, the current one stays valid until the write completes
+ */
+static mdf_err_t mupgrade_store_index_save(void)
+{
+    mdf_err_t ret  = MDF_OK;
+    uint8_t sector = (g_store->sector + 1) % MUPGRADE_STORE_INDEX_SECTORS;
+
+    g_store->index.seq++;
+    g_store->index.crc32 = crc32_le(UINT32_MAX, (uint8_t *)g_store->index.entry,
+                                    g_store->index.entry_num * sizeof(mupgrade_store_entry_t));
+
+    ret = esp_partition_erase_range(g_store->partition, sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_erase_range", mdf_err_to_name(ret));
+
+    ret = esp_partition_write(g_store->partition, sector * SPI_FLASH_SEC_SIZE, &g_store->index,
+                              sizeof(mupgrade_store_index_t));
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_write", mdf_err_to_name(ret));
+
+    g_store->sector = sector;
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Whether [offset, offset + size) overlaps a stored image or the image being written
+ */
+static bool mupgrade_store_extent_used(size_t offset, size_t size)
+{
+    const mupgrade_store_entry_t *entry = NULL;
+
+    if (g_store->writer && !g_store->writer->duplicate
+            && offset < g_store->writer->entry.offset + g_store->writer->extent_size
+            && g_store->writer->entry.offset < offset + size) {
+        return true;
+    }
+
+    for (int i = 0; i < g_store->index.entry_num; ++i) {
+        entry = g_store->index.entry + i;
+
+        if (offset < entry->offset + mupgrade_store_extent_size(entry) && entry->offset < offset + size) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief First free extent of the data area that fits size, 0 if there is none
+ */
+static size_t mupgrade_store_alloc(size_t size)
+{
+    const mupgrade_store_entry_t *entry = NULL;
+    size_t offset = MUPGRADE_STORE_DATA_OFFSET;
+
+    /**< A free extent starts at the data area or right after an image */
+    for (int i = -1; i < (int)g_store->index.entry_num; ++i) {
+        if (i >= 0) {
+            entry  = g_store->index.entry + i;
+            offset = entry->offset + mupgrade_store_extent_size(entry);
+        }
+
+        if (offset + size <= g_store->partition->size && !mupgrade_store_extent_used(offset, size)) {
+            return offset;
+        }
+    }
+
+    return 0;
+}
+
+static int mupgrade_store_find_sha256(const uint8_t sha256[32])
+{
+    for (int i = 0; i < g_store->index.entry_num; ++i) {
+        if (!memcmp(g_store->index.entry[i].sha256, sha256, sizeof(g_store->index.entry[i].sha256))) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+mdf_err_t mupgrade_store_begin(const char *name, const char *version, size_t size, const uint8_t sha256[32])
+{
+    MDF_PARAM_CHECK(name);
+    MDF_PARAM_CHECK(version);
+    MDF_PARAM_CHECK(size > 0 && size != OTA_SIZE_UNKNOWN);
+
+    mdf_err_t ret                   = MDF_OK;
+    mupgrade_store_writer_t *writer = NULL;
+    int duplicate                   = -1;
+
+    ret = mupgrade_store_lock();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_lock");
+
+    /**< One firmware is stored at a time, the writer is only freed by mupgrade_store_finish() */
+    ret = MDF_ERR_INVALID_STATE;
+    MDF_ERROR_GOTO(g_store->writer, EXIT, "A firmware is being stored, name: %s",
+                   g_store->writer->entry.name);
+
+    writer = MDF_CALLOC(1, sizeof(mupgrade_store_writer_t));
+    ret    = MDF_ERR_NO_MEM;
+    MDF_ERROR_GOTO(!writer, EXIT, "");
+
+    strncpy(writer->entry.name, name, sizeof(writer->entry.name));
+    strncpy(writer->entry.version, version, sizeof(writer->entry.version));
+    writer->entry.size        = size;
+    writer->entry.image_type  = MUPGRADE_IMAGE_TYPE_FULL;
+    writer->entry.packet_size = MUPGRADE_PACKET_MAX_SIZE;
+
+    if (sha256) {
+        writer->sha256_expected = true;
+        memcpy(writer->entry.sha256, sha256, sizeof(writer->entry.sha256));
+        duplicate = mupgrade_store_find_sha256(sha256);
+    }
+
+    if (duplicate >= 0) {
+        /**< The images are keyed by their content, the same binary is stored once */
+        writer->duplicate = true;
+        memcpy(&writer->entry, g_store->index.entry + duplicate, sizeof(mupgrade_store_entry_t));
+        strncpy(writer->entry.name, name, sizeof(writer->entry.name));
+        strncpy(writer->entry.version, version, sizeof(writer->entry.version));
+        ret = MDF_ERR_INVALID_ARG;
+        MDF_ERROR_GOTO(writer->entry.size != size, EXIT, "The size does not match the stored image, size: %d",
+                       writer->entry.size);
+        MDF_LOGI("The image is already stored, name: %s, version: %s, offset: 0x%x",
+                 name, version, writer->entry.offset);
+    } else {
+        writer->extent_size  = MUPGRADE_ALIGN_SECTOR(size + MUPGRADE_MANIFEST_MAX_SIZE);
+        writer->entry.offset = mupgrade_store_alloc(writer->extent_size);
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+        MDF_ERROR_GOTO(!writer->entry.offset, EXIT, "No free space in the firmware store, size: %d", size);
+    }
+
+    g_store->writer = writer;
+    ret = MDF_OK;
+
+EXIT:
+
+    if (ret != MDF_OK) {
+        MDF_FREE(writer);
+    }
+
+    mupgrade_store_unlock();
+    return ret;
+}
+
+mdf_err_t mupgrade_store_write(const void *data, size_t size)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_PARAM_CHECK(size);
+    MDF_ERROR_CHECK(!g_store, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT, "mupgrade_store_begin");
+
+    mdf_err_t ret                   = MDF_OK;
+    esp_err_t err                   = ESP_OK;
+    mupgrade_store_writer_t *writer = NULL;
+
+    ret = mupgrade_store_lock();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_lock");
+
+    writer = g_store->writer;
+    ret    = MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT;
+    MDF_ERROR_GOTO(!writer, EXIT, "mupgrade_store_begin");
+
+    ret = MDF_ERR_INVALID_ARG;
+    MDF_ERROR_GOTO(writer->written_size + size > writer->entry.size, EXIT,
+                   "The image is larger than expected, size: %d", size);
+
+    if (writer->duplicate) {
+        writer->written_size += size;
+        ret = MDF_OK;
+        goto EXIT;
+    }
+
+    /**< The image type is read from its header, as in mupgrade_firmware_download() */
+    if (writer->written_size == 0) {
+        if (mupgrade_compress_is_valid(data, size)) {
+            writer->entry.image_type  = MUPGRADE_IMAGE_TYPE_COMPRESSED;
+            writer->entry.image_size  = ((mupgrade_compress_header_t *)data)->image_size;
+            writer->entry.packet_size = MUPGRADE_COMPRESS_PACKET_SIZE;
+        } else if (mupgrade_delta_is_valid(data, size)) {
+            writer->entry.image_type  = MUPGRADE_IMAGE_TYPE_DELTA;
+        }
+    }
+
+    if (writer->written_size + size > writer->erased_size) {
+        size_t erase_size = MUPGRADE_ALIGN_SECTOR(writer->written_size + size - writer->erased_size);
+
+        err = esp_partition_erase_range(g_store->partition, writer->entry.offset + writer->erased_size, erase_size);
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+        MDF_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_partition_erase_range", mdf_err_to_name(err));
+        writer->erased_size += erase_size;
+    }
+
+    err = esp_partition_write(g_store->partition, writer->entry.offset + writer->written_size, data, size);
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+    MDF_ERROR_GOTO(err != ESP_OK, EXIT, "<%s> esp_partition_write", mdf_err_to_name(err));
+
+    writer->written_size += size;
+    ret = MDF_OK;
+
+EXIT:
+    mupgrade_store_unlock();
+    return ret;
+}
+
+mdf_err_t mupgrade_store_finish(void)
+{
+    MDF_ERROR_CHECK(!g_store, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT, "mupgrade_store_begin");
+
+    mdf_err_t ret                   = MDF_OK;
+    mupgrade_store_writer_t *writer = NULL;
+    mupgrade_store_entry_t *entry   = NULL;
+    mupgrade_manifest_t *manifest   = NULL;
+    size_t manifest_size            = 0;
+    uint8_t sha256[32]              = {0};
+    int duplicate                   = -1;
+    int i                           = 0;
+
+    /**< The lock is held until the writer is freed, its extent stays reserved while it is hashed */
+    ret = mupgrade_store_lock();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_lock");
+
+    writer = g_store->writer;
+    ret    = MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT;
+    MDF_ERROR_GOTO(!writer, EXIT, "mupgrade_store_begin");
+    entry  = &writer->entry;
+
+    ret = MDF_ERR_MUPGRADE_FIRMWARE_INCOMPLETE;
+    MDF_ERROR_GOTO(writer->written_size != entry->size, EXIT, "The image is incomplete, written_size: %d",
+                   writer->written_size);
+
+    if (!writer->duplicate) {
+        /**< The image is hashed back from flash, what is sent is what was checked */
+        manifest = MDF_MALLOC(MUPGRADE_MANIFEST_MAX_SIZE);
+        ret      = MDF_ERR_NO_MEM;
+        MDF_ERROR_GOTO(!manifest, EXIT, "");
+
+        ret = mupgrade_manifest_build(g_store->partition, entry->offset, entry->size, entry->packet_size,
+                                      sha256, manifest, &manifest_size);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_manifest_build");
+
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        MDF_ERROR_GOTO(writer->sha256_expected && memcmp(sha256, entry->sha256, sizeof(sha256)), EXIT,
+                       "The sha256 of the firmware does not match the expected digest");
+
+        memcpy(entry->sha256, sha256, sizeof(entry->sha256));
+        entry->manifest_size = manifest_size;
+
+        ret = esp_partition_write(g_store->partition, entry->offset + entry->size, manifest, manifest_size);
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_partition_write", mdf_err_to_name(ret));
+    }
+
+    /**< Uploaded without its digest, the content may be stored already, the new extent is left free */
+    duplicate = writer->duplicate ? -1 : mupgrade_store_find_sha256(entry->sha256);
+
+    if (duplicate >= 0) {
+        entry->offset        = g_store->index.entry[duplicate].offset;
+        entry->manifest_size = g_store->index.entry[duplicate].manifest_size;
+    }
+
+    /**< A new upload of the same name and version replaces the previous one */
+    for (i = 0; i < g_store->index.entry_num; ++i) {
+        if (mupgrade_store_entry_match(g_store->index.entry + i, entry->name, entry->version)) {
+            break;
+        }
+    }
+
+    if (i < g_store->index.entry_num && g_store->busy[i]) {
+        ret = MDF_ERR_NOT_SUPPORTED;
+        MDF_LOGW("The image replaced is being sent, name: %s, version: %s", entry->name, entry->version);
+    } else if (i == CONFIG_MUPGRADE_STORE_IMAGE_MAX_NUM) {
+        ret = MDF_ERR_MUPGRADE_FIRMWARE_PARTITION;
+        MDF_LOGW("The firmware store is full, images: %d", g_store->index.entry_num);
+    } else {
+        memcpy(g_store->index.entry + i, entry, sizeof(mupgrade_store_entry_t));
+        g_store->index.entry_num = MAX(g_store->index.entry_num, i + 1);
+        ret = mupgrade_store_index_save();
+    }
+
+    MDF_LOGI("Store the firmware, name: %s, version: %s, size: %d, offset: 0x%x, ret: %s",
+             entry->name, entry->version, entry->size, entry->offset, mdf_err_to_name(ret));
+
+EXIT:
+    MDF_FREE(manifest);
+    MDF_FREE(g_store->writer);
+    mupgrade_store_unlock();
+    return ret;
+}
+
+mdf_err_t mupgrade_store_open(const char *name, const char *version, mupgrade_store_entry_t *entry)
+{
+    MDF_PARAM_CHECK(name);
+    MDF_PARAM_CHECK(entry);
+
+    mdf_err_t ret = mupgrade_store_lock();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_lock");
+
+    ret = MDF_ERR_NOT_FOUND;
+
+    for (int i = 0; i < g_store->index.entry_num; ++i) {
+        if (mupgrade_store_entry_match(g_store->index.entry + i, name, version)) {
+            memcpy(entry, g_store->index.entry + i, sizeof(mupgrade_store_entry_t));
+            g_store->busy[i]++;
+            ret = MDF_OK;
+            break;
+        }
+    }
+
+    mupgrade_store_unlock();
+    return ret;
+}
+
+mdf_err_t mupgrade_store_close(const mupgrade_store_entry_t *entry)
+{
+    MDF_PARAM_CHECK(entry);
+
+    mdf_err_t ret = mupgrade_store_lock();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_lock");
+
+    ret = MDF_ERR_NOT_FOUND;
+
+    for (int i = 0; i < g_store->index.entry_num; ++i) {
+        if (mupgrade_store_entry_match(g_store->index.entry + i, entry->name, entry->version)
+                && g_store->busy[i]) {
+            g_store->busy[i]--;
+            ret = MDF_OK;
+            break;
+        }
+    }
+
+    mupgrade_store_unlock();
+    return ret;
+}
+
+mdf_err_t mupgrade_store_delete(const char *name, const char *version)
+{
+    MDF_PARAM_CHECK(name);
+    MDF_PARAM_CHECK(version);
+
+    mdf_err_t ret = mupgrade_store_lock();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_lock");
+
+    ret = MDF_ERR_NOT_FOUND;
+
+    for (int i = 0; i < g_store->index.entry_num; ++i) {
+        if (!mupgrade_store_entry_match(g_store->index.entry + i, name, version)) {
+            continue;
+        }
+
+        if (g_store->busy[i]) {
+            ret = MDF_ERR_NOT_SUPPORTED;
+            MDF_LOGW("The image is being sent, name: %s, version: %s", name, version);
+            break;
+        }
+
+        /**< Only the index is updated, the extent is erased when it is reused */
+        g_store->index.entry_num--;
+        memmove(g_store->index.entry + i, g_store->index.entry + i + 1,
+                (g_store->index.entry_num - i) * sizeof(mupgrade_store_entry_t));
+        memmove(g_store->busy + i, g_store->busy + i + 1, g_store->index.entry_num - i);
+        g_store->busy[g_store->index.entry_num] = 0;
+
+        ret = mupgrade_store_index_save();
+        break;
+    }
+
+    mupgrade_store_unlock();
+    return ret;
+}
+
+mdf_err_t mupgrade_store_list(mupgrade_store_entry_t *entries, size_t *num)
+{
+    MDF_PARAM_CHECK(entries);
+    MDF_PARAM_CHECK(num);
+
+    mdf_err_t ret = mupgrade_store_lock();
+    MDF_ERROR_CHECK(ret != MDF_OK, ret, "mupgrade_store_lock");
+
+    *num = MIN(*num, g_store->index.entry_num);
+    memcpy(entries, g_store->index.entry, *num * sizeof(mupgrade_store_entry_t));
+
+    mupgrade_store_unlock();
+    return MDF_OK;
+}
+
+const esp_partition_t *mupgrade_store_partition(void)
+{
+    if (mupgrade_store_lock() != MDF_OK) {
+        return NULL;
+    }
+
+    mupgrade_store_unlock();
+    return g_store->partition;
+}
@@ -0,0 +1,478 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mbedtls/sha256.h"
+
+#include "mdf_common.h"
+#include "mupgrade_priv.h"
+
+#define MUPGRADE_BLOCK_NONE       (0xFFFF)
+#define MUPGRADE_VERIFY_READ_SIZE (256) /**< Read back in small chunks, no buffer is allocated */
+
+/**
+ * @brief Hashes of the firmware computed by the root while it is downloaded
+ */
+typedef struct {
+    mbedtls_sha256_context image_ctx;
+    mbedtls_sha256_context block_ctx;
+    size_t block_size;            /**< Length of a block */
+    size_t block_written;         /**< Length of the current block hashed */
+    bool finished;
+    bool sha256_expected;
+    uint8_t sha256[32];           /**< Expected digest of the firmware */
+    mupgrade_manifest_t *manifest;
+} mupgrade_manifest_builder_t;
+
+/**
+ * @brief Manifest received by the node and the block hashed as its packets arrive in order
+ */
+typedef struct {
+    mupgrade_manifest_t *manifest;
+    size_t manifest_size;
+    uint64_t verified;            /**< Blocks that match the manifest */
+    mbedtls_sha256_context block_ctx;
+    uint16_t block;               /**< Block hashed in order, MUPGRADE_BLOCK_NONE if none */
+    uint16_t block_next_seq;      /**< Next packet of the block expected in order */
+} mupgrade_verify_t;
+
+static const char *TAG = "mupgrade_verify";
+static mupgrade_manifest_builder_t *g_manifest_builder = NULL;
+static mupgrade_verify_t *g_verify                     = NULL;
+
+static void mupgrade_manifest_builder_free(mupgrade_manifest_builder_t *builder)
+{
+    if (!builder) {
+        return;
+    }
+
+    mbedtls_sha256_free(&builder->image_ctx);
+    mbedtls_sha256_free(&builder->block_ctx);
+    MDF_FREE(builder->manifest);
+    MDF_FREE(builder);
+}
+
+static mupgrade_manifest_builder_t *mupgrade_manifest_builder_create(const uint8_t sha256[32], uint16_t packet_size)
+{
+    mupgrade_manifest_builder_t *builder = MDF_CALLOC(1, sizeof(mupgrade_manifest_builder_t));
+
+    if (!builder) {
+        return NULL;
+    }
+
+    builder->manifest = MDF_CALLOC(1, MUPGRADE_MANIFEST_MAX_SIZE);
+
+    if (!builder->manifest) {
+        MDF_FREE(builder);
+        return NULL;
+    }
+
+    builder->block_size = MUPGRADE_MANIFEST_BLOCK_PACKETS * packet_size;
+    builder->manifest->block_packets = MUPGRADE_MANIFEST_BLOCK_PACKETS;
+
+    if (sha256) {
+        builder->sha256_expected = true;
+        memcpy(builder->sha256, sha256, sizeof(builder->sha256));
+    }
+
+    mbedtls_sha256_init(&builder->image_ctx);
+    mbedtls_sha256_init(&builder->block_ctx);
+    mbedtls_sha256_starts_ret(&builder->image_ctx, 0);
+    mbedtls_sha256_starts_ret(&builder->block_ctx, 0);
+
+    return builder;
+}
+
+static void mupgrade_manifest_block_finish(mupgrade_manifest_builder_t *builder)
+{
+    mupgrade_manifest_t *manifest = builder->manifest;
+    uint8_t sha256[32]            = {0};
+
+    mbedtls_sha256_finish_ret(&builder->block_ctx, sha256);
+    memcpy(manifest->block_sha256 + manifest->block_num * MUPGRADE_MANIFEST_HASH_SIZE,
+           sha256, MUPGRADE_MANIFEST_HASH_SIZE);
+    manifest->block_num++;
+
+    builder->block_written = 0;
+    mbedtls_sha256_starts_ret(&builder->block_ctx, 0);
+}
+
+static mdf_err_t mupgrade_manifest_hash(mupgrade_manifest_builder_t *builder, const void *data, size_t size)
+{
+    const uint8_t *block_data = (const uint8_t *)data;
+
+    mbedtls_sha256_update_ret(&builder->image_ctx, data, size);
+
+    for (size_t block_size = 0; size > 0; block_data += block_size, size -= block_size) {
+        MDF_ERROR_CHECK(builder->manifest->block_num >= MUPGRADE_MANIFEST_BLOCK_MAX_NUM,
+                        MDF_ERR_INVALID_SIZE, "The firmware has too many blocks");
+
+        block_size = MIN(size, builder->block_size - builder->block_written);
+        mbedtls_sha256_update_ret(&builder->block_ctx, block_data, block_size);
+        builder->block_written += block_size;
+
+        if (builder->block_written == builder->block_size) {
+            mupgrade_manifest_block_finish(builder);
+        }
+    }
+
+    return MDF_OK;
+}
+
+/**
+ * @brief Hash the last block, sha256 is set to the digest of the whole firmware
+ */
+static mdf_err_t mupgrade_manifest_hash_finish(mupgrade_manifest_builder_t *builder, uint8_t sha256[32])
+{
+    if (builder->block_written > 0) {
+        mupgrade_manifest_block_finish(builder);
+    }
+
+    mbedtls_sha256_finish_ret(&builder->image_ctx, sha256);
+    builder->finished = true;
+
+    if (builder->sha256_expected && memcmp(sha256, builder->sha256, sizeof(builder->sha256))) {
+        MDF_LOGW("The sha256 of the firmware does not match the expected digest");
+        return MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+    }
+
+    MDF_LOGD("Manifest, block_num: %d, sha256 checked: %d", builder->manifest->block_num,
+             builder->sha256_expected);
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_manifest_init(const uint8_t sha256[32], uint16_t packet_size)
+{
+    MDF_PARAM_CHECK(packet_size);
+
+    mupgrade_manifest_builder_free(g_manifest_builder);
+
+    g_manifest_builder = mupgrade_manifest_builder_create(sha256, packet_size);
+    MDF_ERROR_CHECK(!g_manifest_builder, MDF_ERR_NO_MEM, "");
+
+    return MDF_OK;
+}
+
+mdf_err_t mupgrade_manifest_update(const void *data, size_t size)
+{
+    MDF_PARAM_CHECK(data);
+    MDF_ERROR_CHECK(!g_manifest_builder || g_manifest_builder->finished, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT,
+                    "mupgrade_manifest_init");
+
+    return mupgrade_manifest_hash(g_manifest_builder, data, size);
+}
+
+mdf_err_t mupgrade_manifest_finish(void)
+{
+    MDF_ERROR_CHECK(!g_manifest_builder, MDF_ERR_MUPGRADE_FIRMWARE_NOT_INIT, "mupgrade_manifest_init");
+
+    mdf_err_t ret      = MDF_OK;
+    uint8_t sha256[32] = {0};
+
+    if (g_manifest_builder->finished) {
+        return MDF_OK;
+    }
+
+    ret = mupgrade_manifest_hash_finish(g_manifest_builder, sha256);
+
+    if (ret != MDF_OK) {
+        mupgrade_manifest_builder_free(g_manifest_builder);
+        g_manifest_builder = NULL;
+    }
+
+    return ret;
+}
+
+const mupgrade_manifest_t *mupgrade_manifest_get(size_t *size)
+{
+    if (!g_manifest_builder || !g_manifest_builder->finished) {
+        return NULL;
+    }
+
+    if (size) {
+        *size = sizeof(mupgrade_manifest_t) + g_manifest_builder->manifest->block_num * MUPGRADE_MANIFEST_HASH_SIZE;
+    }
+
+    return g_manifest_builder->manifest;
+}
+
+mdf_err_t mupgrade_manifest_build(const esp_partition_t *partition, size_t offset, size_t size,
+                                  uint16_t packet_size, uint8_t sha256[32],
+                                  mupgrade_manifest_t *manifest, size_t *manifest_size)
+{
+    MDF_PARAM_CHECK(partition);
+    MDF_PARAM_CHECK(size);
+    MDF_PARAM_CHECK(packet_size);
+    MDF_PARAM_CHECK(sha256);
+    MDF_PARAM_CHECK(manifest);
+    MDF_PARAM_CHECK(manifest_size);
+
+    mdf_err_t ret                        = MDF_OK;
+    mupgrade_manifest_builder_t *builder = mupgrade_manifest_builder_create(NULL, packet_size);
+    uint8_t *data                        = MDF_MALLOC(SPI_FLASH_SEC_SIZE);
+
+    MDF_ERROR_GOTO(!builder || !data, EXIT, "");
+
+    for (size_t read_size = 0; read_size < size; read_size += SPI_FLASH_SEC_SIZE) {
+        size_t data_size = MIN(size - read_size, SPI_FLASH_SEC_SIZE);
+
+        ret = esp_partition_read(partition, offset + read_size, data, data_size);
+        MDF_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+        ret = mupgrade_manifest_hash(builder, data, data_size);
+        MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_manifest_hash");
+    }
+
+    ret = mupgrade_manifest_hash_finish(builder, sha256);
+    MDF_ERROR_GOTO(ret != MDF_OK, EXIT, "mupgrade_manifest_hash_finish");
+
+    *manifest_size = sizeof(mupgrade_manifest_t) + builder->manifest->block_num * MUPGRADE_MANIFEST_HASH_SIZE;
+    memcpy(manifest, builder->manifest, *manifest_size);
+
+EXIT:
+
+    if (!builder || !data) {
+        ret = MDF_ERR_NO_MEM;
+    }
+
+    mupgrade_manifest_builder_free(builder);
+    MDF_FREE(data);
+    return ret;
+}
+
+void mupgrade_verify_deinit(void)
+{
+    if (!g_verify) {
+        return;
+    }
+
+    mbedtls_sha256_free(&g_verify->block_ctx);
+    MDF_FREE(g_verify->manifest);
+    MDF_FREE(g_verify);
+}
+
+mdf_err_t mupgrade_verify_init(const mupgrade_manifest_t *manifest, size_t size)
+{
+    MDF_PARAM_CHECK(manifest);
+    MDF_PARAM_CHECK(size >= sizeof(mupgrade_manifest_t));
+    MDF_ERROR_CHECK(!manifest->block_packets || manifest->block_num > MUPGRADE_MANIFEST_BLOCK_MAX_NUM
+                    || size < sizeof(mupgrade_manifest_t) + manifest->block_num * MUPGRADE_MANIFEST_HASH_SIZE,
+                    MDF_ERR_INVALID_ARG, "Invalid manifest, block_packets: %d, block_num: %d",
+                    manifest->block_packets, manifest->block_num);
+
+    size = sizeof(mupgrade_manifest_t) + manifest->block_num * MUPGRADE_MANIFEST_HASH_SIZE;
+
+    /**< The status is requested before every pass, keep the blocks already checked */
+    if (g_verify && g_verify->manifest_size == size && !memcmp(g_verify->manifest, manifest, size)) {
+        return MDF_OK;
+    }
+
+    mupgrade_verify_deinit();
+
+    g_verify = MDF_CALLOC(1, sizeof(mupgrade_verify_t));
+    MDF_ERROR_CHECK(!g_verify, MDF_ERR_NO_MEM, "");
+
+    g_verify->manifest = MDF_MALLOC(size);
+
+    if (!g_verify->manifest) {
+        MDF_FREE(g_verify);
+        return MDF_ERR_NO_MEM;
+    }
+
+    memcpy(g_verify->manifest, manifest, size);
+    g_verify->manifest_size = size;
+    g_verify->block         = MUPGRADE_BLOCK_NONE;
+    mbedtls_sha256_init(&g_verify->block_ctx);
+
+    return MDF_OK;
+}
+
+static uint16_t mupgrade_packet_length(const mupgrade_status_t *status, uint16_t seq)
+{
+    size_t offset = seq * status->packet_size;
+    return MIN(status->total_size - offset, status->packet_size);
+}
+
+static bool mupgrade_block_is_complete(const mupgrade_status_t *status, uint16_t block)
+{
+    uint16_t packet_num = (status->total_size + status->packet_size - 1) / status->packet_size;
+    uint16_t start_seq  = block * g_verify->manifest->block_packets;
+    uint16_t end_seq    = MIN(start_seq + g_verify->manifest->block_packets, packet_num);
+
+    for (uint16_t i = start_seq; i < end_seq; ++i) {
+        if (!MUPGRADE_GET_BITS(status->progress_array, i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Erase the sectors of a block that does not match, flash writes only clear bits so
+ *        its packets can not be written again in place. The packets sharing these sectors
+ *        with the neighbouring blocks are dropped as well.
+ */
+static mdf_err_t mupgrade_verify_drop(mupgrade_status_t *status, const esp_partition_t *partition,
+                                      size_t image_offset, uint16_t start_seq, uint16_t end_seq)
+{
+    mdf_err_t ret       = MDF_OK;
+    uint16_t packet_num = (status->total_size + status->packet_size - 1) / status->packet_size;
+    size_t erase_start  = (start_seq * status->packet_size) & ~(SPI_FLASH_SEC_SIZE - 1);
+    size_t erase_end    = MUPGRADE_ALIGN_SECTOR(MIN(end_seq * status->packet_size, status->total_size));
+
+    start_seq = erase_start / status->packet_size;
+    end_seq   = MIN((erase_end + status->packet_size - 1) / status->packet_size, packet_num);
+
+    MDF_LOGW("Drop the packets of the block, seq: %d - %d", start_seq, end_seq - 1);
+
+    for (uint16_t i = start_seq; i < end_seq; ++i) {
+        if (MUPGRADE_GET_BITS(status->progress_array, i)) {
+            status->progress_array[i >> 0x3] &= ~(1 << (i & 0x7));
+            status->written_size -= mupgrade_packet_length(status, i);
+        }
+
+        g_verify->verified &= ~(1ULL << (i / g_verify->manifest->block_packets));
+    }
+
+    g_verify->block = MUPGRADE_BLOCK_NONE;
+
+    ret = esp_partition_erase_range(partition, image_offset + erase_start, erase_end - erase_start);
+    MDF_ERROR_CHECK(ret != ESP_OK, MDF_ERR_MUPGRADE_FIRMWARE_PARTITION,
+                    "<%s> esp_partition_erase_range", mdf_err_to_name(ret));
+
+    return MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+}
+
+/**
+ * @brief Compare a complete block with the manifest, the block is read back from flash
+ *        unless all of its packets were hashed as they arrived
+ */
+static mdf_err_t mupgrade_verify_block(mupgrade_status_t *status, const esp_partition_t *partition,
+                                       size_t image_offset, uint16_t block)
+{
+    mdf_err_t ret       = MDF_OK;
+    uint16_t packet_num = (status->total_size + status->packet_size - 1) / status->packet_size;
+    uint16_t start_seq  = block * g_verify->manifest->block_packets;
+    uint16_t end_seq    = MIN(start_seq + g_verify->manifest->block_packets, packet_num);
+    uint8_t sha256[32]  = {0};
+
+    if (g_verify->block == block && g_verify->block_next_seq == end_seq) {
+        mbedtls_sha256_finish_ret(&g_verify->block_ctx, sha256);
+        g_verify->block = MUPGRADE_BLOCK_NONE;
+    } else {
+        uint8_t buffer[MUPGRADE_VERIFY_READ_SIZE];
+        size_t offset = start_seq * status->packet_size;
+        size_t end    = MIN(end_seq * status->packet_size, status->total_size);
+        mbedtls_sha256_context ctx;
+
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts_ret(&ctx, 0);
+
+        for (size_t length = 0; offset < end; offset += length) {
+            length = MIN(end - offset, sizeof(buffer));
+            ret    = esp_partition_read(partition, image_offset + offset, buffer, length);
+            MDF_ERROR_BREAK(ret != ESP_OK, "<%s> esp_partition_read", mdf_err_to_name(ret));
+
+            mbedtls_sha256_update_ret(&ctx, buffer, length);
+        }
+
+        mbedtls_sha256_finish_ret(&ctx, sha256);
+        mbedtls_sha256_free(&ctx);
+    }
+
+    if (ret == ESP_OK && !memcmp(sha256, g_verify->manifest->block_sha256 + block * MUPGRADE_MANIFEST_HASH_SIZE,
+                                 MUPGRADE_MANIFEST_HASH_SIZE)) {
+        g_verify->verified |= 1ULL << block;
+        return MDF_OK;
+    }
+
+    MDF_LOGW("The block does not match the manifest, block: %d", block);
+
+    return mupgrade_verify_drop(status, partition, image_offset, start_seq, end_seq);
+}
+
+mdf_err_t mupgrade_verify_write(mupgrade_status_t *status, const esp_partition_t *partition,
+                                size_t image_offset, uint16_t seq, const uint8_t *data)
+{
+    MDF_PARAM_CHECK(status);
+    MDF_PARAM_CHECK(partition);
+    MDF_PARAM_CHECK(data);
+
+    if (!g_verify) {
+        return MDF_OK;
+    }
+
+    uint16_t block     = seq / g_verify->manifest->block_packets;
+    uint16_t start_seq = block * g_verify->manifest->block_packets;
+
+    if (block >= g_verify->manifest->block_num) {
+        MDF_LOGW("The packet is not covered by the manifest, seq: %d", seq);
+        return MDF_OK;
+    }
+
+    /**< Hash the packets of a block while they arrive in order, the first pass sends them in order */
+    if (seq == start_seq) {
+        mbedtls_sha256_starts_ret(&g_verify->block_ctx, 0);
+        g_verify->block          = block;
+        g_verify->block_next_seq = start_seq;
+    }
+
+    if (g_verify->block == block && g_verify->block_next_seq == seq) {
+        mbedtls_sha256_update_ret(&g_verify->block_ctx, data, mupgrade_packet_length(status, seq));
+        g_verify->block_next_seq++;
+    } else if (g_verify->block == block) {
+        g_verify->block = MUPGRADE_BLOCK_NONE;
+    }
+
+    if (!mupgrade_block_is_complete(status, block)) {
+        return MDF_OK;
+    }
+
+    return mupgrade_verify_block(status, partition, image_offset, block);
+}
+
+bool mupgrade_verify_is_checked(uint16_t seq)
+{
+    if (!g_verify) {
+        return true;
+    }
+
+    uint16_t block = seq / g_verify->manifest->block_packets;
+
+    return block < g_verify->manifest->block_num && (g_verify->verified & (1ULL << block));
+}
+
+mdf_err_t mupgrade_verify_finish(mupgrade_status_t *status, const esp_partition_t *partition,
+                                 size_t image_offset)
+{
+    MDF_PARAM_CHECK(status);
+    MDF_PARAM_CHECK(partition);
+
+    mdf_err_t ret = MDF_OK;
+
+    if (!g_verify) {
+        return MDF_OK;
+    }
+
+    for (uint16_t block = 0; block < g_verify->manifest->block_num; ++block) {
+        /**< A block dropped with its neighbour is not complete any more */
+        if (!(g_verify->verified & (1ULL << block)) && mupgrade_block_is_complete(status, block)
+                && mupgrade_verify_block(status, partition, image_offset, block) != MDF_OK) {
+            ret = MDF_ERR_MUPGRADE_FIRMWARE_INVALID;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1 @@
+COMPONENT_PRIV_INCLUDEDIRS := ..
@@ -0,0 +1,105 @@
+// Copyright 2017 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "mdf_common.h"
+#include "mupgrade_priv.h"
+#include "unity.h"
+
+#define TEST_STATUS_PROGRESS_SIZE (MUPGRADE_PACKET_MAX_NUM / 8)
+
+static void test_status_legacy_fill(uint8_t *legacy_data, size_t written_size)
+{
+    mupgrade_status_t status = {
+        .type         = MUPGRADE_TYPE_STATUS,
+        .name         = "legacy_firmware",
+        .error_code   = MDF_OK,
+        .total_size   = 1024 * 1024,
+        .written_size = written_size,
+    };
+
+    memcpy(legacy_data, &status, MUPGRADE_STATUS_LEGACY_SIZE);
+}
+
+/**
+ * @brief A legacy node that is missing packets answers with its progress, 45 + 512 bytes.
+ *        The bitmap must land at progress_array and not be read as the fields added after written_size
+ */
+TEST_CASE("mupgrade_status_unpack legacy status with progress", "[mupgrade]")
+{
+    uint8_t legacy_data[MUPGRADE_STATUS_LEGACY_SIZE + TEST_STATUS_PROGRESS_SIZE] = {0};
+    uint8_t *legacy_progress  = legacy_data + MUPGRADE_STATUS_LEGACY_SIZE;
+    mupgrade_status_t *status = MDF_MALLOC(sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE);
+    TEST_ASSERT_NOT_NULL(status);
+
+    test_status_legacy_fill(legacy_data, 300 * MUPGRADE_LEGACY_PACKET_SIZE);
+
+    for (int i = 0; i < TEST_STATUS_PROGRESS_SIZE; ++i) {
+        legacy_progress[i] = i & 0xff;
+    }
+
+    TEST_ASSERT_EQUAL(557, sizeof(legacy_data));
+    TEST_ASSERT(MUPGRADE_STATUS_IS_LEGACY(sizeof(legacy_data)));
+    TEST_ASSERT_EQUAL(sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE,
+                      mupgrade_status_unpack(legacy_data, sizeof(legacy_data), NULL));
+    TEST_ASSERT_EQUAL(sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE,
+                      mupgrade_status_unpack(legacy_data, sizeof(legacy_data), status));
+
+    TEST_ASSERT_EQUAL(MUPGRADE_TYPE_STATUS, status->type);
+    TEST_ASSERT_EQUAL_STRING("legacy_firmware", status->name);
+    TEST_ASSERT_EQUAL(1024 * 1024, status->total_size);
+    TEST_ASSERT_EQUAL(300 * MUPGRADE_LEGACY_PACKET_SIZE, status->written_size);
+    TEST_ASSERT_EQUAL(0, status->version);
+    TEST_ASSERT_EQUAL(0, status->image_type);
+    TEST_ASSERT_EQUAL(0, status->image_size);
+    TEST_ASSERT_EQUAL(0, status->packet_size);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(legacy_progress, status->progress_array, TEST_STATUS_PROGRESS_SIZE);
+
+    MDF_FREE(status);
+}
+
+TEST_CASE("mupgrade_status_unpack legacy status without progress", "[mupgrade]")
+{
+    uint8_t legacy_data[MUPGRADE_STATUS_LEGACY_SIZE] = {0};
+    mupgrade_status_t status = {0};
+
+    test_status_legacy_fill(legacy_data, 0);
+
+    TEST_ASSERT_EQUAL(sizeof(mupgrade_status_t), mupgrade_status_unpack(legacy_data, sizeof(legacy_data), &status));
+    TEST_ASSERT_EQUAL_STRING("legacy_firmware", status.name);
+    TEST_ASSERT_EQUAL(0, status.written_size);
+    TEST_ASSERT_EQUAL(0, status.version);
+}
+
+TEST_CASE("mupgrade_status_unpack current status", "[mupgrade]")
+{
+    mupgrade_status_t *data   = MDF_CALLOC(1, sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE);
+    mupgrade_status_t *status = MDF_CALLOC(1, sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE);
+    TEST_ASSERT(data && status);
+
+    data->type        = MUPGRADE_TYPE_STATUS;
+    data->version     = MUPGRADE_STATUS_VERSION;
+    data->packet_size = MUPGRADE_PACKET_MAX_SIZE;
+    strcpy(data->name, "firmware");
+    memset(data->progress_array, 0x5a, TEST_STATUS_PROGRESS_SIZE);
+
+    TEST_ASSERT_FALSE(MUPGRADE_STATUS_IS_LEGACY(sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE));
+    TEST_ASSERT_EQUAL(sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE,
+                      mupgrade_status_unpack(data, sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE, status));
+    TEST_ASSERT_EQUAL_MEMORY(data, status, sizeof(mupgrade_status_t) + TEST_STATUS_PROGRESS_SIZE);
+
+    MDF_FREE(data);
+    MDF_FREE(status);
+}
@@ -32,6 +32,17 @@ typedef struct {
     mwifi_data_type_t type;           /**< The type of data */
 } __attribute__((packed)) mwifi_data_head_t;
 
+/**
+ * @brief Trace of a packet for tools/mdebug_trace.py, prev is the magic of the packet forwarded
+ */
+#ifdef CONFIG_MWIFI_TRACE
+#define MWIFI_TRACE(event, magic, prev, addr, size) \
+    MDF_LOGI("trace %s, magic: %08x, prev: %08x, addr: " MACSTR ", size: %d, tsf: %lld", \
+             event, magic, prev, MAC2STR(addr), size, esp_mesh_get_tsf_time())
+#else
+#define MWIFI_TRACE(event, magic, prev, addr, size)
+#endif /**< CONFIG_MWIFI_TRACE */
+
 static const char *TAG           = "mwifi";
 static bool g_mwifi_inited_flag  = false;
 static bool mwifi_connected_flag = false;
@@ -663,6 +674,7 @@ static mdf_err_t mwifi_subcontract_write(const mesh_addr_t *dest_addr, const mes
     static SemaphoreHandle_t s_mwifi_send_lock = NULL;
     mwifi_data_head_t *data_head = (mwifi_data_head_t *)opt->val;
     mesh_data_t mesh_data        = {0x0};
+    uint32_t prev_magic          = data_head->magic;
     data_head->total_size_hight  = data->size >> 12;
     data_head->total_size_low    = data->size & 0xfff;
     data_head->packet_seq        = 0;
@@ -694,6 +706,7 @@ static mdf_err_t mwifi_subcontract_write(const mesh_addr_t *dest_addr, const mes
             ret = esp_mesh_send(dest_addr, &mesh_data, flag, opt, 1);
 
             if (ret == ESP_ERR_MESH_NO_MEMORY) {
+                MDF_METRICS_INC(MDF_METRICS_MWIFI_NO_MEMORY_RETRY);
                 MDF_LOGW("<%s> esp_mesh_send", mdf_err_to_name(ret));
                 vTaskDelay(100 / portTICK_PERIOD_MS);
             }
@@ -701,6 +714,13 @@ static mdf_err_t mwifi_subcontract_write(const mesh_addr_t *dest_addr, const mes
 
         /**< ESP-WIFI-MESH send completed, release send lock */
         xSemaphoreGive(s_mwifi_send_lock);
+
+        if (ret == ESP_OK) {
+            MDF_METRICS_INC(MDF_METRICS_MWIFI_FRAGMENT_SEND);
+        } else {
+            MDF_METRICS_INC(MDF_METRICS_MWIFI_SEND_FAIL);
+        }
+
         MDF_ERROR_CHECK(ret != ESP_OK && !(flag & MESH_DATA_GROUP && ret == ESP_ERR_MESH_DISCARD), ret,
                         "Node failed to send packets, dest_addr: " MACSTR
                         ", flag: 0x%02x, opt->type: 0x%02x, opt->len: %d, data->tos: %d, data: %p, size: %d",
@@ -710,6 +730,12 @@ static mdf_err_t mwifi_subcontract_write(const mesh_addr_t *dest_addr, const mes
         mesh_data.data += MWIFI_PAYLOAD_LEN;
     }
 
+    /**< The packet is known by the magic of its last fragment, as the receiver keeps it */
+    MWIFI_TRACE("tx", data_head->magic, prev_magic, dest_addr->addr, data->size);
+
+    /**< A packet forwarded to several destinations keeps the magic it was received with */
+    data_head->magic = prev_magic;
+
     return MDF_OK;
 }
 
@@ -856,6 +882,7 @@ mdf_err_t mwifi_write(const uint8_t *dest_addrs, const mwifi_data_type_t *data_t
     uint8_t addr_any[]     = MWIFI_ADDR_ANY;
     uint8_t addr_broadcast[] = MWIFI_ADDR_BROADCAST;
     uint8_t self_addr[MWIFI_ADDR_LEN] = {0};
+    int64_t start_time     = MDF_METRICS_TIME();
 
     /**
      * @brief  If the destination address is NULL, it is received by the mwifi_root_read of the root node.
@@ -960,6 +987,7 @@ mdf_err_t mwifi_write(const uint8_t *dest_addrs, const mwifi_data_type_t *data_t
                    mdf_err_to_name(ret), data_flag, MAC2STR(dest_addrs));
 
 EXIT:
+    MDF_METRICS_OBSERVE(MDF_METRICS_MWIFI_WRITE_US, start_time);
     MDF_FREE(compress_data);
     return ret;
 }
@@ -1026,10 +1054,13 @@ mdf_err_t __mwifi_read(uint8_t *src_addr, mwifi_data_type_t *data_type,
                 goto EXIT;
             }
 
+            MDF_METRICS_INC(MDF_METRICS_MWIFI_FRAGMENT_RECV);
+
             /**
              * @brief Discard this packet if there is a packet loss in the middle
              */
             if (data_head.packet_seq != expect_seq) {
+                MDF_METRICS_INC(MDF_METRICS_MWIFI_REASSEMBLY_DROP);
                 MDF_LOGW("Part of the packet is lost, expect_seq: %d, recv_seq: %d",
                          expect_seq, data_head.packet_seq);
 
@@ -1047,6 +1078,7 @@ mdf_err_t __mwifi_read(uint8_t *src_addr, mwifi_data_type_t *data_type,
              * @brief Filter retransmitted packets
              */
             if (data_head.magic == s_data_magic) {
+                MDF_METRICS_INC(MDF_METRICS_MWIFI_DUPLICATE);
                 expect_seq--;
                 MDF_LOGD("Received duplicate packets, sequence: %d", s_data_magic);
                 continue;
@@ -1058,6 +1090,8 @@ mdf_err_t __mwifi_read(uint8_t *src_addr, mwifi_data_type_t *data_type,
             recv_data    = MDF_REALLOC_RETRY(recv_data, total_size);
         }
 
+        MWIFI_TRACE("rx", data_head.magic, 0, src_addr, recv_size);
+
         self_data_flag = data_head.transmit_self;
         mesh_data.data = recv_data;
         mesh_data.size = recv_size;
@@ -1350,11 +1384,13 @@ mdf_err_t __mwifi_root_read(uint8_t *src_addr, mwifi_data_type_t *data_type,
         }
 
         MDF_ERROR_GOTO(ret != ESP_OK || mesh_data.size <= 0, EXIT, "<%s> Node failed to receive packets", mdf_err_to_name(ret));
+        MDF_METRICS_INC(MDF_METRICS_MWIFI_FRAGMENT_RECV);
 
         /**
          * @brief Discard this packet if there is a packet loss in the middle
          */
         if (data_head.packet_seq != expect_seq) {
+            MDF_METRICS_INC(MDF_METRICS_MWIFI_REASSEMBLY_DROP);
             MDF_LOGW("Part of the packet is lost, expect_seq: %d, recv_seq: %d",
                      expect_seq, data_head.packet_seq);
 
@@ -1373,6 +1409,8 @@ mdf_err_t __mwifi_root_read(uint8_t *src_addr, mwifi_data_type_t *data_type,
         recv_data  = MDF_REALLOC_RETRY(recv_data, total_size);
     }
 
+    MWIFI_TRACE("rx", data_head.magic, 0, src_addr, recv_size);
+
     memcpy(data_type, &data_head.type, sizeof(mwifi_data_type_t));
 
     if (data_type->compression) {
@@ -20,9 +20,12 @@
 #define PROGMEM
 #include "mdebug_espnow.h"
 #include "mdebug_console.h"
+#include "mdebug_coredump.h"
+#include "mdebug_log.h"
 #include "mdebug_espnow.h"
 
 #define MDEBUG_LOG_MAX_SIZE 1460
+#define MDEBUG_RECV_MAX_SIZE (sizeof(mdebug_log_batch_t) + MDEBUG_LOG_BATCH_MAX_SIZE)
 
 typedef struct log_record_ {
     size_t total;
@@ -96,6 +99,35 @@ static esp_err_t log_analysis(const uint8_t *mac, const uint8_t *data)
     return ESP_OK;
 }
 
+/**
+ * @brief Handle a log received, the binary logs are printed as the "log -r"
+ *        command does to be decoded by tools/mdebug_log_decode.py
+ */
+static void log_recv(const uint8_t *mac, const uint8_t *data, size_t size)
+{
+    if (size && data[0] == MDEBUG_LOG_BINARY_MARKER) {
+        uint8_t *b64_buf = base64_encode(data, size, NULL);
+        printf("[" MACSTR "] mdebug_log_data: %s\n", MAC2STR(mac), b64_buf);
+        free(b64_buf);
+        return;
+    }
+
+    /**< The line break is already printed with the text */
+    if (size && data[size - 1] == '\n') {
+        size--;
+    }
+
+    printf("[" MACSTR "] %.*s\n", MAC2STR(mac), (int)size, data);
+
+    /**< log_analysis() reads up to the end of the string */
+    char *log = strndup((char *)data, size);
+
+    if (log) {
+        log_analysis(mac, (uint8_t *)log);
+        free(log);
+    }
+}
+
 void print_system_info_timercb(void *timer)
 {
     char *buffer = NULL;
@@ -117,13 +149,14 @@ void print_system_info_timercb(void *timer)
 static void espnow_recv_task(void *arg)
 {
     uint8_t src_addr[6]  = { 0 };
-    uint8_t *recv_data   = (uint8_t *)malloc(MDEBUG_LOG_MAX_SIZE);
-    size_t recv_size     = MDEBUG_LOG_MAX_SIZE;
+    uint8_t *recv_data   = (uint8_t *)malloc(MDEBUG_RECV_MAX_SIZE);
+    uint8_t *logs        = (uint8_t *)malloc(MDEBUG_LOG_BATCH_MAX_SIZE);
+    size_t recv_size     = MDEBUG_RECV_MAX_SIZE;
     mdebug_espnow_t type = MDEBUG_ESPNOW_COREDUMP;
 
     for (;;) {
-        recv_size = MDEBUG_LOG_MAX_SIZE;
-        memset(recv_data, 0, MDEBUG_LOG_MAX_SIZE);
+        recv_size = MDEBUG_RECV_MAX_SIZE;
+        memset(recv_data, 0, MDEBUG_RECV_MAX_SIZE);
 
         /**
          * @brief read data from controller
@@ -135,6 +168,24 @@ static void espnow_recv_task(void *arg)
                     static uint8_t expect_addr[6] = {0};
                     static size_t written_size = 0;
 
+                    /**< Compressed core dump, reassembled from the serial log by tools/mdebug_coredump.py */
+                    if (recv_data[0] >= MDEBUG_COREDUMP_STREAM_BEGIN) {
+                        bool finished = false;
+                        log_record_t *log_record = NULL;
+
+                        mdebug_coredump_recv(src_addr, recv_data, recv_size, &finished);
+
+                        SLIST_FOREACH(log_record, &s_log_record_list, next) {
+                            if (finished && !memcmp(log_record->mac, src_addr, 6)) {
+                                log_record->coredump++;
+                                break;
+                            }
+                        }
+
+                        break;
+                    }
+
+                    /**< Core dump sent by the previous firmware */
                     mdebug_coredump_packet_t *packet = (mdebug_coredump_packet_t *)recv_data;
                     MDF_ERROR_BREAK(packet->size <= 0, "Core dump length: %d Bytes", packet->size);
                     MDF_LOGV("Core dump, %d, length: %d, seq: %d", packet->type, packet->size, packet->seq);
@@ -212,10 +263,30 @@ static void espnow_recv_task(void *arg)
                     break;
                 }
 
-                case MDEBUG_ESPNOW_LOG: {
-                    printf("[" MACSTR "] %.*s\n", MAC2STR(src_addr), recv_size, recv_data);
-                    log_analysis(src_addr, recv_data);
+                case MDEBUG_ESPNOW_LOG:
+                    log_recv(src_addr, recv_data, recv_size);
+                    break;
+
+                case MDEBUG_ESPNOW_LOG_BATCH: {
+                    size_t logs_size = MDEBUG_LOG_BATCH_MAX_SIZE;
+                    MDF_ERROR_BREAK(mdebug_log_batch_unpack((mdebug_log_batch_t *)recv_data, recv_size,
+                                                            logs, &logs_size) != MDF_OK,
+                                    "mdebug_log_batch_unpack, seq: %d", ((mdebug_log_batch_t *)recv_data)->seq);
+
+                    /**< A batch is the logs one after the other, a binary log ends the text before it */
+                    for (size_t offset = 0, size = 0; offset < logs_size; offset += size) {
+                        size = mdebug_log_next_size(logs + offset, logs_size - offset);
+                        log_recv(src_addr, logs + offset, size);
+                    }
+
+                    break;
+                }
 
+                /**< Decoded by tools/mdf_metrics.py */
+                case MDEBUG_ESPNOW_METRICS: {
+                    uint8_t *b64_buf = base64_encode(recv_data, recv_size, NULL);
+                    printf("[" MACSTR "] mdf_metrics: %s\n", MAC2STR(src_addr), b64_buf);
+                    free(b64_buf);
                     break;
                 }
 
@@ -226,6 +297,7 @@ static void espnow_recv_task(void *arg)
     }
 
     free(recv_data);
+    free(logs);
     vTaskDelete(NULL);
 }
 
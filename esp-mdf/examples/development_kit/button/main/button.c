@@ -426,9 +426,17 @@ static mdf_err_t button_mesh_mode()
     while (xEventGroupWaitBits(g_event_group_trigger,
                                EVENT_GROUP_BUTTON_KEY_LONG_PUSH | EVENT_GROUP_BUTTON_KEY_RELEASE,
                                pdTRUE, pdFALSE, portMAX_DELAY)) {
-        ret = mlink_trigger_handle(MLINK_COMMUNICATE_MESH);
+        /**< Only the triggers watching the keys that were operated are evaluated */
+        for (uint8_t cid = BUTTON_CID_KEY0; cid <= BUTTON_CID_KEY3; ++cid) {
+            if (button_key_get_status(cid) == BUTTON_KEY_NONE) {
+                continue;
+            }
+
+            ret = mlink_trigger_handle_cid(MLINK_COMMUNICATE_MESH, cid);
+            MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Data transmission failed, cid: %d", mdf_err_to_name(ret), cid);
+        }
+
         button_key_reset_status();
-        MDF_ERROR_CONTINUE(ret != MDF_OK, "<%s> Data transmission failed", mdf_err_to_name(ret));
     }
 
     MDF_ERROR_ASSERT(mwifi_deinit());
@@ -0,0 +1,365 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Compare the CPU of a handshake of components/mconfig/mconfig_chain.c for the two
+modes of CONFIG_MCONFIG_CHAIN_HANDSHAKE, for one slave:
+
+    rsa:   the slave generates an RSA-1024 key, the master parses its PEM key and
+           encrypts with it, the slave decrypts with the private key.
+    ecdh:  the master makes one X25519 multiplication per slave and SHA-256, the
+           slave two multiplications (its public key, the secret) and SHA-256.
+
+The same operations are made in pure Python so the ratio of the two modes, not
+the times, is the result. AES, which is the same for both, is not counted.
+The keys of the master and the slave are in the table once per run, the column
+"per device" is what each new slave costs to the master and to itself.
+
+Usage:
+    mconfig_chain_bench.py bench [-n <count>] [--devices <num>]
+    mconfig_chain_bench.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import base64
+import hashlib
+import os
+import random
+import sys
+import time
+
+RSA_KEY_BITS = 1024   # MCONFIG_RSA_KEY_BITS
+RSA_EXPONENT = 65537  # MCONFIG_RSA_EXPONENT
+ECDH_KEY_LEN = 32     # MCONFIG_ECDH_KEY_LEN
+
+P25519 = 2 ** 255 - 19
+A24    = 121665
+
+
+def x25519(scalar, u):
+    """X25519 of RFC 7748, keys and results are 32 bytes in little endian"""
+    k = bytearray(scalar)
+    k[0] &= 248
+    k[31] &= 127
+    k[31] |= 64
+    k = int.from_bytes(bytes(k), 'little')
+    x1 = int.from_bytes(u, 'little') & ((1 << 255) - 1)
+    x2, z2, x3, z3, swap = 1, 0, x1, 1, 0
+
+    for t in reversed(range(255)):
+        bit = (k >> t) & 1
+        swap ^= bit
+
+        if swap:
+            x2, x3, z2, z3 = x3, x2, z3, z2
+
+        swap = bit
+        a, b = (x2 + z2) % P25519, (x2 - z2) % P25519
+        aa, bb = a * a % P25519, b * b % P25519
+        e = (aa - bb) % P25519
+        c, d = (x3 + z3) % P25519, (x3 - z3) % P25519
+        da, cb = d * a % P25519, c * b % P25519
+        x3 = (da + cb) ** 2 % P25519
+        z3 = x1 * (da - cb) ** 2 % P25519
+        x2 = aa * bb % P25519
+        z2 = e * (aa + A24 * e) % P25519
+
+    if swap:
+        x2, z2 = x3, z3
+
+    return (x2 * pow(z2, P25519 - 2, P25519) % P25519).to_bytes(32, 'little')
+
+
+X25519_BASE = (9).to_bytes(32, 'little')
+
+
+def ecdh_derive_key(secret, master_pubkey, slave_pubkey):
+    """mconfig_ecdh_derive_key(), the AES key is the head of SHA-256 of the secret and both keys"""
+    return hashlib.sha256(secret + master_pubkey + slave_pubkey).digest()[:16]
+
+
+def is_prime(n, rounds=20):
+    if n < 2:
+        return False
+
+    for p in (2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37):
+        if n % p == 0:
+            return n == p
+
+    d, s = n - 1, 0
+
+    while not d & 1:
+        d, s = d >> 1, s + 1
+
+    for _ in range(rounds):
+        x = pow(random.randrange(2, n - 1), d, n)
+
+        if x in (1, n - 1):
+            continue
+
+        for _ in range(s - 1):
+            x = x * x % n
+
+            if x == n - 1:
+                break
+        else:
+            return False
+
+    return True
+
+
+def gen_prime(bits):
+    while True:
+        p = random.getrandbits(bits) | (3 << (bits - 2)) | 1
+
+        if p % RSA_EXPONENT != 1 and is_prime(p):
+            return p
+
+
+def rsa_gen_key(bits=RSA_KEY_BITS):
+    """mconfig_rsa_gen_key(), returns (n, d, p, q)"""
+    while True:
+        p, q = gen_prime(bits // 2), gen_prime(bits // 2)
+        n = p * q
+
+        if p != q and n.bit_length() == bits:
+            d = pow(RSA_EXPONENT, -1, (p - 1) * (q - 1))
+            return n, d, p, q
+
+
+def der_length(size):
+    if size < 0x80:
+        return bytes([size])
+
+    data = size.to_bytes((size.bit_length() + 7) // 8, 'big')
+    return bytes([0x80 | len(data)]) + data
+
+
+def der_integer(value):
+    data = value.to_bytes(value.bit_length() // 8 + 1, 'big')
+    return b'\x02' + der_length(len(data)) + data
+
+
+def der_sequence(*items):
+    data = b''.join(items)
+    return b'\x30' + der_length(len(data)) + data
+
+
+RSA_OID = bytes.fromhex('06092a864886f70d0101010500')
+
+
+def rsa_pubkey_pem(n):
+    """SubjectPublicKeyInfo of the slave, the request holds its base64"""
+    key = der_sequence(der_integer(n), der_integer(RSA_EXPONENT))
+    info = der_sequence(der_sequence(RSA_OID[:11], RSA_OID[11:]), b'\x03' + der_length(len(key) + 1) + b'\x00' + key)
+    return base64.b64encode(info)
+
+
+def der_read(data, offset):
+    tag, size = data[offset], data[offset + 1]
+    offset += 2
+
+    if size & 0x80:
+        num = size & 0x7f
+        size = int.from_bytes(data[offset:offset + num], 'big')
+        offset += num
+
+    return tag, data[offset:offset + size], offset + size
+
+
+def rsa_parse_pem(pem):
+    """mbedtls_pk_parse_public_key() of the master"""
+    info = base64.b64decode(pem)
+    _, info, _ = der_read(info, 0)
+    _, _, offset = der_read(info, 0)
+    _, key, _ = der_read(info, offset)
+    _, key, _ = der_read(key, 1)
+    _, n, offset = der_read(key, 0)
+    _, e, _ = der_read(key, offset)
+    return int.from_bytes(n, 'big'), int.from_bytes(e, 'big')
+
+
+def rsa_encrypt(n, e, plaintext):
+    """PKCS#1 v1.5 with the public key, mconfig_rsa_encrypt()"""
+    size = (n.bit_length() + 7) // 8
+    padding = bytes(random.randrange(1, 256) for _ in range(size - len(plaintext) - 3))
+    block = b'\x00\x02' + padding + b'\x00' + plaintext
+    return pow(int.from_bytes(block, 'big'), e, n).to_bytes(size, 'big')
+
+
+def rsa_decrypt(key, ciphertext):
+    """PKCS#1 v1.5 with the private key and the CRT, mconfig_rsa_decrypt()"""
+    n, d, p, q = key
+    c = int.from_bytes(ciphertext, 'big')
+    m1, m2 = pow(c, d % (p - 1), p), pow(c, d % (q - 1), q)
+    m = m2 + q * (pow(q, -1, p) * (m1 - m2) % p)
+    block = m.to_bytes((n.bit_length() + 7) // 8, 'big')
+
+    if block[:2] != b'\x00\x02':
+        raise ValueError('Invalid padding')
+
+    return block[block.index(b'\x00', 2) + 1:]
+
+
+def rsa_handshake(plaintext):
+    """Returns the CPU in seconds of (slave key, master per device, slave per device)"""
+    start = time.process_time()
+    key = rsa_gen_key()
+    pem = rsa_pubkey_pem(key[0])
+    keygen = time.process_time() - start
+
+    start = time.process_time()
+    ciphertext = rsa_encrypt(*rsa_parse_pem(pem), plaintext=plaintext)
+    master = time.process_time() - start
+
+    start = time.process_time()
+    result = rsa_decrypt(key, ciphertext)
+    slave = time.process_time() - start
+
+    assert result == plaintext
+    return keygen, master, slave
+
+
+def ecdh_handshake(master_privkey, master_pubkey):
+    """Returns the CPU in seconds of (slave key, master per device, slave per device)"""
+    start = time.process_time()
+    slave_privkey = os.urandom(ECDH_KEY_LEN)
+    slave_pubkey = x25519(slave_privkey, X25519_BASE)
+    keygen = time.process_time() - start
+
+    start = time.process_time()
+    master_key = ecdh_derive_key(x25519(master_privkey, slave_pubkey), master_pubkey, slave_pubkey)
+    master = time.process_time() - start
+
+    start = time.process_time()
+    slave_key = ecdh_derive_key(x25519(slave_privkey, master_pubkey), master_pubkey, slave_pubkey)
+    slave = time.process_time() - start
+
+    assert master_key == slave_key
+    return keygen, master, slave
+
+
+def average(values):
+    return sum(values) / len(values)
+
+
+def bench(count, devices):
+    plaintext = os.urandom(RSA_KEY_BITS // 8 - 11)
+    rsa = [rsa_handshake(plaintext) for _ in range(count)]
+
+    master_privkey = os.urandom(ECDH_KEY_LEN)
+    start = time.process_time()
+    master_pubkey = x25519(master_privkey, X25519_BASE)
+    master_keygen = time.process_time() - start
+    ecdh = [ecdh_handshake(master_privkey, master_pubkey) for _ in range(count)]
+
+    result = {}
+
+    for mode, runs, master_key in (('rsa', rsa, 0), ('ecdh', ecdh, master_keygen)):
+        keygen, master, slave = [average([run[i] for run in runs]) for i in range(3)]
+        result[mode] = {
+            'keygen': keygen,
+            'master_key': master_key,
+            'master': master,
+            'slave': slave,
+            'device': master + slave + keygen,
+        }
+
+    print('%-6s %12s %12s %12s %12s %12s' % ('mode', 'master key', 'slave key', 'master', 'slave', 'per device'))
+
+    for mode in ('rsa', 'ecdh'):
+        r = result[mode]
+        print('%-6s %10.2fms %10.2fms %10.2fms %10.2fms %10.2fms' % (mode, r['master_key'] * 1000, r['keygen'] * 1000,
+              r['master'] * 1000, r['slave'] * 1000, r['device'] * 1000))
+
+    rsa, ecdh = result['rsa'], result['ecdh']
+    print('\nPer device, ecdh takes %.1f%% of the CPU of rsa (%d runs), master: %.1f%%, slave: %.1f%%' % (
+          ecdh['device'] * 100 / rsa['device'], count,
+          ecdh['master'] * 100 / rsa['master'], (ecdh['slave'] + ecdh['keygen']) * 100 / (rsa['slave'] + rsa['keygen'])))
+
+    if devices:
+        # A master serves its slaves one after the other, the chain doubles the masters each round
+        print('%d devices, CPU of the masters: rsa %.2fs, ecdh %.2fs' % (devices, devices * rsa['master'],
+              master_keygen + devices * ecdh['master']))
+
+    return result
+
+
+def test():
+    vectors = [
+        ('a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4',
+         'e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c',
+         'c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552'),
+        ('4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d',
+         'e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493',
+         '95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957'),
+    ]
+
+    for scalar, u, result in vectors:
+        assert x25519(bytes.fromhex(scalar), bytes.fromhex(u)).hex() == result
+
+    alice = bytes.fromhex('77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a')
+    bob = bytes.fromhex('5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb')
+    alice_pubkey, bob_pubkey = x25519(alice, X25519_BASE), x25519(bob, X25519_BASE)
+    assert alice_pubkey.hex() == '8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a'
+    assert bob_pubkey.hex() == 'de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f'
+    assert x25519(alice, bob_pubkey) == x25519(bob, alice_pubkey)
+    assert x25519(alice, bob_pubkey).hex() == '4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742'
+
+    key = rsa_gen_key()
+    assert key[0].bit_length() == RSA_KEY_BITS
+    assert rsa_parse_pem(rsa_pubkey_pem(key[0])) == (key[0], RSA_EXPONENT)
+    assert len(rsa_pubkey_pem(key[0])) == 216  # The request of the slave pads it to 220 with '\n'
+
+    plaintext = os.urandom(RSA_KEY_BITS // 8 - 11)
+    assert rsa_decrypt(key, rsa_encrypt(key[0], RSA_EXPONENT, plaintext)) == plaintext
+
+    result = bench(2, 0)
+    assert result['ecdh']['device'] < result['rsa']['device']
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_bench = subparsers.add_parser('bench', help='Compare the CPU of a handshake of the two modes')
+    parser_bench.add_argument('-n', '--count', type=int, default=10, help='Number of handshakes of each mode')
+    parser_bench.add_argument('--devices', type=int, default=0, help='Also give the CPU of the masters for these devices')
+
+    subparsers.add_parser('test', help='Check X25519 against RFC 7748 and RSA, then bench a few handshakes')
+
+    args = parser.parse_args()
+
+    if args.command == 'bench':
+        bench(max(args.count, 1), args.devices)
+    elif args.command == 'test':
+        try:
+            test()
+        except AssertionError:
+            print('FAIL')
+            raise
+
+        print('PASS')
+    else:
+        parser.print_help()
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
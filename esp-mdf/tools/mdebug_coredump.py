@@ -0,0 +1,352 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Reassemble a core dump sent by "coredump -s <addr>" from the serial log of the
+receiver, components/mdebug/mdebug_coredump.c prints its data as lines:
+
+    mdebug_coredump: <addr> begin <id> <size> <offset>
+    mdebug_coredump: <addr> data <id> <offset> <base64>
+    mdebug_coredump: <addr> end <id> <compressed size>
+
+The data is the core dump compressed by miniz, a transfer resumed after an
+interruption continues in another log, so several logs can be given. The core
+dump is checked against its id, the CRC-32 sent by the device, and written in
+base64 for espcoredump.py:
+
+    mdebug_coredump.py reassemble receiver.log [--output core.b64]
+    espcoredump.py info_corefile -t b64 -c core.b64 <elf>
+
+Usage:
+    mdebug_coredump.py reassemble log [log ...] [--addr xx:xx:xx:xx:xx:xx] [--output core.b64] [--raw]
+    mdebug_coredump.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import base64
+import random
+import re
+import struct
+import sys
+import zlib
+
+# Must match mdebug_coredump_stream_t, MDEBUG_ESPNOW_PAYLOAD_LEN and CONFIG_MDEBUG_COREDUMP_*
+STREAM_HEADER = struct.Struct('<BBHII')
+FRAME_SIZE    = 236 - STREAM_HEADER.size
+WINDOW        = 4
+TIMEOUT_MS    = 300
+# Old transfer: a frame of 230 bytes, then 20 ms, no retransmission but "coredump -q"
+LEGACY_SIZE   = 230
+LEGACY_DELAY  = 20
+# Time of a frame of ESP-NOW and its MAC acknowledgement, and the serial port of the receiver
+FRAME_MS      = 2.5
+UART_BAUD     = 115200
+
+LINE = re.compile(r'mdebug_coredump: ([0-9a-f:]{17}) (begin|data|end) ([0-9a-f]{8}) (\d+)(?: (\S+))?')
+
+
+def parse(lines):
+    """The transfers of the logs by (addr, id): {'size', 'total', 'data': {offset: bytes}}"""
+    transfers = {}
+
+    for line in lines:
+        match = LINE.search(line)
+
+        if not match:
+            continue
+
+        addr, kind, id, number, extra = match.groups()
+        transfer = transfers.setdefault((addr, int(id, 16)), {'size': None, 'total': None, 'data': {}})
+
+        if kind == 'begin':
+            transfer['size'] = int(number)
+        elif kind == 'data' and extra:
+            try:
+                transfer['data'][int(number)] = base64.b64decode(extra)
+            except (TypeError, ValueError):
+                pass  # A line cut by the serial port
+        elif kind == 'end':
+            transfer['total'] = int(number)
+
+    return transfers
+
+
+def reassemble(transfer, id):
+    """The core dump of a transfer, ValueError if a part is missing or does not match its id"""
+    stream = b''
+
+    for offset in sorted(transfer['data']):
+        if offset > len(stream):
+            raise ValueError('Data missing at offset %d' % len(stream))
+
+        stream = stream[:offset] + transfer['data'][offset]
+
+    if transfer['total'] is not None and len(stream) < transfer['total']:
+        raise ValueError('Data missing at offset %d of %d' % (len(stream), transfer['total']))
+
+    try:
+        core = zlib.decompress(stream)
+    except zlib.error as e:
+        raise ValueError('Compressed data corrupted, %s' % e)
+
+    if zlib.crc32(core) & 0xffffffff != id or (transfer['size'] is not None and len(core) != transfer['size']):
+        raise ValueError('The core dump does not match its id %08x' % id)
+
+    return core
+
+
+class Link(object):
+    """ESP-NOW between the device and the receiver, a frame is lost with the probability loss"""
+
+    def __init__(self, loss, seed):
+        self.rng  = random.Random(seed)
+        self.loss = loss
+        self.time = 0.0
+
+    def send(self):
+        self.time += FRAME_MS
+        return self.rng.random() >= self.loss
+
+
+def serial_ms(size):
+    """Time for the receiver to print a line of data, 10 bits per character"""
+    return (len('mdebug_coredump: 30:ae:a4:00:4b:90 data 00000000 00000 ') + (size + 2) // 3 * 4) * 10000.0 / UART_BAUD
+
+
+def stream_send(core, link, receiver, cut=None):
+    """The transfer of mdebug_coredump_send_task(), go-back-N over the link, returns the lines
+    printed by the receiver, cut stops the link after this many frames"""
+    id     = zlib.crc32(core) & 0xffffffff
+    stream = zlib.compress(core, 1)
+    lines  = []
+    frames = [0]
+
+    def deliver():
+        frames[0] += 1
+        return (cut is None or frames[0] <= cut) and link.send()
+
+    def ack_to(offset):
+        return deliver() and offset
+
+    # BEGIN, the receiver answers with the offset it has of this core dump
+    if receiver.get('id') != id:
+        receiver.update(id=id, offset=0)
+
+    for _ in range(10):
+        if deliver():
+            lines.append('mdebug_coredump: %s begin %08x %d %d' % (receiver['addr'], id, len(core), receiver['offset']))
+
+            if deliver():
+                break
+
+        link.time += TIMEOUT_MS
+    else:
+        return lines
+
+    base = sent = receiver['offset']
+    retry = 0
+    unacked = 0
+    busy_until = link.time
+
+    while base < len(stream) and retry < 10:
+        acked = None
+
+        while sent < min(base + WINDOW * FRAME_SIZE, len(stream)):
+            data = stream[sent:sent + FRAME_SIZE]
+            offset = sent
+            sent += len(data)
+
+            if not deliver():
+                continue
+
+            # The receiver prints its lines one after the other, a frame waits for the previous ones
+            busy_until = max(busy_until, link.time) + serial_ms(len(data))
+
+            if offset != receiver['offset']:
+                if not receiver.get('gap'):
+                    receiver['gap'] = True
+
+                    if ack_to(True):
+                        acked = ('nack' if offset > receiver['offset'] else 'ack', receiver['offset'])
+                continue
+
+            receiver['offset'] += len(data)
+            receiver['gap'] = False
+            unacked += 1
+            lines.append('mdebug_coredump: %s data %08x %d %s' % (receiver['addr'], id, offset,
+                                                                  base64.b64encode(data).decode()))
+
+            if unacked >= max(WINDOW // 2, 1) or len(data) < FRAME_SIZE:
+                unacked = 0
+
+                if ack_to(True):
+                    acked = ('ack', receiver['offset'])
+
+        # The window is sent, the sender waits for an acknowledgement
+        if acked is None:
+            link.time = max(link.time, busy_until - WINDOW * serial_ms(FRAME_SIZE)) + TIMEOUT_MS
+            sent = base
+            retry += 1
+            continue
+
+        link.time = max(link.time, busy_until - WINDOW * serial_ms(FRAME_SIZE))
+        base = max(base, acked[1])
+        sent = base if acked[0] == 'nack' else max(sent, base)
+        retry = 0
+
+    if base == len(stream):
+        while not (deliver() and deliver()):
+            link.time += TIMEOUT_MS
+
+        lines.append('mdebug_coredump: %s end %08x %d' % (receiver['addr'], id, len(stream)))
+
+    link.time = max(link.time, busy_until)
+    return lines
+
+
+def legacy_ms(core, link):
+    """Time of the previous transfer, a lost frame loses the core dump, so the transfer is
+    started again from the frame lost with "coredump -q", a second to notice and type it"""
+    seq = 0
+
+    while seq * LEGACY_SIZE < len(core):
+        if link.send():
+            link.time += LEGACY_DELAY + serial_ms(LEGACY_SIZE)
+            seq += 1
+        else:
+            link.time += 1000
+
+    return link.time
+
+
+def synthetic_core(size, seed=1):
+    """A core dump: task control blocks, stacks mostly filled with the canary and pointers"""
+    rng   = random.Random(seed)
+    words = []
+
+    for i in range(size // 4):
+        if (i * 4 // 4096) % 3 == 0:
+            words.append(0)
+        elif rng.randrange(4) == 0:
+            words.append(0x3ffb0000 + rng.randrange(4096) * 4)
+        elif rng.randrange(8) == 0:
+            words.append(rng.getrandbits(32))
+        else:
+            words.append(0xa5a5a5a5)
+
+    return struct.pack('<%dI' % len(words), *words)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Reassemble a core dump sent over ESP-NOW by mdebug')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_reassemble = subparsers.add_parser('reassemble', help='Reassemble the core dump from the receiver logs')
+    parser_reassemble.add_argument('logs', nargs='+', help='Serial logs of the receiver')
+    parser_reassemble.add_argument('--addr', help='Address of the device, the last core dump received if omitted')
+    parser_reassemble.add_argument('--output', default='core.b64', help='Core dump for espcoredump.py')
+    parser_reassemble.add_argument('--raw', action='store_true', help='Write the core dump in binary, -t raw')
+
+    subparsers.add_parser('test', help='Simulated transfers with losses and a resume must reassemble and be fast')
+
+    args = parser.parse_args()
+
+    if args.command == 'reassemble':
+        lines = []
+
+        for log in args.logs:
+            with open(log, 'rb') as f:
+                lines += f.read().decode('latin-1').splitlines()
+
+        transfers = [(key, transfer) for key, transfer in parse(lines).items()
+                     if not args.addr or key[0] == args.addr.lower()]
+
+        if not transfers:
+            print('No core dump in the logs')
+            return 1
+
+        # The transfer whose data comes last in the logs
+        (addr, id), transfer = transfers[-1]
+
+        try:
+            core = reassemble(transfer, id)
+        except ValueError as e:
+            print('%s %08x: %s, send it again with "coredump -s", it resumes' % (addr, id, e))
+            return 1
+
+        with open(args.output, 'wb') as f:
+            f.write(core if args.raw else base64.b64encode(core))
+
+        print('%s %08x: %d bytes written to %s' % (addr, id, len(core), args.output))
+    elif args.command == 'test':
+        core = synthetic_core(64 * 1024)
+
+        for loss in (0.0, 0.05, 0.2):
+            link     = Link(loss, 1)
+            receiver = {'addr': '30:ae:a4:00:4b:90'}
+            lines    = stream_send(core, link, receiver)
+            stream_s = link.time / 1000
+            legacy_s = legacy_ms(core, Link(loss, 1)) / 1000
+
+            (_, id), transfer = list(parse(lines).items())[0]
+
+            if reassemble(transfer, id) != core:
+                print('FAIL: loss %d%%, the core dump does not reassemble' % (loss * 100))
+                return 1
+
+            print('loss %3d%%: stream %.1f s, previous %.1f s' % (loss * 100, stream_s, legacy_s))
+
+            if stream_s > 10 or stream_s * 3 > legacy_s:
+                print('FAIL: loss %d%%, the stream is not fast enough' % (loss * 100))
+                return 1
+
+        # The link is lost during the transfer, it resumes from the offset received
+        receiver = {'addr': '30:ae:a4:00:4b:90'}
+        first    = stream_send(core, Link(0.05, 2), receiver, cut=30)
+        second   = stream_send(core, Link(0.05, 3), receiver)
+
+        if 'end' in ' '.join(first) or ' begin %08x %d 0' % (zlib.crc32(core) & 0xffffffff, len(core)) in second[0]:
+            print('FAIL: the transfer is not resumed')
+            return 1
+
+        (_, id), transfer = list(parse(first + second).items())[0]
+
+        if reassemble(transfer, id) != core:
+            print('FAIL: the resumed core dump does not reassemble')
+            return 1
+
+        # A core dump missing data is reported
+        transfer['data'].pop(sorted(transfer['data'])[5])
+
+        try:
+            reassemble(transfer, id)
+            print('FAIL: a core dump missing data is reassembled')
+            return 1
+        except ValueError:
+            pass
+
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,251 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Read the logs that components/mdebug/mdebug_flash.c stores in flash, from a dump
+of the log partition, such as after a crash:
+
+    esptool.py read_flash <partition address> <partition size> log.bin
+    mdebug_flash_log.py read log.bin [--offset 0] [--size 32768] [--minutes 5]
+
+The log file is a ring of sectors, each with a header holding its seq, the time
+of its first log and a CRC, followed by records of a log each with its size and
+CRC. Binary logs (CONFIG_MDEBUG_LOG_BINARY) are written to --output for
+mdebug_log_decode.py.
+
+Usage:
+    mdebug_flash_log.py read log.bin [--offset 0] [--size 32768] [--minutes N] [--output logs.bin]
+    mdebug_flash_log.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import random
+import struct
+import sys
+import zlib
+
+# Must match mdebug_flash_sector_t, mdebug_flash_record_t and MDEBUG_FLASH_SECTOR_MAGIC
+SECTOR_SIZE   = 4096
+SECTOR_MAGIC  = 0x474c444d
+SECTOR_HEADER = struct.Struct('<IIIIHH')
+RECORD_HEADER = struct.Struct('<HH')
+UNSET         = 0xffff
+
+
+def crc16_le(data, crc=0xffff):
+    """crc16_le() of the ROM, CRC-16/CCITT reflected with the inversions"""
+    crc = ~crc & 0xffff
+
+    for byte in bytearray(data):
+        crc ^= byte
+
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x8408 if crc & 1 else 0)
+
+    return ~crc & 0xffff
+
+
+def crc32_le(data, crc=0xffffffff):
+    """crc32_le() of the ROM, inverted at both ends as zlib"""
+    return zlib.crc32(data, crc) & 0xffffffff
+
+
+def parse(image, offset, size):
+    """The sectors in the order of the logs: (seq, timestamp, [log, ...])"""
+    sectors = {}
+
+    for index in range(size // SECTOR_SIZE):
+        data = image[offset + index * SECTOR_SIZE:offset + (index + 1) * SECTOR_SIZE]
+
+        if len(data) < SECTOR_HEADER.size:
+            break
+
+        magic, seq, timestamp, crc, end, _ = SECTOR_HEADER.unpack_from(data)
+
+        if magic != SECTOR_MAGIC or crc != crc32_le(data[:12]):
+            continue
+
+        logs     = []
+        position = SECTOR_HEADER.size
+        end      = end if SECTOR_HEADER.size <= end <= SECTOR_SIZE else SECTOR_SIZE
+
+        # Unlike the device, every record is checked
+        while position + RECORD_HEADER.size <= end:
+            length, crc = RECORD_HEADER.unpack_from(data, position)
+
+            if length == UNSET or not length or position + RECORD_HEADER.size + length > end:
+                break
+
+            log = data[position + RECORD_HEADER.size:position + RECORD_HEADER.size + length]
+
+            if crc16_le(log) != crc:
+                break
+
+            logs.append(log)
+            position += RECORD_HEADER.size + length
+
+        sectors[index] = (seq, timestamp, logs)
+
+    if not sectors:
+        return []
+
+    # From the sector with the highest seq back to the oldest one of the same run
+    count = size // SECTOR_SIZE
+    head  = max(sectors, key=lambda index: sectors[index][0])
+    order = [head]
+
+    for _ in range(count - 1):
+        prev = (order[0] - 1) % count
+
+        if prev not in sectors or sectors[prev][0] + 1 != sectors[order[0]][0]:
+            break
+
+        order.insert(0, prev)
+
+    return [sectors[index] for index in order]
+
+
+def select(sectors, minutes=None):
+    """The logs of the last minutes before the first log of the newest sector"""
+    if minutes is None or not sectors:
+        return sectors
+
+    begin = sectors[-1][1] - minutes * 60
+    first = 0
+
+    for i, (_, timestamp, _) in enumerate(sectors):
+        if timestamp <= begin:
+            first = i
+
+    return sectors[first:]
+
+
+def write_sectors(logs, sector_num, power_loss=None):
+    """A log file written as mdebug_flash_write() does and the bytes programmed,
+    power_loss stops the programming after this many bytes"""
+    image  = bytearray(b'\xab' * sector_num * SECTOR_SIZE)
+    budget = [power_loss, 0]
+    state  = {'head': -1, 'end': 0, 'seq': -1, 'closed': True}
+
+    def program(address, data):
+        for i, byte in enumerate(bytearray(data)):
+            if budget[0] == 0:
+                return
+
+            if budget[0] is not None:
+                budget[0] -= 1
+
+            budget[1] += 1
+            image[address + i] &= byte
+
+    for timestamp, log in logs:
+        record = RECORD_HEADER.pack(len(log), crc16_le(log))
+
+        # Close the sector, then erase the next one and write its header
+        if not state['closed'] and state['end'] + len(record) + len(log) > SECTOR_SIZE:
+            program(state['head'] * SECTOR_SIZE + 16, struct.pack('<H', state['end']))
+            state['closed'] = True
+
+        if state['closed']:
+            state['head'] = (state['head'] + 1) % sector_num
+            state['seq'] += 1
+            header = struct.pack('<III', SECTOR_MAGIC, state['seq'], timestamp)
+
+            if budget[0] != 0:
+                image[state['head'] * SECTOR_SIZE:(state['head'] + 1) * SECTOR_SIZE] = b'\xff' * SECTOR_SIZE
+
+            program(state['head'] * SECTOR_SIZE, header + struct.pack('<I', crc32_le(header)))
+            state['end']    = SECTOR_HEADER.size
+            state['closed'] = False
+
+        program(state['head'] * SECTOR_SIZE + state['end'], record + log)
+        state['end'] += len(record) + len(log)
+
+    return bytes(image), budget[1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Read the mdebug logs from a dump of the log partition')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_read = subparsers.add_parser('read', help='Print the logs of a dump')
+    parser_read.add_argument('image', help='Dump of the log partition')
+    parser_read.add_argument('--offset', type=int, default=0, help='CONFIG_MDEBUG_LOG_PARTITION_OFFSET')
+    parser_read.add_argument('--size', type=int, default=32768, help='CONFIG_MDEBUG_LOG_FILE_MAX_SIZE')
+    parser_read.add_argument('--minutes', type=int, help='Only the logs of the last minutes')
+    parser_read.add_argument('--output', help='Write the logs to this file instead of printing them')
+
+    subparsers.add_parser('test', help='Logs written with power losses must read back whole and in order')
+
+    args = parser.parse_args()
+
+    if args.command == 'read':
+        with open(args.image, 'rb') as f:
+            sectors = select(parse(f.read(), args.offset, args.size), args.minutes)
+
+        logs = b''.join(b''.join(logs) for _, _, logs in sectors)
+
+        if args.output:
+            with open(args.output, 'wb') as f:
+                f.write(logs)
+        else:
+            for seq, timestamp, _ in sectors[:1]:
+                print('From sector %d, time %d' % (seq, timestamp))
+
+            sys.stdout.write(logs.decode('latin-1'))
+    elif args.command == 'test':
+        rng  = random.Random(1)
+        logs = [(1000 + i, ('I (%d) test: line %d %s\n' % (i, i, 'x' * rng.randrange(80))).encode())
+                for i in range(3000)]
+
+        sectors = parse(write_sectors(logs, 8)[0], 0, 8 * SECTOR_SIZE)
+        read    = [log for _, _, sector_logs in sectors for log in sector_logs]
+        count   = len(read)
+
+        if not read or read != [log for _, log in logs[-len(read):]] or len(sectors) != 8:
+            print('FAIL: the logs do not read back in order')
+            return 1
+
+        last = select(sectors, 1)
+
+        if last[0][1] > sectors[-1][1] - 60 or len(last) == len(sectors):
+            print('FAIL: the last minute selects %d of %d sectors' % (len(last), len(sectors)))
+            return 1
+
+        # A power loss at every byte of the last logs, the logs read are whole and in order
+        _, total = write_sectors(logs[:200], 4)
+
+        for cut in range(total - 600, total):
+            image, _ = write_sectors(logs[:200], 4, cut)
+            read     = [log for _, _, sector_logs in parse(image, 0, 4 * SECTOR_SIZE) for log in sector_logs]
+            first    = [log for _, log in logs].index(read[0]) if read else 0
+
+            if read != [log for _, log in logs[first:first + len(read)]]:
+                print('FAIL: an incomplete log is read, cut: %d' % cut)
+                return 1
+
+        print('PASS: %d sectors, %d logs, last minute from sector %d' % (len(sectors), count, last[0][0]))
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
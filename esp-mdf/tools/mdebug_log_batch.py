@@ -0,0 +1,265 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate the ESP-NOW traffic of the mdebug logs, and pack or unpack the
+batches of MDEBUG_ESPNOW_LOG_BATCH as components/mdebug/mdebug_log.c does.
+
+    line        a mdebug_espnow_write() per log, the previous sender
+    packed      the logs of a frame sent together, CONFIG_MDEBUG_LOG_BATCH_COMPRESS=n
+    compressed  the logs of CONFIG_MDEBUG_LOG_BATCH_SIZE compressed by miniz,
+                sent in several frames
+
+A batch is sent once full or CONFIG_MDEBUG_LOG_BATCH_TIMEOUT_MS after its first
+log. The airtime of a frame is FRAME_OVERHEAD_US for the preamble, the
+acknowledgement and the interframe spaces plus its bytes at PHY_RATE_MBPS.
+
+Usage:
+    mdebug_log_batch.py simulate [--lines 2000] [--rate 50] [--timeout 1000] [--size 2048]
+    mdebug_log_batch.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import random
+import struct
+import sys
+import zlib
+
+# Must match MESPNOW_PAYLOAD_LEN, the header of mespnow and mdebug_espnow_data_t
+MESPNOW_PAYLOAD_LEN  = 238
+MESPNOW_HEADER_LEN   = 12
+ESPNOW_DATA_LEN      = 2
+# Must match mdebug_log_batch_t and MDEBUG_LOG_BINARY_MARKER
+BATCH_HEADER         = struct.Struct('<BBH')
+BATCH_MAX_SIZE       = 4096
+BATCH_FRAME_SIZE     = MESPNOW_PAYLOAD_LEN - ESPNOW_DATA_LEN - BATCH_HEADER.size
+BINARY_MARKER        = 0
+# 802.11 MAC header, vendor specific action frame and FCS of ESP-NOW
+FRAME_MAC_LEN        = 43
+FRAME_OVERHEAD_US    = 300
+PHY_RATE_MBPS        = 1.0
+
+TAGS = ['mwifi', 'mupgrade', 'mdebug_log', 'mespnow', 'get_started', 'mesh_event']
+MESSAGES = [
+    '[%s, %d]: Node send, size: %d, data: {"seq":%d,"layer":%d,"status":%d}',
+    '[%s, %d]: Root receive, addr: 30:ae:a4:80:4c:%02x, size: %d, data: %d',
+    '[%s, %d]: System information, channel: %d, layer: %d, self mac: 30:ae:a4:80:4c:%02x, '
+    'parent bssid: 30:ae:a4:80:4c:%02x, parent rssi: -%d, node num: %d, free heap: %d',
+    '[%s, %d]: <MESH_EVENT_ROUTING_TABLE_ADD> add %d, new:%d, layer:%d',
+    '[%s, %d]: mwifi_write, ret: %d, size: %d',
+]
+
+
+def frames(size):
+    """Frames of a mdebug_espnow_write() of size bytes"""
+    return max(1, (size + ESPNOW_DATA_LEN + MESPNOW_PAYLOAD_LEN - 1) // MESPNOW_PAYLOAD_LEN)
+
+
+def airtime_us(size):
+    """Airtime of a mdebug_espnow_write() of size bytes, every frame has its own overhead"""
+    frame_num = frames(size)
+    data_len  = size + ESPNOW_DATA_LEN + frame_num * (MESPNOW_HEADER_LEN + FRAME_MAC_LEN)
+    return frame_num * FRAME_OVERHEAD_US + data_len * 8 / PHY_RATE_MBPS
+
+
+def synthetic_logs(count, rate, seed=1):
+    """(time_ms, log) of the logs of a node, about rate logs per second"""
+    rng  = random.Random(seed)
+    time = 0.0
+    logs = []
+
+    for _ in range(count):
+        time += rng.expovariate(rate) * 1000
+        tag     = rng.choice(TAGS)
+        message = rng.choice(MESSAGES)
+        args    = [rng.choice(['mwifi_root_write', 'mwifi_write', 'mupgrade_firmware_download', 'app_main'])]
+        args   += [rng.randrange(2000) for _ in range(message.count('%d') + message.count('%02x'))]
+        line    = '%s (%d) %s: %s\n' % (rng.choice('IIIIWE'), int(time), tag, message % tuple(args))
+        logs.append((time, line.encode()))
+
+    return logs
+
+
+def pack(logs, seq, compress):
+    """The batch as mdebug_log_batch_send() sends it"""
+    data       = b''.join(logs)
+    compressed = False
+
+    if compress and len(data) > BATCH_FRAME_SIZE:
+        packed = zlib.compress(data, 1)
+
+        if len(packed) < len(data):
+            data, compressed = packed, True
+
+    return BATCH_HEADER.pack(int(compressed), seq & 0xff, len(b''.join(logs))) + data
+
+
+def unpack(batch):
+    """The logs of a batch, mdebug_log_batch_unpack() and mdebug_log_next_size()"""
+    compressed, _, size = BATCH_HEADER.unpack_from(batch)
+    data = batch[BATCH_HEADER.size:]
+
+    if compressed & 1:
+        data = zlib.decompress(data)
+
+    if len(data) != size:
+        raise ValueError('Invalid batch, size: %d, expected: %d' % (len(data), size))
+
+    logs   = []
+    offset = 0
+
+    while offset < len(data):
+        if bytearray(data[offset:offset + 1])[0] == BINARY_MARKER:
+            record = bytearray(data[offset:offset + 2])
+            length = min(record[1], len(data) - offset) if len(record) == 2 and record[1] >= 2 else len(data) - offset
+        else:
+            length = len(data) - offset
+
+            for i in range(offset, len(data)):
+                char = bytearray(data[i:i + 1])[0]
+
+                if char == ord('\n') or char == BINARY_MARKER:
+                    length = i - offset + (char != BINARY_MARKER)
+                    break
+
+        logs.append(data[offset:offset + length])
+        offset += length
+
+    return logs
+
+
+def send(logs, mode, timeout_ms, batch_size):
+    """Batches sent by mdebug_log_send_task(), a batch per log for the line mode"""
+    if mode == 'line':
+        return [log for _, log in logs]
+
+    batch_size = batch_size if mode == 'compressed' else BATCH_FRAME_SIZE
+    batches    = []
+    pending    = []
+    start      = 0
+
+    for time, log in logs:
+        # The deadline of the batch passed before this log
+        if pending and time - start >= timeout_ms:
+            batches.append(pack(pending, len(batches), mode == 'compressed'))
+            pending = []
+
+        if pending and len(b''.join(pending)) + len(log) > batch_size:
+            batches.append(pack(pending, len(batches), mode == 'compressed'))
+            pending = []
+
+        if not pending:
+            start = time
+
+        pending.append(log)
+
+        if len(b''.join(pending)) >= batch_size:
+            batches.append(pack(pending, len(batches), mode == 'compressed'))
+            pending = []
+
+    if pending:
+        batches.append(pack(pending, len(batches), mode == 'compressed'))
+
+    return batches
+
+
+def simulate(logs, timeout_ms, batch_size):
+    results = {}
+    total   = sum(len(log) for _, log in logs)
+
+    print('logs: %d, %d bytes' % (len(logs), total))
+    print('%-10s %8s %8s %10s %12s' % ('mode', 'writes', 'frames', 'bytes', 'airtime_ms'))
+
+    for mode in ('line', 'packed', 'compressed'):
+        writes  = send(logs, mode, timeout_ms, batch_size)
+        results[mode] = {
+            'writes': len(writes),
+            'frames': sum(frames(len(write)) for write in writes),
+            'bytes': sum(len(write) for write in writes),
+            'airtime': sum(airtime_us(len(write)) for write in writes) / 1000,
+            'batches': writes,
+        }
+        stats = results[mode]
+        print('%-10s %8d %8d %10d %12.1f' % (mode, stats['writes'], stats['frames'], stats['bytes'], stats['airtime']))
+
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Simulate the batches of the mdebug logs sent over ESP-NOW')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_simulate = subparsers.add_parser('simulate', help='Compare the frames and airtime of the senders')
+    parser_simulate.add_argument('--lines', type=int, default=2000, help='Number of logs')
+    parser_simulate.add_argument('--rate', type=float, default=50, help='Logs per second')
+    parser_simulate.add_argument('--timeout', type=int, default=1000, help='CONFIG_MDEBUG_LOG_BATCH_TIMEOUT_MS')
+    parser_simulate.add_argument('--size', type=int, default=2048, help='CONFIG_MDEBUG_LOG_BATCH_SIZE')
+
+    subparsers.add_parser('test', help='The batches must unpack to the logs and cut the frames')
+
+    args = parser.parse_args()
+
+    if args.command == 'simulate':
+        simulate(synthetic_logs(args.lines, args.rate), args.timeout, min(args.size, BATCH_MAX_SIZE))
+    elif args.command == 'test':
+        logs = synthetic_logs(2000, 50)
+
+        # Text and binary logs, the binary ones end the text before them
+        mixed = [log for _, log in logs[:20]]
+        mixed.insert(3, b'\x00\x06\x84\x12\x02\x08')
+        mixed.insert(4, b'I (12) no line break')
+        mixed.insert(5, b'\x00\x03\x10')
+
+        for compress in (False, True):
+            if unpack(pack(mixed, 0, compress)) != mixed:
+                print('FAIL: the batch does not unpack to its logs, compress: %s' % compress)
+                return 1
+
+        results = simulate(logs, 1000, 2048)
+
+        for mode in ('packed', 'compressed'):
+            if b''.join(b''.join(unpack(batch)) for batch in results[mode]['batches']) != b''.join(log for _, log in logs):
+                print('FAIL: the %s batches lose logs' % mode)
+                return 1
+
+        line       = results['line']
+        packed     = results['packed']
+        compressed = results['compressed']
+
+        if packed['frames'] * 4 > line['frames'] * 3 or compressed['frames'] * 3 > line['frames'] \
+                or compressed['airtime'] * 3 > line['airtime']:
+            print('FAIL: the batches do not cut the frames and airtime enough')
+            return 1
+
+        # Few logs are sent at the deadline, every batch holds a single frame
+        results = simulate(synthetic_logs(50, 0.5), 1000, 2048)
+
+        if results['compressed']['frames'] > results['line']['frames']:
+            print('FAIL: the batches send more frames than the logs')
+            return 1
+
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,455 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Decode the binary logs of mdebug (CONFIG_MDEBUG_LOG_BINARY).
+
+With the binary logs a device does not format its logs for ESP-NOW and flash,
+it only records the offset of the format string in the firmware and the raw
+arguments (mdebug_log_binary_t in components/mdebug/include/mdebug_log.h):
+
+    uint8_t  marker     0x00, a text log never starts with '\\0'
+    uint8_t  size       size of the record, header included
+    varint   format     offset of the format from SOC_DROM_LOW
+    ...      arguments  in the order of the conversions of the format
+
+The format and the strings stored in the firmware are read from its ELF file.
+The input is the raw log (flash partition, ESP-NOW payloads) or the output of
+the "log -r" command, its base64 lines are decoded. Text logs may be mixed
+with the binary ones, they are printed as is.
+
+Usage:
+    mdebug_log_decode.py decode firmware.elf log.bin [--color]
+    mdebug_log_decode.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import base64
+import random
+import re
+import struct
+import sys
+
+# Must match MDEBUG_LOG_BINARY_MARKER, MDEBUG_LOG_BINARY_MAX_SIZE, MDEBUG_LOG_BINARY_STR_DROM and SOC_DROM_LOW
+MARKER     = 0x00
+MAX_SIZE   = 255
+STR_DROM   = 0xff
+DROM_LOW   = 0x3F400000
+DROM_HIGH  = 0x3F800000
+SHT_NOBITS = 8
+SHF_ALLOC  = 0x2
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?([hlLqjzt]*)([diouxXcspnfFeEgGaA%]|$)')
+COLOR      = re.compile(r'\x1b\[[0-9;]*m')
+CONSOLE    = re.compile(r'mdebug_log_data: ([A-Za-z0-9+/=]+)')
+
+
+class Elf(object):
+    """Sections of an ELF32 file loaded in memory, enough to read the strings of the firmware"""
+
+    def __init__(self, data):
+        if data[:4] != b'\x7fELF' or bytearray(data)[4] != 1:
+            raise ValueError('Not an ELF32 file')
+
+        shoff, = struct.unpack_from('<I', data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', data, 0x2E)
+        self.data     = data
+        self.sections = []
+
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from('<6I', data, shoff + i * shentsize)
+
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size:
+                self.sections.append((addr, offset, size))
+
+    def string(self, addr):
+        for section_addr, offset, size in self.sections:
+            if section_addr <= addr < section_addr + size:
+                start = offset + addr - section_addr
+                end   = self.data.find(b'\0', start, offset + size)
+                return self.data[start:end if end >= 0 else offset + size].decode('latin-1')
+
+        return None
+
+
+class DromString(object):
+    """A string stored in the firmware, only its offset is sent"""
+
+    def __init__(self, offset, text):
+        self.offset = offset
+        self.text   = text
+
+
+def put_varint(value):
+    data = bytearray()
+
+    while True:
+        data.append((value & 0x7f) | (0x80 if value > 0x7f else 0))
+        value >>= 7
+
+        if not value:
+            return data
+
+
+def get_varint(data, pos):
+    value = shift = 0
+
+    while True:
+        byte   = data[pos]
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        pos   += 1
+
+        if not byte & 0x80:
+            return value, pos
+
+
+def zigzag(value):
+    return ((value << 1) ^ (value >> 31)) & 0xffffffff
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def encode(fmt_offset, fmt, args):
+    """Same as mdebug_log_binary_encode(), for the test"""
+    data = bytearray([MARKER, 0]) + put_varint(fmt_offset)
+    args = list(args)
+
+    for match in CONVERSION.finditer(fmt):
+        _, width, precision, length, conv = match.groups()
+        wide = length.count('l') + 2 * (length.count('q') + length.count('j')) >= 2
+
+        for star in (width, precision):
+            if star == '*':
+                data += put_varint(zigzag(args.pop(0)))
+
+        if conv in ('%', '', 'n'):
+            continue
+
+        value = args.pop(0)
+
+        if conv == 's':
+            if isinstance(value, DromString):
+                data += bytearray([STR_DROM]) + put_varint(value.offset)
+            else:
+                text = value.encode('latin-1')[:min(MAX_SIZE - len(data) - 1, STR_DROM - 1)]
+                data += bytearray([len(text)]) + text
+        elif conv in 'aAeEfFgG':
+            data += struct.pack('<d', value)
+        elif wide:
+            data += struct.pack('<q' if conv in 'di' else '<Q', value)
+        elif conv in 'di':
+            data += put_varint(zigzag(value))
+        else:
+            data += put_varint(value & 0xffffffff)
+
+        if len(data) > MAX_SIZE:
+            raise ValueError('The record of "%s" is full' % fmt)
+
+    data[1] = len(data)
+    return bytes(data)
+
+
+def format_conversion(flags, width, precision, conv, value):
+    """Render a C conversion with the % operator of Python"""
+    spec = '%' + flags + (width or '') + ('.' + precision if precision is not None else '')
+
+    if conv == 'p':
+        return (spec + '#x') % value
+    elif conv == 'c':
+        return (spec + 's') % chr(value & 0xff)
+    elif conv in 'aA':
+        return float(value).hex()
+    elif conv in 'iu':
+        return (spec + 'd') % value
+
+    return (spec + conv) % value
+
+
+def render(elf, record):
+    """Text of a record, the missing arguments of a truncated record are printed as '?'"""
+    data = bytearray(record)
+    fmt_offset, pos = get_varint(data, 2)
+    fmt = elf.string(DROM_LOW + fmt_offset)
+
+    if fmt is None:
+        return '<unknown format 0x%x>\n' % (DROM_LOW + fmt_offset)
+
+    output = []
+    last   = 0
+
+    for match in CONVERSION.finditer(fmt):
+        flags, width, precision, length, conv = match.groups()
+        wide = length.count('l') + 2 * (length.count('q') + length.count('j')) >= 2
+        output.append(fmt[last:match.start()])
+        last = match.end()
+
+        if conv == '%':
+            output.append('%')
+            continue
+        elif conv in ('', 'n'):
+            continue
+
+        try:
+            if width == '*':
+                value, pos = get_varint(data, pos)
+                width = str(unzigzag(value))
+
+            if precision == '*':
+                value, pos = get_varint(data, pos)
+                precision = str(max(unzigzag(value), 0))
+
+            if conv == 's':
+                if data[pos] == STR_DROM:
+                    offset, pos = get_varint(data, pos + 1)
+                    value = elf.string(DROM_LOW + offset)
+                    value = '<0x%x>' % (DROM_LOW + offset) if value is None else value
+                else:
+                    value = bytes(data[pos + 1:pos + 1 + data[pos]]).decode('latin-1')
+                    pos  += 1 + data[pos]
+            elif conv in 'aAeEfFgG':
+                value, = struct.unpack_from('<d', data, pos)
+                pos   += 8
+            elif wide:
+                value, = struct.unpack_from('<q' if conv in 'di' else '<Q', data, pos)
+                pos   += 8
+            else:
+                value, pos = get_varint(data, pos)
+                value = unzigzag(value) if conv in 'di' else value
+
+            if pos > len(data):
+                raise IndexError
+
+            output.append(format_conversion(flags, width, precision, conv, value))
+        except (IndexError, struct.error):
+            output.append('?')
+            pos = len(data)
+
+    output.append(fmt[last:])
+    return ''.join(output)
+
+
+def split(stream):
+    """Text and binary records of a log, a record cut at the end of the log is dropped"""
+    stream = bytearray(stream)
+    pos    = 0
+
+    while pos < len(stream):
+        if stream[pos] == MARKER:
+            size = stream[pos + 1] if pos + 1 < len(stream) else 0
+
+            if pos + max(size, 2) > len(stream):
+                return
+            elif size >= 3:
+                yield 'binary', bytes(stream[pos:pos + size])
+                pos += size
+            else:
+                pos += 1
+
+            continue
+
+        end = stream.find(b'\0', pos)
+        end = len(stream) if end < 0 else end
+        yield 'text', bytes(stream[pos:end])
+        pos = end
+
+
+def decode(elf, stream, color=False):
+    output = []
+
+    for kind, data in split(stream):
+        output.append(render(elf, data) if kind == 'binary' else data.decode('latin-1'))
+
+    text = ''.join(output)
+    return text if color else COLOR.sub('', text)
+
+
+def read_log(path):
+    """The raw log or the base64 lines printed by the "log -r" command"""
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    lines = CONSOLE.findall(data.decode('latin-1')) if b'mdebug_log_data: ' in data else []
+    return b''.join(base64.b64decode(line) for line in lines) if lines else data
+
+
+def synthetic_elf(strings):
+    """An ELF32 file with the strings in a .flash.rodata section mapped at DROM_LOW + 0x20,
+    after 64 KB of other data as the offsets of a firmware take 3 bytes"""
+    rodata    = bytearray(64 * 1024)
+    offsets   = {}
+
+    for text in strings:
+        offsets[text] = 0x20 + len(rodata)
+        rodata += text.encode('latin-1') + b'\0'
+
+    shstrtab  = b'\0.flash.rodata\0.shstrtab\0'
+    data_off  = 52
+    str_off   = data_off + len(rodata)
+    sh_off    = (str_off + len(shstrtab) + 3) // 4 * 4
+    header    = b'\x7fELF\x01\x01\x01' + b'\0' * 9
+    header   += struct.pack('<HHIIIIIHHHHHH', 2, 94, 1, 0, 0, sh_off, 0, 52, 0, 0, 40, 3, 2)
+    sections  = struct.pack('<10I', *([0] * 10))
+    sections += struct.pack('<10I', 1, 1, SHF_ALLOC, DROM_LOW + 0x20, data_off, len(rodata), 0, 0, 4, 0)
+    sections += struct.pack('<10I', 15, 3, 0, 0, str_off, len(shstrtab), 0, 0, 1, 0)
+    image     = header + bytes(rodata) + shstrtab
+    image    += b'\0' * (sh_off - len(image)) + sections
+
+    return image, offsets
+
+
+def mdf_log_format(letter, fmt):
+    """Same as MDF_LOG_FORMAT()"""
+    colors = {'E': '\033[0;31m', 'W': '\033[0;33m', 'I': '\033[0;32m', 'D': '', 'V': ''}
+    return colors[letter] + letter + ' (%u) [%s, %d]: ' + fmt + ('\033[0m' if colors[letter] else '') + '\n'
+
+
+def workload(offsets, count, seed=1):
+    """Logs of a mesh device with DEBUG enabled: (format, arguments)"""
+    rng  = random.Random(seed)
+    tags = ['mwifi', 'mespnow', 'mupgrade_node', 'mlink_handle', 'mdebug_log']
+    logs = [
+        ('D', 'Receive data, size: %d, src_addr: %02x:%02x:%02x:%02x:%02x:%02x',
+         lambda: [rng.randrange(1, 1456)] + [rng.randrange(256) for _ in range(6)]),
+        ('D', 'Mesh layer: %d, rssi: %d, free heap: %u', lambda: [rng.randrange(1, 7), -rng.randrange(30, 90), rng.randrange(40000, 120000)]),
+        ('I', 'Parent is connected, layer: %d, channel: %d', lambda: [rng.randrange(1, 7), rng.randrange(1, 14)]),
+        ('D', 'mwifi_write, size: %d, type: %s, ret: %s', lambda: [rng.randrange(1, 1456), 'json', 'MDF_OK']),
+        ('W', '<%s> Wait for the response timed out, seq: %d', lambda: [DromString(offsets['ESP_ERR_TIMEOUT'], 'ESP_ERR_TIMEOUT'),
+                                                                     rng.randrange(65536)]),
+        ('D', 'Temperature: %.2f, voltage: %.3f', lambda: [rng.uniform(20, 40), rng.uniform(3.0, 3.4)]),
+    ]
+
+    for _ in range(count):
+        letter, fmt, args = rng.choice(logs)
+        tag = rng.choice(tags)
+        yield mdf_log_format(letter, fmt), [rng.randrange(1000, 10000000), DromString(offsets[tag], tag),
+                                            rng.randrange(20, 2000)] + args()
+
+
+def c_printf(fmt, args):
+    """Reference rendering of the host, the arguments are not encoded"""
+    values = [arg.text if isinstance(arg, DromString) else arg for arg in args]
+    return fmt.replace('%u', '%d') % tuple(values)
+
+
+def test():
+    tags    = ['mwifi', 'mespnow', 'mupgrade_node', 'mlink_handle', 'mdebug_log', 'ESP_ERR_TIMEOUT']
+    cases   = [
+        ('%02x:%02x|%-6s|%5d|%%', [0xa, 0xff, 'ab', -42], '0a:ff|ab    |  -42|%'),
+        ('%*d|%.*s|%c', [-4, 7, 2, 'xyz', 65], '7   |xy|A'),
+        ('%lld %llu %u', [-(1 << 40), (1 << 63) + 5, 0xffffffff], '-1099511627776 9223372036854775813 4294967295'),
+        ('%p %.3f %e %s', [0x3ffb1000, 3.14159, 12345.678, 'abc'], '0x3ffb1000 3.142 1.234568e+04 abc'),
+        ('%08.3f|%+d|%x|%s', [-2.5, 3, -1, 'x' * 300], '-002.500|+3|ffffffff|'),
+    ]
+
+    fmts = [fmt for fmt, _, _ in cases]
+    elf, offsets = synthetic_elf(tags + fmts + [mdf_log_format(letter, fmt) for letter, fmt, _ in [
+        ('D', 'Receive data, size: %d, src_addr: %02x:%02x:%02x:%02x:%02x:%02x', 0),
+        ('D', 'Mesh layer: %d, rssi: %d, free heap: %u', 0),
+        ('I', 'Parent is connected, layer: %d, channel: %d', 0),
+        ('D', 'mwifi_write, size: %d, type: %s, ret: %s', 0),
+        ('W', '<%s> Wait for the response timed out, seq: %d', 0),
+        ('D', 'Temperature: %.2f, voltage: %.3f', 0)]])
+    elf = Elf(elf)
+
+    # Conversions, the string too long for the record is truncated to fill it
+    for fmt, args, expected in cases:
+        record = encode(offsets[fmt], fmt, args)
+        text   = render(elf, record)
+
+        if len(record) == MAX_SIZE:
+            expected += 'x' * (len(text) - len(expected)) if len(text) > len(expected) + 200 else ' '
+
+        if text != expected:
+            print('FAIL: "%s" rendered "%s", expected "%s"' % (fmt, text, expected))
+            return 1
+
+    # Text and binary logs mixed in a stream, the record cut at the end is dropped
+    record = encode(offsets[fmts[0]], fmts[0], cases[0][1])
+    stream = b'[2026-10-18 10:00:00] ' + record + b'I (1) text\n' + record[:-3]
+
+    if decode(elf, stream) != '[2026-10-18 10:00:00] ' + cases[0][2] + 'I (1) text\n':
+        print('FAIL: mixed stream "%s"' % decode(elf, stream))
+        return 1
+
+    # Volume of the logs of a device
+    text_size = binary_size = 0
+    binary    = bytearray()
+    reference = []
+
+    for fmt, args in workload(offsets, 2000):
+        text        = c_printf(fmt, args)
+        record      = encode(offsets[fmt], fmt, args)
+        text_size   += len(text)
+        binary_size += len(record)
+        binary      += record
+        reference.append(COLOR.sub('', text))
+
+    console = ''.join('I (1) [mdebug_cmd, 158]: mdebug_log_data: %s\n' % base64.b64encode(bytes(binary[i:i + 1171])).decode()
+                      for i in range(0, len(binary), 1171))
+
+    if decode(elf, bytes(binary)) != ''.join(reference):
+        print('FAIL: the decoded logs do not match')
+        return 1
+
+    if CONSOLE.findall(console) and b''.join(base64.b64decode(line) for line in CONSOLE.findall(console)) != binary:
+        print('FAIL: the output of "log -r" is not decoded')
+        return 1
+
+    print('logs: %d, text: %d bytes, binary: %d bytes, ratio: %.1f' % (2000, text_size, binary_size,
+                                                                       float(text_size) / binary_size))
+
+    if text_size < binary_size * 3:
+        print('FAIL: the binary logs are not at least 3 times smaller')
+        return 1
+
+    print('PASS')
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode the binary logs of mdebug')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_decode = subparsers.add_parser('decode', help='Print the logs as text')
+    parser_decode.add_argument('elf', help='ELF file of the firmware that wrote the logs')
+    parser_decode.add_argument('log', help='Raw log or output of the "log -r" command')
+    parser_decode.add_argument('--color', action='store_true', help='Keep the colors of the logs')
+
+    subparsers.add_parser('test', help='Round trip of the conversions and volume of the logs')
+
+    args = parser.parse_args()
+
+    if args.command == 'decode':
+        with open(args.elf, 'rb') as f:
+            elf = Elf(f.read())
+
+        sys.stdout.write(decode(elf, read_log(args.log), args.color))
+    elif args.command == 'test':
+        return test()
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
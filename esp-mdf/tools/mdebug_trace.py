@@ -0,0 +1,529 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Analyze the logs of the nodes of a mesh together, such as the latency of the
+packets from their sender to their receivers. The logs are read from:
+
+    the receiver of the logs:        [xx:xx:xx:xx:xx:xx] I (1234) tag: ...
+    the files it writes per node:    xx-xx-xx-xx-xx-xx.log
+    a serial console of a node:      I (1234) tag: ...   (the node is the name of the file)
+    a dump of the log partition:     read as mdebug_flash_log.py does, text logs only
+
+With CONFIG_MWIFI_TRACE, mwifi logs a "trace" line for each packet sent,
+received and forwarded with its magic and the TSF time of the mesh, the same
+clock on all the nodes. The packets are matched by their magic, and the local
+time of the logs of each node, and of each boot of it, is aligned to the TSF
+time by the trace lines of that boot.
+
+Usage:
+    mdebug_trace.py latency <log> [...] [--pairs]
+    mdebug_trace.py paths <log> [...] [--magic 1a2b3c4d] [--slower MS] [--limit N]
+    mdebug_trace.py timeline <log> [...] [--grep REGEX]
+    mdebug_trace.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import re
+import struct
+import sys
+
+import mdebug_flash_log
+
+ANSI  = re.compile(r'\x1b\[[0-9;]*m')
+LINE  = re.compile(r'^(?:\[([0-9a-f:]{17})\] )?([EWIDV]) \((\d+)\) ([^:]+): (.*)$')
+TRACE = re.compile(r'trace (tx|rx), magic: ([0-9a-f]{8}), prev: ([0-9a-f]{8}), '
+                   r'addr: ([0-9a-f:]{17}), size: (\d+), tsf: (-?\d+)')
+FILE_ADDR = re.compile(r'^([0-9a-f]{2}(?:-[0-9a-f]{2}){5})')
+
+# Buckets of the histograms as mdf_metrics.h, bucket 0 below 64 us, then x2
+BUCKET_NUM   = 16
+BUCKET_SHIFT = 6
+
+# A time going back more than this is a restart
+RESTART_MS = 1000
+
+# Addresses a packet is sent to that are not a node: root, any, broadcast
+GROUP_ADDRS = ('00:00:00:00:00:00', '00:00:00:00:00:01', 'ff:ff:ff:ff:ff:ff')
+
+
+class Line(object):
+    __slots__ = ('node', 'boot', 'local_ms', 'level', 'tag', 'text', 'trace')
+
+    def __init__(self, node, boot, local_ms, level, tag, text):
+        self.node     = node
+        self.boot     = boot
+        self.local_ms = local_ms
+        self.level    = level
+        self.tag      = tag
+        self.text     = text
+        self.trace    = None
+
+
+class Event(object):
+    """A trace line: a packet sent (tx) or received (rx) by a node"""
+    __slots__ = ('kind', 'node', 'magic', 'prev', 'addr', 'size', 'tsf')
+
+    def __init__(self, kind, node, magic, prev, addr, size, tsf):
+        self.kind  = kind
+        self.node  = node
+        self.magic = magic
+        self.prev  = prev
+        self.addr  = addr
+        self.size  = size
+        self.tsf   = tsf
+
+
+def node_of_file(path):
+    """The node of a file without addresses in its lines, its address if the file is named by it"""
+    name  = os.path.basename(path)
+    match = FILE_ADDR.match(name.lower())
+    return match.group(1).replace('-', ':') if match else os.path.splitext(name)[0]
+
+
+def read_text(path, offset=0, size=None):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if len(data) >= 4 and struct.unpack_from('<I', data, offset)[0] == mdebug_flash_log.SECTOR_MAGIC:
+        sectors = mdebug_flash_log.parse(data, offset, size or len(data) - offset)
+        data    = b''.join(b''.join(logs) for _, _, logs in sectors)
+
+    return data.decode('latin-1')
+
+
+def parse(texts):
+    """The lines of the texts [(default node, text)], a node restarted when its time goes back,
+    more than the few ms the logs of concurrent tasks may be out of order"""
+    lines = []
+    last  = {}
+
+    for default_node, text in texts:
+        for raw in text.splitlines():
+            match = LINE.match(ANSI.sub('', raw).strip())
+
+            if not match:
+                continue
+
+            addr, level, local_ms, tag, body = match.groups()
+            node     = addr or default_node
+            local_ms = int(local_ms)
+            boot, previous_ms = last.get(node, (0, None))
+
+            if previous_ms is not None and local_ms + RESTART_MS < previous_ms:
+                boot += 1
+
+            last[node] = (boot, local_ms)
+            line = Line(node, boot, local_ms, level, tag.strip(), body)
+            trace = TRACE.search(body)
+
+            if trace:
+                kind, magic, prev, taddr, tsize, tsf = trace.groups()
+                line.trace = Event(kind, node, int(magic, 16), int(prev, 16), taddr,
+                                   int(tsize), int(tsf))
+
+            lines.append(line)
+
+    return lines
+
+
+def align(lines):
+    """The offset of each boot of each node from its local time to the TSF time, in ms,
+    the median of its trace lines, {(node, boot): offset}"""
+    samples = {}
+
+    for line in lines:
+        if line.trace and line.trace.tsf > 0:
+            samples.setdefault((line.node, line.boot), []).append(line.trace.tsf / 1000.0 - line.local_ms)
+
+    return dict((key, sorted(values)[len(values) // 2]) for key, values in samples.items())
+
+
+def mesh_ms(line, offsets):
+    """The time of a line on the TSF clock, None if its boot has no trace line"""
+    offset = offsets.get((line.node, line.boot))
+    return None if offset is None else line.local_ms + offset
+
+
+def match(lines):
+    """The packets sent, each as (tx, [rx, ...], [forwarded packet, ...]) and the roots of
+    the trees, the packets not forwarded from another. A magic is random, a receiver
+    is matched to the packet of this magic sent last before it"""
+    sent = {}
+
+    for line in lines:
+        event = line.trace
+
+        if event and event.kind == 'tx':
+            sent.setdefault(event.magic, []).append([event, [], []])
+
+    def packet_before(magic, tsf):
+        best = None
+
+        for packet in sent.get(magic, []):
+            if packet[0].tsf <= tsf and (best is None or packet[0].tsf > best[0].tsf):
+                best = packet
+
+        return best
+
+    events = [line.trace for line in lines if line.trace]
+    roots  = []
+
+    for event in events:
+        if event.kind == 'rx':
+            packet = packet_before(event.magic, event.tsf)
+
+            if packet:
+                packet[1].append(event)
+
+    for event in events:
+        if event.kind == 'rx':
+            continue
+        elif event.prev:
+            # Forwarded by the node that received the packet of the magic prev
+            packet = packet_before(event.prev, event.tsf)
+            forward = [p for p in sent[event.magic] if p[0] is event][0]
+
+            if packet and any(rx.node == event.node for rx in packet[1]):
+                packet[2].append(forward)
+            else:
+                roots.append(forward)
+        else:
+            roots.append([p for p in sent[event.magic] if p[0] is event][0])
+
+    return roots
+
+
+def walk(packet, origin, depth=0):
+    """The receptions of a tree of packets: (depth, rx, latency of the hop, latency from the origin)"""
+    tx, receptions, forwards = packet
+
+    for rx in sorted(receptions, key=lambda rx: rx.tsf):
+        yield depth, rx, rx.tsf - tx.tsf, rx.tsf - origin.tsf
+
+        for forward in forwards:
+            if forward[0].node == rx.node:
+                for item in walk(forward, origin, depth + 1):
+                    yield item
+
+
+def histogram(values):
+    buckets = [0] * BUCKET_NUM
+
+    for us in values:
+        us = max(us, 0)
+        bucket = us.bit_length() - BUCKET_SHIFT if us >> BUCKET_SHIFT else 0
+        buckets[min(bucket, BUCKET_NUM - 1)] += 1
+
+    return buckets
+
+
+def percentile(values, ratio):
+    ordered = sorted(values)
+    return ordered[min(int(ratio * len(ordered)), len(ordered) - 1)] if ordered else 0
+
+
+def render_histogram(title, values):
+    if not values:
+        return ['%s: no packet' % title]
+
+    lines = ['%s: %d, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms'
+             % (title, len(values), percentile(values, 0.5) / 1000.0, percentile(values, 0.9) / 1000.0,
+                percentile(values, 0.99) / 1000.0, max(values) / 1000.0)]
+    buckets = histogram(values)
+    peak    = max(buckets)
+    first   = min(i for i, number in enumerate(buckets) if number)
+    last    = max(i for i, number in enumerate(buckets) if number)
+
+    for index, number in enumerate(buckets[first:last + 1], first):
+        limit = '>=%d us' % (1 << (BUCKET_SHIFT + index - 1)) if index == BUCKET_NUM - 1 \
+            else '<%d us' % (1 << (BUCKET_SHIFT + index))
+        lines.append('    %10s %8d %s' % (limit, number, '#' * (number * 50 // peak)))
+
+    return lines
+
+
+def latency(lines, pairs=False):
+    roots = match(lines)
+    nodes = set(line.node for line in lines)
+    hops  = []
+    ends  = []
+    lost  = 0
+    per_pair = {}
+
+    for root in roots:
+        origin = root[0]
+
+        for depth, rx, hop, end in walk(root, origin):
+            hops.append(hop)
+            ends.append(end)
+            per_pair.setdefault((origin.node, rx.node), []).append(end)
+
+    # A packet to a node whose logs are read and that it did not log
+    def count_lost(packet):
+        count = 0 if packet[1] or packet[0].addr in GROUP_ADDRS or packet[0].addr not in nodes else 1
+        return count + sum(count_lost(forward) for forward in packet[2])
+
+    for root in roots:
+        lost += count_lost(root)
+
+    output = ['%d nodes, %d packets sent, %d received, %d lost' % (len(nodes), len(roots), len(ends), lost)]
+    output += render_histogram('hop', hops)
+    output += render_histogram('end to end', ends)
+
+    if pairs:
+        output.append('%-17s    %-17s %8s %10s %10s %10s' % ('from', 'to', 'packets', 'p50 ms', 'p99 ms', 'max ms'))
+
+        for (src, dest), values in sorted(per_pair.items(), key=lambda item: -percentile(item[1], 0.99)):
+            output.append('%-17s -> %-17s %8d %10.1f %10.1f %10.1f'
+                          % (src, dest, len(values), percentile(values, 0.5) / 1000.0,
+                             percentile(values, 0.99) / 1000.0, max(values) / 1000.0))
+
+    return output
+
+
+def paths(lines, magic=None, slower_ms=None, limit=None):
+    output = []
+
+    for root in match(lines):
+        origin    = root[0]
+        reception = list(walk(root, origin))
+        magics    = set([origin.magic] + [rx.magic for _, rx, _, _ in reception])
+
+        if magic is not None and magic not in magics:
+            continue
+
+        if slower_ms is not None and not any(end >= slower_ms * 1000 for _, _, _, end in reception):
+            continue
+
+        output.append('%08x %s -> %s, size: %d, tsf: %d'
+                      % (origin.magic, origin.node, origin.addr, origin.size, origin.tsf))
+
+        for depth, rx, hop, end in reception:
+            output.append('    %s-> %s, hop %.1f ms, total %.1f ms' % ('  ' * depth, rx.node, hop / 1000.0, end / 1000.0))
+
+        if not reception:
+            output.append('    not received')
+
+        if limit and len([line for line in output if not line.startswith(' ')]) >= limit:
+            break
+
+    return output
+
+
+def timeline(lines, pattern=None):
+    offsets = align(lines)
+    regex   = re.compile(pattern) if pattern else None
+    output  = []
+    aligned = []
+
+    for line in lines:
+        if regex and not regex.search(line.tag + ': ' + line.text):
+            continue
+
+        time = mesh_ms(line, offsets)
+
+        # The lines of a boot without trace line keep their local time and are marked
+        aligned.append((time if time is not None else line.local_ms, time is None, line))
+
+    for time, local, line in sorted(aligned, key=lambda item: item[0]):
+        output.append('%12.1f%s [%s] %s (%d) %s: %s' % (time, '*' if local else ' ', line.node, line.level,
+                                                       line.local_ms, line.tag, line.text))
+
+    return output
+
+
+class Mesh(object):
+    """Nodes with their own boot time sending packets, the logs they write as mwifi does
+    with CONFIG_MWIFI_TRACE"""
+
+    def __init__(self, nodes, seed=1):
+        self.rng   = random.Random(seed)
+        self.nodes = nodes
+        self.boot  = dict((node, self.rng.randrange(1000, 50000) * 1000) for node in nodes)
+        self.logs  = dict((node, []) for node in nodes)
+
+    def log(self, node, tsf, text, level='I', tag='mwifi'):
+        local_ms = (tsf - self.boot[node]) // 1000
+        color    = {'I': '32', 'W': '33', 'E': '31'}[level]
+        self.logs[node].append((tsf, '\x1b[0;%sm%s (%d) %s: %s\x1b[0m' % (color, level, local_ms, tag, text)))
+
+    def lines(self, node):
+        return [line for _, line in sorted(self.logs[node], key=lambda item: item[0])]
+
+    def trace(self, kind, node, magic, prev, addr, size, tsf):
+        self.log(node, tsf, 'trace %s, magic: %08x, prev: %08x, addr: %s, size: %d, tsf: %d'
+                 % (kind, magic, prev, addr, size, tsf))
+
+    def send(self, src, dest, tsf, latency_us, lost=False):
+        magic = self.rng.getrandbits(32)
+        self.trace('tx', src, magic, 0, dest, 100, tsf)
+
+        if not lost:
+            self.trace('rx', dest, magic, 0, src, 100, tsf + latency_us)
+
+        return magic
+
+
+def test():
+    nodes = ['30:ae:a4:00:00:%02x' % i for i in range(4)]
+    mesh  = Mesh(nodes)
+    rng   = random.Random(2)
+    tsf   = 60000000
+    sent  = []
+
+    for i in range(2000):
+        src, dest = rng.sample(nodes, 2)
+        tsf += rng.randrange(1000, 20000)
+        latency_us = int(rng.lognormvariate(8, 0.8))
+        lost = i % 100 == 99
+        mesh.send(src, dest, tsf, latency_us, lost)
+        sent.append((src, dest, latency_us, lost))
+
+        if i % 10 == 0:
+            mesh.log(src, tsf + 5, 'heap %d' % rng.randrange(100000), tag='app')
+
+    # Node 0 sends a group packet to nodes 1 and 2, node 2 forwards it to node 3
+    tsf += 100000
+    first = rng.getrandbits(32)
+    mesh.trace('tx', nodes[0], first, 0, 'ff:ff:ff:ff:ff:ff', 300, tsf)
+    mesh.trace('rx', nodes[1], first, 0, nodes[0], 300, tsf + 3000)
+    mesh.trace('rx', nodes[2], first, 0, nodes[0], 300, tsf + 4000)
+    second = rng.getrandbits(32)
+    mesh.trace('tx', nodes[2], second, first, nodes[3], 300, tsf + 5000)
+    mesh.trace('rx', nodes[3], second, 0, nodes[2], 300, tsf + 12000)
+
+    # Node 3 restarts and keeps sending, its logs are aligned again
+    boots = dict(((node, 0), mesh.boot[node] / 1000.0) for node in nodes)
+    tsf += 1000000
+    mesh.boot[nodes[3]] = tsf - 100000
+    boots[(nodes[3], 1)] = mesh.boot[nodes[3]] / 1000.0
+    mesh.log(nodes[3], tsf, 'restart after a reset', tag='app')
+    mesh.send(nodes[3], nodes[0], tsf + 1000, 2500)
+
+    # The logs of node 0 from the receiver, node 1 from a file named by its address,
+    # node 2 from a serial console, node 3 from a dump of its log partition
+    texts = [('receiver', '\n'.join('[%s] %s' % (nodes[0], line) for line in mesh.lines(nodes[0]))),
+             (node_of_file('30-ae-a4-00-00-01.log'), '\r\n'.join(mesh.lines(nodes[1]))),
+             ('30:ae:a4:00:00:02', '\n'.join(mesh.lines(nodes[2])))]
+    flash_logs = [(index, (ANSI.sub('', line) + '\n').encode()) for index, line in enumerate(mesh.lines(nodes[3]))]
+    image, _ = mdebug_flash_log.write_sectors(flash_logs, 64)
+    sectors  = mdebug_flash_log.parse(image, 0, len(image))
+    texts.append((nodes[3], b''.join(b''.join(logs) for _, _, logs in sectors).decode('latin-1')))
+
+    lines   = parse(texts)
+    offsets = align(lines)
+
+    if sorted(offsets) != sorted(boots):
+        print('FAIL: boots aligned %s' % sorted(offsets))
+        return 1
+
+    for (node, boot), offset in sorted(offsets.items()):
+        if abs(offset - boots[(node, boot)]) > 1:
+            print('FAIL: %s boot %d aligned at %.1f ms instead of %.1f ms'
+                  % (node, boot, offset, boots[(node, boot)]))
+            return 1
+
+    roots = match(lines)
+    ends  = sorted(end for root in roots for _, _, _, end in walk(root, root[0]))
+    expect = sorted([latency_us for _, _, latency_us, lost in sent if not lost] + [3000, 4000, 12000, 2500])
+
+    if ends != expect:
+        print('FAIL: %d latencies matched instead of %d' % (len(ends), len(expect)))
+        return 1
+
+    report = latency(lines, pairs=True)
+    lost   = len([item for item in sent if item[3]])
+
+    if not report[0].endswith('%d lost' % lost):
+        print('FAIL: %s, %d lost' % (report[0], lost))
+        return 1
+
+    forwarded = paths(lines, magic=second)
+
+    if len(forwarded) != 4 or 'total 12.0 ms' not in forwarded[-1] or not forwarded[-1].startswith('      -> '):
+        print('FAIL: path of the forwarded packet\n' + '\n'.join(forwarded))
+        return 1
+
+    merged = timeline(lines, 'trace|restart')
+    times  = [float(line.split()[0].rstrip('*')) for line in merged]
+
+    if times != sorted(times) or any('*' in line.split()[0] for line in merged):
+        print('FAIL: the timeline is not in order')
+        return 1
+
+    print('\n'.join(report[:2] + forwarded))
+    print('PASS: %d nodes, %d boots aligned, %d packets matched, %d lost'
+          % (len(nodes), len(offsets), len(ends), lost))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Analyze the logs of the nodes of a mesh together')
+    subparsers = parser.add_subparsers(dest='command')
+
+    def add_inputs(subparser):
+        subparser.add_argument('inputs', nargs='+', help='Logs of the receiver, of the nodes or dumps of their log partition')
+        subparser.add_argument('--offset', type=int, default=0, help='Offset of the log file in the dumps')
+        subparser.add_argument('--size', type=int, help='CONFIG_MDEBUG_LOG_FILE_MAX_SIZE, the rest of the dumps by default')
+
+    parser_latency = subparsers.add_parser('latency', help='Histograms of the latency of the packets')
+    add_inputs(parser_latency)
+    parser_latency.add_argument('--pairs', action='store_true', help='The latency per sender and receiver')
+
+    parser_paths = subparsers.add_parser('paths', help='The nodes each packet went through')
+    add_inputs(parser_paths)
+    parser_paths.add_argument('--magic', type=lambda value: int(value, 16), help='Only the packet of this magic')
+    parser_paths.add_argument('--slower', type=float, help='Only the packets slower than this, in ms')
+    parser_paths.add_argument('--limit', type=int, help='Number of packets')
+
+    parser_timeline = subparsers.add_parser('timeline', help='The logs of all the nodes on the TSF clock')
+    add_inputs(parser_timeline)
+    parser_timeline.add_argument('--grep', help='Only the lines matching this regular expression')
+
+    subparsers.add_parser('test', help='Logs of a simulated mesh must align and match')
+
+    args = parser.parse_args()
+
+    if args.command == 'test':
+        return test()
+    elif args.command not in ('latency', 'paths', 'timeline'):
+        parser.print_help()
+        return 1
+
+    lines = parse([(node_of_file(path), read_text(path, args.offset, args.size)) for path in args.inputs])
+
+    if not lines:
+        print('No log found')
+        return 1
+
+    if args.command == 'latency':
+        output = latency(lines, args.pairs)
+    elif args.command == 'paths':
+        output = paths(lines, args.magic, args.slower, args.limit)
+    else:
+        output = timeline(lines, args.grep)
+
+    print('\n'.join(output))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
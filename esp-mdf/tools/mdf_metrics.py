@@ -0,0 +1,305 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Decode the metrics snapshots of components/mcommon/mdf_metrics.c, CONFIG_MDF_METRICS.
+A snapshot is read in base64 from:
+
+    the console,  "metrics -b":                 mdf_metrics: <base64>
+    the receiver, "metrics -s <addr>":          [xx:xx:xx:xx:xx:xx] mdf_metrics: <base64>
+    mlink,        {"request": "get_metrics"}:   "metrics": "<base64>"
+
+Logs, files of responses or snapshots themselves can be given. With several
+snapshots of a device, the counters are also given per second since the
+previous one.
+
+Usage:
+    mdf_metrics.py decode <log | base64> [...] [--all]
+    mdf_metrics.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import base64
+import os
+import random
+import re
+import struct
+import sys
+
+# Must match mdf_metrics_snapshot_t and the enums of mdf_metrics.h, new ones are appended
+HEADER     = struct.Struct('<BBBBBBHI')
+VERSION    = 1
+COUNTERS   = ['mwifi_fragment_send', 'mwifi_fragment_recv', 'mwifi_reassembly_drop', 'mwifi_duplicate',
+              'mwifi_no_memory_retry', 'mwifi_send_fail', 'mespnow_send', 'mespnow_send_retry',
+              'mespnow_send_fail', 'mespnow_recv', 'mespnow_duplicate', 'mespnow_crc_fail',
+              'mespnow_queue_full', 'mlink_request', 'mlink_request_fail']
+GAUGES     = ['mespnow_queue_high']
+HISTOGRAMS = ['mwifi_write_us', 'mespnow_write_us', 'mlink_handle_us']
+
+LINE = re.compile(r'(?:\[([0-9a-f:]{17})\] )?mdf_metrics: ([A-Za-z0-9+/=]+)|"metrics":\s*"([A-Za-z0-9+/=]+)"')
+
+
+def name(names, index, kind):
+    return names[index] if index < len(names) else '%s_%d' % (kind, index)
+
+
+def decode(data):
+    """The snapshot as a dict, ValueError if it is not one"""
+    if len(data) < HEADER.size:
+        raise ValueError('Snapshot too short, %d bytes' % len(data))
+
+    version, counter_num, gauge_num, histogram_num, bucket_num, bucket_shift, _, uptime_ms = HEADER.unpack_from(data)
+    value_num = counter_num + gauge_num + histogram_num * (bucket_num + 1)
+
+    if version != VERSION:
+        raise ValueError('Snapshot version %d, this tool reads version %d' % (version, VERSION))
+
+    if len(data) < HEADER.size + value_num * 4:
+        raise ValueError('Snapshot too short, %d bytes for %d values' % (len(data), value_num))
+
+    values   = struct.unpack_from('<%dI' % value_num, data, HEADER.size)
+    snapshot = {'uptime_ms': uptime_ms, 'bucket_shift': bucket_shift, 'counters': [], 'gauges': [], 'histograms': []}
+
+    for i in range(counter_num):
+        snapshot['counters'].append((name(COUNTERS, i, 'counter'), values[i]))
+
+    for i in range(gauge_num):
+        snapshot['gauges'].append((name(GAUGES, i, 'gauge'), values[counter_num + i]))
+
+    for i in range(histogram_num):
+        offset = counter_num + gauge_num + i * (bucket_num + 1)
+        snapshot['histograms'].append((name(HISTOGRAMS, i, 'histogram'),
+                                       list(values[offset:offset + bucket_num]), values[offset + bucket_num]))
+
+    return snapshot
+
+
+def bucket_limit(index, bucket_num, bucket_shift):
+    """Values of the bucket are below this limit, None for the last one"""
+    return None if index == bucket_num - 1 else 1 << (bucket_shift + index)
+
+
+def percentile(buckets, bucket_shift, maximum, ratio):
+    """The upper bound of the bucket holding this ratio of the values"""
+    count = sum(buckets)
+    total = 0
+
+    for index, number in enumerate(buckets):
+        total += number
+
+        if number and total >= ratio * count:
+            limit = bucket_limit(index, len(buckets), bucket_shift)
+            return maximum if limit is None else min(limit, maximum)
+
+    return 0
+
+
+def parse(texts):
+    """The snapshots of the texts: [(addr, snapshot)], the invalid ones are reported"""
+    snapshots = []
+
+    for text in texts:
+        for match in LINE.finditer(text):
+            addr, b64 = match.group(1) or 'local', match.group(2) or match.group(3)
+
+            try:
+                snapshots.append((addr, decode(base64.b64decode(b64))))
+            except (TypeError, ValueError) as e:
+                print('%s: %s' % (addr, e))
+
+    return snapshots
+
+
+def render(addr, snapshot, previous=None, show_all=False):
+    lines = ['%s, uptime: %.1f s' % (addr, snapshot['uptime_ms'] / 1000.0)]
+    seconds = None
+
+    if previous and snapshot['uptime_ms'] > previous['uptime_ms']:
+        seconds = (snapshot['uptime_ms'] - previous['uptime_ms']) / 1000.0
+
+    for index, (counter, value) in enumerate(snapshot['counters']):
+        if not value and not show_all:
+            continue
+
+        line = '    %-24s %10d' % (counter, value)
+
+        # A counter lower than before, the device restarted or was reset
+        if seconds and index < len(previous['counters']) and value >= previous['counters'][index][1]:
+            line += '  %10.1f/s' % ((value - previous['counters'][index][1]) / seconds)
+
+        lines.append(line)
+
+    for gauge, value in snapshot['gauges']:
+        lines.append('    %-24s %10d' % (gauge, value))
+
+    for histogram, buckets, maximum in snapshot['histograms']:
+        if not sum(buckets) and not show_all:
+            continue
+
+        lines.append('    %-24s %10d  p50 <%d us, p90 <%d us, p99 <%d us, max %d us'
+                     % (histogram, sum(buckets),
+                        percentile(buckets, snapshot['bucket_shift'], maximum, 0.5),
+                        percentile(buckets, snapshot['bucket_shift'], maximum, 0.9),
+                        percentile(buckets, snapshot['bucket_shift'], maximum, 0.99), maximum))
+
+    return '\n'.join(lines)
+
+
+class Device(object):
+    """The registry of a device, as mdf_metrics_add(), mdf_metrics_max(), mdf_metrics_observe()
+    and mdf_metrics_snapshot() update and merge the metrics of each core"""
+
+    def __init__(self, cores=2, bucket_num=16, bucket_shift=6):
+        self.bucket_num   = bucket_num
+        self.bucket_shift = bucket_shift
+        self.cores = [{'counters': [0] * len(COUNTERS), 'gauges': [0] * len(GAUGES),
+                       'buckets': [[0] * bucket_num for _ in HISTOGRAMS], 'max_us': [0] * len(HISTOGRAMS)}
+                      for _ in range(cores)]
+
+    def add(self, core, id, n=1):
+        self.cores[core]['counters'][id] = (self.cores[core]['counters'][id] + n) & 0xffffffff
+
+    def max(self, core, id, value):
+        self.cores[core]['gauges'][id] = max(self.cores[core]['gauges'][id], value)
+
+    def observe(self, core, id, us):
+        bucket = us.bit_length() - self.bucket_shift if us >> self.bucket_shift else 0
+        self.cores[core]['buckets'][id][min(bucket, self.bucket_num - 1)] += 1
+        self.cores[core]['max_us'][id] = max(self.cores[core]['max_us'][id], us)
+
+    def snapshot(self, uptime_ms):
+        values = [sum(core['counters'][i] for core in self.cores) & 0xffffffff for i in range(len(COUNTERS))]
+        values += [max(core['gauges'][i] for core in self.cores) for i in range(len(GAUGES))]
+
+        for i in range(len(HISTOGRAMS)):
+            values += [sum(core['buckets'][i][j] for core in self.cores) for j in range(self.bucket_num)]
+            values.append(max(core['max_us'][i] for core in self.cores))
+
+        return HEADER.pack(VERSION, len(COUNTERS), len(GAUGES), len(HISTOGRAMS), self.bucket_num,
+                           self.bucket_shift, 0, uptime_ms) + struct.pack('<%dI' % len(values), *values)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode the metrics snapshots of mdf_metrics')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_decode = subparsers.add_parser('decode', help='Print the snapshots of logs, responses or base64')
+    parser_decode.add_argument('inputs', nargs='+', help='Files with "mdf_metrics:" lines or "metrics" fields, or a snapshot')
+    parser_decode.add_argument('--all', action='store_true', help='Also print the counters and histograms at zero')
+
+    subparsers.add_parser('test', help='Snapshots of two cores must merge, decode and give their percentiles')
+
+    args = parser.parse_args()
+
+    if args.command == 'decode':
+        texts = []
+
+        for item in args.inputs:
+            if os.path.isfile(item):
+                with open(item, 'rb') as f:
+                    texts.append(f.read().decode('latin-1'))
+            else:
+                texts.append('mdf_metrics: ' + item)
+
+        snapshots = parse(texts)
+
+        if not snapshots:
+            print('No metrics snapshot found')
+            return 1
+
+        previous = {}
+
+        for addr, snapshot in snapshots:
+            print(render(addr, snapshot, previous.get(addr), args.all))
+            previous[addr] = snapshot
+    elif args.command == 'test':
+        rng    = random.Random(1)
+        device = Device()
+        sent   = 0
+        latency = []
+
+        for _ in range(5000):
+            core = rng.randrange(2)
+            us   = int(rng.lognormvariate(7, 1))
+            device.add(core, COUNTERS.index('mwifi_fragment_send'))
+            device.observe(core, HISTOGRAMS.index('mwifi_write_us'), us)
+            sent += 1
+            latency.append(us)
+
+        device.add(1, COUNTERS.index('mwifi_no_memory_retry'), 3)
+        device.max(0, GAUGES.index('mespnow_queue_high'), 4)
+        device.max(1, GAUGES.index('mespnow_queue_high'), 2)
+
+        first  = base64.b64encode(device.snapshot(10000)).decode()
+        device.add(0, COUNTERS.index('mwifi_fragment_send'), 500)
+        second = base64.b64encode(device.snapshot(20000)).decode()
+        log    = ('I (10000) mdebug_cmd: metrics\nmdf_metrics: %s\n'
+                  '[30:ae:a4:00:4b:90] mdf_metrics: %s\n{"metrics": "%s", "status_code": 0}\n' % (first, second, second))
+
+        snapshots = parse([log])
+
+        if len(snapshots) != 3 or [addr for addr, _ in snapshots] != ['local', '30:ae:a4:00:4b:90', 'local']:
+            print('FAIL: %d snapshots found in the log' % len(snapshots))
+            return 1
+
+        snapshot = snapshots[0][1]
+        counters = dict(snapshot['counters'])
+        _, buckets, maximum = snapshot['histograms'][HISTOGRAMS.index('mwifi_write_us')]
+
+        if (counters['mwifi_fragment_send'] != sent or counters['mwifi_no_memory_retry'] != 3
+                or dict(snapshot['gauges'])['mespnow_queue_high'] != 4 or sum(buckets) != sent or maximum != max(latency)):
+            print('FAIL: the cores are not merged')
+            return 1
+
+        # The percentile is the upper bound of its bucket, at most twice the exact one
+        latency.sort()
+
+        for ratio in (0.5, 0.9, 0.99):
+            exact = latency[int(ratio * len(latency)) - 1]
+            bound = percentile(buckets, snapshot['bucket_shift'], maximum, ratio)
+
+            if not exact < bound <= max(2 * exact, 1 << snapshot['bucket_shift']) and bound != maximum:
+                print('FAIL: p%d is %d us, exact %d us' % (ratio * 100, bound, exact))
+                return 1
+
+        # A newer firmware with more counters is still read
+        newer = bytearray(device.snapshot(30000))
+        newer[1] += 1
+        newer[HEADER.size + len(COUNTERS) * 4:HEADER.size + len(COUNTERS) * 4] = struct.pack('<I', 7)
+
+        if dict(decode(bytes(newer))['counters'])['counter_%d' % len(COUNTERS)] != 7:
+            print('FAIL: an appended counter is not read')
+            return 1
+
+        rate = render('local', snapshots[2][1], snapshot)
+
+        if '50.0/s' not in rate:
+            print('FAIL: the rate between two snapshots\n%s' % rate)
+            return 1
+
+        print(render('local', snapshot))
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
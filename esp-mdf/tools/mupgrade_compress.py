@@ -0,0 +1,255 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Compress firmware for mupgrade.
+
+The format is the one read by mupgrade_compress_write() and
+mupgrade_compress_apply() in components/mupgrade/mupgrade_compress.c:
+
+    packet 0    mupgrade_compress_header_t, padded to PACKET_SIZE
+    packet n    mupgrade_compress_block_t and its raw deflate stream,
+                padded to PACKET_SIZE except the last packet
+
+Every block is an independent deflate stream that fits in one packet, so the
+nodes inflate each packet as it arrives and in any order.
+
+Usage:
+    mupgrade_compress.py compress   firmware.bin firmware.cmp
+    mupgrade_compress.py decompress firmware.cmp firmware.bin
+    mupgrade_compress.py test       [firmware.bin]
+
+Upload firmware.cmp through /ota/firmware like a full firmware.
+"""
+
+from __future__ import print_function
+
+import argparse
+import hashlib
+import random
+import struct
+import sys
+import time
+import zlib
+
+COMPRESS_MAGIC   = 0x504d434d  # "MCMP"
+COMPRESS_VERSION = 1
+
+HEADER_FORMAT = '<IHHIHH32s'
+HEADER_SIZE   = struct.calcsize(HEADER_FORMAT)
+BLOCK_FORMAT  = '<IHHI'
+BLOCK_SIZE    = struct.calcsize(BLOCK_FORMAT)
+
+# Must match MUPGRADE_COMPRESS_PACKET_SIZE and MUPGRADE_COMPRESS_BLOCK_SIZE
+PACKET_SIZE    = 1024
+RAW_BLOCK_SIZE = 4096
+DATA_MAX_SIZE  = PACKET_SIZE - BLOCK_SIZE
+# Decompressed blocks are kept word aligned for flash writes
+RAW_ALIGN      = 16
+
+
+def _deflate(data):
+    compressor = zlib.compressobj(9, zlib.DEFLATED, -15, 9)
+    return compressor.compress(data) + compressor.flush()
+
+
+def _inflate(data, raw_size):
+    decompressor = zlib.decompressobj(-15)
+    raw = decompressor.decompress(data, raw_size)
+
+    if len(raw) != raw_size or not decompressor.eof:
+        raise ValueError('Invalid deflate stream')
+
+    return raw
+
+
+def _next_block(image, offset):
+    """Largest aligned block at offset whose deflate stream fits in one packet"""
+    remain = len(image) - offset
+
+    if remain <= RAW_BLOCK_SIZE:
+        data = _deflate(image[offset:])
+
+        if len(data) <= DATA_MAX_SIZE:
+            return remain, data
+
+    # Search in RAW_ALIGN units, a stored deflate block costs 5 bytes so one unit always fits
+    low  = 1
+    high = min(RAW_BLOCK_SIZE, remain) // RAW_ALIGN
+    best = None
+
+    while low <= high:
+        middle = (low + high) // 2
+        data   = _deflate(image[offset:offset + middle * RAW_ALIGN])
+
+        if len(data) <= DATA_MAX_SIZE:
+            best = (middle * RAW_ALIGN, data)
+            low  = middle + 1
+        else:
+            high = middle - 1
+
+    return best
+
+
+def compress(image):
+    packets = []
+    offset  = 0
+
+    while offset < len(image):
+        raw_size, data = _next_block(image, offset)
+        crc = zlib.crc32(image[offset:offset + raw_size]) & 0xffffffff
+        packets.append(struct.pack(BLOCK_FORMAT, offset, raw_size, len(data), crc) + data)
+        offset += raw_size
+
+    if len(packets) + 1 > 4096:
+        raise ValueError('The image needs %d packets, more than MUPGRADE_PACKET_MAX_NUM' % (len(packets) + 1))
+
+    header = struct.pack(HEADER_FORMAT, COMPRESS_MAGIC, COMPRESS_VERSION, HEADER_SIZE, len(image),
+                         len(packets), RAW_BLOCK_SIZE, hashlib.sha256(image).digest())
+    packets.insert(0, header)
+
+    return b''.join(packet.ljust(PACKET_SIZE, b'\0') for packet in packets[:-1]) + packets[-1]
+
+
+def decompress(container, shuffle=False):
+    """
+    Rebuild the image the way the node does: each packet is inflated on its
+    own into a RAW_BLOCK_SIZE buffer and written at the offset of its block.
+    """
+    magic, version, header_size, image_size, block_num, block_size, image_sha256 = \
+        struct.unpack_from(HEADER_FORMAT, container)
+
+    if magic != COMPRESS_MAGIC or version != COMPRESS_VERSION or block_size > RAW_BLOCK_SIZE:
+        raise ValueError('Invalid compressed header, magic: 0x%x, version: %d' % (magic, version))
+
+    seqs = list(range(1, (len(container) + PACKET_SIZE - 1) // PACKET_SIZE))
+
+    if len(seqs) != block_num:
+        raise ValueError('The compressed firmware is truncated, block_num: %d, expected: %d' % (len(seqs), block_num))
+
+    if shuffle:
+        random.Random(1).shuffle(seqs)
+
+    image = bytearray(b'\xff' * image_size)
+
+    for seq in seqs:
+        packet = container[seq * PACKET_SIZE:(seq + 1) * PACKET_SIZE]
+        offset, raw_size, data_size, crc = struct.unpack_from(BLOCK_FORMAT, packet)
+
+        if raw_size > block_size or offset + raw_size > image_size or BLOCK_SIZE + data_size > len(packet):
+            raise ValueError('Invalid compressed block, seq: %d' % seq)
+
+        raw = _inflate(packet[BLOCK_SIZE:BLOCK_SIZE + data_size], raw_size)
+
+        if zlib.crc32(raw) & 0xffffffff != crc:
+            raise ValueError('The crc32 of the block does not match, seq: %d' % seq)
+
+        image[offset:offset + raw_size] = raw
+
+    if hashlib.sha256(image).digest() != image_sha256:
+        raise ValueError('The sha256 of the image does not match')
+
+    return bytes(image)
+
+
+def report(image, container, elapsed):
+    packets = (len(container) + PACKET_SIZE - 1) // PACKET_SIZE
+
+    print('image size   : %d, %d packets' % (len(image), (len(image) + PACKET_SIZE - 1) // PACKET_SIZE))
+    print('compressed   : %d, %d packets (%.1f%% of image)' %
+          (len(container), packets, len(container) * 100.0 / max(len(image), 1)))
+    print('node memory  : %d bytes of output buffer and one inflate context' % RAW_BLOCK_SIZE)
+    print('compress time: %.2fs' % elapsed)
+
+
+def synthetic_image(size=1024 * 1024, seed=1):
+    """Image made of repeated instruction-like words and strings, roughly as compressible as firmware"""
+    rng   = random.Random(seed)
+    words = [struct.pack('<I', rng.getrandbits(32)) for _ in range(64)]
+    text  = [b'mupgrade', b'mwifi_root_write', b'esp_partition_write', b'MDF_ERR_NO_MEM', b'0x%08x']
+    image = bytearray()
+
+    while len(image) < size:
+        if rng.random() < 0.15:
+            image += rng.choice(text) + b'\0'
+        elif rng.random() < 0.2:
+            image += struct.pack('<I', rng.getrandbits(32))
+        else:
+            image += rng.choice(words)
+
+    return bytes(image[:size])
+
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def write_file(path, data):
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compress firmware for mupgrade')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_compress = subparsers.add_parser('compress', help='Compress firmware.bin')
+    parser_compress.add_argument('image', help='Firmware')
+    parser_compress.add_argument('output', help='Output compressed firmware')
+
+    parser_decompress = subparsers.add_parser('decompress', help='Decompress a compressed firmware')
+    parser_decompress.add_argument('input', help='Compressed firmware')
+    parser_decompress.add_argument('image', help='Output firmware')
+
+    parser_test = subparsers.add_parser('test', help='Round trip with packets inflated out of order, report the size')
+    parser_test.add_argument('image', nargs='?', help='Firmware, a synthetic image is used if omitted')
+
+    args = parser.parse_args()
+
+    if args.command == 'compress':
+        image = read_file(args.image)
+        start = time.time()
+        container = compress(image)
+        elapsed = time.time() - start
+        decompress(container)
+        write_file(args.output, container)
+        report(image, container, elapsed)
+    elif args.command == 'decompress':
+        image = decompress(read_file(args.input))
+        write_file(args.image, image)
+        print('image size   : %d' % len(image))
+    elif args.command == 'test':
+        image = read_file(args.image) if args.image else synthetic_image()
+        start = time.time()
+        container = compress(image)
+        elapsed = time.time() - start
+
+        if decompress(container, shuffle=True) != image:
+            print('FAIL: the decompressed image differs from the firmware')
+            return 1
+
+        report(image, container, elapsed)
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,307 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Generate and apply delta firmware for mupgrade.
+
+The delta format is the one read by mupgrade_delta_apply() in
+components/mupgrade/mupgrade_delta.c:
+
+    mupgrade_delta_header_t, then a list of mupgrade_delta_op_t
+    COPY   <offset> <size>  copy from the running (base) image
+    INSERT <size> <data>    data carried in the delta
+    END
+
+Usage:
+    mupgrade_delta.py diff  old.bin new.bin delta.bin
+    mupgrade_delta.py patch old.bin delta.bin new.bin
+    mupgrade_delta.py test  [old.bin new.bin]
+
+Upload delta.bin through /ota/firmware like a full firmware, the root
+detects the delta header and nodes running old.bin rebuild new.bin.
+"""
+
+from __future__ import print_function
+
+import argparse
+import hashlib
+import os
+import random
+import struct
+import sys
+import time
+
+DELTA_MAGIC   = 0x544c444d  # "MDLT"
+DELTA_VERSION = 1
+
+OP_END    = 0
+OP_COPY   = 1
+OP_INSERT = 2
+
+HEADER_FORMAT = '<IHHII32s32s'
+HEADER_SIZE   = struct.calcsize(HEADER_FORMAT)
+OP_FORMAT     = '<BII'
+OP_SIZE       = struct.calcsize(OP_FORMAT)
+
+# Shortest run worth a COPY, shorter runs cost less as INSERT data
+MATCH_SIZE  = 32
+# Base offsets indexed every INDEX_STEP bytes, every run of
+# MATCH_SIZE + INDEX_STEP - 1 common bytes is still found
+INDEX_STEP  = 8
+# Must match MUPGRADE_PACKET_MAX_SIZE, the only buffer the node uses
+BUFFER_SIZE = 1440
+
+
+def _match_forward(base, base_offset, target, target_offset):
+    size  = 0
+    limit = min(len(base) - base_offset, len(target) - target_offset)
+    chunk = 256
+
+    while size + chunk <= limit and \
+            base[base_offset + size:base_offset + size + chunk] == target[target_offset + size:target_offset + size + chunk]:
+        size += chunk
+
+    while size < limit and base[base_offset + size] == target[target_offset + size]:
+        size += 1
+
+    return size
+
+
+def diff(base, target):
+    """Return the list of operations rebuilding target from base"""
+    index = {}
+
+    for offset in range(0, len(base) - MATCH_SIZE + 1, INDEX_STEP):
+        index.setdefault(base[offset:offset + MATCH_SIZE], offset)
+
+    ops         = []
+    insert_from = 0
+    next_copy   = None
+    i           = 0
+
+    while i <= len(target) - MATCH_SIZE:
+        # Prefer continuing the previous copy, code that did not move stays one operation
+        if next_copy is not None and base[next_copy:next_copy + MATCH_SIZE] == target[i:i + MATCH_SIZE]:
+            offset = next_copy
+        else:
+            offset = index.get(target[i:i + MATCH_SIZE])
+
+        if offset is None:
+            i += 1
+            continue
+
+        size = _match_forward(base, offset, target, i)
+
+        # Take back the bytes in front of the match that were about to be inserted
+        while i > insert_from and offset > 0 and base[offset - 1] == target[i - 1]:
+            i, offset, size = i - 1, offset - 1, size + 1
+
+        if i > insert_from:
+            ops.append((OP_INSERT, 0, target[insert_from:i]))
+
+        if ops and ops[-1][0] == OP_COPY and ops[-1][1] + ops[-1][2] == offset:
+            ops[-1] = (OP_COPY, ops[-1][1], ops[-1][2] + size)
+        else:
+            ops.append((OP_COPY, offset, size))
+
+        i          += size
+        insert_from = i
+        next_copy   = offset + size
+
+    if insert_from < len(target):
+        ops.append((OP_INSERT, 0, target[insert_from:]))
+
+    return ops
+
+
+def encode(base, target, ops):
+    data = [struct.pack(HEADER_FORMAT, DELTA_MAGIC, DELTA_VERSION, HEADER_SIZE, len(base), len(target),
+                        hashlib.sha256(base).digest(), hashlib.sha256(target).digest())]
+
+    for op, offset, value in ops:
+        if op == OP_COPY:
+            data.append(struct.pack(OP_FORMAT, OP_COPY, offset, value))
+        else:
+            data.append(struct.pack(OP_FORMAT, OP_INSERT, 0, len(value)))
+            data.append(value)
+
+    data.append(struct.pack(OP_FORMAT, OP_END, 0, 0))
+    return b''.join(data)
+
+
+def patch(base, delta):
+    """
+    Rebuild the new image the way the node does: operations are read one at
+    a time and data moves through a single BUFFER_SIZE buffer.
+    Return the new image and the number of bytes held while applying.
+    """
+    magic, version, header_size, base_size, target_size, base_sha256, target_sha256 = \
+        struct.unpack_from(HEADER_FORMAT, delta)
+
+    if magic != DELTA_MAGIC or version != DELTA_VERSION:
+        raise ValueError('Invalid delta header, magic: 0x%x, version: %d' % (magic, version))
+
+    if base_size != len(base) or hashlib.sha256(base).digest() != base_sha256:
+        raise ValueError('The base image does not match the delta')
+
+    target = bytearray()
+    offset = header_size
+
+    while True:
+        op, op_offset, size = struct.unpack_from(OP_FORMAT, delta, offset)
+        offset += OP_SIZE
+
+        if op == OP_END:
+            break
+        elif op == OP_COPY:
+            if op_offset + size > base_size:
+                raise ValueError('Copy out of the base image, offset: %d, size: %d' % (op_offset, size))
+            source, source_offset = base, op_offset
+        elif op == OP_INSERT:
+            source, source_offset = delta, offset
+            offset += size
+        else:
+            raise ValueError('Unknown delta operation, type: %d' % op)
+
+        for chunk in range(0, size, BUFFER_SIZE):
+            target += source[source_offset + chunk:source_offset + min(size, chunk + BUFFER_SIZE)]
+
+    if len(target) != target_size or hashlib.sha256(target).digest() != target_sha256:
+        raise ValueError('The sha256 of the new image does not match')
+
+    return bytes(target), BUFFER_SIZE + HEADER_SIZE + OP_SIZE
+
+
+def report(base, target, delta, apply_memory, elapsed):
+    copy_size   = 0
+    insert_size = 0
+    op_num      = 0
+    offset      = HEADER_SIZE
+
+    while True:
+        op, _, size = struct.unpack_from(OP_FORMAT, delta, offset)
+        offset += OP_SIZE
+        op_num += 1
+
+        if op == OP_END:
+            break
+        elif op == OP_COPY:
+            copy_size += size
+        else:
+            insert_size += size
+            offset      += size
+
+    print('base size    : %d' % len(base))
+    print('target size  : %d' % len(target))
+    print('delta size   : %d (%.1f%% of target)' % (len(delta), len(delta) * 100.0 / max(len(target), 1)))
+    print('operations   : %d, copied: %d, inserted: %d' % (op_num, copy_size, insert_size))
+    print('apply memory : %d bytes (independent of the image size)' % apply_memory)
+    print('diff time    : %.2fs' % elapsed)
+
+
+def synthetic_images(size=1024 * 1024, change=0.03, seed=1):
+    """Base image and a target that shifts code and changes about `change` of it"""
+    rng  = random.Random(seed)
+    base = bytearray(rng.getrandbits(8) for _ in range(size))
+
+    target = bytearray(base)
+    edits  = max(1, int(size * change / 512))
+
+    for _ in range(edits):
+        offset = rng.randrange(len(target))
+        length = rng.randrange(16, 1024)
+        kind   = rng.randrange(3)
+
+        if kind == 0:
+            target[offset:offset + length] = bytearray(rng.getrandbits(8) for _ in range(length))
+        elif kind == 1:
+            target[offset:offset] = bytearray(rng.getrandbits(8) for _ in range(length))
+        else:
+            del target[offset:offset + length]
+
+    return bytes(base), bytes(target)
+
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def write_file(path, data):
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate and apply mupgrade delta firmware')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_diff = subparsers.add_parser('diff', help='Generate a delta from old.bin to new.bin')
+    parser_diff.add_argument('base', help='Firmware running on the nodes')
+    parser_diff.add_argument('target', help='New firmware')
+    parser_diff.add_argument('delta', help='Output delta')
+
+    parser_patch = subparsers.add_parser('patch', help='Apply a delta to old.bin')
+    parser_patch.add_argument('base', help='Firmware the delta was generated from')
+    parser_patch.add_argument('delta', help='Delta generated by diff')
+    parser_patch.add_argument('target', help='Output firmware')
+
+    parser_test = subparsers.add_parser('test', help='Round trip diff and patch, report the delta size and apply memory')
+    parser_test.add_argument('base', nargs='?', help='Old firmware, a synthetic image is used if omitted')
+    parser_test.add_argument('target', nargs='?', help='New firmware')
+
+    args = parser.parse_args()
+
+    if args.command == 'diff':
+        base, target = read_file(args.base), read_file(args.target)
+        start = time.time()
+        delta = encode(base, target, diff(base, target))
+        elapsed = time.time() - start
+        _, apply_memory = patch(base, delta)
+        write_file(args.delta, delta)
+        report(base, target, delta, apply_memory, elapsed)
+    elif args.command == 'patch':
+        target, _ = patch(read_file(args.base), read_file(args.delta))
+        write_file(args.target, target)
+        print('target size  : %d' % len(target))
+    elif args.command == 'test':
+        if args.base and args.target:
+            base, target = read_file(args.base), read_file(args.target)
+        elif args.base or args.target:
+            parser.error('test needs both old.bin and new.bin, or neither')
+        else:
+            base, target = synthetic_images()
+
+        start = time.time()
+        delta = encode(base, target, diff(base, target))
+        elapsed = time.time() - start
+        rebuilt, apply_memory = patch(base, delta)
+
+        if rebuilt != target:
+            print('FAIL: the rebuilt image differs from the new firmware')
+            return 1
+
+        report(base, target, delta, apply_memory, elapsed)
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
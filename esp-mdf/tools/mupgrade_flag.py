@@ -0,0 +1,247 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Benchmark the lookup of the firmware flag of mupgrade_firmware_check().
+
+    kmp       byte by byte over the whole partition, the previous lookup
+    word      a word at a time over the whole partition, only the bytes equal
+              to the first byte of the flag are compared
+    drom      a word at a time over the segments mapped to DROM, found from the
+              image header, the lookup of components/mupgrade/mupgrade_check.c
+
+The time is that of this script, the bytes read are what matters on the device
+where every byte is read through the flash cache.
+
+Usage:
+    mupgrade_flag.py bench [firmware.bin] [--size 4] [--flag "** MUPGRADE_FIRMWARE_FLAG **"]
+    mupgrade_flag.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import random
+import struct
+import sys
+import time
+
+# Must match CONFIG_MUPGRADE_FIRMWARE_FLAG, ESP_IMAGE_HEADER_MAGIC and ESP_APP_DESC_MAGIC_WORD
+FLAG              = b'** MUPGRADE_FIRMWARE_FLAG **'
+IMAGE_MAGIC       = 0xE9
+APP_DESC_MAGIC    = 0xABCD5432
+IMAGE_HEADER_SIZE = 24
+SEGMENT_HEADER    = struct.Struct('<II')
+DROM_LOW          = 0x3F400000
+DROM_HIGH         = 0x3F800000
+ONES_WORD         = 0x01010101
+HIGHS_WORD        = 0x80808080
+
+
+def find_kmp(image, flag, start=0, end=None):
+    end  = len(image) if end is None else end
+    fail = [0] * len(flag)
+    j    = 0
+
+    for i in range(1, len(flag)):
+        while j > 0 and flag[j] != flag[i]:
+            j = fail[j - 1]
+
+        if flag[j] == flag[i]:
+            j += 1
+
+        fail[i] = j
+
+    j = 0
+
+    for i in range(start, end):
+        while j > 0 and image[i] != flag[j]:
+            j = fail[j - 1]
+
+        if image[i] == flag[j]:
+            j += 1
+
+            if j == len(flag):
+                return i - j + 1, i + 1 - start
+
+    return None, end - start
+
+
+def find_word(image, flag, start=0, end=None):
+    """Same as mupgrade_flag_find(), start is word aligned"""
+    end        = len(image) if end is None else end
+    last       = end - len(flag) + 1
+    first_word = flag[0] * ONES_WORD
+    word_end   = start + (last - start) // 4 * 4
+
+    # Unpacked by chunks to stop at the flag
+    for chunk in range(start, word_end, 4096):
+        words = struct.unpack_from('<%dI' % ((min(chunk + 4096, word_end) - chunk) // 4), image, chunk)
+
+        for index, word in enumerate(words):
+            word ^= first_word
+
+            if not ((word - ONES_WORD) & ~word & HIGHS_WORD):
+                continue
+
+            offset = chunk + index * 4
+
+            for i in range(offset, offset + 4):
+                if image[i] == flag[0] and image[i:i + len(flag)] == flag:
+                    return i, i + 4 - start
+
+    for i in range(word_end, last):
+        if image[i:i + len(flag)] == flag:
+            return i, i + 1 - start
+
+    return None, end - start
+
+
+def find_drom(image, flag):
+    """Same as mupgrade_flag_find_drom(), the partition is only searched if the layout is unknown"""
+    magic, segment_count = struct.unpack_from('<BB', image)
+
+    if magic != IMAGE_MAGIC or struct.unpack_from('<I', image, IMAGE_HEADER_SIZE + SEGMENT_HEADER.size)[0] != APP_DESC_MAGIC:
+        return find_word(image, flag)
+
+    offset     = IMAGE_HEADER_SIZE
+    bytes_read = IMAGE_HEADER_SIZE
+
+    for _ in range(segment_count):
+        load_addr, data_len = SEGMENT_HEADER.unpack_from(image, offset)
+        offset     += SEGMENT_HEADER.size
+        bytes_read += SEGMENT_HEADER.size
+
+        if DROM_LOW <= load_addr < DROM_HIGH:
+            found, size = find_word(image, flag, offset, offset + data_len)
+            bytes_read += size
+
+            if found is not None:
+                return found, bytes_read
+
+        offset += data_len
+
+    return None, bytes_read
+
+
+def synthetic_image(size_mb, flag, seed=1):
+    """An image laid out as the ESP-IDF ones: DROM with the app descriptor, DRAM, IRAM, IROM.
+    The flag is near the end of the read-only data, None for a firmware of another project"""
+    rng   = random.Random(seed)
+    total = size_mb * 1024 * 1024
+
+    def random_bytes(size):
+        data = bytearray(rng.getrandbits(8) for _ in range(size % 4096))
+        block = bytearray(rng.getrandbits(8) for _ in range(4096))
+        return data + block * (size // 4096)
+
+    drom_size = total // 8
+    rodata    = random_bytes(drom_size - 256)
+
+    if flag:
+        position = len(rodata) - len(flag) - rng.randrange(1024)
+        rodata[position:position + len(flag)] = flag
+
+    drom = struct.pack('<I', APP_DESC_MAGIC) + b'\0' * 252 + bytes(rodata)
+
+    segments = [(DROM_LOW + 0x20, drom), (0x3FFB0000, bytes(random_bytes(16 * 1024))),
+                (0x40080000, bytes(random_bytes(64 * 1024)))]
+    used     = IMAGE_HEADER_SIZE + sum(SEGMENT_HEADER.size + len(data) for _, data in segments) + SEGMENT_HEADER.size
+    segments.append((0x400D0020, bytes(random_bytes(total - used))))
+
+    image = bytearray(struct.pack('<BB', IMAGE_MAGIC, len(segments)) + b'\0' * (IMAGE_HEADER_SIZE - 2))
+
+    for load_addr, data in segments:
+        image += SEGMENT_HEADER.pack(load_addr, len(data)) + data
+
+    return bytes(image)
+
+
+def bench(image, flag):
+    results = {}
+
+    if not isinstance(image[0], int):  # Python 2
+        image = bytearray(image)
+        flag  = bytearray(flag)
+
+    print('image: %d bytes' % len(image))
+    print('%-6s %10s %12s %10s' % ('lookup', 'offset', 'bytes_read', 'time_ms'))
+
+    for name, lookup in (('kmp', find_kmp), ('word', find_word), ('drom', find_drom)):
+        start         = time.time()
+        offset, size  = lookup(image, flag)
+        elapsed       = (time.time() - start) * 1000
+        results[name] = (offset, size, elapsed)
+        print('%-6s %10s %12d %10.1f' % (name, '0x%x' % offset if offset is not None else 'none', size, elapsed))
+
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the lookup of the firmware flag of mupgrade')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_bench = subparsers.add_parser('bench', help='Compare the lookups on a firmware or a synthetic image')
+    parser_bench.add_argument('image', nargs='?', help='Firmware, a synthetic image is used if omitted')
+    parser_bench.add_argument('--size', type=int, default=4, help='Size of the synthetic image in MB')
+    parser_bench.add_argument('--flag', default=FLAG.decode(), help='CONFIG_MUPGRADE_FIRMWARE_FLAG')
+
+    subparsers.add_parser('test', help='2 and 4 MB images, the lookups must agree and drom read less')
+
+    args = parser.parse_args()
+
+    if args.command == 'bench':
+        if args.image:
+            with open(args.image, 'rb') as f:
+                image = f.read()
+        else:
+            image = synthetic_image(args.size, args.flag.encode())
+
+        bench(image, args.flag.encode())
+    elif args.command == 'test':
+        for size_mb in (2, 4):
+            # The lookups must agree on a firmware of this project
+            results = bench(synthetic_image(size_mb, FLAG), FLAG)
+            offsets = set(offset for offset, _, _ in results.values())
+
+            if len(offsets) != 1 or None in offsets:
+                print('FAIL: %d MB, the lookups do not agree' % size_mb)
+                return 1
+
+            # A firmware of another project is rejected without reading its code
+            results = bench(synthetic_image(size_mb, None), FLAG)
+
+            if results['drom'][0] is not None or results['drom'][1] * 4 > results['kmp'][1]:
+                print('FAIL: %d MB, the firmware without the flag is read entirely' % size_mb)
+                return 1
+
+        image = bytearray(synthetic_image(2, FLAG))
+        image[0] = 0
+
+        if find_drom(bytes(image), FLAG)[0] != find_kmp(bytes(image), FLAG)[0]:
+            print('FAIL: the unknown layout is not searched entirely')
+            return 1
+
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,272 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Build and check the firmware manifest of mupgrade.
+
+The root hashes the firmware while it is downloaded (mupgrade_manifest_update()
+in components/mupgrade/mupgrade_verify.c) and appends the manifest to the
+status request:
+
+    uint16_t block_packets   packets in a block
+    uint16_t block_num       number of blocks
+    block_num * 16 bytes     leading bytes of the SHA-256 of every block
+
+A node checks a block once all of its packets are written. A block that does
+not match is erased together with the packets sharing its sectors and is
+requested again, a corrupted firmware is never booted.
+
+Usage:
+    mupgrade_manifest.py sha256   firmware.bin    value of the Firmware-Sha256 header
+    mupgrade_manifest.py manifest firmware.bin    print the manifest
+    mupgrade_manifest.py test     [firmware.bin]  transfer with lost and corrupted packets
+"""
+
+from __future__ import print_function
+
+import argparse
+import binascii
+import hashlib
+import random
+import struct
+import sys
+
+# Must match MUPGRADE_PACKET_MAX_SIZE, MUPGRADE_MANIFEST_BLOCK_PACKETS and MUPGRADE_MANIFEST_HASH_SIZE
+PACKET_SIZE    = 1440
+BLOCK_PACKETS  = 64
+HASH_SIZE      = 16
+PACKET_MAX_NUM = 4096
+SECTOR_SIZE    = 4096
+RETRY_COUNT    = 20
+
+
+def manifest(image):
+    block_size = BLOCK_PACKETS * PACKET_SIZE
+    hashes = [hashlib.sha256(image[offset:offset + block_size]).digest()[:HASH_SIZE]
+              for offset in range(0, len(image), block_size)]
+
+    if (len(image) + PACKET_SIZE - 1) // PACKET_SIZE > PACKET_MAX_NUM:
+        raise ValueError('The image needs more than %d packets' % PACKET_MAX_NUM)
+
+    return struct.pack('<HH', BLOCK_PACKETS, len(hashes)) + b''.join(hashes)
+
+
+class Node(object):
+    """Flash and progress of a node, same checks as mupgrade_verify_write() and mupgrade_verify_finish()"""
+
+    def __init__(self, total_size, data):
+        self.total_size  = total_size
+        self.packet_num  = (total_size + PACKET_SIZE - 1) // PACKET_SIZE
+        self.flash       = bytearray(b'\xff' * ((total_size + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE))
+        self.progress    = set()
+        self.verified    = set()
+        block_packets, block_num = struct.unpack_from('<HH', data)
+        self.block_packets = block_packets
+        self.hashes = [data[4 + i * HASH_SIZE:4 + (i + 1) * HASH_SIZE] for i in range(block_num)]
+        self.in_order    = None  # [block, next_seq, sha256]
+        self.stats       = {'dropped_blocks': 0, 'dropped_packets': 0, 'read_back': 0, 'in_order': 0}
+
+    def _range(self, block):
+        start = block * self.block_packets
+        return start, min(start + self.block_packets, self.packet_num)
+
+    def _drop(self, start_seq, end_seq):
+        erase_start = start_seq * PACKET_SIZE // SECTOR_SIZE * SECTOR_SIZE
+        erase_end   = (min(end_seq * PACKET_SIZE, self.total_size) + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE
+
+        for seq in range(erase_start // PACKET_SIZE, min((erase_end + PACKET_SIZE - 1) // PACKET_SIZE, self.packet_num)):
+            if seq in self.progress:
+                self.progress.discard(seq)
+                self.stats['dropped_packets'] += 1
+
+            self.verified.discard(seq // self.block_packets)
+
+        self.in_order = None
+        self.flash[erase_start:erase_end] = b'\xff' * (erase_end - erase_start)
+        self.stats['dropped_blocks'] += 1
+
+    def _complete(self, block):
+        start, end = self._range(block)
+        return all(seq in self.progress for seq in range(start, end))
+
+    def _verify(self, block):
+        start, end = self._range(block)
+
+        if self.in_order and self.in_order[0] == block and self.in_order[1] == end:
+            digest = self.in_order[2].digest()
+            self.in_order = None
+            self.stats['in_order'] += 1
+        else:
+            digest = hashlib.sha256(bytes(self.flash[start * PACKET_SIZE:min(end * PACKET_SIZE, self.total_size)])).digest()
+            self.stats['read_back'] += 1
+
+        if digest[:HASH_SIZE] == self.hashes[block]:
+            self.verified.add(block)
+            return True
+
+        self._drop(start, end)
+        return False
+
+    def write(self, seq, data):
+        if seq in self.progress:
+            return True
+
+        offset = seq * PACKET_SIZE
+
+        # A flash write only clears bits
+        for i, value in enumerate(bytearray(data)):
+            self.flash[offset + i] &= value
+
+        self.progress.add(seq)
+        block = seq // self.block_packets
+        start, _ = self._range(block)
+
+        if seq == start:
+            self.in_order = [block, start, hashlib.sha256()]
+
+        if self.in_order and self.in_order[0] == block:
+            if self.in_order[1] == seq:
+                self.in_order[2].update(data)
+                self.in_order[1] += 1
+            else:
+                self.in_order = None
+
+        return not self._complete(block) or self._verify(block)
+
+    def finish(self):
+        ok = True
+
+        for block in range(len(self.hashes)):
+            if block not in self.verified and self._complete(block) and not self._verify(block):
+                ok = False
+
+        return ok
+
+    def image(self):
+        return bytes(self.flash[:self.total_size])
+
+
+def transfer(image, loss, corruption, seed, reset_at=None):
+    """Send the firmware in passes like mupgrade_firmware_send(), the first pass in order"""
+    rng   = random.Random(seed)
+    node  = Node(len(image), manifest(image))
+    packets = [image[seq * PACKET_SIZE:(seq + 1) * PACKET_SIZE] for seq in range(node.packet_num)]
+    stats = {'passes': 0, 'sent': 0, 'corrupted': 0}
+
+    for retry in range(RETRY_COUNT):
+        missing = [seq for seq in range(node.packet_num) if seq not in node.progress]
+
+        if not missing:
+            if node.finish():
+                break
+
+            continue
+
+        stats['passes'] += 1
+
+        # The repair passes are sent in a shuffled order to exercise the read back
+        if retry:
+            rng.shuffle(missing)
+
+        for seq in missing:
+            stats['sent'] += 1
+
+            if rng.random() < loss:
+                continue
+
+            data = packets[seq]
+
+            if rng.random() < corruption:
+                data = bytearray(data)
+                data[rng.randrange(len(data))] ^= 1 << rng.randrange(8)
+                data = bytes(data)
+                stats['corrupted'] += 1
+
+            node.write(seq, data)
+
+        # A reset loses the in-order hashes and the verified blocks, the journal keeps the progress
+        if reset_at is not None and retry == reset_at:
+            node.verified = set()
+            node.in_order = None
+
+    stats.update(node.stats)
+    return node, stats
+
+
+def synthetic_image(size=1024 * 1024, seed=1):
+    rng = random.Random(seed)
+    return bytes(bytearray(rng.getrandbits(8) for _ in range(size)))
+
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build and check the firmware manifest of mupgrade')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_sha256 = subparsers.add_parser('sha256', help='Print the value of the Firmware-Sha256 header')
+    parser_sha256.add_argument('image', help='Firmware as uploaded')
+
+    parser_manifest = subparsers.add_parser('manifest', help='Print the manifest of the firmware')
+    parser_manifest.add_argument('image', help='Firmware as uploaded')
+
+    parser_test = subparsers.add_parser('test', help='Transfer with lost and corrupted packets, the image must match')
+    parser_test.add_argument('image', nargs='?', help='Firmware, a synthetic image is used if omitted')
+
+    args = parser.parse_args()
+
+    if args.command == 'sha256':
+        print(hashlib.sha256(read_file(args.image)).hexdigest())
+    elif args.command == 'manifest':
+        data = manifest(read_file(args.image))
+        block_packets, block_num = struct.unpack_from('<HH', data)
+        print('block_packets: %d, block_num: %d, size: %d' % (block_packets, block_num, len(data)))
+
+        for block in range(block_num):
+            print('%3d %s' % (block, binascii.hexlify(data[4 + block * HASH_SIZE:4 + (block + 1) * HASH_SIZE]).decode()))
+    elif args.command == 'test':
+        image = read_file(args.image) if args.image else synthetic_image()
+        cases = (('clean', 0.0, 0.0, None), ('loss', 0.05, 0.0, None),
+                 ('corrupted', 0.05, 0.01, None), ('reset', 0.05, 0.01, 2))
+
+        print('%-10s %6s %6s %9s %8s %8s %9s %9s' % ('case', 'passes', 'sent', 'corrupted', 'dropped',
+                                                   'in_order', 'read_back', 'result'))
+
+        for name, loss, corruption, reset_at in cases:
+            node, stats = transfer(image, loss, corruption, 1, reset_at)
+            ok = len(node.progress) == node.packet_num and node.image() == image
+
+            print('%-10s %6d %6d %9d %8d %8d %9d %9s' % (name, stats['passes'], stats['sent'], stats['corrupted'],
+                                                       stats['dropped_blocks'], stats['in_order'], stats['read_back'],
+                                                       'match' if ok else 'MISMATCH'))
+
+            if not ok or (corruption and not stats['dropped_blocks']):
+                print('FAIL: %s' % name)
+                return 1
+
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,225 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate the firmware distribution of mupgrade on a mesh tree, with and
+without the tree relay (CONFIG_MUPGRADE_TREE_RELAY).
+
+    root      every pass, each missing packet is sent down the tree to the
+              devices missing it, a packet lost on a link is lost for the
+              whole subtree below it
+    relay     after a pass, each device sends its children the packets it has
+              and they miss, layer by layer since a device finishes once its
+              parent has finished (mupgrade_relay.c)
+
+Time is counted in packet transmissions: a device sends one packet at a time,
+devices send in parallel. A relay round lasts the sum over the layers of the
+busiest device of the layer. Every status request costs STATUS_COST.
+
+Usage:
+    mupgrade_relay.py simulate [--layers 6] [--fanout 3] [--packets 600] [--loss 0.03] [--seed 1]
+    mupgrade_relay.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import random
+import sys
+
+# Must match CONFIG_MUPGRADE_RETRY_COUNT
+RETRY_COUNT = 20
+# Status request and answers, in packet transmissions
+STATUS_COST = 50
+
+
+class Tree(object):
+    def __init__(self, layers, fanout):
+        # Node 0 is the root at layer 1
+        self.parent   = [None]
+        self.layer    = [1]
+        self.children = [[]]
+
+        frontier = [0]
+
+        for layer in range(2, layers + 1):
+            next_frontier = []
+
+            for parent in frontier:
+                for _ in range(fanout):
+                    node = len(self.parent)
+                    self.parent.append(parent)
+                    self.layer.append(layer)
+                    self.children.append([])
+                    self.children[parent].append(node)
+                    next_frontier.append(node)
+
+            frontier = next_frontier
+
+        self.layers = layers
+
+    def devices(self):
+        return range(1, len(self.parent))
+
+
+def simulate(tree, packet_num, loss, relay, seed):
+    rng      = random.Random(seed)
+    full     = (1 << packet_num) - 1
+    received = [full] + [0] * (len(tree.parent) - 1)
+    stats    = {'passes': 0, 'root_tx': 0, 'relay_tx': 0, 'time': 0}
+
+    def multicast(node, seq, targets, tx):
+        """Forward a packet to the children whose subtree has a target, like mwifi_transmit_write()"""
+        for child in tree.children[node]:
+            if not subtree_targets[child]:
+                continue
+
+            tx[node] += 1
+
+            if rng.random() < loss:
+                continue
+
+            if child in targets:
+                received[child] |= 1 << seq
+
+            multicast(child, seq, targets, tx)
+
+    for retry in range(RETRY_COUNT):
+        unfinished = [node for node in tree.devices() if received[node] != full]
+        stats['time'] += STATUS_COST
+
+        if not unfinished:
+            break
+
+        # Root pass
+        stats['passes'] += 1
+        tx = [0] * len(tree.parent)
+
+        for seq in range(packet_num):
+            bit     = 1 << seq
+            targets = set(node for node in unfinished if not received[node] & bit)
+
+            if not targets:
+                continue
+
+            subtree_targets = [False] * len(tree.parent)
+
+            for node in targets:
+                while node is not None and not subtree_targets[node]:
+                    subtree_targets[node] = True
+                    node = tree.parent[node]
+
+            multicast(0, seq, targets, tx)
+
+        stats['root_tx'] += tx[0]
+        stats['time']    += max(tx)
+
+        if not relay:
+            continue
+
+        # Relay round, the devices of layer 2 are served by the root
+        stats['time'] += STATUS_COST
+
+        for layer in range(2, tree.layers):
+            busiest = 0
+
+            for node in tree.devices():
+                if tree.layer[node] != layer:
+                    continue
+
+                node_tx = 0
+
+                for child in tree.children[node]:
+                    missing = received[node] & ~received[child]
+
+                    while missing:
+                        bit      = missing & -missing
+                        missing ^= bit
+                        node_tx += 1
+
+                        if rng.random() >= loss:
+                            received[child] |= bit
+
+                busiest = max(busiest, node_tx)
+                stats['relay_tx'] += node_tx
+
+            stats['time'] += busiest
+
+    stats['unfinished'] = sum(1 for node in tree.devices() if received[node] != full)
+    return stats
+
+
+def report(rows):
+    print('%-6s %-7s %6s %7s %9s %9s %9s %10s' % ('layers', 'mode', 'nodes', 'passes', 'root_tx',
+                                                 'relay_tx', 'time', 'unfinished'))
+
+    for layers, mode, nodes, stats in rows:
+        print('%-6d %-7s %6d %7d %9d %9d %9d %10d' % (layers, mode, nodes, stats['passes'], stats['root_tx'],
+                                                      stats['relay_tx'], stats['time'], stats['unfinished']))
+
+
+def run(max_layers, fanout, packet_num, loss, seed):
+    rows    = []
+    results = {}
+
+    for layers in range(2, max_layers + 1):
+        tree = Tree(layers, fanout)
+
+        for mode, relay in (('root', False), ('relay', True)):
+            stats = simulate(tree, packet_num, loss, relay, seed)
+            rows.append((layers, mode, len(tree.parent) - 1, stats))
+            results[(layers, mode)] = stats
+
+    report(rows)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Simulate the tree relay of the mupgrade firmware distribution')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_simulate = subparsers.add_parser('simulate', help='Compare the distribution with and without relay')
+    parser_simulate.add_argument('--layers', type=int, default=6, help='Layers of the tree, the root is layer 1')
+    parser_simulate.add_argument('--fanout', type=int, default=3, help='Children of every device')
+    parser_simulate.add_argument('--packets', type=int, default=600, help='Number of packets of the firmware')
+    parser_simulate.add_argument('--loss', type=float, default=0.03, help='Loss rate of a link')
+    parser_simulate.add_argument('--seed', type=int, default=1, help='Seed of the packet loss')
+
+    subparsers.add_parser('test', help='6 layers, the relay must finish with less root traffic and time')
+
+    args = parser.parse_args()
+
+    if args.command == 'simulate':
+        run(args.layers, args.fanout, args.packets, args.loss, args.seed)
+    elif args.command == 'test':
+        results = run(6, 3, 600, 0.03, 1)
+        root    = results[(6, 'root')]
+        relay   = results[(6, 'relay')]
+
+        if relay['unfinished'] or relay['root_tx'] >= root['root_tx'] or relay['time'] >= root['time']:
+            print('FAIL: the relay does not reduce the root traffic and the time of a 6-layer tree')
+            return 1
+
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,200 @@
+#!/usr/bin/env python
+#
+# Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate the repair passes of mupgrade_firmware_send() on a large mesh.
+
+After every pass the root requests the progress of the unfinished devices
+(mupgrade_request_status() in components/mupgrade/mupgrade_root.c), then
+sends the missing packets again. Two strategies are compared:
+
+    global    every packet missed by any device is sent to every device
+    grouped   devices are split into GROUP_MAX groups of similar progress
+              and a packet is only sent to the groups missing it
+
+A delivery is one packet sent to one device, a redundant delivery is one the
+device had already received.
+
+Usage:
+    mupgrade_repair.py simulate [--nodes 500] [--packets 1024] [--seed 1]
+    mupgrade_repair.py test
+"""
+
+from __future__ import print_function
+
+import argparse
+import random
+import sys
+
+# Must match MUPGRADE_GROUP_MAX and CONFIG_MUPGRADE_RETRY_COUNT
+GROUP_MAX   = 8
+RETRY_COUNT = 20
+
+
+def _popcount(value):
+    return bin(value).count('1')
+
+
+class Grouping(object):
+    """Same selection as mupgrade_table_group_select(), bitmaps are Python integers"""
+
+    def __init__(self, full):
+        self.full   = full
+        self.groups = []  # [received, members]
+
+    def add(self, node, received):
+        best, best_cost = None, None
+
+        for group in self.groups:
+            group_only = _popcount(group[0] & ~received)
+            node_only  = _popcount(received & ~group[0])
+
+            if not group_only and not node_only:
+                best = group
+                break
+
+            cost = group_only * len(group[1]) + node_only
+
+            if best_cost is None or cost < best_cost:
+                best, best_cost = group, cost
+        else:
+            if len(self.groups) < GROUP_MAX:
+                best = [self.full, []]
+                self.groups.append(best)
+
+        best[0] &= received
+        best[1].append(node)
+
+    def targets(self, seq):
+        bit = 1 << seq
+        return [node for received, members in self.groups if not received & bit for node in members]
+
+
+def simulate(node_num, packet_num, grouped, seed):
+    rng  = random.Random(seed)
+    full = (1 << packet_num) - 1
+
+    # Most devices lose a few packets, some are behind weak links and a few miss the first pass
+    loss       = []
+    first_loss = []
+
+    for _ in range(node_num):
+        kind = rng.random()
+        loss.append(rng.uniform(0.1, 0.3) if 0.01 <= kind < 0.05 else rng.uniform(0.0, 0.02))
+        first_loss.append(1.0 if kind < 0.01 else loss[-1])
+
+    received   = [0] * node_num
+    unfinished = set(range(node_num))
+    stats      = {'passes': 0, 'packets': 0, 'deliveries': 0, 'redundant': 0}
+    first      = True
+
+    for _ in range(RETRY_COUNT):
+        if first:
+            targets = dict((seq, list(unfinished)) for seq in range(packet_num))
+            first   = False
+        else:
+            unfinished = set(node for node in unfinished if received[node] != full)
+
+            if not unfinished:
+                break
+
+            if grouped:
+                grouping = Grouping(full)
+
+                for node in sorted(unfinished):
+                    grouping.add(node, received[node])
+
+                union = full
+
+                for group in grouping.groups:
+                    union &= group[0]
+
+                targets = dict((seq, grouping.targets(seq)) for seq in range(packet_num) if not union >> seq & 1)
+            else:
+                union = full
+
+                for node in unfinished:
+                    union &= received[node]
+
+                targets = dict((seq, list(unfinished)) for seq in range(packet_num) if not union >> seq & 1)
+
+        stats['passes'] += 1
+
+        for seq, nodes in sorted(targets.items()):
+            stats['packets']    += 1
+            stats['deliveries'] += len(nodes)
+            bit = 1 << seq
+
+            for node in nodes:
+                if received[node] & bit:
+                    stats['redundant'] += 1
+                elif rng.random() >= (first_loss if stats['passes'] == 1 else loss)[node]:
+                    received[node] |= bit
+
+    stats['unfinished'] = sum(1 for node in range(node_num) if received[node] != full)
+    return stats
+
+
+def report(node_num, packet_num, results):
+    print('nodes        : %d, packets: %d, groups: %d' % (node_num, packet_num, GROUP_MAX))
+    print('%-9s %7s %9s %12s %12s %11s' % ('strategy', 'passes', 'packets', 'deliveries', 'redundant', 'unfinished'))
+
+    for name, stats in results:
+        print('%-9s %7d %9d %12d %12d %11d' % (name, stats['passes'], stats['packets'], stats['deliveries'],
+                                               stats['redundant'], stats['unfinished']))
+
+
+def run(node_num, packet_num, seed):
+    results = [(name, simulate(node_num, packet_num, grouped, seed))
+               for name, grouped in (('global', False), ('grouped', True))]
+    report(node_num, packet_num, results)
+    return dict(results)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Simulate the repair passes of the mupgrade firmware sending')
+    subparsers = parser.add_subparsers(dest='command')
+
+    parser_simulate = subparsers.add_parser('simulate', help='Compare the repair strategies')
+    parser_simulate.add_argument('--nodes', type=int, default=500, help='Number of devices')
+    parser_simulate.add_argument('--packets', type=int, default=1024, help='Number of packets of the firmware')
+    parser_simulate.add_argument('--seed', type=int, default=1, help='Seed of the packet loss')
+
+    subparsers.add_parser('test', help='500 devices, the grouped repair must not send more than the global one')
+
+    args = parser.parse_args()
+
+    if args.command == 'simulate':
+        run(args.nodes, args.packets, args.seed)
+    elif args.command == 'test':
+        results  = run(500, 1024, 1)
+        baseline = results['global']
+        grouped  = results['grouped']
+
+        if grouped['unfinished'] > baseline['unfinished'] or grouped['deliveries'] > baseline['deliveries']:
+            print('FAIL: the grouped repair sends more or leaves more devices unfinished')
+            return 1
+
+        print('PASS')
+    else:
+        parser.print_help()
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())